@@ -1,11 +1,53 @@
 bits 32
 
+; Ядро слинковано в верхней половине адресного пространства (higher-half)
+KERNEL_VIRTUAL_BASE equ 0xC0000000
+
 ; Multiboot заголовок
 section .multiboot
 align 4
     dd 0x1BADB002      ; magic number
-    dd 0x00000000      ; flags  
-    dd -(0x1BADB002 + 0x00000000)  ; checksum
+    dd 0x00000003      ; flags: MULTIBOOT_PAGE_ALIGN (модули по 4KB) | MULTIBOOT_MEMORY_INFO (карта памяти)
+    dd -(0x1BADB002 + 0x00000003)  ; checksum
+
+; Каталог страниц ядра: тождественное отображение первых 4MB (только на время
+; перехода) и прямое отображение физической памяти с 0xC0000000
+section .data
+%ifdef CONFIG_PAE
+; PAE: четыре PD подряд (PDPT[0..3]), PD[3] — общий для всех процессов PD ядра
+align 4096
+global boot_page_directory
+boot_page_directory:
+    dq 0x00000083                   ; 0-2MB, 2MB-страница (PS|RW|P)
+    dq 0x00200083                   ; 2-4MB
+    times (3 * 512 - 2) dq 0        ; Остальное пользовательское пространство
+%assign i 0
+%rep 511
+    dq (i << 21) | 0x83             ; 0xC0000000 + i*2MB -> i*2MB
+%assign i i+1
+%endrep
+    dq 0                            ; Окно KMAP (заполняет ядро)
+
+align 32
+boot_pdpt:
+%assign i 0
+%rep 4
+    dd (boot_page_directory - KERNEL_VIRTUAL_BASE + i * 4096) + 1, 0
+%assign i i+1
+%endrep
+%else
+align 4096
+global boot_page_directory
+boot_page_directory:
+    dd 0x00000083                   ; 0-4MB, 4MB-страница (PS|RW|P)
+    times (768 - 1) dd 0            ; Пользовательское пространство
+%assign i 0
+%rep 255
+    dd (i << 22) | 0x83             ; 0xC0000000 + i*4MB -> i*4MB
+%assign i i+1
+%endrep
+    dd 0                            ; Зарезервировано
+%endif
 
 ; Стек
 section .bss
@@ -14,20 +56,57 @@ stack_bottom:
     resb 16384  ; 16 KB стек
 stack_top:
 
-; Точка входа
+; Точка входа (выполняется по физическому адресу, пока пейджинг выключен)
 section .text
 global _start
 
 _start:
+    ; EAX (magic) и EBX (multiboot_info) сохраняем до вызова kernel_main
+%ifdef CONFIG_PAE
+    mov ecx, cr4
+    or ecx, 0x00000020              ; CR4.PAE
+    mov cr4, ecx
+    mov ecx, (boot_pdpt - KERNEL_VIRTUAL_BASE)
+%else
+    mov ecx, cr4
+    or ecx, 0x00000010              ; CR4.PSE (4MB-страницы)
+    mov cr4, ecx
+    mov ecx, (boot_page_directory - KERNEL_VIRTUAL_BASE)
+%endif
+    mov cr3, ecx
+
+    mov ecx, cr0
+    or ecx, 0x80000000              ; CR0.PG
+    mov cr0, ecx
+
+    ; Переходим на виртуальные адреса верхней половины
+    lea ecx, [higher_half]
+    jmp ecx
+
+higher_half:
+    ; Тождественное отображение больше не нужно: первые 3GB отдаются процессам
+%ifdef CONFIG_PAE
+    mov dword [boot_page_directory], 0
+    mov dword [boot_page_directory + 8], 0
+%else
+    mov dword [boot_page_directory], 0
+%endif
+    mov ecx, cr3
+    mov cr3, ecx
+
     ; Настраиваем стек
     mov esp, stack_top
-    
+
+    ; Передаём в kernel_main(magic, multiboot_info)
+    push ebx           ; Физический адрес структуры multiboot_info
+    push eax           ; Магическое число загрузчика
+
     ; Вызываем главную функцию C
     extern kernel_main
     call kernel_main
-    
+
     ; Если ядро вернулось, зависаем
     cli
 .hang:
     hlt
-    jmp .hang
\ No newline at end of file
+    jmp .hang
@@ -0,0 +1,42 @@
+#ifndef DIRENT_H
+#define DIRENT_H
+
+#include "types.h"
+
+// Directory records of getdents/readdirplus and the stat_t of stat
+
+#define DT_FILE 1 // Regular file
+#define DT_DIR  2 // Directory
+#define DT_DEV  3 // Device
+
+// File status, from stat(path, buf) and readdirplus
+typedef struct
+{
+    uint32_t st_ino;    // Inode number
+    uint32_t st_type;   // DT_*
+    uint32_t st_size;   // Size in bytes
+    uint32_t st_blocks; // Data blocks in use (512 bytes each)
+    uint32_t st_ctime;  // Creation timestamp (filesystem counter)
+    uint32_t st_mtime;  // Modification timestamp
+} stat_t;
+
+// getdents record
+typedef struct
+{
+    uint32_t d_ino;    // Inode number
+    uint16_t d_reclen; // Record length (multiple of 4)
+    uint8_t d_type;    // DT_*
+    uint8_t pad;
+    char d_name[];     // NUL-terminated name
+} dirent_t;
+
+// readdirplus record
+typedef struct
+{
+    stat_t d_stat;     // Status of the entry
+    uint16_t d_reclen; // Record length (multiple of 4)
+    uint8_t pad[2];
+    char d_name[];     // NUL-terminated name
+} dirent_plus_t;
+
+#endif
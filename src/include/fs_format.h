@@ -0,0 +1,142 @@
+#ifndef FS_FORMAT_H
+#define FS_FORMAT_H
+
+// On-disk filesystem format, shared by the kernel and the host image
+// builder (tools/mkfs.c). The includer provides uint8_t/uint32_t: the kernel
+// through types.h, the host tool through <stdint.h>.
+//
+// Volume layout, in 512-byte sectors:
+//
+//   0                   superblock
+//   inode_bitmap_start  inode bitmap (one bit per inode)
+//   block_bitmap_start  data block bitmap (one bit per data block)
+//   inode_table_start   inode table (FS_INODES_PER_SECTOR per sector)
+//   data_start          data blocks: block n lives in sector data_start + n
+//
+// Every region starts on a sector boundary, and data_start on an
+// FS_DATA_ALIGN boundary: the kernel caches the device in 4 KB blocks, and a
+// cache block must hold either metadata or data, never both. Data block 0 is
+// never allocated
+// (an extent starting at 0 means "not allocated"), inode 0 is the root
+// directory.
+//
+// Directories use extendible hashing. The directory's own data is a bucket
+// table of 2^depth block numbers (its size is 4 << depth bytes, 0 for an
+// empty directory). The entry for `name` lives in the bucket referenced by
+// table[fs_dir_hash(name) & (2^depth - 1)]. A bucket is a single data block
+// outside the directory's extents; all its entries share the low
+// `bucket.depth` bits of their hash, so 2^(depth - bucket.depth) consecutive-
+// stride table slots point at it. A full bucket is split in two, and the
+// table doubles when the bucket's depth already equals the table's.
+//
+// A regular file of at most FS_INLINE_MAX bytes keeps its data inside the
+// inode, in the bytes of extents[] (FS_INODE_F_INLINE, extent_count 0). It
+// moves to data blocks once it grows past that.
+//
+// A compressed file (FS_INODE_F_COMPRESSED) keeps its size field as the
+// logical size; its extents hold a table of uint32_t end offsets, one per
+// FS_COMP_GROUP bytes of file data, followed by the groups. Group i occupies
+// [end[i - 1], end[i]) counted from the end of the table (end[-1] = 0). A
+// group whose stored length equals its logical length is stored as is,
+// otherwise it is an LZ4 block: sequences of a token (literal count << 4 |
+// match length - 4, 15 meaning "continued in following bytes, each adding
+// up to 255"), the literals and a 16-bit little-endian match offset; the
+// last sequence has literals only.
+
+#define FS_MAGIC        0x4D594653 // "MYFS"
+#define FS_VERSION      4          // 2: hashed directories, 3: inline data, 4: compression
+
+#define FS_BLOCK_SIZE   512        // Data block size (one sector)
+#define FS_DATA_ALIGN   8          // data_start is a multiple of this (sectors)
+#define FS_MAX_FILENAME 32         // Name length including the terminator
+#define FS_MAX_EXTENTS  8          // Extents per inode
+#define FS_ROOT_INODE   0          // Root directory inode
+
+#define FS_INODE_FREE   0          // Unused inode
+#define FS_INODE_FILE   1          // Regular file
+#define FS_INODE_DIR    2          // Directory
+
+#define FS_INODE_F_INLINE     0x2  // Data stored in extents[] (inode flags)
+#define FS_INODE_F_COMPRESS   0x4  // Compress the data once writers are done
+#define FS_INODE_F_COMPRESSED 0x8  // Data stored as compressed groups
+
+#define FS_SB_F_COMPRESS 0x1       // New files get FS_INODE_F_COMPRESS (superblock flags)
+
+#define FS_COMP_GROUP   4096       // File bytes per compressed group
+
+// Superblock (sector 0)
+typedef struct
+{
+    uint32_t magic;              // FS_MAGIC
+    uint32_t version;            // FS_VERSION
+    uint32_t block_size;         // FS_BLOCK_SIZE
+    uint32_t total_sectors;      // Volume size in sectors
+    uint32_t total_inodes;       // Inode table size
+    uint32_t free_inodes;        // Unused inodes
+    uint32_t total_blocks;       // Data blocks (including reserved block 0)
+    uint32_t free_blocks;        // Unused data blocks
+    uint32_t inode_bitmap_start; // First sector of the inode bitmap
+    uint32_t block_bitmap_start; // First sector of the block bitmap
+    uint32_t inode_table_start;  // First sector of the inode table
+    uint32_t data_start;         // Sector of data block 0
+    uint32_t time_counter;       // Timestamp counter at the last sync
+    uint32_t flags;              // FS_SB_F_*
+} fs_superblock_t;
+
+// Extent: a contiguous run of data blocks
+typedef struct
+{
+    uint32_t start;  // First block of the run (0 — not allocated)
+    uint32_t length; // Number of blocks
+} fs_extent_t;
+
+// Inode, 128 bytes so that a sector holds a whole number of them
+typedef struct
+{
+    uint8_t type;                        // FS_INODE_FREE / FILE / DIR
+    char filename[FS_MAX_FILENAME];      // Name in the parent directory
+    uint32_t size;                       // Size in bytes
+    fs_extent_t extents[FS_MAX_EXTENTS]; // Data extents in file order
+    uint32_t extent_count;               // Extents in use
+    uint32_t created_time;               // Creation timestamp
+    uint32_t modified_time;              // Modification timestamp
+    uint32_t parent_inode;               // Parent directory
+    uint32_t flags;                      // Storage flags, 0 for extent-mapped data
+    uint32_t reserved;                   // Padding to 128 bytes
+} fs_inode_t;
+
+#define FS_INODES_PER_SECTOR (FS_BLOCK_SIZE / sizeof(fs_inode_t))
+#define FS_INLINE_MAX        (FS_MAX_EXTENTS * sizeof(fs_extent_t)) // 64 bytes
+
+// Directory entry
+typedef struct
+{
+    uint32_t inode_number;      // Inode of the entry (0 — free slot)
+    char name[FS_MAX_FILENAME]; // Entry name
+    uint8_t type;               // FS_INODE_FILE / FS_INODE_DIR
+} fs_dir_entry_t;
+
+#define FS_DIR_BUCKET_ENTRIES ((FS_BLOCK_SIZE - 8) / sizeof(fs_dir_entry_t))
+#define FS_DIR_MAX_DEPTH      16 // Bucket table of at most 64K slots (256KB)
+
+// Directory bucket, one data block
+typedef struct
+{
+    uint32_t depth;                               // Hash bits shared by the entries
+    uint32_t count;                               // Entries in use
+    fs_dir_entry_t entries[FS_DIR_BUCKET_ENTRIES]; // inode_number 0 — free slot
+} fs_dir_bucket_t;
+
+// Name hash for directory buckets (FNV-1a)
+static inline uint32_t fs_dir_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef INOTIFY_H
+#define INOTIFY_H
+
+#include "types.h"
+
+// Change notification masks and the event record read from an inotify descriptor
+
+#define IN_MODIFY      0x001 // File data changed
+#define IN_CREATE      0x002 // Entry created in a watched directory
+#define IN_DELETE      0x004 // Entry deleted from a watched directory
+#define IN_DELETE_SELF 0x008 // The watched file or directory itself was deleted
+#define IN_MOVED_FROM  0x010 // Entry renamed out of a watched directory
+#define IN_MOVED_TO    0x020 // Entry renamed into a watched directory
+#define IN_MOVE_SELF   0x040 // The watched file or directory itself was moved
+#define IN_ALL_EVENTS  0x07F
+
+#define IN_IGNORED     0x100      // Watch removed (rm_watch or the file was deleted)
+#define IN_Q_OVERFLOW  0x200      // Events were lost, wd is -1
+#define IN_ISDIR       0x40000000 // The subject of the event is a directory
+
+// Event record
+typedef struct
+{
+    int32_t wd;      // Watch descriptor
+    uint32_t mask;   // IN_* of the event
+    uint32_t cookie; // Pairs IN_MOVED_FROM with IN_MOVED_TO, otherwise 0
+    uint32_t len;    // Bytes of name, including the terminator and padding
+    char name[];     // Entry name for directory watches
+} inotify_event_t;
+
+#endif
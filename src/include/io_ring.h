@@ -0,0 +1,48 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include "types.h"
+
+// Submission and completion rings of io_ring_setup/io_ring_enter
+
+#define IO_RING_SQ_ENTRIES 64  // Submission ring size (power of two)
+#define IO_RING_CQ_ENTRIES 128 // Completion ring size (power of two)
+
+#define IO_OP_NOP   0 // No operation, result 0
+#define IO_OP_READ  1 // read(fd, addr, len), or pread at offset >= 0
+#define IO_OP_WRITE 2 // write(fd, addr, len), or pwrite at offset >= 0
+#define IO_OP_OPEN  3 // open(addr, len as flags), result is the new fd
+#define IO_OP_CLOSE 4 // close(fd)
+
+// Submission entry
+typedef struct
+{
+    uint8_t opcode;     // IO_OP_*
+    uint8_t pad[3];
+    int32_t fd;         // File descriptor
+    uint32_t addr;      // Buffer or path
+    uint32_t len;       // Byte count, open flags for IO_OP_OPEN
+    int32_t offset;     // File offset, -1 for the current position
+    uint32_t user_data; // Copied to the completion
+} io_sqe_t;
+
+// Completion entry
+typedef struct
+{
+    uint32_t user_data; // From the submission entry
+    int32_t result;     // System call result, -1 on error
+} io_cqe_t;
+
+typedef struct
+{
+    volatile uint32_t sq_head; // Next entry the kernel consumes
+    volatile uint32_t sq_tail; // Next entry the program fills
+    volatile uint32_t cq_head; // Next completion the program consumes
+    volatile uint32_t cq_tail; // Next completion the kernel posts
+    uint32_t sq_entries;       // IO_RING_SQ_ENTRIES, set by io_ring_setup
+    uint32_t cq_entries;       // IO_RING_CQ_ENTRIES, set by io_ring_setup
+    io_sqe_t sq[IO_RING_SQ_ENTRIES];
+    io_cqe_t cq[IO_RING_CQ_ENTRIES];
+} io_ring_t;
+
+#endif
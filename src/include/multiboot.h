@@ -0,0 +1,54 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include "types.h"
+
+// Value passed in EAX by a Multiboot-compliant boot loader
+#define MULTIBOOT_BOOTLOADER_MAGIC  0x2BADB002
+
+// Multiboot header flags (requested by the kernel)
+#define MULTIBOOT_PAGE_ALIGN        0x00000001 // Align modules on 4KB boundaries
+#define MULTIBOOT_MEMORY_INFO       0x00000002 // Provide mem_* and mmap_* fields
+
+// multiboot_info_t flags (provided by the boot loader)
+#define MULTIBOOT_INFO_MEMORY       0x00000001 // mem_lower/mem_upper are valid
+#define MULTIBOOT_INFO_BOOTDEV      0x00000002 // boot_device is valid
+#define MULTIBOOT_INFO_CMDLINE      0x00000004 // cmdline is valid
+#define MULTIBOOT_INFO_MODS         0x00000008 // mods_count/mods_addr are valid
+#define MULTIBOOT_INFO_MEM_MAP      0x00000040 // mmap_length/mmap_addr are valid
+
+// Memory map entry types
+#define MULTIBOOT_MEMORY_AVAILABLE  1
+#define MULTIBOOT_MEMORY_RESERVED   2
+
+// Boot information structure
+typedef struct {
+    uint32_t flags;               // Which of the fields below are valid
+    uint32_t mem_lower;           // KB of lower memory (below 1MB)
+    uint32_t mem_upper;           // KB of upper memory (above 1MB)
+    uint32_t boot_device;         // BIOS boot device
+    uint32_t cmdline;             // Physical address of the kernel command line
+    uint32_t mods_count;          // Number of boot modules
+    uint32_t mods_addr;           // Physical address of the module table
+    uint32_t syms[4];             // a.out / ELF symbol information
+    uint32_t mmap_length;         // Size of the memory map buffer
+    uint32_t mmap_addr;           // Physical address of the memory map
+} __attribute__((packed)) multiboot_info_t;
+
+// Memory map entry (size does not include the size field itself)
+typedef struct {
+    uint32_t size;                // Size of the rest of the entry
+    uint64_t addr;                // Base physical address
+    uint64_t len;                 // Length in bytes
+    uint32_t type;                // MULTIBOOT_MEMORY_*
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+// Boot module descriptor
+typedef struct {
+    uint32_t mod_start;           // Physical start address of the module
+    uint32_t mod_end;             // Physical end address (exclusive)
+    uint32_t cmdline;             // Module command line string
+    uint32_t reserved;            // Must be zero
+} __attribute__((packed)) multiboot_module_t;
+
+#endif // MULTIBOOT_H
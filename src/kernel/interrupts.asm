@@ -20,6 +20,10 @@ irq1_handler:
     mov fs, ax
     mov gs, ax
     
+    ; Счётчик IRQ1 для /proc/interrupts
+    extern irq_counts
+    inc dword [irq_counts + 4]
+
     ; Вызываем обработчик C
     extern keyboard_handler
     call keyboard_handler
@@ -35,6 +39,50 @@ irq1_handler:
     ; Выходим из прерывания
     iret
 
+; Обработчики аппаратных прерываний IRQ2-IRQ15 (PCI-устройства и т.п.):
+; номер IRQ передаётся в irq_dispatch, который вызывает драйвер и шлёт EOI
+%assign irq_num 2
+%rep 14
+irq_stub_ %+ irq_num:
+    pusha
+    push ds
+    push es
+    push fs
+    push gs
+
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+
+    push dword irq_num
+    extern irq_dispatch
+    call irq_dispatch
+    add esp, 4
+
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    popa
+    iret
+%assign irq_num irq_num+1
+%endrep
+
+; Таблица точек входа по номеру IRQ (IRQ0 и IRQ1 имеют свои обработчики)
+section .data
+global irq_stub_table
+irq_stub_table:
+    dd 0, 0
+%assign irq_num 2
+%rep 14
+    dd irq_stub_ %+ irq_num
+%assign irq_num irq_num+1
+%endrep
+
+section .text
+
 ; Обработчик общих исключений
 global exception_handler
 exception_handler:
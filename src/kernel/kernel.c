@@ -16,8 +16,13 @@ typedef unsigned int size_t;
 #include "../include/types.h"
 #include "../include/elf.h"
 #include "../include/keyboard.h"
+#include "../include/multiboot.h"
+#include "../include/fs_format.h"
+#include "../include/io_ring.h"
+#include "../include/dirent.h"
+#include "../include/inotify.h"
 
-#define VGA_MEMORY 0xB8000
+#define VGA_MEMORY P2V(0xB8000)
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
 #define KEYBOARD_DATA_PORT 0x60
@@ -28,16 +33,50 @@ typedef unsigned int size_t;
 #define PIC2_DATA 0xA1
 #define PIC_EOI 0x20
 
+// Higher-half: ядро слинковано и отображено с 0xC0000000, физическая память
+// доступна ядру через прямое отображение [KERNEL_VIRTUAL_BASE, +DIRECT_MAP_SIZE)
+#define KERNEL_VIRTUAL_BASE 0xC0000000
+#define P2V(addr) ((uint32_t)(addr) + KERNEL_VIRTUAL_BASE)
+#define V2P(addr) ((uint32_t)(addr) - KERNEL_VIRTUAL_BASE)
+
 // Управление памятью
-#define HEAP_START 0x400000 // Начало кучи (4 MB)
+#define HEAP_PHYS_START 0x400000           // Физическое начало кучи (4 MB)
+#define HEAP_START P2V(HEAP_PHYS_START)    // Виртуальное начало кучи
 #define HEAP_SIZE 0x100000  // Размер кучи (1 MB)
 #define BLOCK_SIZE sizeof(memory_block_t)
 
 // Виртуальная память и пейджинг
 #define PAGE_SIZE 4096    // Размер страницы 4KB
-#define PAGE_ENTRIES 1024 // Количество записей в таблице страниц
-#define PAGE_DIRECTORY_SIZE PAGE_ENTRIES * sizeof(uint32_t)
-#define PAGE_TABLE_SIZE PAGE_ENTRIES * sizeof(uint32_t)
+
+#ifdef CONFIG_PAE
+// PAE: PDPT (4 записи) -> 4 Page Directory -> Page Tables, записи по 64 бита.
+// Четыре PD размещаются подряд, поэтому индексируются как один массив из 2048 записей
+typedef uint64_t page_directory_entry_t; // PDE - 64-битная запись
+typedef uint64_t page_table_entry_t;     // PTE - 64-битная запись
+typedef uint64_t phys_addr_t;            // Физический адрес (до 64 GB)
+#define PAGE_ENTRIES 512      // Количество записей в таблице страниц
+#define PAGE_DIR_ENTRIES 2048 // 4 PD по 512 записей
+#define PDPT_ENTRIES 4        // Записей в Page Directory Pointer Table
+#define DIRECT_MAP_SIZE 0x3FE00000 // 1022 MB (2MB-страницы, последняя — окно KMAP)
+#define PAGE_FRAME_MASK 0x000FFFFFFFFFF000ULL
+#define PDE_INDEX(addr) ((addr) >> 21)
+#define PDE_ADDR(index) ((uint32_t)(index) << 21) // Начало области записи PD
+#define PTE_INDEX(addr) (((addr) >> 12) & 0x1FF)
+#else
+typedef uint32_t page_directory_entry_t; // PDE - 32-битная запись
+typedef uint32_t page_table_entry_t;     // PTE - 32-битная запись
+typedef uint32_t phys_addr_t;            // Физический адрес
+#define PAGE_ENTRIES 1024     // Количество записей в таблице страниц
+#define PAGE_DIR_ENTRIES 1024 // Количество записей в Page Directory
+#define DIRECT_MAP_SIZE 0x3FC00000 // 1020 MB (4MB-страницы, последняя PDE зарезервирована)
+#define PAGE_FRAME_MASK 0xFFFFF000
+#define PDE_INDEX(addr) ((addr) >> 22)
+#define PDE_ADDR(index) ((uint32_t)(index) << 22) // Начало области записи PD
+#define PTE_INDEX(addr) (((addr) >> 12) & 0x3FF)
+#endif
+
+#define PAGE_DIRECTORY_SIZE (PAGE_DIR_ENTRIES * sizeof(page_directory_entry_t))
+#define PAGE_TABLE_SIZE (PAGE_ENTRIES * sizeof(page_table_entry_t))
 
 // Флаги для Page Directory Entry и Page Table Entry
 #define PAGE_PRESENT 0x001  // Страница присутствует в памяти
@@ -49,25 +88,96 @@ typedef unsigned int size_t;
 #define PAGE_DIRTY 0x040    // Страница была изменена
 #define PAGE_PS 0x080       // Page Size (только для PDE)
 #define PAGE_GLOBAL 0x100   // Глобальная страница
-
-// Раздел адресного пространства: 0..0xBFFFFFFF — ядро, 0xC0000000.. — пользователь
-#define USER_SPACE_BASE 0xC0000000
-
-// Адреса для размещения структур пейджинга
-#define PAGE_DIRECTORY_ADDR 0x300000 // 3MB - Page Directory
-#define PAGE_TABLES_ADDR 0x301000    // 3MB+4KB - Page Tables
+#define PAGE_NOEXEC 0x200   // Программный флаг отображения: запрет исполнения (NX в PAE)
+#ifdef CONFIG_PAE
+#define PAGE_NX 0x8000000000000000ULL // Бит 63: No-Execute
+#endif
+
+// Раздел адресного пространства: 0x00400000..0xBFFFFFFF — пользователь, 0xC0000000.. — ядро
+// Первые 4MB не отображаются для процессов (ловушка для NULL-указателей)
+#define USER_SPACE_BASE 0x00400000
+#define USER_SPACE_END KERNEL_VIRTUAL_BASE
+#define USER_PDE_START PDE_INDEX(USER_SPACE_BASE)   // Первая пользовательская запись PD
+#define KERNEL_PDE_START PDE_INDEX(KERNEL_VIRTUAL_BASE) // Первая запись ядра в PD
+
+// Стек пользовательского режима: под последней пользовательской страницей,
+// которая остаётся неотображённой
+#define USER_STACK_TOP (USER_SPACE_END - PAGE_SIZE)
+#define USER_STACK_SIZE 0x4000 // 16KB
+
+// Пользовательская часть каталога процесса: в PAE — три PD (PDPT[3] ссылается
+// на общий PD ядра), без PAE — весь каталог, т.к. записи ядра живут в нём же
+#ifdef CONFIG_PAE
+#define PROCESS_PD_SIZE (KERNEL_PDE_START * sizeof(page_directory_entry_t))
+#define PROCESS_DIR_FRAMES (PROCESS_PD_SIZE / PAGE_SIZE + 1) // Три PD и кадр PDPT
+#else
+#define PROCESS_PD_SIZE PAGE_DIRECTORY_SIZE
+#define PROCESS_DIR_FRAMES 1
+#endif
+
+// Окно временного отображения физических кадров (в т.ч. выше 4 GB)
+#define KMAP_VADDR (KERNEL_VIRTUAL_BASE + DIRECT_MAP_SIZE)
 
 // Файловая система
-#define FS_MAX_FILES 64       // Максимум файлов
-#define FS_MAX_FILENAME 32    // Максимум символов в имени файла
-#define FS_MAX_FILESIZE 1024  // Максимум байт в файле
-#define FS_BLOCK_SIZE 64      // Размер блока данных
-#define FS_MAX_BLOCKS 256     // Максимум блоков данных
-#define FS_MAX_DIR_ENTRIES 16 // Максимум записей в директории
-
-#define FS_INODE_FREE 0 // Свободный inode
-#define FS_INODE_FILE 1 // Обычный файл
-#define FS_INODE_DIR 2  // Директория
+#define FS_INITIAL_INODES 64  // Начальный размер таблицы inodes
+#define FS_FALLBACK_BLOCKS 256 // Блоков данных, если нет памяти выше ELF-области
+#define FS_MAX_PATH 256       // Максимум символов в пути
+#define FS_MIN_DCACHE 256     // Минимальный размер кэша dentry (степень двойки)
+#define FS_MAX_OPEN_FILES 128 // Размер таблицы открытых файлов
+#define FS_WRITE_BUFFER_SIZE 4096 // Буфер записи открытого файла
+#define FS_AT_POSITION 0xFFFFFFFF // Смещение: текущая позиция открытого файла
+#define FS_ZCACHE_SLOTS 16    // Распакованных групп сжатых файлов в кэше
+#define LZ_HASH_BITS 12       // Размер хеш-таблицы компрессора (2^n позиций)
+#define FS_DEDUP_SLOTS 8192   // Отпечатков блоков в индексе дедупликации (степень двойки)
+#define FS_DEDUP_WAYS 8       // Слотов, просматриваемых при поиске отпечатка
+#define FS_BLOCK_REFS_MAX 255 // Предел дополнительных ссылок на общий блок
+#define FS_MAX_WATCHES 32     // Наблюдений за файлами на всю систему
+#define FS_WATCH_QUEUE 64     // Событий в очереди одного наблюдателя
+#define FS_DEFRAG_STEP_BLOCKS 64 // Блоков, копируемых дефрагментацией за шаг
+#define FS_DEFRAG_INTERVAL (TIMER_FREQUENCY / 10) // Тиков между шагами в idle
+#define FS_DEFRAG_SCAN 256    // Inodes, просматриваемых за шаг в поиске файла
+#define FS_DEFRAG_RUN_PASSES 4 // Предел defrag run в проходах (с переносом всех блоков)
+
+// VFS: точки монтирования других ФС в директориях корневой
+#define VFS_MAX_MOUNTS 8       // Размер таблицы монтирования
+#define VFS_TYPE_DEVICE 3      // Тип записи директории для устройств (FS_INODE_* + 1)
+
+// procfs: файлы со статистикой ядра, генерируемые при чтении
+#define PROC_MOUNT "/proc"     // Директория монтирования
+#define PROC_TEXT_SIZE 4096    // Предел содержимого одного файла
+
+// devfs: файлы устройств
+#define DEV_MOUNT "/dev"       // Директория монтирования
+#define SHELL_PATH "/bin:/usr/bin" // Директории поиска программ для run
+
+// Размеры ФС при монтировании выбираются по свободной физической памяти
+#define FS_ARENA_MAX 0x10000000 // Не больше 256MB под данные и таблицы ФС
+#define FS_ARENA_MIN 0x100000   // Меньше 1MB — используем кучу ядра
+#define FS_BYTES_PER_INODE 1024 // Один inode на столько байт данных
+
+// Том на блочном устройстве
+#define FS_ROOT_DEVICE "vda"     // Устройство, с которого монтируется ФС
+#define FS_IO_MAX_SECTORS 256    // Секторов в одном запросе чтения/записи
+
+#define FS_BITMAP_WORDS(bits) (((bits) + 31) / 32) // Слов в битовой карте
+
+// Флаги inode (поле flags). Данные в памяти ядра бывают только у томов
+// в памяти и на устройство не попадают; FS_INODE_F_INLINE — в fs_format.h
+#define FS_INODE_F_MEMORY 0x1 // Данные по адресу extents[0].start, только чтение
+// Файл изменён, а сжатие или дедупликация ещё не выполнены: их сделает
+// закрытие последней ссылки. Флаг может попасть на том — тогда обработка
+// произойдёт при следующем закрытии
+#define FS_INODE_F_UNSETTLED 0x10
+
+// Модули загрузчика (initrd)
+#define BOOT_MODULES_MAX 8      // Сколько модулей Multiboot учитывается
+#define BOOT_MODULE_NAME 64     // Длина сохраняемой командной строки модуля
+#define INITRD_CPIO_MAGIC "070701" // cpio newc
+#define INITRD_TAR_MAGIC "ustar"   // tar POSIX ustar (смещение 257)
+
+#define FS_DENTRY_EMPTY 0    // Слот кэша свободен
+#define FS_DENTRY_POSITIVE 1 // Имя есть в директории
+#define FS_DENTRY_NEGATIVE 2 // Имени в директории нет
 
 // Планировщик задач
 #define MAX_TASKS 8          // Максимум задач
@@ -118,12 +228,89 @@ typedef unsigned int size_t;
 #define SYS_FCNTL 18
 #define SYS_MMAP 19
 #define SYS_MUNMAP 20
+#define SYS_LSEEK 21
+#define SYS_PREAD 22
+#define SYS_PWRITE 23
+#define SYS_SENDFILE 24
+#define SYS_IO_RING_SETUP 25
+#define SYS_IO_RING_ENTER 26
+#define SYS_CLONEFILE 27
+#define SYS_GETDENTS 28
+#define SYS_READDIRPLUS 29
+#define SYS_INOTIFY_INIT 30
+#define SYS_INOTIFY_ADD_WATCH 31
+#define SYS_INOTIFY_RM_WATCH 32
+#define SYS_MAX 64 // Номера системных вызовов меньше этого (счётчики)
+
+// PCI (конфигурационное пространство через порты 0xCF8/0xCFC)
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+#define PCI_MAX_DEVICES 32
+#define PCI_COMMAND 0x04          // Регистр команд
+#define PCI_COMMAND_IO 0x0001     // Разрешить доступ к портам ввода-вывода
+#define PCI_COMMAND_MASTER 0x0004 // Разрешить bus mastering (DMA)
+
+// Блочные устройства
+#define BLK_SECTOR_SIZE 512   // Размер сектора
+#define BLK_MAX_SEGMENTS 16   // Максимум сегментов scatter-gather в запросе
+#define BLK_MAX_DEVICES 4     // Размер таблицы блочных устройств
+#define BLK_PENDING 1         // Запрос в очереди устройства
+#define BLK_OK 0              // Запрос выполнен
+#define BLK_ERROR -1          // Ошибка устройства
+
+// Буферный кэш блочных устройств
+#define BCACHE_BLOCK_SIZE 4096                          // Размер буфера кэша
+#define BCACHE_BLOCK_SECTORS (BCACHE_BLOCK_SIZE / BLK_SECTOR_SIZE)
+#define BCACHE_MAX_BYTES 0x1000000                      // Не больше 16MB под кэш
+#define BCACHE_MIN_BUFFERS 16                           // Минимум буферов, если памяти мало
+#define BCACHE_READAHEAD 8                              // Блоков упреждающего чтения
+#define BCACHE_SEQ_THRESHOLD 2                          // Подряд идущих блоков до упреждения
+#define BCACHE_FLUSH_INTERVAL TIMER_FREQUENCY           // Фоновая запись раз в секунду
+#define BCACHE_DIRTY_AGE (5 * TIMER_FREQUENCY)          // Грязный буфер живёт до 5 секунд
+#define BCACHE_VALID 0x01                               // Данные буфера актуальны
+#define BCACHE_DIRTY 0x02                               // Изменён, не записан на устройство
+#define BCACHE_IO 0x04                                  // Запрос к устройству в полёте
+#define BCACHE_READAHEAD_FLAG 0x08                      // Прочитан упреждающе, ещё не запрошен
+
+// RAM-диск для проверки блочного слоя и кэша без virtio
+#define RAMDISK_SIZE 0x100000 // 1MB
+#define RAMDISK_QUEUE_DEPTH 16
+
+// virtio-blk (legacy-интерфейс PCI, QEMU -drive if=virtio)
+#define VIRTIO_VENDOR_ID 0x1AF4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+#define VIRTIO_PCI_HOST_FEATURES 0x00
+#define VIRTIO_PCI_GUEST_FEATURES 0x04
+#define VIRTIO_PCI_QUEUE_PFN 0x08
+#define VIRTIO_PCI_QUEUE_NUM 0x0C
+#define VIRTIO_PCI_QUEUE_SEL 0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY 0x10
+#define VIRTIO_PCI_STATUS 0x12
+#define VIRTIO_PCI_ISR 0x13
+#define VIRTIO_PCI_CONFIG 0x14 // Конфигурация устройства: ёмкость в секторах (64 бита)
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED 0x80
+#define VIRTQ_DESC_F_NEXT 1  // Цепочка продолжается в next
+#define VIRTQ_DESC_F_WRITE 2 // Буфер записывается устройством
+#define VIRTIO_BLK_T_IN 0    // Чтение с диска
+#define VIRTIO_BLK_T_OUT 1   // Запись на диск
 
 // Таймер (PIT - Programmable Interval Timer)
 #define PIT_FREQUENCY 1193182
 #define TIMER_FREQUENCY 100 // 100 Hz = 10ms тики
 #define PIT_COMMAND 0x43
 #define PIT_DATA0 0x40
+#define PIT_DATA2 0x42
+#define PIT_GATE_PORT 0x61    // Вход GATE (бит 0) и выход OUT (бит 5) канала 2
+#define TSC_CALIBRATE_MS 10   // Длительность калибровки TSC по каналу 2 PIT
+
+// Последовательный порт COM1 (QEMU: -serial stdio)
+#define COM1_PORT 0x3F8
+#define COM1_LSR (COM1_PORT + 5) // Line Status Register
+#define COM1_LSR_DR 0x01         // Принят байт
+#define COM1_LSR_THRE 0x20       // Регистр передатчика свободен
 
 // GDT (Global Descriptor Table)
 #define GDT_ENTRIES 8
@@ -141,7 +328,7 @@ static inline int is_user_address(const void *ptr, uint32_t size)
 {
     uint32_t start = (uint32_t)ptr;
     uint32_t end = start + (size ? size - 1 : 0);
-    return (start >= USER_SPACE_BASE) && (end >= USER_SPACE_BASE);
+    return (start >= USER_SPACE_BASE) && (end >= start) && (end < USER_SPACE_END);
 }
 
 static inline int is_cpl3(void)
@@ -165,11 +352,22 @@ static inline uint32_t get_current_task_page_directory_base(void)
 
 // ===== БЕЗОПАСНОЕ ПОСТРАНИЧНОЕ КОПИРОВАНИЕ USER/KERNEL =====
 
+// Записи Page Directory по значению корня (физический CR3) адресного пространства
+static inline page_directory_entry_t *page_dir_from_root(uint32_t root)
+{
+#ifdef CONFIG_PAE
+    // CR3 указывает на PDPT; её первая запись — начало пользовательских PD
+    return (page_directory_entry_t *)P2V(((uint64_t *)P2V(root))[0] & PAGE_FRAME_MASK);
+#else
+    return (page_directory_entry_t *)P2V(root);
+#endif
+}
+
 // Проверка валидности пользовательской страницы
 static int is_user_page_valid(uint32_t vaddr)
 {
     // Проверяем, что адрес в пользовательском пространстве
-    if (vaddr < USER_SPACE_BASE)
+    if (vaddr < USER_SPACE_BASE || vaddr >= USER_SPACE_END)
         return 0;
 
     // Получаем текущий Page Directory процесса
@@ -177,12 +375,11 @@ static int is_user_page_valid(uint32_t vaddr)
     if (!page_dir_base)
         return 0;
 
-    // Доступ к записям PDE как к массиву uint32_t (избегаем зависимости от типов)
-    uint32_t *page_dir_entries = (uint32_t *)page_dir_base;
+    page_directory_entry_t *page_dir_entries = page_dir_from_root(page_dir_base);
 
     // Вычисляем индексы
-    uint32_t page_dir_index = vaddr >> 22;
-    uint32_t page_table_index = (vaddr >> 12) & 0x3FF;
+    uint32_t page_dir_index = PDE_INDEX(vaddr);
+    uint32_t page_table_index = PTE_INDEX(vaddr);
 
     // Проверяем Page Directory Entry
     if (!(page_dir_entries[page_dir_index] & PAGE_PRESENT))
@@ -190,10 +387,9 @@ static int is_user_page_valid(uint32_t vaddr)
     if (!(page_dir_entries[page_dir_index] & PAGE_USER))
         return 0;
 
-    // Получаем Page Table
-    uint32_t page_table_addr = page_dir_entries[page_dir_index] & 0xFFFFF000;
-    // Доступ к записям PTE как к массиву uint32_t
-    uint32_t *page_table_entries = (uint32_t *)page_table_addr;
+    // Получаем Page Table (таблицы страниц всегда лежат ниже 4 GB)
+    uint32_t page_table_addr = P2V(page_dir_entries[page_dir_index] & PAGE_FRAME_MASK);
+    page_table_entry_t *page_table_entries = (page_table_entry_t *)page_table_addr;
 
     // Проверяем Page Table Entry
     if (!(page_table_entries[page_table_index] & PAGE_PRESENT))
@@ -316,6 +512,12 @@ static inline int copy_to_user(void *user_dst, const void *kernel_src, uint32_t
 #define O_CREAT 0x0040
 #define O_TRUNC 0x0200
 #define O_APPEND 0x0400
+#define O_ACCMODE 0x0003
+
+// Точка отсчёта для lseek
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
 
 // Стандартные файловые дескрипторы
 #define STDIN_FILENO 0
@@ -362,14 +564,10 @@ typedef struct memory_block
     struct memory_block *prev; // Указатель на предыдущий блок
 } memory_block_t;
 
-// Структуры для виртуальной памяти
-typedef uint32_t page_directory_entry_t; // PDE - 32-битная запись
-typedef uint32_t page_table_entry_t;     // PTE - 32-битная запись
-
-// Структура Page Directory
+// Структура Page Directory (типы записей определены в начале файла)
 typedef struct
 {
-    page_directory_entry_t entries[PAGE_ENTRIES];
+    page_directory_entry_t entries[PAGE_DIR_ENTRIES];
 } page_directory_t;
 
 // Структура Page Table
@@ -380,48 +578,249 @@ typedef struct
 
 // === СТРУКТУРЫ ФАЙЛОВОЙ СИСТЕМЫ ===
 
-// Суперблок файловой системы
+// Суперблок, inode и запись директории — в fs_format.h (формат тома на диске)
+
+// Запись кэша dentry: (родитель, имя) -> inode или отрицательный результат
 typedef struct
 {
-    uint32_t magic;        // Магическое число для проверки
-    uint32_t total_inodes; // Общее количество inodes
-    uint32_t free_inodes;  // Свободные inodes
-    uint32_t total_blocks; // Общее количество блоков данных
-    uint32_t free_blocks;  // Свободные блоки
-    uint32_t block_size;   // Размер блока данных
-} fs_superblock_t;
+    uint32_t parent;            // Родительская директория
+    uint32_t inode;             // Номер inode (для положительной записи)
+    uint8_t state;              // FS_DENTRY_EMPTY / POSITIVE / NEGATIVE
+    char name[FS_MAX_FILENAME]; // Имя компонента пути
+} fs_dentry_t;
 
-// Индексный узел (inode) файла
+// Глобальное состояние файловой системы
+// Слот кэша распакованных групп сжатых файлов (данные — в fs_zcache_data)
 typedef struct
 {
-    uint8_t type;                   // Тип: свободный, файл, директория
-    char filename[FS_MAX_FILENAME]; // Имя файла
-    uint32_t size;                  // Размер файла в байтах
-    uint32_t blocks[16];            // Прямые указатели на блоки данных
-    uint32_t created_time;          // Время создания (упрощенно)
-    uint32_t modified_time;         // Время модификации
-    uint32_t parent_inode;          // Родительская директория (для файлов)
-} fs_inode_t;
+    fs_inode_t *inode;  // Файл (NULL — слот свободен)
+    uint32_t group;     // Номер группы в файле
+    uint32_t refcount;  // Закреплён участком fs_inode_span
+    uint32_t last_used; // Отметка последнего обращения (вытеснение LRU)
+    int dirty;          // Группу изменили, в блоках она старая
+    uint32_t length;    // У изменённой: конец записанных байт в группе
+    uint32_t base_size; // У изменённой: размер файла, которому соответствуют блоки
+} fs_zslot_t;
 
-// Запись директории
+// Отпечаток блока данных в индексе дедупликации
 typedef struct
 {
-    uint32_t inode_number;      // Номер inode
-    char name[FS_MAX_FILENAME]; // Имя файла
-    uint8_t type;               // Тип записи (файл/директория)
-} fs_dir_entry_t;
+    uint32_t hash;  // Хеш содержимого блока
+    uint32_t block; // Номер блока (0 — слот свободен)
+    uint32_t inode; // Файл, которому блок принадлежал при записи отпечатка
+} fs_fingerprint_t;
+
+// Фоновая дефрагментация: курсор прохода, текущий перенос и статистика
+typedef struct
+{
+    int enabled;           // Шаги из задачи idle включены
+    uint32_t cursor;       // Следующий просматриваемый inode
+    uint32_t pass_moves;   // Переносов за текущий проход
+    int settled;           // Проход без переносов: ждать изменений ФС
+    uint32_t settled_time; // fs_time_counter на момент settled
+    uint32_t settled_free; // Свободных блоков на момент settled
+    uint32_t last_tick;    // Тик последнего шага из idle
+    int moving;            // Идёт перенос участка файла
+    uint32_t inode;        // Переносимый inode
+    fs_inode_t snapshot;   // Inode на начало переноса (изменился — отмена)
+    uint32_t first;        // Порядковый номер первого блока участка в файле
+    uint32_t length;       // Блоков в участке
+    uint32_t target;       // Начало нового места участка
+    uint32_t copied;       // Скопировано блоков участка
+    uint32_t moves;        // Завершённых переносов
+    uint32_t blocks_moved; // Скопировано блоков
+    uint32_t aborted;      // Переносов отменено
+    uint32_t passes;       // Завершённых проходов по inodes
+} fs_defrag_t;
+
+// Событие в очереди наблюдателя (read отдаёт его записью inotify_event_t)
+typedef struct
+{
+    int32_t wd;                 // Наблюдение, -1 для IN_Q_OVERFLOW
+    uint32_t mask;              // IN_* события
+    uint32_t cookie;            // Общий у пары IN_MOVED_FROM/IN_MOVED_TO
+    char name[FS_MAX_FILENAME]; // Имя записи (пусто — событие самого файла)
+} fs_watch_event_t;
+
+// Наблюдатель — открытый файл inotify_init с кольцевой очередью событий
+typedef struct
+{
+    fs_watch_event_t events[FS_WATCH_QUEUE];
+    uint32_t head;  // Первое непрочитанное событие
+    uint32_t count; // Событий в очереди
+} fs_watcher_t;
+
+// Наблюдение за inode корневой ФС, номер слота + 1 — wd
+typedef struct
+{
+    fs_watcher_t *watcher; // Чья очередь (NULL — слот свободен)
+    uint32_t inode;        // Наблюдаемый файл или директория
+    uint32_t mask;         // IN_* интересующих событий
+} fs_watch_t;
 
-// Глобальное состояние файловой системы
 typedef struct
 {
     fs_superblock_t superblock;          // Суперблок
-    fs_inode_t inodes[FS_MAX_FILES];     // Таблица inodes
+    fs_inode_t *inodes;                  // Таблица inodes (память — под inode_limit)
+    uint32_t inode_capacity;             // Используемая часть таблицы inodes
+    uint32_t inode_limit;                // Предел роста таблицы inodes
     uint8_t *data_blocks;                // Указатель на область данных
-    uint8_t inode_bitmap[FS_MAX_FILES];  // Битовая карта занятых inodes
-    uint8_t block_bitmap[FS_MAX_BLOCKS]; // Битовая карта занятых блоков
+    uint32_t *inode_bitmap;              // Битовая карта inodes (32 на слово)
+    uint32_t *block_bitmap;              // Битовая карта блоков (32 на слово)
+    uint32_t inode_hint;                 // С какого inode начинать поиск свободного
+    uint32_t block_hint;                 // С какого блока начинать поиск свободного
+    uint32_t arena_size;                 // Зарезервировано физической памяти (0 — куча)
+    struct block_device *device;         // Устройство тома (NULL — ФС только в памяти)
+    uint8_t *image;                      // Метаданные тома в памяти, сектор к сектору
+    uint32_t image_sectors;              // Размер образа метаданных в секторах
+    uint32_t *sector_loaded;             // Секторы образа, прочитанные с устройства
+    int meta_dirty;                      // Метаданные изменены после записи
+    uint32_t meta_dirty_since;           // Тик первого изменения
+    uint32_t sectors_read;               // Прочитано секторов метаданных
+    uint32_t sectors_written;            // Записано секторов (метаданные и данные)
+    fs_dentry_t *dcache;                 // Кэш dentry (открытая адресация)
+    uint32_t dcache_size;                // Слотов в кэше dentry (степень двойки)
+    uint32_t dcache_limit;               // Предел роста кэша dentry (слотов)
+    uint32_t dcache_negatives;           // Отрицательных записей в кэше
+    uint32_t dcache_lookups;             // Поисков в кэше
+    uint32_t dcache_hits;                // Положительных попаданий
+    uint32_t dcache_negative_hits;       // Отрицательных попаданий
+    uint32_t dcache_probes;              // Просмотрено слотов при поиске
+    fs_zslot_t zcache[FS_ZCACHE_SLOTS];  // Кэш распакованных групп
+    uint32_t zcache_clock;               // Счётчик обращений к кэшу групп
+    uint32_t zcache_hits;                // Групп найдено в кэше
+    uint32_t zcache_misses;              // Групп распаковано
+    uint8_t *block_refs;                 // Дополнительные ссылки на блоки (NULL — том на устройстве)
+    int dedup;                           // Дедупликация записанных файлов включена
+    uint32_t dedup_shared;               // Блоков сэкономлено общими ссылками
+    uint32_t dedup_cow;                  // Общих блоков скопировано при записи
+    fs_defrag_t defrag;                  // Фоновая дефрагментация
     int initialized;                     // Флаг инициализации
 } fs_state_t;
 
+// Обработчик непрерывного участка данных файла при передаче без
+// промежуточного буфера. Возвращает число обработанных байт (< 0 — ошибка)
+typedef int (*fs_span_fn_t)(void *ctx, uint8_t *data, uint32_t size);
+
+// Обработчик записи при обходе директории: ненулевой результат
+// прекращает обход
+typedef int (*fs_dir_fn_t)(fs_dir_entry_t *entry, void *ctx);
+
+struct open_file;
+
+// Операции открытого файла, одна таблица на ФС или устройство. offset ==
+// FS_AT_POSITION — с позиции открытого файла со сдвигом. Режим доступа
+// проверяет VFS до вызова
+typedef struct
+{
+    int (*read_spans)(struct open_file *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx);
+    int (*write_spans)(struct open_file *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx); // NULL — только чтение
+    uint32_t (*size)(struct open_file *file); // NULL — размер 0 (устройства)
+    int (*release)(struct open_file *file);   // Последний close (-1 — ошибка), может быть NULL
+    int (*readdir)(struct open_file *file, fs_dir_fn_t fn, void *ctx); // С позиции файла; NULL — не директория
+} file_ops_t;
+
+// Операции над узлами смонтированной ФС. rest — путь от точки монтирования
+// без ведущих '/'. ФС без операций создания доступна только для чтения
+typedef struct
+{
+    const char *name;                                            // Тип ФС
+    struct open_file *(*open)(const char *rest, int flags);      // Файл или директория, NULL — нет узла
+    int (*readdir)(const char *rest, fs_dir_fn_t fn, void *ctx); // -1 — не директория
+} inode_ops_t;
+
+// Точка монтирования: пути под директорией inode корневой ФС разбирает ops
+typedef struct
+{
+    uint32_t inode; // Директория монтирования (0 — слот свободен)
+    const inode_ops_t *ops;
+} vfs_mount_t;
+
+// Открытый файл: позиция и флаги общие для всех дескрипторов, полученных
+// из одного open (в том числе унаследованных через fork)
+typedef struct open_file
+{
+    const file_ops_t *ops; // Операции ФС или устройства файла
+    fs_inode_t *inode;    // Inode корневой ФС (NULL — файл другой ФС или устройство)
+    void *private_data;   // Состояние файла другой ФС
+    uint32_t offset;      // Текущая позиция в файле
+    int flags;            // Флаги открытия (O_RDONLY, O_WRONLY, O_RDWR, ...)
+    uint32_t ref_count;   // Число ссылающихся дескрипторов (0 — слот свободен)
+    uint8_t *wbuf;        // Буфер записи (выделяется при первой записи)
+    uint32_t wbuf_len;    // Накоплено байт в буфере
+    uint32_t wbuf_offset; // Смещение в файле, с которого начинается буфер
+} open_file_t;
+
+// === СТРУКТУРЫ БЛОЧНЫХ УСТРОЙСТВ ===
+
+// Найденное PCI-устройство
+typedef struct
+{
+    uint8_t bus, slot, func;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t irq_line; // Линия IRQ контроллера PIC (0xFF — нет)
+    uint32_t bar[6];  // Базовые адреса (BAR0-BAR5)
+} pci_device_t;
+
+// Сегмент scatter-gather: физически непрерывный буфер ядра
+typedef struct
+{
+    void *buffer;
+    uint32_t length; // Байт, кратно BLK_SECTOR_SIZE в сумме по запросу
+} blk_segment_t;
+
+struct block_device;
+
+// Асинхронный запрос к блочному устройству. complete вызывается по
+// завершении — обычно из обработчика прерывания
+typedef struct blk_request
+{
+    struct block_device *device;
+    uint32_t sector;                           // Первый сектор
+    int write;                                 // 0 — чтение, 1 — запись
+    blk_segment_t segments[BLK_MAX_SEGMENTS];  // Буферы данных по порядку
+    uint32_t segment_count;
+    volatile int status;                       // BLK_PENDING / BLK_OK / BLK_ERROR
+    void (*complete)(struct blk_request *req); // Может быть NULL
+    void *context;                             // Данные вызывающего
+} blk_request_t;
+
+// Блочное устройство: драйвер заполняет размеры и операции
+typedef struct block_device
+{
+    char name[16];
+    uint32_t sector_count;                                         // Ёмкость в секторах
+    uint32_t queue_depth;                                          // Запросов в полёте максимум
+    int (*submit)(struct block_device *dev, blk_request_t *req);   // -1 — очередь полна
+    void (*poll)(struct block_device *dev);                        // Сбор завершений без прерывания
+    void *driver_data;
+    uint32_t in_flight;     // Запросов в очереди устройства
+    uint32_t max_in_flight; // Наибольшая достигнутая глубина очереди
+    uint32_t reads, writes; // Выполнено запросов
+    uint32_t sectors_read, sectors_written;
+    uint32_t errors;
+    uint32_t ra_next; // Блок кэша, ожидаемый при последовательном чтении
+    uint32_t ra_run;  // Длина текущей последовательной серии
+} block_device_t;
+
+// Буфер кэша: копия блока устройства размером BCACHE_BLOCK_SIZE
+typedef struct bcache_buf
+{
+    block_device_t *dev;            // NULL — буфер свободен
+    uint32_t block;                 // Номер блока на устройстве
+    uint8_t *data;
+    uint32_t refcount;              // Закреплён пользователями (не вытесняется)
+    volatile uint8_t flags;         // BCACHE_VALID / DIRTY / IO / READAHEAD_FLAG
+    uint32_t dirty_since;           // Тик, когда буфер стал грязным
+    struct bcache_buf *hash_next;   // Цепочка в хеш-таблице
+    struct bcache_buf *lru_prev;    // Список LRU: в голове — давно не
+    struct bcache_buf *lru_next;    // использованные, в хвосте — свежие
+    blk_request_t req;              // Асинхронное чтение или запись буфера
+} bcache_buf_t;
+
 // === СТРУКТУРЫ ПЛАНИРОВЩИКА ЗАДАЧ ===
 
 // Состояние регистров для переключения контекста
@@ -438,11 +837,9 @@ typedef struct
 // Структура файлового дескриптора
 typedef struct file_descriptor
 {
-    int fd;                         // Номер файлового дескриптора
-    int flags;                      // Флаги открытия (O_RDONLY, O_WRONLY, O_RDWR)
-    uint32_t position;              // Текущая позиция в файле
-    char filename[FS_MAX_FILENAME]; // Имя файла
-    int valid;                      // Валидность дескриптора
+    int fd;            // Номер файлового дескриптора
+    open_file_t *file; // Открытый файл (позиция, флаги, inode)
+    int valid;         // Валидность дескриптора
 } file_descriptor_t;
 
 // Структура процесса
@@ -452,12 +849,13 @@ typedef struct process
     uint32_t ppid;             // Parent Process ID
     uint32_t uid;              // User ID
     uint32_t gid;              // Group ID
-    char working_dir[256];     // Текущая рабочая директория
+    uint32_t cwd_inode;        // Текущая рабочая директория (inode)
     file_descriptor_t fds[32]; // Файловые дескрипторы (0-31)
     int next_fd;               // Следующий свободный FD
-    uint32_t page_directory;   // Адрес Page Directory процесса
+    uint32_t page_directory;   // Физический адрес корня таблиц страниц (CR3)
     uint32_t memory_limit;     // Лимит памяти процесса
     uint32_t memory_used;      // Используемая память
+    io_ring_t *io_ring;        // Кольца ввода-вывода процесса (NULL — нет)
 } process_t;
 
 // Структура задачи
@@ -476,6 +874,14 @@ typedef struct task
     struct task *next;        // Следующая задача в списке
 } task_t;
 
+// Модуль загрузчика (строка module в grub.cfg, -initrd в QEMU)
+typedef struct
+{
+    uint32_t start;              // Физический адрес содержимого
+    uint32_t size;               // Размер в байтах
+    char name[BOOT_MODULE_NAME]; // Командная строка модуля
+} boot_module_t;
+
 // Глобальные переменные
 struct idt_entry idt[256];
 struct idt_ptr idtp;
@@ -486,6 +892,7 @@ int terminal_row = 0, terminal_column = 0;
 // Переменные таймера и планировщика
 uint32_t timer_ticks = 0;
 uint32_t timer_frequency = TIMER_FREQUENCY;
+uint32_t tsc_khz = 0; // Частота TSC (тактов на миллисекунду), 0 — не откалиброван
 
 // Переменные управления памятью
 memory_block_t *heap_start = NULL;
@@ -494,13 +901,35 @@ uint32_t free_memory = 0;
 uint32_t used_memory = 0;
 
 // Переменные виртуальной памяти
-page_directory_t *page_directory = (page_directory_t *)PAGE_DIRECTORY_ADDR;
-page_table_t *page_tables = (page_table_t *)PAGE_TABLES_ADDR;
+extern page_directory_t boot_page_directory; // Каталог ядра из boot.asm
+page_directory_t *page_directory = &boot_page_directory;
+uint32_t kernel_page_root = 0; // CR3 ядра (каталог или PDPT из boot.asm)
 int paging_enabled = 0;
+int nx_enabled = 0; // EFER.NXE включён (только PAE)
+
+// Модули загрузчика (initrd)
+boot_module_t boot_modules[BOOT_MODULES_MAX];
+uint32_t boot_module_count = 0;
 
 // Переменные файловой системы
 fs_state_t filesystem;
 uint32_t fs_time_counter = 0; // Простой счетчик времени
+uint32_t shell_cwd_inode = 0; // Текущая директория шелла (FS_ROOT_INODE)
+int in_syscall = 0;           // Глубина вложенности системных вызовов
+open_file_t open_files[FS_MAX_OPEN_FILES];       // Таблица открытых файлов
+extern const file_ops_t dev_console_ops;
+open_file_t console_file = {.ops = &dev_console_ops, .flags = O_RDWR, .ref_count = 1}; // stdin/stdout/stderr
+vfs_mount_t vfs_mounts[VFS_MAX_MOUNTS]; // Таблица монтирования
+uint32_t open_files_buffered = 0; // Открытых файлов с несброшенным буфером записи
+uint8_t fs_zcache_data[FS_ZCACHE_SLOTS][FS_COMP_GROUP]; // Распакованные группы
+fs_fingerprint_t fs_dedup_index[FS_DEDUP_SLOTS];        // Отпечатки блоков данных
+fs_watch_t fs_watches[FS_MAX_WATCHES]; // Наблюдения за файлами
+uint32_t fs_watch_count = 0;           // Занятых слотов fs_watches
+uint32_t fs_watch_cookie = 0;          // Последний cookie переименования
+
+// Счётчики для procfs
+uint32_t irq_counts[16];           // Прерываний по линиям IRQ
+uint32_t syscall_counts[SYS_MAX];  // Вызовов по номерам
 
 // Переменные планировщика
 task_t *task_list = NULL;
@@ -520,18 +949,55 @@ void terminal_writestring(const char *data);
 void terminal_putchar(char c);
 void print_number(uint32_t num);
 void terminal_clear(void);
+void init_serial(void);
+void serial_writestring(const char *data);
+void serial_write_number(uint32_t num);
 void shell_prompt(void);
 void execute_command(const char *command);
 
 // Объявления функций файловой системы
 void init_filesystem(void);
+void init_initrd(void);
 int fs_create_file(const char *filename);
 int fs_delete_file(const char *filename);
+int fs_rename(const char *old_path, const char *new_path);
 int fs_write_file(const char *filename, const char *data, uint32_t size);
 int fs_read_file(const char *filename, char *buffer, uint32_t max_size);
+int fs_append_file(const char *filename, const char *data, uint32_t size);
+int fs_compress_file(const char *filename, int enable);
+int fs_set_dedup(int enable);
+int fs_clone_file(const char *src, const char *dst);
+void fs_data_usage(uint32_t *logical_kb, uint32_t *physical_kb);
+int fs_read_file_at(const char *filename, uint32_t offset, char *buffer, uint32_t size);
+int fs_lookup_path(const char *path);
+int fs_walk(const char *path, vfs_mount_t **mount, const char **rest);
+int fs_get_path(uint32_t inode_num, char *buffer, uint32_t size);
 void fs_list_files(void);
 int fs_file_exists(const char *filename);
 fs_inode_t *fs_find_inode(const char *filename);
+int fs_sync(void);
+
+// Открытые файлы
+open_file_t *fs_open(const char *path, int flags);
+open_file_t *fs_file_dup(open_file_t *file);
+int fs_close(open_file_t *file);
+int fs_file_read(open_file_t *file, void *buffer, uint32_t size);
+int fs_file_write(open_file_t *file, const void *data, uint32_t size);
+int fs_file_pread(open_file_t *file, void *buffer, uint32_t size, uint32_t offset);
+int fs_file_pwrite(open_file_t *file, const void *data, uint32_t size, uint32_t offset);
+int fs_file_seek(open_file_t *file, int offset, int whence);
+uint32_t fs_file_size(open_file_t *file);
+int fs_file_readdir(open_file_t *file, fs_dir_fn_t fn, void *ctx);
+void fs_stat_inode(uint32_t inode_num, stat_t *st);
+int fs_stat(const char *path, stat_t *st);
+open_file_t *fs_watch_open(void);
+int fs_watch_add(open_file_t *file, const char *path, uint32_t mask);
+int fs_watch_remove(open_file_t *file, int wd);
+int fs_defrag_step(uint32_t budget, int wait);
+void fs_defrag_idle(void);
+void fs_layout_stats(uint32_t *files, uint32_t *fragmented, uint32_t *free_runs, uint32_t *largest_free);
+int fs_file_read_spans(open_file_t *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx);
+int fs_file_write_spans(open_file_t *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx);
 
 // Функции для работы с директориями
 int fs_create_directory(const char *dirname);
@@ -543,6 +1009,40 @@ fs_inode_t *fs_find_inode_in_dir(uint32_t parent_inode, const char *name);
 int fs_add_entry_to_dir(uint32_t parent_inode, uint32_t child_inode, const char *name, uint8_t type);
 int fs_remove_entry_from_dir(uint32_t parent_inode, const char *name);
 
+// VFS: таблица монтирования, devfs и procfs
+int vfs_mount(const char *path, const inode_ops_t *ops);
+vfs_mount_t *vfs_mount_at(uint32_t inode_num);
+int vfs_emit(fs_dir_fn_t fn, void *ctx, const char *name, uint8_t type);
+int vfs_list(vfs_mount_t *mount, const char *rest, const char *path);
+extern const inode_ops_t devfs_ops;
+extern const inode_ops_t procfs_ops;
+
+// Прерывания, PCI и блочные устройства
+typedef void (*irq_handler_t)(int irq);
+void irq_register(int irq, irq_handler_t handler);
+void pci_enumerate(void);
+pci_device_t *pci_find_device(uint16_t vendor_id, uint16_t device_id);
+int blk_register(block_device_t *dev);
+block_device_t *blk_find(const char *name);
+int blk_idle(void);
+int blk_submit(blk_request_t *req);
+int blk_wait(blk_request_t *req);
+int blk_rw(block_device_t *dev, uint32_t sector, void *buffer, uint32_t count, int write);
+void init_virtio_blk(void);
+void init_ramdisk(void);
+
+// Буферный кэш
+void init_bcache(void);
+bcache_buf_t *bcache_get(block_device_t *dev, uint32_t block, int fill);
+bcache_buf_t *bcache_buf_of(const void *data);
+void bcache_put(bcache_buf_t *buf);
+void bcache_mark_dirty(bcache_buf_t *buf);
+int bcache_prefetch(block_device_t *dev, uint32_t block);
+int bcache_writeback(block_device_t *dev, uint32_t min_age);
+int bcache_flush(block_device_t *dev);
+void bcache_timer(void);
+void fs_idle_writeback(void);
+
 // Объявления функций планировщика
 void init_scheduler(void);
 task_t *create_task(const char *name, void (*entry_point)(void), uint32_t priority);
@@ -556,16 +1056,29 @@ task_t *fork_process(task_t *parent);
 int exec_process(const char *filename, char **argv);
 int wait_process(uint32_t pid);
 void cleanup_process(task_t *task);
-int allocate_fd(task_t *task, const char *filename, int flags);
-void free_fd(task_t *task, int fd);
+int allocate_fd(task_t *task, open_file_t *file);
+int free_fd(task_t *task, int fd);
 file_descriptor_t *get_fd(task_t *task, int fd);
 
+// Резервирование непрерывной прямо отображённой памяти (для ФС)
+static void *phys_reserve_direct(uint32_t max_bytes, uint32_t *reserved);
+
+// Физические кадры (аллокатор из карты памяти Multiboot)
+static int phys_alloc_frame(phys_addr_t *out_phys);
+static void *phys_alloc_direct(uint32_t count, phys_addr_t *out_phys);
+static void phys_free_frame(phys_addr_t phys);
+static void *phys_frame_ptr(phys_addr_t phys);
+static int demand_page_load(task_t *task, uint32_t fault_addr);
+
 // Функции для управления памятью процессов
 uint32_t create_process_page_directory(void);
 void destroy_process_page_directory(uint32_t page_dir);
 void switch_to_process_page_directory(uint32_t page_dir);
-int map_memory_for_process(task_t *task, uint32_t virtual_addr, uint32_t physical_addr, uint32_t size, int flags);
+int map_memory_for_process(task_t *task, uint32_t virtual_addr, phys_addr_t physical_addr, uint32_t size, int flags);
 int unmap_memory_for_process(task_t *task, uint32_t virtual_addr, uint32_t size);
+int copy_process_memory(task_t *dst, task_t *src);
+uint32_t map_user_stack(task_t *task);
+int map_elf_program(task_t *task);
 void *allocate_memory_for_process(task_t *task, uint32_t size);
 void free_memory_for_process(task_t *task, void *ptr, uint32_t size);
 
@@ -659,6 +1172,66 @@ static inline uint8_t inb(uint16_t port)
     return ret;
 }
 
+static inline void outw(uint16_t port, uint16_t val)
+{
+    asm volatile("outw %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint16_t inw(uint16_t port)
+{
+    uint16_t ret;
+    asm volatile("inw %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline void outl(uint16_t port, uint32_t val)
+{
+    asm volatile("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint32_t inl(uint16_t port)
+{
+    uint32_t ret;
+    asm volatile("inl %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+// Запрет прерываний с сохранением прежнего состояния IF
+static inline uint32_t irq_save(void)
+{
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags)
+{
+    if (flags & 0x200)
+        asm volatile("sti" : : : "memory");
+}
+
+// Счётчик тактов процессора
+static inline uint64_t read_tsc(void)
+{
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+// Деление 64-битного числа на 32-битное двумя divl (без libgcc)
+static inline uint64_t div_u64(uint64_t n, uint32_t d)
+{
+    uint32_t high = n >> 32, low = (uint32_t)n, q_high = 0, q_low, rem = 0;
+    if (high >= d)
+    {
+        q_high = high / d;
+        high %= d;
+    }
+    asm("divl %4" : "=a"(q_low), "=d"(rem) : "a"(low), "d"(high), "rm"(d));
+    (void)rem;
+    return ((uint64_t)q_high << 32) | q_low;
+}
+
 // Функции для работы с памятью
 void *memset(void *dest, int val, size_t len)
 {
@@ -681,6 +1254,18 @@ void *memcpy(void *dest, const void *src, size_t len)
     return dest;
 }
 
+int memcmp(const void *a, const void *b, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)a;
+    const uint8_t *q = (const uint8_t *)b;
+    for (; len > 0; len--, p++, q++)
+    {
+        if (*p != *q)
+            return *p - *q;
+    }
+    return 0;
+}
+
 // Функции для работы со строками
 int strlen(const char *str)
 {
@@ -871,6 +1456,50 @@ void print_hex(uint32_t num)
     }
 }
 
+// === ПОСЛЕДОВАТЕЛЬНЫЙ ПОРТ ===
+
+// COM1: 115200 бод, 8N1, без прерываний. Вывод опрашивает готовность
+// передатчика, поэтому работает в любом контексте
+void init_serial(void)
+{
+    outb(COM1_PORT + 1, 0x00); // Прерывания порта выключены
+    outb(COM1_PORT + 3, 0x80); // DLAB: доступ к делителю
+    outb(COM1_PORT + 0, 0x01); // Делитель 1 — 115200 бод
+    outb(COM1_PORT + 1, 0x00);
+    outb(COM1_PORT + 3, 0x03); // 8 бит, без чётности, 1 стоп-бит
+    outb(COM1_PORT + 2, 0xC7); // FIFO включён и очищен
+    outb(COM1_PORT + 4, 0x03); // DTR, RTS
+}
+
+void serial_putchar(char c)
+{
+    if (c == '\n')
+        serial_putchar('\r');
+    while (!(inb(COM1_LSR) & COM1_LSR_THRE))
+        ;
+    outb(COM1_PORT, c);
+}
+
+void serial_writestring(const char *data)
+{
+    while (*data)
+        serial_putchar(*data++);
+}
+
+void serial_write_number(uint32_t num)
+{
+    char buffer[12];
+    int i = 0;
+    do
+    {
+        buffer[i++] = '0' + (num % 10);
+        num /= 10;
+    } while (num > 0);
+
+    while (i > 0)
+        serial_putchar(buffer[--i]);
+}
+
 // Инициализация системы управления памятью
 void init_memory_management()
 {
@@ -1122,9 +1751,8 @@ uint32_t elf_load_program(elf_loader_t *loader)
     }
 
     uint32_t min_addr = 0xFFFFFFFF;
-    uint32_t max_addr = 0;
 
-    // First pass: find memory range needed
+    // Find the lowest segment address
     for (int i = 0; i < loader->header->e_phnum; i++)
     {
         elf_program_header_t *ph = &loader->pheaders[i];
@@ -1135,10 +1763,6 @@ uint32_t elf_load_program(elf_loader_t *loader)
             {
                 min_addr = ph->p_vaddr;
             }
-            if (ph->p_vaddr + ph->p_memsz > max_addr)
-            {
-                max_addr = ph->p_vaddr + ph->p_memsz;
-            }
         }
     }
 
@@ -1151,32 +1775,7 @@ uint32_t elf_load_program(elf_loader_t *loader)
     uint32_t load_base = ELF_LOAD_BASE;
     loader->load_base = load_base;
 
-    // Second pass: actually load segments (eager load for now; DP also supported)
-    for (int i = 0; i < loader->header->e_phnum; i++)
-    {
-        elf_program_header_t *ph = &loader->pheaders[i];
-
-        if (ph->p_type == PT_LOAD)
-        {
-            // Calculate load address
-            uint32_t load_addr = load_base + (ph->p_vaddr - min_addr);
-
-            // Copy file data to memory
-            if (ph->p_filesz > 0)
-            {
-                memcpy((void *)load_addr,
-                       loader->data + ph->p_offset,
-                       ph->p_filesz);
-            }
-
-            // Zero out any remaining memory (BSS section)
-            if (ph->p_memsz > ph->p_filesz)
-            {
-                memset((void *)(load_addr + ph->p_filesz), 0,
-                       ph->p_memsz - ph->p_filesz);
-            }
-        }
-    }
+    // Segment pages are copied into the task's own frames by map_elf_program()
 
     // Adjust entry point to loaded address
     loader->entry_point = load_base + (loader->header->e_entry - min_addr);
@@ -1263,11 +1862,16 @@ task_t *create_elf_task(const char *name, uint8_t *elf_data, uint32_t elf_size,
         return NULL;
     }
 
-    // Загружаем программу в память
+    // Загружаем программу в собственное адресное пространство задачи
     uint32_t entry_point = elf_load_program(task->elf_loader);
-    if (entry_point == 0)
+    uint32_t stack_top = 0;
+    task->process.page_directory = entry_point ? create_process_page_directory() : 0;
+    if (task->process.page_directory && map_elf_program(task) == 0)
+        stack_top = map_user_stack(task);
+    if (stack_top == 0)
     {
         terminal_writestring("Error: Failed to load ELF program\n");
+        destroy_process_page_directory(task->process.page_directory);
         elf_cleanup(task->elf_loader);
         kfree(task->elf_loader);
         kfree(task->stack);
@@ -1276,7 +1880,6 @@ task_t *create_elf_task(const char *name, uint8_t *elf_data, uint32_t elf_size,
     }
 
     // Настраиваем контекст для пользовательского режима
-    uint32_t stack_top = (uint32_t)task->stack + task->stack_size - 4;
     create_user_task(entry_point, stack_top, task);
 
     // Добавляем в список задач
@@ -1411,1880 +2014,9214 @@ uint32_t test_elf_size = sizeof(test_elf_program);
 
 // === ФАЙЛОВАЯ СИСТЕМА ===
 
-void init_filesystem(void)
-{
-    memset(&filesystem, 0, sizeof(fs_state_t));
+// === БИТОВЫЕ КАРТЫ ===
 
-    // Инициализируем суперблок
-    filesystem.superblock.magic = 0x12345678;
-    filesystem.superblock.total_inodes = FS_MAX_FILES;
-    filesystem.superblock.free_inodes = FS_MAX_FILES;
-    filesystem.superblock.total_blocks = FS_MAX_BLOCKS;
-    filesystem.superblock.free_blocks = FS_MAX_BLOCKS;
-    filesystem.superblock.block_size = FS_BLOCK_SIZE;
+// Номер младшего установленного бита (value != 0)
+static inline uint32_t bit_scan_forward(uint32_t value)
+{
+    uint32_t index;
+    asm("bsf %1, %0" : "=r"(index) : "rm"(value));
+    return index;
+}
 
-    // Выделяем память для блоков данных
-    filesystem.data_blocks = (uint8_t *)kmalloc(FS_MAX_BLOCKS * FS_BLOCK_SIZE);
-    if (!filesystem.data_blocks)
-    {
-        terminal_writestring("Error: Failed to allocate filesystem data blocks\n");
-        return;
-    }
+static void fs_image_load(const void *ptr, uint32_t size);
 
-    memset(filesystem.data_blocks, 0, FS_MAX_BLOCKS * FS_BLOCK_SIZE);
-    memset(filesystem.inode_bitmap, 0, FS_MAX_FILES);
-    memset(filesystem.block_bitmap, 0, FS_MAX_BLOCKS);
+// Битовые карты тома на устройстве читаются по мере обращения: перед
+// доступом к слову подгружается содержащий его сектор образа
+static inline int fs_bit_test(uint32_t *bitmap, uint32_t bit)
+{
+    fs_image_load(&bitmap[bit >> 5], 4);
+    return (bitmap[bit >> 5] >> (bit & 31)) & 1;
+}
 
-    filesystem.initialized = 1;
+static inline void fs_bit_set(uint32_t *bitmap, uint32_t bit)
+{
+    fs_image_load(&bitmap[bit >> 5], 4);
+    bitmap[bit >> 5] |= 1u << (bit & 31);
+}
 
-    terminal_writestring("Filesystem initialized\n");
+static inline void fs_bit_clear(uint32_t *bitmap, uint32_t bit)
+{
+    fs_image_load(&bitmap[bit >> 5], 4);
+    bitmap[bit >> 5] &= ~(1u << (bit & 31));
 }
 
-int fs_create_file(const char *filename)
+// Поиск первого бита со значением value в [from, bits) пословно через bsf.
+// Возвращает bits, если такого бита нет
+static uint32_t fs_bitmap_next(uint32_t *bitmap, uint32_t bits, uint32_t from, int value)
 {
-    if (!filesystem.initialized || !filename)
-        return -1;
+    if (from >= bits)
+        return bits;
+
+    uint32_t words = FS_BITMAP_WORDS(bits);
+    uint32_t index = from >> 5;
+    fs_image_load(&bitmap[index], 4);
+    uint32_t word = (value ? bitmap[index] : ~bitmap[index]) & (~0u << (from & 31));
 
-    // Проверяем, не существует ли файл уже
-    if (fs_file_exists(filename))
+    while (word == 0)
     {
-        terminal_writestring("File already exists: ");
-        terminal_writestring(filename);
-        terminal_writestring("\n");
-        return -1;
+        if (++index >= words)
+            return bits;
+        if ((index & 127) == 0) // Начало следующего сектора карты
+            fs_image_load(&bitmap[index], 4);
+        word = value ? bitmap[index] : ~bitmap[index];
     }
 
-    // Ищем свободный inode
-    for (int i = 0; i < FS_MAX_FILES; i++)
+    uint32_t bit = (index << 5) + bit_scan_forward(word);
+    return bit < bits ? bit : bits;
+}
+
+// Установка или сброс битов [start, start + count) целыми словами, где возможно
+static void fs_bitmap_fill(uint32_t *bitmap, uint32_t start, uint32_t count, int value)
+{
+    if (count > 0)
+        fs_image_load(&bitmap[start >> 5], ((start + count - 1) / 32 - start / 32 + 1) * 4);
+
+    while (count > 0)
     {
-        if (filesystem.inode_bitmap[i] == 0)
-        {
-            filesystem.inode_bitmap[i] = 1;
-            filesystem.superblock.free_inodes--;
+        uint32_t shift = start & 31;
+        uint32_t n = 32 - shift;
+        if (n > count)
+            n = count;
 
-            fs_inode_t *inode = &filesystem.inodes[i];
-            memset(inode, 0, sizeof(fs_inode_t));
-            inode->type = FS_INODE_FILE;
-            strncpy(inode->filename, filename, FS_MAX_FILENAME - 1);
-            inode->created_time = fs_time_counter++;
-            inode->modified_time = inode->created_time;
+        uint32_t mask = (n == 32) ? ~0u : (((1u << n) - 1) << shift);
+        if (value)
+            bitmap[start >> 5] |= mask;
+        else
+            bitmap[start >> 5] &= ~mask;
 
-            return i;
-        }
+        start += n;
+        count -= n;
     }
+}
+
+static void fs_dcache_reset(void);
+static int fs_inode_is_open(fs_inode_t *inode);
+static void fs_inode_flush(fs_inode_t *inode);
+
+// === ТОМ НА УСТРОЙСТВЕ ===
+
+// Метаданные тома (суперблок, битовые карты, таблица inodes) отображаются в
+// память сектор к сектору, но читаются лениво: при монтировании — только
+// суперблок, остальные секторы — при первом обращении. Блоки данных читаются
+// и пишутся через буферный кэш. Для ФС в памяти эти функции ничего не делают
 
-    terminal_writestring("No free inodes available\n");
-    return -1; // Нет свободных inodes
+// Указатель внутри образа метаданных (иначе — таблицы ядра вне образа)
+static inline int fs_in_image(const void *ptr)
+{
+    return filesystem.device && (const uint8_t *)ptr >= filesystem.image &&
+           (const uint8_t *)ptr < filesystem.image + filesystem.image_sectors * FS_BLOCK_SIZE;
 }
 
-int fs_file_exists(const char *filename)
+// Чтение ещё не загруженных секторов, покрывающих [ptr, ptr + size)
+static void fs_image_load(const void *ptr, uint32_t size)
 {
-    if (!filesystem.initialized || !filename)
-        return 0;
+    if (size == 0 || !fs_in_image(ptr))
+        return;
+
+    uint32_t offset = (const uint8_t *)ptr - filesystem.image;
+    uint32_t end = (offset + size - 1) / FS_BLOCK_SIZE + 1;
+    uint32_t *loaded = filesystem.sector_loaded;
 
-    for (int i = 0; i < FS_MAX_FILES; i++)
+    for (uint32_t sector = fs_bitmap_next(loaded, end, offset / FS_BLOCK_SIZE, 0); sector < end;
+         sector = fs_bitmap_next(loaded, end, sector, 0))
     {
-        if (filesystem.inode_bitmap[i] &&
-            filesystem.inodes[i].type == FS_INODE_FILE &&
-            strcmp(filesystem.inodes[i].filename, filename) == 0)
+        uint32_t count = fs_bitmap_next(loaded, end, sector, 1) - sector;
+        if (count > FS_IO_MAX_SECTORS)
+            count = FS_IO_MAX_SECTORS;
+
+        uint8_t *buffer = filesystem.image + sector * FS_BLOCK_SIZE;
+        if (blk_rw(filesystem.device, sector, buffer, count, 0) < 0)
         {
-            return 1;
+            // Нечитаемые секторы отдаются нулями, ошибка видна в статистике устройства
+            terminal_writestring("Filesystem: read error at sector ");
+            print_number(sector);
+            terminal_writestring("\n");
+            memset(buffer, 0, count * FS_BLOCK_SIZE);
         }
-    }
 
-    return 0;
+        fs_bitmap_fill(loaded, sector, count, 1);
+        filesystem.sectors_read += count;
+        sector += count;
+    }
 }
 
-fs_inode_t *fs_find_inode(const char *filename)
+// Пометка метаданных изменёнными (для фоновой записи)
+static inline void fs_meta_dirty(void)
 {
-    if (!filesystem.initialized || !filename)
-        return NULL;
-
-    for (int i = 0; i < FS_MAX_FILES; i++)
+    if (filesystem.device && !filesystem.meta_dirty)
     {
-        if (filesystem.inode_bitmap[i] &&
-            filesystem.inodes[i].type == FS_INODE_FILE &&
-            strcmp(filesystem.inodes[i].filename, filename) == 0)
-        {
-            return &filesystem.inodes[i];
-        }
+        filesystem.meta_dirty = 1;
+        filesystem.meta_dirty_since = timer_ticks;
     }
+}
 
-    return NULL;
+// Inode по номеру. Сектор таблицы inodes тома подгружается при первом обращении
+static inline fs_inode_t *fs_inode(uint32_t inode_num)
+{
+    fs_inode_t *inode = &filesystem.inodes[inode_num];
+    fs_image_load(inode, sizeof(fs_inode_t));
+    return inode;
 }
 
-int fs_write_file(const char *filename, const char *data, uint32_t size)
+// Буфер кэша с данными блока block тома и смещение блока в нём
+static bcache_buf_t *fs_block_buffer(uint32_t block, uint32_t *within, int fill)
 {
-    if (!filesystem.initialized || !filename || !data || size == 0)
-        return -1;
+    uint32_t sector = filesystem.superblock.data_start + block;
+    *within = (sector % BCACHE_BLOCK_SECTORS) * FS_BLOCK_SIZE;
+    return bcache_get(filesystem.device, sector / BCACHE_BLOCK_SECTORS, fill);
+}
 
-    fs_inode_t *inode = fs_find_inode(filename);
-    if (!inode)
+// Обнуление блоков [start, start + count). Буферы кэша, перекрытые
+// целиком, не читаются с устройства
+static void fs_zero_blocks(uint32_t start, uint32_t count)
+{
+    if (!filesystem.device)
     {
-        terminal_writestring("File not found: ");
-        terminal_writestring(filename);
-        terminal_writestring("\n");
-        return -1;
+        memset(filesystem.data_blocks + start * FS_BLOCK_SIZE, 0, count * FS_BLOCK_SIZE);
+        return;
     }
 
-    if (size > FS_MAX_FILESIZE)
+    while (count > 0)
     {
-        size = FS_MAX_FILESIZE;
-    }
+        uint32_t within;
+        uint32_t first = (filesystem.superblock.data_start + start) % BCACHE_BLOCK_SECTORS;
+        uint32_t n = BCACHE_BLOCK_SECTORS - first < count ? BCACHE_BLOCK_SECTORS - first : count;
 
-    // Простая реализация: записываем в первый блок
-    if (inode->blocks[0] == 0)
-    {
-        // Ищем свободный блок
-        for (uint32_t i = 0; i < FS_MAX_BLOCKS; i++)
-        {
-            if (filesystem.block_bitmap[i] == 0)
-            {
-                filesystem.block_bitmap[i] = 1;
-                filesystem.superblock.free_blocks--;
-                inode->blocks[0] = i;
-                break;
-            }
-        }
-    }
+        bcache_buf_t *buf = fs_block_buffer(start, &within, n != BCACHE_BLOCK_SECTORS);
+        if (!buf)
+            return;
+        memset(buf->data + within, 0, n * FS_BLOCK_SIZE);
+        bcache_mark_dirty(buf);
+        bcache_put(buf);
 
-    if (inode->blocks[0] > 0)
-    {
-        uint8_t *block_data = filesystem.data_blocks + (inode->blocks[0] * FS_BLOCK_SIZE);
-        memcpy(block_data, data, size);
-        inode->size = size;
-        inode->modified_time = fs_time_counter++;
-        return 0;
+        start += n;
+        count -= n;
     }
-
-    terminal_writestring("No free blocks available\n");
-    return -1;
 }
 
-int fs_read_file(const char *filename, char *buffer, uint32_t max_size)
+// Монтирование тома с устройства FS_ROOT_DEVICE. Читается только
+// суперблок, поэтому время монтирования не зависит от объёма данных.
+// Память резервируется под метаданные и кэш dentry, данные — в буферном
+// кэше. -1 — устройства или тома нет, либо метаданные не помещаются в память
+static int fs_mount_device(void)
 {
-    if (!filesystem.initialized || !filename || !buffer)
+    block_device_t *dev = blk_find(FS_ROOT_DEVICE);
+    if (!dev)
         return -1;
 
-    fs_inode_t *inode = fs_find_inode(filename);
-    if (!inode || inode->size == 0)
+    static uint8_t sector0[FS_BLOCK_SIZE];
+    fs_superblock_t *sb = (fs_superblock_t *)sector0;
+    if (blk_rw(dev, 0, sector0, 1, 0) < 0)
+    {
+        terminal_writestring("Filesystem: cannot read superblock from " FS_ROOT_DEVICE "\n");
+        return -1;
+    }
+    if (sb->magic != FS_MAGIC || sb->version != FS_VERSION || sb->block_size != FS_BLOCK_SIZE)
+    {
+        terminal_writestring("Filesystem: no filesystem on " FS_ROOT_DEVICE ", using memory\n");
+        return -1;
+    }
+    if (sb->total_sectors > dev->sector_count || sb->data_start + sb->total_blocks != sb->total_sectors ||
+        sb->inode_table_start + (sb->total_inodes + FS_INODES_PER_SECTOR - 1) / FS_INODES_PER_SECTOR >
+            sb->data_start)
+    {
+        terminal_writestring("Filesystem: corrupted superblock on " FS_ROOT_DEVICE "\n");
+        return -1;
+    }
+    // Буфер кэша с блоками данных не должен захватывать секторы метаданных:
+    // фоновая запись вернула бы на диск их устаревшую копию
+    if (sb->data_start % BCACHE_BLOCK_SECTORS != 0)
+    {
+        terminal_writestring("Filesystem: data area of " FS_ROOT_DEVICE " is not aligned, recreate it with mkfs\n");
         return -1;
+    }
 
-    uint32_t read_size = (inode->size < max_size) ? inode->size : max_size;
+    // Разметка арены: образ метаданных, карта загруженных секторов, кэш dentry
+    uint32_t image_bytes = sb->data_start * FS_BLOCK_SIZE;
+    uint32_t map_bytes = FS_BITMAP_WORDS(sb->data_start) * 4;
+    uint32_t dcache_want = FS_MIN_DCACHE;
+    while (dcache_want < sb->total_inodes * 2)
+        dcache_want <<= 1;
 
-    if (inode->blocks[0] > 0)
+    uint32_t arena_size = 0;
+    uint8_t *arena = (uint8_t *)phys_reserve_direct(image_bytes + map_bytes + dcache_want * sizeof(fs_dentry_t),
+                                                    &arena_size);
+    if (!arena || arena_size < image_bytes + map_bytes + FS_MIN_DCACHE * sizeof(fs_dentry_t))
     {
-        uint8_t *block_data = filesystem.data_blocks + (inode->blocks[0] * FS_BLOCK_SIZE);
-        memcpy(buffer, block_data, read_size);
-        return read_size;
+        terminal_writestring("Filesystem: metadata of " FS_ROOT_DEVICE " does not fit in memory\n");
+        return -1;
     }
 
-    return -1;
+    memcpy(arena, sector0, FS_BLOCK_SIZE);
+    filesystem.sector_loaded = (uint32_t *)(arena + image_bytes);
+    memset(filesystem.sector_loaded, 0, map_bytes);
+    fs_bit_set(filesystem.sector_loaded, 0);
+
+    filesystem.dcache = (fs_dentry_t *)(arena + image_bytes + map_bytes);
+    filesystem.dcache_limit = FS_MIN_DCACHE;
+    uint32_t dcache_room = (arena_size - image_bytes - map_bytes) / sizeof(fs_dentry_t);
+    while (filesystem.dcache_limit * 2 <= dcache_room && filesystem.dcache_limit < dcache_want)
+        filesystem.dcache_limit <<= 1;
+
+    // Таблицы тома используются прямо из образа. Таблица inodes не растёт:
+    // её размер задан при создании тома
+    memcpy(&filesystem.superblock, sb, sizeof(fs_superblock_t));
+    filesystem.device = dev;
+    filesystem.image = arena;
+    filesystem.image_sectors = sb->data_start;
+    filesystem.arena_size = arena_size;
+    filesystem.inode_bitmap = (uint32_t *)(arena + sb->inode_bitmap_start * FS_BLOCK_SIZE);
+    filesystem.block_bitmap = (uint32_t *)(arena + sb->block_bitmap_start * FS_BLOCK_SIZE);
+    filesystem.inodes = (fs_inode_t *)(arena + sb->inode_table_start * FS_BLOCK_SIZE);
+    filesystem.inode_capacity = sb->total_inodes;
+    filesystem.inode_limit = sb->total_inodes;
+    filesystem.inode_hint = 1;
+    filesystem.block_hint = 1;
+    fs_time_counter = sb->time_counter;
+    filesystem.defrag.enabled = 1;
+
+    fs_dcache_reset();
+    filesystem.initialized = 1;
+
+    terminal_writestring("Filesystem mounted from " FS_ROOT_DEVICE ": ");
+    print_number(sb->total_blocks * FS_BLOCK_SIZE / 1024);
+    terminal_writestring(" KB data, ");
+    print_number(sb->total_inodes);
+    terminal_writestring(" inodes\n");
+    return 0;
 }
 
-int fs_delete_file(const char *filename)
+void init_filesystem(void)
 {
-    if (!filesystem.initialized || !filename)
-        return -1;
+    memset(&filesystem, 0, sizeof(fs_state_t));
 
-    for (int i = 0; i < FS_MAX_FILES; i++)
+    // Том на блочном устройстве, если он есть; иначе — ФС только в памяти.
+    // С модулями загрузчика корень всегда в памяти: в него раскладывается
+    // initrd (см. init_initrd)
+    if (boot_module_count == 0 && fs_mount_device() == 0)
+        return;
+
+    // Размер ФС в памяти определяется при монтировании: большая часть
+    // свободной памяти над ELF-областью, а без неё — небольшой том в куче ядра
+    uint32_t total_blocks;
+    uint32_t arena_size = 0;
+    uint8_t *arena = (uint8_t *)phys_reserve_direct(FS_ARENA_MAX, &arena_size);
+
+    if (arena && arena_size >= FS_ARENA_MIN)
+    {
+        // 3/4 арены под блоки данных, остальное — таблицы и кэш dentry
+        total_blocks = (arena_size / 4 * 3) / FS_BLOCK_SIZE;
+        uint32_t table_bytes = arena_size - total_blocks * FS_BLOCK_SIZE;
+        uint32_t block_tables = FS_BITMAP_WORDS(total_blocks) * 4 + total_blocks;
+        uint32_t per_inode = sizeof(fs_inode_t) + 4 * sizeof(fs_dentry_t) + 1;
+
+        filesystem.inode_limit = total_blocks * FS_BLOCK_SIZE / FS_BYTES_PER_INODE;
+        if (filesystem.inode_limit > (table_bytes - block_tables) / per_inode)
+            filesystem.inode_limit = (table_bytes - block_tables) / per_inode;
+
+        // Разметка арены: данные, таблица inodes, битовые карты, счётчики
+        // ссылок на блоки, кэш dentry
+        uint8_t *next = arena;
+        filesystem.data_blocks = next;
+        next += total_blocks * FS_BLOCK_SIZE;
+        filesystem.inodes = (fs_inode_t *)next;
+        next += filesystem.inode_limit * sizeof(fs_inode_t);
+        filesystem.inode_bitmap = (uint32_t *)next;
+        next += FS_BITMAP_WORDS(filesystem.inode_limit) * 4;
+        filesystem.block_bitmap = (uint32_t *)next;
+        next += FS_BITMAP_WORDS(total_blocks) * 4;
+        filesystem.block_refs = next;
+        next += total_blocks;
+        filesystem.dcache = (fs_dentry_t *)next;
+        filesystem.dcache_limit = filesystem.inode_limit * 4;
+        filesystem.arena_size = arena_size;
+    }
+    else
     {
-        if (filesystem.inode_bitmap[i] &&
-            filesystem.inodes[i].type == FS_INODE_FILE &&
-            strcmp(filesystem.inodes[i].filename, filename) == 0)
+        total_blocks = FS_FALLBACK_BLOCKS;
+        filesystem.inode_limit = FS_INITIAL_INODES;
+
+        // Выделяем память для блоков данных и таблиц
+        filesystem.data_blocks = (uint8_t *)kmalloc(total_blocks * FS_BLOCK_SIZE);
+        filesystem.inodes = (fs_inode_t *)kmalloc(filesystem.inode_limit * sizeof(fs_inode_t));
+        filesystem.inode_bitmap = (uint32_t *)kmalloc(FS_BITMAP_WORDS(filesystem.inode_limit) * 4);
+        filesystem.block_bitmap = (uint32_t *)kmalloc(FS_BITMAP_WORDS(total_blocks) * 4);
+        filesystem.block_refs = (uint8_t *)kmalloc(total_blocks);
+        filesystem.dcache = (fs_dentry_t *)kmalloc(FS_MIN_DCACHE * sizeof(fs_dentry_t));
+        filesystem.dcache_limit = FS_MIN_DCACHE;
+        if (!filesystem.data_blocks || !filesystem.inodes || !filesystem.inode_bitmap ||
+            !filesystem.block_bitmap || !filesystem.block_refs || !filesystem.dcache)
         {
+            terminal_writestring("Error: Failed to allocate filesystem data blocks\n");
+            return;
+        }
+    }
 
-            fs_inode_t *inode = &filesystem.inodes[i];
+    // Блоки данных обнуляются при выделении, таблицы — по мере роста
+    filesystem.inode_capacity = FS_INITIAL_INODES;
+    if (filesystem.inode_capacity > filesystem.inode_limit)
+        filesystem.inode_capacity = filesystem.inode_limit;
+    memset(filesystem.inodes, 0, filesystem.inode_capacity * sizeof(fs_inode_t));
+    memset(filesystem.inode_bitmap, 0, FS_BITMAP_WORDS(filesystem.inode_limit) * 4);
+    memset(filesystem.block_bitmap, 0, FS_BITMAP_WORDS(total_blocks) * 4);
+    memset(filesystem.block_refs, 0, total_blocks);
+    memset(fs_dedup_index, 0, sizeof(fs_dedup_index));
 
-            // Освобождаем блоки данных
-            for (int j = 0; j < 16 && inode->blocks[j] > 0; j++)
-            {
-                filesystem.block_bitmap[inode->blocks[j]] = 0;
-                filesystem.superblock.free_blocks++;
-            }
+    // Инициализируем суперблок
+    filesystem.superblock.magic = FS_MAGIC;
+    filesystem.superblock.version = FS_VERSION;
+    filesystem.superblock.total_inodes = filesystem.inode_capacity;
+    filesystem.superblock.free_inodes = filesystem.inode_capacity;
+    filesystem.superblock.total_blocks = total_blocks;
+    filesystem.superblock.free_blocks = total_blocks - 1;
+    filesystem.superblock.block_size = FS_BLOCK_SIZE;
 
-            // Освобождаем inode
-            filesystem.inode_bitmap[i] = 0;
-            filesystem.superblock.free_inodes++;
-            memset(inode, 0, sizeof(fs_inode_t));
+    // Блок 0 зарезервирован: start == 0 означает "экстент не выделен"
+    fs_bit_set(filesystem.block_bitmap, 0);
+    filesystem.block_hint = 1;
 
-            return 0;
-        }
-    }
+    // Inode 0 — корневая директория, её родитель — она сама
+    fs_inode_t *root = &filesystem.inodes[FS_ROOT_INODE];
+    root->type = FS_INODE_DIR;
+    strcpy(root->filename, "/");
+    root->parent_inode = FS_ROOT_INODE;
+    fs_bit_set(filesystem.inode_bitmap, FS_ROOT_INODE);
+    filesystem.superblock.free_inodes--;
+    filesystem.inode_hint = 1;
+    filesystem.defrag.enabled = 1;
 
-    terminal_writestring("File not found: ");
-    terminal_writestring(filename);
-    terminal_writestring("\n");
-    return -1;
-}
-
-void fs_list_files(void)
-{
-    if (!filesystem.initialized)
-    {
-        terminal_writestring("ERROR: File system not initialized!\n");
-        return;
-    }
-
-    terminal_writestring("Files in filesystem:\n");
-    terminal_writestring("Name               Size      Time\n");
-    terminal_writestring("----------------------------------\n");
+    fs_dcache_reset();
 
-    int file_count = 0;
-    for (int i = 0; i < FS_MAX_FILES; i++)
-    {
-        if (filesystem.inodes[i].type == FS_INODE_FILE)
-        {
-            fs_inode_t *inode = &filesystem.inodes[i];
+    filesystem.initialized = 1;
 
-            // Имя файла
-            terminal_writestring(inode->filename);
+    terminal_writestring("Filesystem initialized: ");
+    print_number(total_blocks * FS_BLOCK_SIZE / 1024);
+    terminal_writestring(" KB data, up to ");
+    print_number(filesystem.inode_limit);
+    terminal_writestring(" inodes\n");
+}
 
-            // Выравнивание
-            int name_len = strlen(inode->filename);
-            for (int j = name_len; j < 18; j++)
-            {
-                terminal_putchar(' ');
-            }
+// === ТАБЛИЦА INODES ===
 
-            // Размер
-            print_number(inode->size);
-            terminal_writestring(" bytes   ");
+// Рост таблицы inodes вдвое (в пределах inode_limit). Память под таблицу
+// зарезервирована при монтировании, поэтому указатели на inodes не меняются
+static int fs_grow_inodes(void)
+{
+    uint32_t old_capacity = filesystem.inode_capacity;
+    uint32_t new_capacity = old_capacity * 2;
+    if (new_capacity > filesystem.inode_limit)
+        new_capacity = filesystem.inode_limit;
+    if (new_capacity <= old_capacity)
+        return -1;
 
-            // Время
-            print_number(inode->modified_time);
-            terminal_putchar('\n');
+    memset(&filesystem.inodes[old_capacity], 0, (new_capacity - old_capacity) * sizeof(fs_inode_t));
+    filesystem.inode_capacity = new_capacity;
+    filesystem.superblock.total_inodes = new_capacity;
+    filesystem.superblock.free_inodes += new_capacity - old_capacity;
 
-            file_count++;
-        }
-    }
+    // Кэш dentry растёт вместе с таблицей
+    fs_dcache_reset();
+    return 0;
+}
 
-    if (file_count == 0)
-    {
-        terminal_writestring("No files found.\n");
-    }
-    else
+// Выделение свободного inode: поиск от подсказки, затем с начала, затем рост таблицы
+static int fs_alloc_inode(void)
+{
+    uint32_t capacity = filesystem.inode_capacity;
+    uint32_t i = fs_bitmap_next(filesystem.inode_bitmap, capacity, filesystem.inode_hint, 0);
+    if (i >= capacity)
+        i = fs_bitmap_next(filesystem.inode_bitmap, capacity, 0, 0);
+    if (i >= capacity)
     {
-        terminal_writestring("\nTotal files: ");
-        print_number(file_count);
-        terminal_putchar('\n');
+        if (fs_grow_inodes() < 0)
+            return -1;
+        i = capacity; // Первый из добавленных inodes
     }
 
-    terminal_writestring("Free inodes: ");
-    print_number(filesystem.superblock.free_inodes);
-    terminal_writestring(", Free blocks: ");
-    print_number(filesystem.superblock.free_blocks);
-    terminal_writestring("\n\n");
+    fs_bit_set(filesystem.inode_bitmap, i);
+    filesystem.superblock.free_inodes--;
+    filesystem.inode_hint = i + 1;
+    fs_meta_dirty();
+    return i;
 }
 
-// === ФУНКЦИИ ДЛЯ РАБОТЫ С ДИРЕКТОРИЯМИ ===
-
-// Создание директории
-int fs_create_directory(const char *dirname)
+static void fs_free_inode(uint32_t inode_num)
 {
-    if (!filesystem.initialized || !dirname)
-        return -1;
+    fs_bit_clear(filesystem.inode_bitmap, inode_num);
+    filesystem.superblock.free_inodes++;
+    fs_meta_dirty();
+}
 
-    // Проверяем, не существует ли директория уже
-    if (fs_file_exists(dirname))
+// === ЭКСТЕНТЫ ===
+
+// Количество блоков, занятых файлом
+static uint32_t fs_inode_block_count(fs_inode_t *inode)
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < inode->extent_count; i++)
     {
-        terminal_writestring("Directory already exists: ");
-        terminal_writestring(dirname);
-        terminal_writestring("\n");
-        return -1;
+        count += inode->extents[i].length;
     }
+    return count;
+}
 
-    // Ищем свободный inode
-    for (int i = 0; i < FS_MAX_FILES; i++)
+// Освобождение непрерывного участка блоков. Общий блок (дедупликация)
+// освобождается только вместе с последней ссылкой на него
+static void fs_free_run(uint32_t start, uint32_t length)
+{
+    uint8_t *refs = filesystem.block_refs;
+    while (length > 0)
     {
-        if (filesystem.inode_bitmap[i] == 0)
+        if (refs && refs[start] > 0)
         {
-            filesystem.inode_bitmap[i] = 1;
-            filesystem.superblock.free_inodes--;
-
-            fs_inode_t *inode = &filesystem.inodes[i];
-            memset(inode, 0, sizeof(fs_inode_t));
-            inode->type = FS_INODE_DIR;
-            strncpy(inode->filename, dirname, FS_MAX_FILENAME - 1);
-            inode->created_time = fs_time_counter++;
-            inode->modified_time = inode->created_time;
-            inode->parent_inode = 0; // Корневая директория
-
-            // Выделяем блок для записей директории
-            for (uint32_t j = 0; j < FS_MAX_BLOCKS; j++)
-            {
-                if (filesystem.block_bitmap[j] == 0)
-                {
-                    filesystem.block_bitmap[j] = 1;
-                    filesystem.superblock.free_blocks--;
-                    inode->blocks[0] = j;
-                    break;
-                }
-            }
-
-            // Инициализируем блок директории
-            if (inode->blocks[0] > 0)
-            {
-                uint8_t *block_data = filesystem.data_blocks + (inode->blocks[0] * FS_BLOCK_SIZE);
-                memset(block_data, 0, FS_BLOCK_SIZE);
-                inode->size = 0; // Пустая директория
-            }
-
-            return i;
+            refs[start]--;
+            filesystem.dedup_shared--;
+            start++;
+            length--;
+            continue;
         }
-    }
 
-    terminal_writestring("No free inodes available\n");
-    return -1;
+        uint32_t run = 1;
+        while (run < length && !(refs && refs[start + run] > 0))
+            run++;
+        fs_bitmap_fill(filesystem.block_bitmap, start, run, 0);
+        filesystem.superblock.free_blocks += run;
+        start += run;
+        length -= run;
+    }
+    fs_meta_dirty();
 }
 
-// Удаление директории
-int fs_delete_directory(const char *dirname)
+// Выделение непрерывного участка до want блоков. Порядок предпочтений:
+// продолжение последнего экстента (hint), первый участок нужной длины
+// начиная с block_hint, иначе самый длинный из найденных.
+// Возвращает начало участка, длину — в *got
+static uint32_t fs_alloc_run(uint32_t want, uint32_t hint, uint32_t *got)
 {
-    if (!filesystem.initialized || !dirname)
-        return -1;
+    uint32_t *bitmap = filesystem.block_bitmap;
+    uint32_t total = filesystem.superblock.total_blocks;
+    uint32_t best_start = 0;
+    uint32_t best_len = 0;
 
-    for (int i = 0; i < FS_MAX_FILES; i++)
+    if (hint > 0 && hint < total && !fs_bit_test(bitmap, hint))
+    {
+        best_start = hint;
+        best_len = fs_bitmap_next(bitmap, total, hint, 1) - hint;
+        if (best_len > want)
+            best_len = want;
+    }
+    else
     {
-        if (filesystem.inode_bitmap[i] &&
-            filesystem.inodes[i].type == FS_INODE_DIR &&
-            strcmp(filesystem.inodes[i].filename, dirname) == 0)
+        // Два прохода: от block_hint до конца, затем от начала до block_hint
+        uint32_t from = filesystem.block_hint < total ? filesystem.block_hint : 1;
+        for (int pass = 0; pass < 2 && best_len < want; pass++)
         {
-            fs_inode_t *inode = &filesystem.inodes[i];
-
-            // Проверяем, что директория пуста
-            if (inode->size > 0)
-            {
-                terminal_writestring("Directory not empty: ");
-                terminal_writestring(dirname);
-                terminal_writestring("\n");
-                return -1;
-            }
+            uint32_t i = pass == 0 ? from : 1;
+            uint32_t limit = pass == 0 ? total : from;
 
-            // Освобождаем блоки данных
-            for (int j = 0; j < 16 && inode->blocks[j] > 0; j++)
+            while (i < limit)
             {
-                filesystem.block_bitmap[inode->blocks[j]] = 0;
-                filesystem.superblock.free_blocks++;
-            }
+                uint32_t start = fs_bitmap_next(bitmap, limit, i, 0);
+                if (start >= limit)
+                    break;
 
-            // Освобождаем inode
-            filesystem.inode_bitmap[i] = 0;
-            filesystem.superblock.free_inodes++;
-            memset(inode, 0, sizeof(fs_inode_t));
+                uint32_t end = fs_bitmap_next(bitmap, total, start, 1);
+                uint32_t len = end - start;
+                if (len > want)
+                    len = want;
 
-            return 0;
+                if (len > best_len)
+                {
+                    best_start = start;
+                    best_len = len;
+                }
+                if (best_len == want)
+                    break;
+                i = end;
+            }
         }
     }
 
-    terminal_writestring("Directory not found: ");
-    terminal_writestring(dirname);
-    terminal_writestring("\n");
-    return -1;
+    *got = best_len;
+    if (best_len == 0)
+    {
+        return 0;
+    }
+
+    // Помечаем участок занятым и обнуляем его содержимое
+    fs_bitmap_fill(bitmap, best_start, best_len, 1);
+    filesystem.superblock.free_blocks -= best_len;
+    filesystem.block_hint = best_start + best_len;
+    fs_meta_dirty();
+    fs_zero_blocks(best_start, best_len);
+
+    return best_start;
 }
 
-// Список содержимого директории
-int fs_list_directory(const char *dirname)
+static void fs_zcache_drop(fs_inode_t *inode);
+
+// Усечение выделенного пространства до bytes байт (размер файла не меняется)
+static void fs_inode_truncate(fs_inode_t *inode, uint32_t bytes)
 {
-    if (!filesystem.initialized || !dirname)
-        return -1;
+    // Хранимые байты сжатого файла не соответствуют его смещениям, поэтому
+    // он отдаёт все блоки: усечение бывает только перед перезаписью
+    if (inode->flags & FS_INODE_F_COMPRESSED)
+    {
+        fs_zcache_drop(inode);
+        inode->flags &= ~FS_INODE_F_COMPRESSED;
+        bytes = 0;
+    }
 
-    fs_inode_t *dir_inode = fs_find_inode(dirname);
-    if (!dir_inode || dir_inode->type != FS_INODE_DIR)
+    // Встроенные данные: блоков нет, пустой файл перестаёт быть встроенным
+    if (inode->flags & FS_INODE_F_INLINE)
     {
-        terminal_writestring("Directory not found: ");
-        terminal_writestring(dirname);
-        terminal_writestring("\n");
-        return -1;
+        if (bytes == 0)
+        {
+            memset(inode->extents, 0, FS_INLINE_MAX);
+            inode->flags &= ~FS_INODE_F_INLINE;
+        }
+        return;
     }
 
-    terminal_writestring("Contents of ");
-    terminal_writestring(dirname);
-    terminal_writestring(":\n");
+    uint32_t keep = (bytes + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+    uint32_t seen = 0;
+    uint32_t new_count = 0;
 
-    if (dir_inode->blocks[0] > 0)
+    for (uint32_t i = 0; i < inode->extent_count; i++)
     {
-        uint8_t *block_data = filesystem.data_blocks + (dir_inode->blocks[0] * FS_BLOCK_SIZE);
-        fs_dir_entry_t *entries = (fs_dir_entry_t *)block_data;
+        fs_extent_t *ext = &inode->extents[i];
+        uint32_t length = ext->length;
 
-        int entry_count = dir_inode->size / sizeof(fs_dir_entry_t);
-        for (int i = 0; i < entry_count; i++)
+        if (seen >= keep)
         {
-            if (entries[i].inode_number > 0)
-            {
-                fs_inode_t *entry_inode = &filesystem.inodes[entries[i].inode_number];
-                if (entry_inode->type == FS_INODE_DIR)
-                {
-                    terminal_writestring("[DIR]  ");
-                }
-                else
-                {
-                    terminal_writestring("[FILE] ");
-                }
-                terminal_writestring(entries[i].name);
-                terminal_putchar('\n');
-            }
+            fs_free_run(ext->start, ext->length);
+        }
+        else if (seen + ext->length > keep)
+        {
+            uint32_t used = keep - seen;
+            fs_free_run(ext->start + used, ext->length - used);
+            ext->length = used;
+            new_count = i + 1;
         }
+        else
+        {
+            new_count = i + 1;
+        }
+        seen += length;
     }
 
-    if (dir_inode->size == 0)
+    for (uint32_t i = new_count; i < inode->extent_count; i++)
     {
-        terminal_writestring("(empty)\n");
+        inode->extents[i].start = 0;
+        inode->extents[i].length = 0;
+    }
+    inode->extent_count = new_count;
+}
+
+static int fs_inode_reserve(fs_inode_t *inode, uint32_t bytes);
+static uint32_t fs_inode_copy(fs_inode_t *inode, uint32_t offset, uint8_t *buf, uint32_t size, int to_inode);
+
+// Перенос встроенных данных в блоки, когда файл перерастает inode
+static int fs_inode_uninline(fs_inode_t *inode, uint32_t bytes)
+{
+    uint8_t data[FS_INLINE_MAX];
+    memcpy(data, inode->extents, FS_INLINE_MAX);
+    memset(inode->extents, 0, FS_INLINE_MAX);
+    inode->flags &= ~FS_INODE_F_INLINE;
+
+    if (fs_inode_reserve(inode, bytes) < 0)
+    {
+        memcpy(inode->extents, data, FS_INLINE_MAX);
+        inode->flags |= FS_INODE_F_INLINE;
+        return -1;
     }
 
+    fs_inode_copy(inode, 0, data, inode->size, 1);
     return 0;
 }
 
-// Поиск inode в директории
-fs_inode_t *fs_find_inode_in_dir(uint32_t parent_inode, const char *name)
+// Выделение места под bytes байт. Файл без блоков до FS_INLINE_MAX байт
+// хранится в самом inode. Новые блоки по возможности продолжают последний
+// экстент, иначе добавляется новый экстент
+static int fs_inode_reserve(fs_inode_t *inode, uint32_t bytes)
 {
-    if (!filesystem.initialized || parent_inode >= FS_MAX_FILES || !name)
-        return NULL;
-
-    fs_inode_t *parent = &filesystem.inodes[parent_inode];
-    if (parent->type != FS_INODE_DIR || !parent->blocks[0])
-        return NULL;
+    if (inode->flags & FS_INODE_F_INLINE)
+        return bytes <= FS_INLINE_MAX ? 0 : fs_inode_uninline(inode, bytes);
+    if (inode->type == FS_INODE_FILE && inode->extent_count == 0 && bytes > 0 && bytes <= FS_INLINE_MAX)
+    {
+        inode->flags |= FS_INODE_F_INLINE;
+        return 0;
+    }
 
-    uint8_t *block_data = filesystem.data_blocks + (parent->blocks[0] * FS_BLOCK_SIZE);
-    fs_dir_entry_t *entries = (fs_dir_entry_t *)block_data;
+    uint32_t need = (bytes + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+    uint32_t have = fs_inode_block_count(inode);
+    uint32_t old_have = have;
 
-    int entry_count = parent->size / sizeof(fs_dir_entry_t);
-    for (int i = 0; i < entry_count; i++)
+    while (have < need)
     {
-        if (entries[i].inode_number > 0 && strcmp(entries[i].name, name) == 0)
+        fs_extent_t *last = NULL;
+        uint32_t hint = 0;
+        if (inode->extent_count > 0)
         {
-            return &filesystem.inodes[entries[i].inode_number];
+            last = &inode->extents[inode->extent_count - 1];
+            hint = last->start + last->length;
         }
+
+        uint32_t got;
+        uint32_t start = fs_alloc_run(need - have, hint, &got);
+        if (got == 0)
+        {
+            terminal_writestring("No free blocks available\n");
+            fs_inode_truncate(inode, old_have * FS_BLOCK_SIZE);
+            return -1;
+        }
+
+        if (last && start == hint)
+        {
+            last->length += got; // Дописывание продолжает последний экстент
+        }
+        else if (inode->extent_count < FS_MAX_EXTENTS)
+        {
+            inode->extents[inode->extent_count].start = start;
+            inode->extents[inode->extent_count].length = got;
+            inode->extent_count++;
+        }
+        else
+        {
+            terminal_writestring("File too fragmented: no free extents\n");
+            fs_free_run(start, got);
+            fs_inode_truncate(inode, old_have * FS_BLOCK_SIZE);
+            return -1;
+        }
+
+        have += got;
     }
 
-    return NULL;
+    return 0;
 }
 
-// Добавление записи в директорию
-int fs_add_entry_to_dir(uint32_t parent_inode, uint32_t child_inode, const char *name, uint8_t type)
+// Участок хранимых байт файла в экстентах с позиции offset: указатель прямо
+// в блоки хранения и длина до конца экстента (не больше size). У тома на
+// устройстве участок лежит в буфере кэша и не длиннее его; буфер закреплён
+// до fs_span_put. write — участок будет перезаписан (буфер помечается
+// изменённым). 0 — offset за пределами выделенных блоков
+static uint32_t fs_extent_span(fs_inode_t *inode, uint32_t offset, uint32_t size, uint8_t **data, int write)
 {
-    if (!filesystem.initialized || parent_inode >= FS_MAX_FILES || child_inode >= FS_MAX_FILES || !name)
-        return -1;
-
-    fs_inode_t *parent = &filesystem.inodes[parent_inode];
-    if (parent->type != FS_INODE_DIR || !parent->blocks[0])
-        return -1;
-
-    uint8_t *block_data = filesystem.data_blocks + (parent->blocks[0] * FS_BLOCK_SIZE);
-    fs_dir_entry_t *entries = (fs_dir_entry_t *)block_data;
+    uint32_t ext_offset = 0; // Смещение начала текущего экстента в файле
 
-    // Ищем свободную запись
-    int entry_count = parent->size / sizeof(fs_dir_entry_t);
-    for (int i = 0; i < FS_MAX_DIR_ENTRIES; i++)
+    for (uint32_t i = 0; i < inode->extent_count; i++)
     {
-        if (i >= entry_count || entries[i].inode_number == 0)
+        uint32_t ext_bytes = inode->extents[i].length * FS_BLOCK_SIZE;
+
+        if (offset < ext_offset + ext_bytes)
         {
-            entries[i].inode_number = child_inode;
-            strncpy(entries[i].name, name, FS_MAX_FILENAME - 1);
-            entries[i].name[FS_MAX_FILENAME - 1] = '\0';
-            entries[i].type = type;
+            uint32_t within = offset - ext_offset;
+            uint32_t chunk = ext_bytes - within;
+            if (chunk > size)
+                chunk = size;
 
-            if (i >= entry_count)
+            if (!filesystem.device)
             {
-                parent->size += sizeof(fs_dir_entry_t);
+                *data = filesystem.data_blocks + inode->extents[i].start * FS_BLOCK_SIZE + within;
+                return chunk;
             }
 
-            parent->modified_time = fs_time_counter++;
-            return 0;
+            // Перезапись буфера целиком не требует чтения блока с устройства
+            uint32_t offset_in_buf;
+            uint32_t block = inode->extents[i].start + within / FS_BLOCK_SIZE;
+            uint32_t whole = write && (filesystem.superblock.data_start + block) % BCACHE_BLOCK_SECTORS == 0 &&
+                             within % FS_BLOCK_SIZE == 0 && chunk >= BCACHE_BLOCK_SIZE;
+            bcache_buf_t *buf = fs_block_buffer(block, &offset_in_buf, !whole);
+            if (!buf)
+                return 0;
+
+            offset_in_buf += within % FS_BLOCK_SIZE;
+            if (chunk > BCACHE_BLOCK_SIZE - offset_in_buf)
+                chunk = BCACHE_BLOCK_SIZE - offset_in_buf;
+            if (write && !whole)
+                bcache_mark_dirty(buf); // Перезаписываемый целиком — в fs_span_written
+            *data = buf->data + offset_in_buf;
+            return chunk;
         }
-    }
 
-    return -1; // Директория полна
+        ext_offset += ext_bytes;
+    }
+    return 0;
 }
 
-// Удаление записи из директории
-int fs_remove_entry_from_dir(uint32_t parent_inode, const char *name)
+// Освобождение участка, полученного fs_inode_span (встроенные данные
+// лежат в образе метаданных, распакованные — в кэше групп)
+static inline void fs_span_put(uint8_t *data)
 {
-    if (!filesystem.initialized || parent_inode >= FS_MAX_FILES || !name)
-        return -1;
-
-    fs_inode_t *parent = &filesystem.inodes[parent_inode];
-    if (parent->type != FS_INODE_DIR || !parent->blocks[0])
-        return -1;
-
-    uint8_t *block_data = filesystem.data_blocks + (parent->blocks[0] * FS_BLOCK_SIZE);
-    fs_dir_entry_t *entries = (fs_dir_entry_t *)block_data;
+    if (data >= fs_zcache_data[0] && data < fs_zcache_data[FS_ZCACHE_SLOTS])
+        filesystem.zcache[(data - fs_zcache_data[0]) / FS_COMP_GROUP].refcount--;
+    else if (filesystem.device && !fs_in_image(data))
+        bcache_put(bcache_buf_of(data));
+}
 
-    int entry_count = parent->size / sizeof(fs_dir_entry_t);
-    for (int i = 0; i < entry_count; i++)
+// Запись written байт в участок записи длиной chunk завершена. Буфер кэша,
+// полученный без чтения с устройства (перезапись целиком), становится
+// изменённым только заполненным полностью: иначе в нём остались бы байты,
+// не принадлежащие блоку, и fs_span_put отбрасывает его вместе с
+// записанным. Возвращает число принятых байт
+static int fs_span_written(uint8_t *data, int written, uint32_t chunk)
+{
+    // Группа сжатого файла: запоминаем, докуда она записана
+    if (data >= fs_zcache_data[0] && data < fs_zcache_data[FS_ZCACHE_SLOTS])
     {
-        if (entries[i].inode_number > 0 && strcmp(entries[i].name, name) == 0)
-        {
-            entries[i].inode_number = 0;
-            memset(entries[i].name, 0, FS_MAX_FILENAME);
-            entries[i].type = 0;
-            parent->modified_time = fs_time_counter++;
-            return 0;
-        }
+        fs_zslot_t *slot = &filesystem.zcache[(data - fs_zcache_data[0]) / FS_COMP_GROUP];
+        uint32_t end = (data - fs_zcache_data[0]) % FS_COMP_GROUP + (written > 0 ? written : 0);
+        if (end > slot->length)
+            slot->length = end;
+        return written;
     }
+    if (!filesystem.device || fs_in_image(data))
+        return written;
 
-    return -1; // Запись не найдена
+    bcache_buf_t *buf = bcache_buf_of(data);
+    if (buf->flags & BCACHE_VALID)
+        return written; // Помечен изменённым при получении участка
+    if (written != (int)chunk)
+        return written < 0 ? written : 0;
+    bcache_mark_dirty(buf);
+    return written;
 }
 
-// === ФУНКЦИИ ДЛЯ УПРАВЛЕНИЯ ПАМЯТЬЮ ПРОЦЕССОВ ===
+// === СЖАТЫЕ ФАЙЛЫ ===
 
-// Создание Page Directory для процесса
-uint32_t create_process_page_directory(void)
-{
-    // Выделяем память для Page Directory
-    uint32_t page_dir_addr = (uint32_t)kmalloc(PAGE_DIRECTORY_SIZE);
-    if (!page_dir_addr)
-        return 0;
+// Файл с флагом FS_INODE_F_COMPRESS сжимается группами по FS_COMP_GROUP
+// байт (формат в fs_format.h), когда закрывается последняя ссылка на
+// изменённый файл. Чтение распаковывает группу в кэш распакованных групп и
+// отдаёт участки прямо из него. Запись меняет только затронутые группы в
+// том же кэше; изменённые группы сжимаются при упаковке (последнее
+// закрытие, fs_sync или нехватка слотов), остальные переносятся в новое
+// представление как хранились, без распаковки
 
-    page_directory_t *new_page_dir = (page_directory_t *)page_dir_addr;
+// Кодек LZ4 (блочный формат): поиск совпадений по хешу 4 байт, без
+// энтропийного кодирования. Последние 5 байт — всегда литералы, совпадение
+// начинается не ближе 12 байт к концу (как у эталонного LZ4)
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_LIMIT 12
 
-    // Инициализируем все записи как несуществующие
-    for (int i = 0; i < PAGE_ENTRIES; i++)
-    {
-        new_page_dir->entries[i] = 0;
-    }
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
 
-    // Копируем первые 768 записей из ядра (первые 3GB - пространство ядра)
-    for (int i = 0; i < 768; i++)
+// Длина в продолжающих байтах после поля токена (len >= 15)
+static int lz_put_length(uint8_t *dst, uint32_t capacity, uint32_t *op, uint32_t len)
+{
+    for (len -= 15;; len -= 255)
     {
-        new_page_dir->entries[i] = page_directory->entries[i];
+        if (*op >= capacity)
+            return -1;
+        dst[(*op)++] = len < 255 ? len : 255;
+        if (len < 255)
+            return 0;
     }
+}
+
+// Последовательность: literals байт литералов, затем совпадение длины
+// match на offset назад (match == 0 — последняя последовательность)
+static int lz_emit(uint8_t *dst, uint32_t capacity, uint32_t *op, const uint8_t *literals, uint32_t count,
+                   uint32_t offset, uint32_t match)
+{
+    if (*op >= capacity)
+        return -1;
+    uint32_t match_code = match ? match - LZ_MIN_MATCH : 0;
+    dst[(*op)++] = ((count < 15 ? count : 15) << 4) | (match_code < 15 ? match_code : 15);
 
-    // Последние 256 записей (1GB пользовательского пространства) оставляем пустыми
-    // Они будут заполняться по мере необходимости
+    if (count >= 15 && lz_put_length(dst, capacity, op, count) < 0)
+        return -1;
+    if (count > capacity - *op)
+        return -1;
+    memcpy(dst + *op, literals, count);
+    *op += count;
 
-    return page_dir_addr;
+    if (match == 0)
+        return 0;
+    if (capacity - *op < 2)
+        return -1;
+    dst[(*op)++] = offset & 0xFF;
+    dst[(*op)++] = offset >> 8;
+    if (match_code >= 15 && lz_put_length(dst, capacity, op, match_code) < 0)
+        return -1;
+    return 0;
 }
 
-// Уничтожение Page Directory процесса
-void destroy_process_page_directory(uint32_t page_dir)
+// Сжатие size байт (не больше FS_COMP_GROUP) в dst. Возвращает длину
+// сжатых данных, 0 — не уместились в capacity
+static uint32_t lz_compress(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t capacity)
 {
-    if (!page_dir)
-        return;
+    static uint16_t table[1 << LZ_HASH_BITS]; // Последняя позиция + 1 для хеша
+    memset(table, 0, sizeof(table));
 
-    page_directory_t *dir = (page_directory_t *)page_dir;
+    uint32_t ip = 0;
+    uint32_t anchor = 0;
+    uint32_t op = 0;
 
-    // Освобождаем Page Tables для пользовательского пространства (последние 256 записей)
-    for (int i = 768; i < PAGE_ENTRIES; i++)
+    while (size >= LZ_MATCH_LIMIT + 1 && ip < size - LZ_MATCH_LIMIT)
     {
-        if (dir->entries[i] & PAGE_PRESENT)
+        uint32_t sequence = lz_read32(src + ip);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        uint32_t ref = table[hash];
+        table[hash] = ip + 1;
+
+        if (ref == 0 || lz_read32(src + ref - 1) != sequence)
         {
-            uint32_t page_table_addr = dir->entries[i] & 0xFFFFF000;
-            kfree((void *)page_table_addr);
+            ip++;
+            continue;
         }
-    }
 
-    // Освобождаем сам Page Directory
-    kfree((void *)page_dir);
-}
+        ref--;
+        uint32_t len = LZ_MIN_MATCH;
+        while (ip + len < size - LZ_LAST_LITERALS && src[ref + len] == src[ip + len])
+            len++;
 
-// Переключение на Page Directory процесса
-void switch_to_process_page_directory(uint32_t page_dir)
-{
-    if (!page_dir)
-        return;
+        if (lz_emit(dst, capacity, &op, src + anchor, ip - anchor, ip - ref, len) < 0)
+            return 0;
+        ip += len;
+        anchor = ip;
+    }
 
-    // Загружаем новый Page Directory в CR3
-    asm volatile("mov %0, %%cr3" : : "r"(page_dir));
+    if (lz_emit(dst, capacity, &op, src + anchor, size - anchor, 0, 0) < 0)
+        return 0;
+    return op;
 }
 
-// Отображение памяти для процесса
-int map_memory_for_process(task_t *task, uint32_t virtual_addr, uint32_t physical_addr, uint32_t size, int flags)
+// Распаковка ровно capacity байт. -1 — данные повреждены
+static int lz_decompress(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t capacity)
 {
-    (void)flags;
-    if (!task || !task->process.page_directory)
-        return -1;
-
-    page_directory_t *page_dir = (page_directory_t *)task->process.page_directory;
-
-    // Выравниваем адреса по границе страницы
-    virtual_addr = virtual_addr & 0xFFFFF000;
-    physical_addr = physical_addr & 0xFFFFF000;
-    size = (size + PAGE_SIZE - 1) & 0xFFFFF000;
+    uint32_t ip = 0;
+    uint32_t op = 0;
 
-    for (uint32_t addr = virtual_addr; addr < virtual_addr + size; addr += PAGE_SIZE, physical_addr += PAGE_SIZE)
+    while (ip < size)
     {
-        uint32_t page_dir_index = addr >> 22;
-        uint32_t page_table_index = (addr >> 12) & 0x3FF;
-
-        // Проверяем, что адрес в пользовательском пространстве
-        if (page_dir_index < 768)
+        uint32_t token = src[ip++];
+        uint32_t count = token >> 4;
+        if (count == 15)
+        {
+            uint32_t byte;
+            do
+            {
+                if (ip >= size)
+                    return -1;
+                byte = src[ip++];
+                count += byte;
+            } while (byte == 255);
+        }
+        if (count > size - ip || count > capacity - op)
             return -1;
+        memcpy(dst + op, src + ip, count);
+        ip += count;
+        op += count;
+        if (ip == size)
+            break; // Последняя последовательность — только литералы
 
-        // Создаем Page Table если нужно
-        if (!(page_dir->entries[page_dir_index] & PAGE_PRESENT))
+        if (size - ip < 2)
+            return -1;
+        uint32_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        uint32_t len = (token & 15) + LZ_MIN_MATCH;
+        if ((token & 15) == 15)
         {
-            uint32_t page_table_addr = (uint32_t)kmalloc(PAGE_TABLE_SIZE);
-            if (!page_table_addr)
-                return -1;
-
-            page_table_t *page_table = (page_table_t *)page_table_addr;
-            memset(page_table, 0, PAGE_TABLE_SIZE);
-
-            // Устанавливаем запись в Page Directory
-            page_dir->entries[page_dir_index] = page_table_addr | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+            uint32_t byte;
+            do
+            {
+                if (ip >= size)
+                    return -1;
+                byte = src[ip++];
+                len += byte;
+            } while (byte == 255);
         }
+        if (offset == 0 || offset > op || len > capacity - op)
+            return -1;
 
-        // Получаем адрес Page Table
-        uint32_t page_table_addr = page_dir->entries[page_dir_index] & 0xFFFFF000;
-        page_table_t *page_table = (page_table_t *)page_table_addr;
-
-        // Устанавливаем запись в Page Table
-        page_table->entries[page_table_index] = physical_addr | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+        // Совпадение может перекрывать само себя — копируем побайтно
+        for (uint32_t i = 0; i < len; i++)
+            dst[op + i] = dst[op - offset + i];
+        op += len;
     }
+    return op == capacity ? (int)op : -1;
+}
 
-    return 0;
+// Групп в файле из size байт
+static inline uint32_t fs_comp_groups(uint32_t size)
+{
+    return (size + FS_COMP_GROUP - 1) / FS_COMP_GROUP;
 }
 
-// Отмена отображения памяти для процесса
-int unmap_memory_for_process(task_t *task, uint32_t virtual_addr, uint32_t size)
+// Логическая длина группы group
+static inline uint32_t fs_comp_group_size(fs_inode_t *inode, uint32_t group)
 {
-    if (!task || !task->process.page_directory)
-        return -1;
-
-    page_directory_t *page_dir = (page_directory_t *)task->process.page_directory;
-
-    // Выравниваем адреса по границе страницы
-    virtual_addr = virtual_addr & 0xFFFFF000;
-    size = (size + PAGE_SIZE - 1) & 0xFFFFF000;
+    uint32_t left = inode->size - group * FS_COMP_GROUP;
+    return left < FS_COMP_GROUP ? left : FS_COMP_GROUP;
+}
 
-    for (uint32_t addr = virtual_addr; addr < virtual_addr + size; addr += PAGE_SIZE)
+// Чтение хранимых байт файла (у сжатого — таблица и группы как есть).
+// -1 — прочитано не всё (ошибка чтения блока)
+static int fs_extent_read(fs_inode_t *inode, uint32_t offset, void *buffer, uint32_t size)
+{
+    uint8_t *buf = (uint8_t *)buffer;
+    while (size > 0)
     {
-        uint32_t page_dir_index = addr >> 22;
-        uint32_t page_table_index = (addr >> 12) & 0x3FF;
-
-        // Проверяем, что адрес в пользовательском пространстве
-        if (page_dir_index < 768)
+        uint8_t *data;
+        uint32_t chunk = fs_extent_span(inode, offset, size, &data, 0);
+        if (chunk == 0)
             return -1;
-
-        if (page_dir->entries[page_dir_index] & PAGE_PRESENT)
-        {
-            uint32_t page_table_addr = page_dir->entries[page_dir_index] & 0xFFFFF000;
-            page_table_t *page_table = (page_table_t *)page_table_addr;
-
-            // Очищаем запись в Page Table
-            page_table->entries[page_table_index] = 0;
-        }
+        memcpy(buf, data, chunk);
+        fs_span_put(data);
+        buf += chunk;
+        offset += chunk;
+        size -= chunk;
     }
-
     return 0;
 }
 
-// ===== GUARD PAGES ДЛЯ СТЕКА =====
-#define GUARD_PAGE_SIZE PAGE_SIZE
+// Размер файла, которому соответствует сжатое представление в блоках: пока
+// у файла есть изменённые группы, inode->size может включать дописанное
+static uint32_t fs_comp_stored_size(fs_inode_t *inode)
+{
+    for (int i = 0; i < FS_ZCACHE_SLOTS; i++)
+    {
+        if (filesystem.zcache[i].inode == inode && filesystem.zcache[i].dirty)
+            return filesystem.zcache[i].base_size;
+    }
+    return inode->size;
+}
 
-// Выделение памяти для процесса с guard pages
-void *allocate_memory_for_process(task_t *task, uint32_t size)
+// Границы группы group в хранимых байтах после таблицы: [*start, *end)
+static int fs_comp_bounds(fs_inode_t *inode, uint32_t group, uint32_t *start, uint32_t *end)
 {
-    if (!task || size == 0)
-        return NULL;
+    *start = 0;
+    if (group > 0 && fs_extent_read(inode, (group - 1) * 4, start, 4) < 0)
+        return -1;
+    return fs_extent_read(inode, group * 4, end, 4);
+}
 
-    // Выравниваем размер по границе страницы
-    size = (size + PAGE_SIZE - 1) & 0xFFFFF000;
+// Распаковка группы сжатого файла в out (FS_COMP_GROUP байт). Байты за
+// концом хранимой группы и группы за концом хранимых данных — нули
+static int fs_comp_load(fs_inode_t *inode, uint32_t group, uint8_t *out)
+{
+    static uint8_t packed[FS_COMP_GROUP];
+    uint32_t stored_size = fs_comp_stored_size(inode);
+    uint32_t groups = fs_comp_groups(stored_size);
+    memset(out, 0, FS_COMP_GROUP);
+    if (group >= groups)
+        return 0;
 
-    // Проверяем лимит памяти (учитываем guard pages)
-    if (task->process.memory_used + size + GUARD_PAGE_SIZE > task->process.memory_limit)
+    uint32_t start, end;
+    if (fs_comp_bounds(inode, group, &start, &end) < 0)
+        return -1;
+
+    uint32_t left = stored_size - group * FS_COMP_GROUP;
+    uint32_t size = left < FS_COMP_GROUP ? left : FS_COMP_GROUP;
+    uint32_t stored = end - start;
+    if (end < start || stored > size)
+        return -1;
+    if (stored == size)
+        return fs_extent_read(inode, groups * 4 + start, out, size);
+
+    if (fs_extent_read(inode, groups * 4 + start, packed, stored) < 0)
+        return -1;
+    return lz_decompress(packed, stored, out, size) < 0 ? -1 : 0;
+}
+
+static int fs_comp_pack(fs_inode_t *inode);
+
+// Кэш распакованных групп: слот закрепляется участком fs_inode_span до
+// fs_span_put, вытесняется давно не использованный незакреплённый слот.
+// Изменённые слоты не вытесняются: если свободных нет, файл давно
+// изменённого слота упаковывается, и его слоты освобождаются
+static fs_zslot_t *fs_zcache_get(fs_inode_t *inode, uint32_t group)
+{
+    fs_zslot_t *victim = NULL;
+    fs_zslot_t *oldest_dirty = NULL;
+    for (int i = 0; i < FS_ZCACHE_SLOTS; i++)
     {
-        return NULL;
+        fs_zslot_t *slot = &filesystem.zcache[i];
+        if (slot->inode == inode && slot->group == group)
+        {
+            filesystem.zcache_hits++;
+            slot->last_used = ++filesystem.zcache_clock;
+            return slot;
+        }
+        if (slot->refcount != 0)
+            continue;
+        if (slot->dirty)
+        {
+            if (!oldest_dirty || slot->last_used < oldest_dirty->last_used)
+                oldest_dirty = slot;
+        }
+        else if (!victim || !slot->inode || (victim->inode && slot->last_used < victim->last_used))
+            victim = slot;
     }
-
-    // Выделяем физическую память
-    void *physical_mem = kmalloc(size);
-    if (!physical_mem)
+    if (!victim && oldest_dirty)
+    {
+        if (fs_comp_pack(oldest_dirty->inode) < 0)
+            return NULL;
+        victim = oldest_dirty; // Упаковка освободила слоты файла
+    }
+    if (!victim)
         return NULL;
 
-    // Находим свободный виртуальный адрес в пользовательском пространстве
-    uint32_t virtual_addr = USER_SPACE_BASE + 0x1000; // Начинаем с 0xC0001000
-    // В реальной системе здесь был бы более сложный алгоритм поиска свободного адреса
-
-    // Отображаем основную память
-    if (map_memory_for_process(task, virtual_addr, (uint32_t)physical_mem, size, PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER) < 0)
+    filesystem.zcache_misses++;
+    victim->inode = NULL;
+    if (fs_comp_load(inode, group, fs_zcache_data[victim - filesystem.zcache]) < 0)
     {
-        kfree(physical_mem);
+        terminal_writestring("Corrupted compressed file: ");
+        terminal_writestring(inode->filename);
+        terminal_writestring("\n");
         return NULL;
     }
-
-    // Добавляем guard page после выделенной области (без маппинга)
-    // Следующая страница после virtual_addr+size остается неотображенной
-    // Это защищает от переполнения буфера
-
-    task->process.memory_used += size + GUARD_PAGE_SIZE;
-    return (void *)virtual_addr;
+    victim->inode = inode;
+    victim->group = group;
+    victim->last_used = ++filesystem.zcache_clock;
+    return victim;
 }
 
-// Освобождение памяти процесса
-void free_memory_for_process(task_t *task, void *ptr, uint32_t size)
+// Группы файла больше не действительны (файл распакован, пересжат или удалён)
+static void fs_zcache_drop(fs_inode_t *inode)
 {
-    if (!task || !ptr)
-        return;
-
-    // Выравниваем размер по границе страницы
-    size = (size + PAGE_SIZE - 1) & 0xFFFFF000;
+    for (int i = 0; i < FS_ZCACHE_SLOTS; i++)
+    {
+        if (filesystem.zcache[i].inode == inode)
+        {
+            filesystem.zcache[i].inode = NULL;
+            filesystem.zcache[i].dirty = 0;
+        }
+    }
+}
 
-    // Отменяем отображение
-    unmap_memory_for_process(task, (uint32_t)ptr, size);
+// Участок сжатого файла: распакованная группа в кэше, до конца группы.
+// Участок записи может лежать за концом файла и помечает группу изменённой
+static uint32_t fs_zcache_span(fs_inode_t *inode, uint32_t offset, uint32_t size, uint8_t **data, int write)
+{
+    if (offset >= inode->size && !write)
+        return 0;
 
-    // Освобождаем физическую память
-    // В реальной системе нужно найти физический адрес по виртуальному
-    // Здесь упрощенная реализация
-    kfree(ptr);
+    uint32_t group = offset / FS_COMP_GROUP;
+    fs_zslot_t *slot = fs_zcache_get(inode, group);
+    if (!slot)
+        return 0;
 
-    if (task->process.memory_used >= size)
+    uint32_t within = offset % FS_COMP_GROUP;
+    uint32_t chunk = write ? FS_COMP_GROUP - within : fs_comp_group_size(inode, group) - within;
+    if (write && !slot->dirty)
     {
-        task->process.memory_used -= size;
+        slot->base_size = fs_comp_stored_size(inode);
+        slot->length = 0;
+        slot->dirty = 1;
     }
+    slot->refcount++;
+    *data = fs_zcache_data[slot - filesystem.zcache] + within;
+    return chunk < size ? chunk : size;
 }
 
-// === УПРАВЛЕНИЕ ПРОЦЕССАМИ ===
+static int fs_inode_read(fs_inode_t *inode, uint32_t offset, void *buffer, uint32_t size);
+static int fs_inode_write(fs_inode_t *inode, uint32_t offset, const void *data, uint32_t size);
 
-void init_process_management(void)
+// Перенос экстентов собранного временного inode в файл вместо его блоков
+static void fs_inode_adopt(fs_inode_t *inode, fs_inode_t *temp, uint32_t flags)
 {
-    terminal_writestring("Process management initialized\n");
+    fs_inode_truncate(inode, 0);
+    memcpy(inode->extents, temp->extents, sizeof(inode->extents));
+    inode->extent_count = temp->extent_count;
+    inode->flags = (inode->flags & ~FS_INODE_F_COMPRESSED) | flags;
+    fs_meta_dirty();
 }
 
-// Создание нового процесса (fork)
-task_t *fork_process(task_t *parent)
+// Сжатие данных файла. Сжатое представление собирается в новых блоках и
+// заменяет старые, только если занимает меньше блоков. Возвращает 1 — файл
+// сжат, 0 — оставлен как есть, -1 — не хватило места
+static int fs_inode_compress(fs_inode_t *inode)
 {
-    if (!parent)
-        return NULL;
+    static uint8_t plain[FS_COMP_GROUP];
+    static uint8_t packed[FS_COMP_GROUP];
 
-    // Создаем новую задачу
-    task_t *child = (task_t *)kmalloc(sizeof(task_t));
-    if (!child)
-        return NULL;
+    if (inode->type != FS_INODE_FILE || inode->size <= FS_BLOCK_SIZE ||
+        (inode->flags & (FS_INODE_F_MEMORY | FS_INODE_F_INLINE | FS_INODE_F_COMPRESSED)))
+        return 0;
 
-    // Копируем структуру задачи
-    memcpy(child, parent, sizeof(task_t));
+    uint32_t groups = fs_comp_groups(inode->size);
+    uint32_t *ends = (uint32_t *)kmalloc(groups * 4);
+    if (!ends)
+        return -1;
 
-    // Устанавливаем новые ID
-    child->id = next_task_id++;
-    child->process.pid = child->id;
-    child->process.ppid = parent->process.pid;
+    // Временный inode без типа: он не становится встроенным
+    fs_inode_t temp;
+    memset(&temp, 0, sizeof(temp));
+    uint32_t limit = fs_inode_block_count(inode) * FS_BLOCK_SIZE;
+    uint32_t stored = 0;
+    int result = 1;
 
-    // Создаем новый стек
-    child->stack = (uint32_t *)kmalloc(TASK_STACK_SIZE);
-    if (!child->stack)
+    for (uint32_t group = 0; group < groups && result > 0; group++)
     {
-        kfree(child);
-        return NULL;
-    }
-
-    // Копируем содержимое стека
-    memcpy(child->stack, parent->stack, TASK_STACK_SIZE);
-
-    // Обновляем указатель на стек в регистрах
-    child->regs.esp = (uint32_t)child->stack + TASK_STACK_SIZE - 4;
+        uint32_t size = fs_comp_group_size(inode, group);
+        if (fs_inode_read(inode, group * FS_COMP_GROUP, plain, size) < 0)
+        {
+            result = -1;
+            break;
+        }
 
-    // Сбрасываем состояние
-    child->state = TASK_STATE_READY;
-    child->time_slice = 10;
+        uint32_t packed_size = lz_compress(plain, size, packed, size - 1);
+        const uint8_t *bytes = packed_size ? packed : plain;
+        uint32_t count = packed_size ? packed_size : size;
 
-    // Добавляем в список задач
-    child->next = task_list;
-    task_list = child;
+        // Не экономит ни одного блока — сжимать не стоит
+        if (groups * 4 + stored + count > limit - FS_BLOCK_SIZE)
+            result = 0;
+        else if (fs_inode_write(&temp, groups * 4 + stored, bytes, count) < 0)
+            result = -1;
+        stored += count;
+        ends[group] = stored;
+    }
 
-    terminal_writestring("Process forked: PID ");
-    print_number(child->process.pid);
-    terminal_writestring("\n");
+    if (result > 0 && fs_inode_write(&temp, 0, ends, groups * 4) < 0)
+        result = -1;
+    kfree(ends);
 
-    return child;
+    if (result <= 0)
+    {
+        fs_inode_truncate(&temp, 0);
+        return result;
+    }
+    fs_inode_adopt(inode, &temp, FS_INODE_F_COMPRESSED);
+    return 1;
 }
 
-// Выполнение программы (exec)
-int exec_process(const char *filename, char **argv)
+// Упаковка изменённых групп сжатого файла: представление собирается
+// заново в новых блоках. Сжимаются только изменённые группы (и выросшая
+// последняя), остальные переносятся как хранились. 0 — готово или нечего
+// упаковывать, -1 — не хватило места (изменения остаются в кэше)
+static int fs_comp_pack(fs_inode_t *inode)
 {
-    (void)argv;
-    if (!current_task || !filename)
-        return -1;
-
-    // Загружаем ELF файл
-    uint8_t *elf_data;
-    uint32_t elf_size;
+    static uint8_t plain[FS_COMP_GROUP];
+    static uint8_t packed[FS_COMP_GROUP];
 
-    if (!load_elf_from_file(filename, &elf_data, &elf_size))
+    // Новый размер — с записанным за концом файла, если запись ещё идёт
+    fs_zslot_t *dirty[FS_ZCACHE_SLOTS] = {0};
+    uint32_t size = inode->size;
+    int changed = 0;
+    for (int i = 0; i < FS_ZCACHE_SLOTS; i++)
     {
-        return -1;
+        fs_zslot_t *slot = &filesystem.zcache[i];
+        if (slot->inode != inode || !slot->dirty)
+            continue;
+        changed = 1;
+        if (slot->group * FS_COMP_GROUP + slot->length > size)
+            size = slot->group * FS_COMP_GROUP + slot->length;
     }
+    if (!changed)
+        return 0;
 
-    // Очищаем старый ELF загрузчик
-    if (current_task->elf_loader)
+    uint32_t old_size = fs_comp_stored_size(inode);
+    uint32_t old_groups = fs_comp_groups(old_size);
+    uint32_t groups = fs_comp_groups(size);
+    uint32_t *ends = (uint32_t *)kmalloc(groups * 4);
+    if (!ends)
+        return -1;
+    for (int i = 0; i < FS_ZCACHE_SLOTS; i++)
     {
-        elf_cleanup(current_task->elf_loader);
-        kfree(current_task->elf_loader);
+        fs_zslot_t *slot = &filesystem.zcache[i];
+        if (slot->inode == inode && slot->dirty && slot->group < groups)
+            dirty[i] = slot;
     }
 
-    // Создаем новый ELF загрузчик
-    current_task->elf_loader = (elf_loader_t *)kmalloc(sizeof(elf_loader_t));
-    if (!current_task->elf_loader)
-    {
-        kfree(elf_data);
-        return -1;
-    }
+    fs_inode_t temp;
+    memset(&temp, 0, sizeof(temp));
+    uint32_t stored = 0;
+    int result = 0;
 
-    // Парсим и загружаем новую программу
-    if (!elf_parse(current_task->elf_loader, elf_data, elf_size))
+    for (uint32_t group = 0; group < groups && result == 0; group++)
     {
-        kfree(current_task->elf_loader);
-        kfree(elf_data);
-        return -1;
+        uint32_t left = size - group * FS_COMP_GROUP;
+        uint32_t group_size = left < FS_COMP_GROUP ? left : FS_COMP_GROUP;
+        uint32_t old_left = old_size - group * FS_COMP_GROUP;
+        const uint8_t *src = NULL;
+        for (int i = 0; i < FS_ZCACHE_SLOTS && !src; i++)
+        {
+            if (dirty[i] && dirty[i]->group == group)
+                src = fs_zcache_data[i];
+        }
+
+        const uint8_t *bytes = packed;
+        uint32_t count;
+        if (!src && group < old_groups && (old_left >= FS_COMP_GROUP || old_left == group_size))
+        {
+            // Неизменённая группа — хранимые байты как есть
+            uint32_t start, end;
+            if (fs_comp_bounds(inode, group, &start, &end) < 0 || end < start || end - start > group_size ||
+                fs_extent_read(inode, old_groups * 4 + start, packed, end - start) < 0)
+            {
+                result = -1;
+                break;
+            }
+            count = end - start;
+        }
+        else
+        {
+            if (!src)
+            {
+                if (fs_comp_load(inode, group, plain) < 0)
+                {
+                    result = -1;
+                    break;
+                }
+                src = plain;
+            }
+            count = lz_compress(src, group_size, packed, group_size - 1);
+            if (count == 0)
+            {
+                bytes = src;
+                count = group_size;
+            }
+        }
+
+        if (fs_inode_write(&temp, groups * 4 + stored, bytes, count) < 0)
+            result = -1;
+        stored += count;
+        ends[group] = stored;
     }
 
-    uint32_t entry_point = elf_load_program(current_task->elf_loader);
-    if (entry_point == 0)
+    if (result == 0 && fs_inode_write(&temp, 0, ends, groups * 4) < 0)
+        result = -1;
+    kfree(ends);
+
+    if (result < 0)
     {
-        elf_cleanup(current_task->elf_loader);
-        kfree(current_task->elf_loader);
-        kfree(elf_data);
+        fs_inode_truncate(&temp, 0);
         return -1;
     }
-
-    // Обновляем имя задачи
-    strcpy(current_task->name, filename);
-
-    // Настраиваем контекст для новой программы
-    uint32_t stack_top = (uint32_t)current_task->stack + current_task->stack_size - 4;
-    create_user_task(entry_point, stack_top, current_task);
-
-    kfree(elf_data);
+    fs_inode_adopt(inode, &temp, FS_INODE_F_COMPRESSED);
+    inode->size = size;
     return 0;
 }
 
-// Ожидание завершения процесса
-int wait_process(uint32_t pid)
+// Распаковка сжатого файла обратно в обычные экстенты
+static int fs_inode_expand(fs_inode_t *inode)
 {
-    if (!current_task)
+    static uint8_t plain[FS_COMP_GROUP];
+
+    if (fs_comp_pack(inode) < 0)
         return -1;
 
-    // Ищем процесс с указанным PID
-    task_t *target = task_list;
-    while (target)
+    fs_inode_t temp;
+    memset(&temp, 0, sizeof(temp));
+    uint32_t groups = fs_comp_groups(inode->size);
+
+    for (uint32_t group = 0; group < groups; group++)
     {
-        if (target->process.pid == pid)
+        uint32_t size = fs_comp_group_size(inode, group);
+        if (fs_comp_load(inode, group, plain) < 0 || fs_inode_write(&temp, group * FS_COMP_GROUP, plain, size) < 0)
         {
-            if (target->state == TASK_STATE_DEAD)
-            {
-                // Процесс уже завершен
-                cleanup_process(target);
-                return pid;
-            }
-            else
-            {
-                // Блокируем текущий процесс до завершения целевого
-                current_task->state = TASK_STATE_BLOCKED;
-                schedule();
-                return pid;
-            }
+            fs_inode_truncate(&temp, 0);
+            return -1;
         }
-        target = target->next;
     }
 
-    return -1; // Процесс не найден
+    fs_inode_adopt(inode, &temp, 0);
+    return 0;
 }
 
-// Очистка ресурсов процесса
-void cleanup_process(task_t *task)
+// === ДЕДУПЛИКАЦИЯ ===
+
+// В ФС в памяти одинаковые блоки файлов могут быть общими. После записи
+// файла каждый его полный блок ищется по хешу содержимого в индексе
+// отпечатков, и найденный блок с тем же содержимым заменяет собственный.
+// block_refs[b] — число дополнительных ссылок на блок b: fs_free_run
+// освобождает его вместе с последней. Запись в экстент с общими блоками
+// сначала переносит экстент в собственные блоки (копирование при записи).
+// Индекс — таблица с прямой адресацией без удаления: найденный отпечаток
+// проверяется по владельцу и содержимому блока, устаревший вытесняется
+
+// Хеш содержимого блока (FNV-1a по словам)
+static uint32_t fs_block_hash(const uint8_t *data)
 {
-    if (!task)
-        return;
+    const uint32_t *words = (const uint32_t *)data;
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < FS_BLOCK_SIZE / 4; i++)
+        hash = (hash ^ words[i]) * 16777619u;
+    return hash;
+}
 
-    // Очищаем ELF загрузчик
-    if (task->elf_loader)
+// Файл, чьи блоки могут быть общими: обычные экстенты с данными
+static inline int fs_inode_shareable(fs_inode_t *inode)
+{
+    return inode->type == FS_INODE_FILE &&
+           !(inode->flags & (FS_INODE_F_MEMORY | FS_INODE_F_INLINE | FS_INODE_F_COMPRESSED));
+}
+
+// Номер блока с порядковым номером index в карте экстентов (0 — за концом)
+static uint32_t fs_extent_block(const fs_extent_t *extents, uint32_t count, uint32_t index)
+{
+    for (uint32_t i = 0; i < count; i++)
     {
-        elf_cleanup(task->elf_loader);
-        kfree(task->elf_loader);
-        task->elf_loader = NULL;
+        if (index < extents[i].length)
+            return extents[i].start + index;
+        index -= extents[i].length;
     }
+    return 0;
+}
 
-    // Очищаем стек
-    if (task->stack)
+// Отпечаток верен, пока блок принадлежит тому же файлу и не изменился
+static int fs_dedup_match(fs_fingerprint_t *entry, const uint8_t *data)
+{
+    if (entry->inode >= filesystem.inode_capacity || filesystem.block_refs[entry->block] >= FS_BLOCK_REFS_MAX)
+        return 0;
+
+    fs_inode_t *owner = fs_inode(entry->inode);
+    for (uint32_t i = 0; fs_inode_shareable(owner) && i < owner->extent_count; i++)
     {
-        kfree(task->stack);
-        task->stack = NULL;
+        if (entry->block - owner->extents[i].start < owner->extents[i].length)
+            return memcmp(filesystem.data_blocks + entry->block * FS_BLOCK_SIZE, data, FS_BLOCK_SIZE) == 0;
     }
+    return 0;
+}
 
-    // Закрываем все файловые дескрипторы
-    for (int i = 0; i < 32; i++)
+// Блок с тем же содержимым, что и block, по индексу отпечатков. Если его
+// нет, в индекс записывается block от имени файла inode_num: в свободный
+// слот группы из FS_DEDUP_WAYS, иначе вместо одного из занятых
+static uint32_t fs_dedup_lookup(uint32_t block, uint32_t inode_num)
+{
+    uint8_t *data = filesystem.data_blocks + block * FS_BLOCK_SIZE;
+    uint32_t hash = fs_block_hash(data);
+    uint32_t set = hash & (FS_DEDUP_SLOTS - FS_DEDUP_WAYS);
+    fs_fingerprint_t *victim = &fs_dedup_index[set + (hash >> 28) % FS_DEDUP_WAYS];
+
+    for (uint32_t way = 0; way < FS_DEDUP_WAYS; way++)
     {
-        if (task->process.fds[i].valid)
+        fs_fingerprint_t *entry = &fs_dedup_index[set + way];
+        if (entry->block == 0)
         {
-            free_fd(task, i);
+            victim = entry;
+            break;
         }
+        if (entry->block == block)
+        {
+            victim = entry; // Блок уже в индексе, отпечаток обновляется
+            break;
+        }
+        if (entry->hash == hash && fs_dedup_match(entry, data))
+            return entry->block;
     }
 
-    // Очищаем Page Directory процесса
-    if (task->process.page_directory)
-    {
-        destroy_process_page_directory(task->process.page_directory);
-        task->process.page_directory = 0;
-    }
-
-    terminal_writestring("Process cleaned up: PID ");
-    print_number(task->process.pid);
-    terminal_writestring("\n");
+    victim->hash = hash;
+    victim->block = block;
+    victim->inode = inode_num;
+    return block;
 }
 
-// Выделение файлового дескриптора
-int allocate_fd(task_t *task, const char *filename, int flags)
+// Замена блоков файла одинаковыми блоками из индекса. Новая карта
+// экстентов применяется, только если умещается в FS_MAX_EXTENTS.
+// Возвращает число блоков, ставших общими
+static int fs_inode_dedup(fs_inode_t *inode)
 {
-    if (!task || !filename)
-        return -1;
+    if (!filesystem.dedup || !filesystem.block_refs || !fs_inode_shareable(inode))
+        return 0;
 
-    // Ищем свободный FD
-    for (int i = 3; i < 32; i++)
-    { // Пропускаем stdin, stdout, stderr
-        if (!task->process.fds[i].valid)
+    uint32_t inode_num = inode - filesystem.inodes;
+    uint32_t blocks = fs_inode_block_count(inode);
+    uint32_t full = inode->size / FS_BLOCK_SIZE; // Неполный последний блок не делится
+    fs_extent_t extents[FS_MAX_EXTENTS];
+    uint32_t count = 0;
+    uint32_t shared = 0;
+    uint32_t index;
+
+    // Новая карта: ссылки на найденные блоки берутся сразу
+    for (index = 0; index < blocks; index++)
+    {
+        uint32_t block = fs_extent_block(inode->extents, inode->extent_count, index);
+        uint32_t target = index < full ? fs_dedup_lookup(block, inode_num) : block;
+
+        if (count > 0 && extents[count - 1].start + extents[count - 1].length == target)
         {
-            task->process.fds[i].fd = i;
-            task->process.fds[i].flags = flags;
-            task->process.fds[i].position = 0;
-            strcpy(task->process.fds[i].filename, filename);
-            task->process.fds[i].valid = 1;
-            return i;
+            extents[count - 1].length++;
+        }
+        else if (count < FS_MAX_EXTENTS)
+        {
+            extents[count].start = target;
+            extents[count].length = 1;
+            count++;
+        }
+        else
+        {
+            break;
+        }
+
+        if (target != block)
+        {
+            filesystem.block_refs[target]++;
+            filesystem.dedup_shared++;
+            shared++;
         }
     }
 
-    return -1; // Нет свободных FD
-}
+    // Карта не уместилась — взятые ссылки возвращаются, файл остаётся как есть
+    if (index < blocks)
+    {
+        for (uint32_t i = 0; i < index; i++)
+        {
+            uint32_t target = fs_extent_block(extents, count, i);
+            if (target != fs_extent_block(inode->extents, inode->extent_count, i))
+            {
+                filesystem.block_refs[target]--;
+                filesystem.dedup_shared--;
+            }
+        }
+        return 0;
+    }
 
-// Освобождение файлового дескриптора
-void free_fd(task_t *task, int fd)
-{
-    if (!task || fd < 0 || fd >= 32)
-        return;
+    if (shared == 0)
+        return 0;
 
-    if (task->process.fds[fd].valid)
+    for (index = 0; index < blocks; index++)
     {
-        memset(&task->process.fds[fd], 0, sizeof(file_descriptor_t));
+        uint32_t block = fs_extent_block(inode->extents, inode->extent_count, index);
+        if (fs_extent_block(extents, count, index) != block)
+            fs_free_run(block, 1);
     }
-}
 
-// Получение файлового дескриптора
-file_descriptor_t *get_fd(task_t *task, int fd)
-{
-    if (!task || fd < 0 || fd >= 32)
-        return NULL;
-    if (!task->process.fds[fd].valid)
-        return NULL;
-    return &task->process.fds[fd];
+    memset(inode->extents, 0, sizeof(inode->extents));
+    memcpy(inode->extents, extents, count * sizeof(fs_extent_t));
+    inode->extent_count = count;
+    return shared;
 }
 
-// === ПЛАНИРОВЩИК ЗАДАЧ ===
-
-void init_scheduler(void)
+// Копирование при записи: общие блоки, которые попадают в [offset,
+// offset + size), переносятся в собственные. Экстент делится на части
+// вокруг скопированного участка; когда свободных экстентов не хватает,
+// копируется весь экстент
+static int fs_inode_unshare(fs_inode_t *inode, uint32_t offset, uint32_t size)
 {
-    current_task = NULL;
-    task_list = NULL;
-    next_task_id = 1;
-    scheduler_ticks = 0;
-    terminal_writestring("Task scheduler initialized\n");
-}
+    uint8_t *refs = filesystem.block_refs;
+    if (!refs || size == 0 || !fs_inode_shareable(inode))
+        return 0;
 
-task_t *create_task(const char *name, void (*entry_point)(void), uint32_t priority)
-{
-    task_t *task = (task_t *)kmalloc(sizeof(task_t));
-    if (!task)
-    {
-        terminal_writestring("ERROR: Failed to allocate memory for task!\n");
-        return NULL;
-    }
+    uint32_t first = offset / FS_BLOCK_SIZE;
+    uint32_t last = (offset + size - 1) / FS_BLOCK_SIZE;
+    uint32_t index = 0; // Порядковый номер первого блока экстента в файле
 
-    // Выделяем стек для задачи
-    task->stack = (uint32_t *)kmalloc(TASK_STACK_SIZE);
-    if (!task->stack)
+    for (uint32_t i = 0; i < inode->extent_count && index <= last; i++)
     {
-        kfree(task);
-        terminal_writestring("ERROR: Failed to allocate stack for task!\n");
-        return NULL;
-    }
-
-    // Инициализируем структуру задачи
-    task->id = next_task_id++;
-    strcpy(task->name, name);
-    task->state = TASK_STATE_READY;
-    task->priority = priority;
-    task->stack_size = TASK_STACK_SIZE;
-    task->time_slice = 10; // 10 тиков
-    task->elf_loader = NULL;
-    task->next = NULL;
-
-    // Инициализируем процесс
-    task->process.pid = task->id;
-    task->process.ppid = 0; // Корневой процесс
-    task->process.uid = 0;  // root
-    task->process.gid = 0;  // root
-    strcpy(task->process.working_dir, "/");
-    task->process.next_fd = 3; // Начинаем с FD 3
-    task->process.page_directory = create_process_page_directory();
-    task->process.memory_limit = 0x100000; // 1MB лимит
-    task->process.memory_used = 0;
+        fs_extent_t ext = inode->extents[i];
+        index += ext.length;
+        if (index <= first)
+            continue;
 
-    // Инициализируем файловые дескрипторы
-    memset(task->process.fds, 0, sizeof(task->process.fds));
+        // Участок [from, to) экстента, который будет перезаписан
+        uint32_t from = first > index - ext.length ? first - (index - ext.length) : 0;
+        uint32_t to = last < index ? last - (index - ext.length) + 1 : ext.length;
+        uint32_t shared = 0;
+        for (uint32_t j = from; j < to; j++)
+            shared += refs[ext.start + j] > 0;
+        if (shared == 0)
+            continue;
 
-    // Стандартные FD
-    task->process.fds[STDIN_FILENO].fd = STDIN_FILENO;
-    task->process.fds[STDIN_FILENO].flags = O_RDONLY;
-    task->process.fds[STDIN_FILENO].valid = 1;
-    strcpy(task->process.fds[STDIN_FILENO].filename, "/dev/stdin");
+        uint32_t pieces = (from > 0) + 1 + (to < ext.length);
+        if (inode->extent_count + pieces - 1 > FS_MAX_EXTENTS)
+        {
+            from = 0;
+            to = ext.length;
+            pieces = 1;
+        }
 
-    task->process.fds[STDOUT_FILENO].fd = STDOUT_FILENO;
-    task->process.fds[STDOUT_FILENO].flags = O_WRONLY;
-    task->process.fds[STDOUT_FILENO].valid = 1;
-    strcpy(task->process.fds[STDOUT_FILENO].filename, "/dev/stdout");
+        uint32_t got;
+        uint32_t start = fs_alloc_run(to - from, 0, &got);
+        if (got < to - from)
+        {
+            terminal_writestring("No free blocks available for copy-on-write\n");
+            if (got > 0)
+                fs_free_run(start, got);
+            return -1;
+        }
 
-    task->process.fds[STDERR_FILENO].fd = STDERR_FILENO;
-    task->process.fds[STDERR_FILENO].flags = O_WRONLY;
-    task->process.fds[STDERR_FILENO].valid = 1;
-    strcpy(task->process.fds[STDERR_FILENO].filename, "/dev/stderr");
+        memcpy(filesystem.data_blocks + start * FS_BLOCK_SIZE,
+               filesystem.data_blocks + (ext.start + from) * FS_BLOCK_SIZE, (to - from) * FS_BLOCK_SIZE);
+        for (uint32_t j = from; j < to; j++)
+            filesystem.dedup_cow += refs[ext.start + j] > 0;
+        fs_free_run(ext.start + from, to - from);
+
+        // Экстент заменяется частями: до участка, копия, после участка
+        for (uint32_t k = inode->extent_count - 1; k > i; k--)
+            inode->extents[k + pieces - 1] = inode->extents[k];
+        fs_extent_t *slot = &inode->extents[i];
+        if (from > 0)
+        {
+            slot->length = from;
+            slot++;
+        }
+        slot->start = start;
+        slot->length = to - from;
+        if (to < ext.length)
+        {
+            slot[1].start = ext.start + to;
+            slot[1].length = ext.length - to;
+        }
+        inode->extent_count += pieces - 1;
+        i += pieces - 1;
+    }
+    return 0;
+}
 
-    // Инициализируем регистры
-    memset(&task->regs, 0, sizeof(registers_t));
-    task->regs.eip = (uint32_t)entry_point;
-    task->regs.esp = (uint32_t)task->stack + TASK_STACK_SIZE - 4; // Вершина стека
-    task->regs.cs = 0x08;                                         // Селектор кода ядра
-    task->regs.ds = 0x10;                                         // Селектор данных ядра
-    task->regs.es = 0x10;
-    task->regs.fs = 0x10;
-    task->regs.gs = 0x10;
-    task->regs.ss = 0x10;
-    task->regs.eflags = 0x202; // Прерывания включены
+// Обработка файла после записи, если он никем не открыт: упаковка
+// изменённых групп сжатого файла, сжатие файла с FS_INODE_F_COMPRESS,
+// иначе поиск его блоков среди уже записанных
+static void fs_inode_settle(fs_inode_t *inode)
+{
+    if (fs_inode_is_open(inode))
+        return;
+    inode->flags &= ~FS_INODE_F_UNSETTLED;
+    if (inode->flags & FS_INODE_F_COMPRESSED)
+        fs_comp_pack(inode);
+    else if (inode->flags & FS_INODE_F_COMPRESS)
+        fs_inode_compress(inode);
+    else
+        fs_inode_dedup(inode);
+}
 
-    // Добавляем задачу в список
-    if (task_list == NULL)
+// Непрерывный участок данных файла с позиции offset (см. fs_extent_span):
+// у данных в памяти ядра, встроенных и сжатых — из их собственной памяти
+static uint32_t fs_inode_span(fs_inode_t *inode, uint32_t offset, uint32_t size, uint8_t **data, int write)
+{
+    // Данные в памяти ядра (initrd) — один участок до конца файла
+    if (inode->flags & FS_INODE_F_MEMORY)
     {
-        task_list = task;
-        current_task = task;
+        if (write || offset >= inode->size)
+            return 0;
+        *data = (uint8_t *)inode->extents[0].start + offset;
+        return size < inode->size - offset ? size : inode->size - offset;
     }
-    else
+
+    // Встроенные данные — в самом inode, рядом с остальными метаданными
+    if (inode->flags & FS_INODE_F_INLINE)
     {
-        task_t *last = task_list;
-        while (last->next)
-        {
-            last = last->next;
-        }
-        last->next = task;
+        if (offset >= FS_INLINE_MAX)
+            return 0;
+        *data = (uint8_t *)inode->extents + offset;
+        return size < FS_INLINE_MAX - offset ? size : FS_INLINE_MAX - offset;
     }
 
-    return task;
+    // Сжатые данные — из кэша распакованных групп
+    if (inode->flags & FS_INODE_F_COMPRESSED)
+        return fs_zcache_span(inode, offset, size, data, write);
+
+    return fs_extent_span(inode, offset, size, data, write);
 }
 
-void schedule(void)
+// Копирование между буфером и данными файла: один memcpy на каждый экстент,
+// попадающий в диапазон [offset, offset + size). Возвращает число
+// скопированных байт (меньше size — ошибка чтения или нет места)
+static uint32_t fs_inode_copy(fs_inode_t *inode, uint32_t offset, uint8_t *buf, uint32_t size, int to_inode)
 {
-    if (!current_task || !current_task->next)
+    uint32_t done = 0;
+    while (size > 0)
     {
-        return;
-    }
+        uint8_t *data;
+        uint32_t chunk = fs_inode_span(inode, offset, size, &data, to_inode);
+        if (chunk == 0)
+            break;
 
-    // Находим следующую готовую задачу
-    task_t *next_task = current_task->next;
-    while (next_task && next_task->state != TASK_STATE_READY)
-    {
-        next_task = next_task->next;
-        if (!next_task)
+        if (to_inode)
         {
-            next_task = task_list; // Возвращаемся к началу списка
-            break;
+            memcpy(data, buf, chunk);
+            fs_span_written(data, chunk, chunk);
         }
-    }
+        else
+        {
+            memcpy(buf, data, chunk);
+        }
+        fs_span_put(data);
 
-    if (next_task && next_task != current_task)
-    {
-        current_task = next_task;
-        switch_to_task(current_task);
+        buf += chunk;
+        offset += chunk;
+        size -= chunk;
+        done += chunk;
     }
+    return done;
 }
 
-void switch_to_task(task_t *task)
+// Чтение из файла по смещению, возвращает число прочитанных байт. -1 —
+// данные не прочитались (ошибка устройства, повреждённая сжатая группа)
+static int fs_inode_read(fs_inode_t *inode, uint32_t offset, void *buffer, uint32_t size)
 {
-    if (!task)
-        return;
+    if (offset >= inode->size)
+        return 0;
 
-    // В реальной ОС здесь было бы переключение контекста
-    // Переключение происходит без вывода сообщений
+    if (size > inode->size - offset)
+        size = inode->size - offset;
+
+    if (fs_inode_copy(inode, offset, (uint8_t *)buffer, size, 0) < size)
+        return -1;
+    return size;
 }
 
-void task_yield(void)
+// Файлы с данными в памяти ядра (initrd) доступны только для чтения
+static inline int fs_inode_readonly(fs_inode_t *inode)
 {
-    if (current_task)
-    {
-        current_task->time_slice = 0; // Принудительно вызываем переключение
-        schedule();
-    }
+    return (inode->flags & FS_INODE_F_MEMORY) != 0;
 }
 
-// === ДЕМОНСТРАЦИОННЫЕ ЗАДАЧИ ===
-
-void idle_task(void)
+// Подготовка записи в [offset, offset + size): выделение недостающих блоков
+static int fs_inode_prepare_write(fs_inode_t *inode, uint32_t offset, uint32_t size)
 {
-    while (1)
+    if (fs_inode_readonly(inode))
     {
-        asm volatile("hlt"); // Ждем прерывания
+        terminal_writestring("Read-only file: ");
+        terminal_writestring(inode->filename);
+        terminal_writestring("\n");
+        return -1;
     }
-}
 
-void demo_task1(void)
-{
-    for (int i = 0; i < 5; i++)
+    // Сжатый файл меняется по группам в кэше распакованных групп, блоки
+    // выделит упаковка. У обычного — блоки под весь диапазон, общие блоки
+    // изменяемого диапазона (вместе с промежутком до offset) становятся
+    // собственными
+    if (!(inode->flags & FS_INODE_F_COMPRESSED))
     {
-        terminal_writestring("Task 1 running... ");
-        print_number(i);
-        terminal_putchar('\n');
+        if (fs_inode_reserve(inode, offset + size) < 0)
+            return -1;
+        uint32_t from = inode->size < offset ? inode->size : offset;
+        if (fs_inode_unshare(inode, from, offset + size - from) < 0)
+            return -1;
+    }
 
-        // Имитация работы
-        for (volatile int j = 0; j < 1000000; j++)
-            ;
+    // Промежуток между концом файла и offset (после lseek) читается нулями
+    static uint8_t zeros[FS_BLOCK_SIZE];
+    for (uint32_t gap = inode->size; gap < offset;)
+    {
+        uint32_t chunk = offset - gap < FS_BLOCK_SIZE ? offset - gap : FS_BLOCK_SIZE;
+        if (fs_inode_copy(inode, gap, zeros, chunk, 1) < chunk)
+            return -1;
+        gap += chunk;
     }
+    return 0;
 }
 
-void demo_task2(void)
+static void fs_notify_modify(fs_inode_t *inode);
+static void fs_notify_entry(uint32_t inode_num, uint32_t mask, uint32_t cookie);
+static void fs_notify_self(uint32_t inode_num, uint32_t mask);
+
+// Завершение записи, данные которой заканчиваются на end
+static void fs_inode_commit_write(fs_inode_t *inode, uint32_t end)
 {
-    for (int i = 0; i < 3; i++)
-    {
-        terminal_writestring("Task 2 executing... ");
-        print_number(i);
-        terminal_putchar('\n');
+    if (end > inode->size)
+        inode->size = end;
+    inode->flags |= FS_INODE_F_UNSETTLED;
+    inode->modified_time = fs_time_counter++;
+    fs_meta_dirty();
+    fs_notify_modify(inode);
+}
 
-        // Имитация работы
-        for (volatile int j = 0; j < 500000; j++)
-            ;
-    }
+// Запись в файл по смещению с выделением недостающих блоков
+static int fs_inode_write(fs_inode_t *inode, uint32_t offset, const void *data, uint32_t size)
+{
+    if (fs_inode_prepare_write(inode, offset, size) < 0)
+        return -1;
+
+    uint32_t done = fs_inode_copy(inode, offset, (uint8_t *)data, size, 1);
+    if (done > 0)
+        fs_inode_commit_write(inode, offset + done);
+    return done < size ? -1 : (int)size;
 }
 
-// === ОБРАБОТЧИКИ ПРЕРЫВАНИЙ ===
+// === ХЕШИРОВАННЫЕ ДИРЕКТОРИИ ===
 
-void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags)
+// Директория — расширяемая хеш-таблица (формат в fs_format.h): данные
+// директории — таблица номеров блоков-корзин, запись с именем name лежит в
+// корзине table[fs_dir_hash(name) & (2^depth - 1)]. Поиск, вставка и
+// удаление читают один слот таблицы и одну корзину. Корзины не сливаются:
+// опустевшие остаются до удаления директории
+
+// Глубина таблицы корзин (число бит хеша)
+static inline uint32_t fs_dir_depth(fs_inode_t *dir)
 {
-    idt[num].base_lo = base & 0xFFFF;
-    idt[num].base_hi = (base >> 16) & 0xFFFF;
-    idt[num].sel = sel;
-    idt[num].always0 = 0;
-    idt[num].flags = flags;
+    return bit_scan_forward(dir->size / 4);
 }
 
-// ===== ЛОГГЕР И ПАНИКА =====
-static void log_reg_dump(const char *msg)
+// Номер блока корзины из слота таблицы
+static uint32_t fs_dir_slot(fs_inode_t *dir, uint32_t index)
 {
-    terminal_writestring("\n[EXC] ");
-    terminal_writestring(msg);
-    terminal_writestring("\n");
+    uint32_t block = 0;
+    fs_inode_read(dir, index * 4, &block, 4);
+    return block;
 }
 
-static void dump_registers(void)
+// Корзина в блоке данных block. У тома на устройстве она лежит в
+// закреплённом буфере кэша (освобождение — fs_span_put). write — корзина
+// будет изменена
+static fs_dir_bucket_t *fs_dir_bucket(uint32_t block, int write)
 {
-    uint32_t eax, ebx, ecx, edx, esi, edi, esp, ebp;
-    uint16_t cs, ds, es, fs, gs, ss;
+    if (!filesystem.device)
+        return (fs_dir_bucket_t *)(filesystem.data_blocks + block * FS_BLOCK_SIZE);
 
-    asm volatile("mov %%eax, %0" : "=m"(eax));
-    asm volatile("mov %%ebx, %0" : "=m"(ebx));
-    asm volatile("mov %%ecx, %0" : "=m"(ecx));
-    asm volatile("mov %%edx, %0" : "=m"(edx));
-    asm volatile("mov %%esi, %0" : "=m"(esi));
-    asm volatile("mov %%edi, %0" : "=m"(edi));
-    asm volatile("mov %%esp, %0" : "=m"(esp));
-    asm volatile("mov %%ebp, %0" : "=m"(ebp));
-    asm volatile("mov %%cs, %0" : "=m"(cs));
-    asm volatile("mov %%ds, %0" : "=m"(ds));
-    asm volatile("mov %%es, %0" : "=m"(es));
-    asm volatile("mov %%fs, %0" : "=m"(fs));
-    asm volatile("mov %%gs, %0" : "=m"(gs));
-    asm volatile("mov %%ss, %0" : "=m"(ss));
-
-    terminal_writestring("Registers:\n");
-    terminal_writestring("EAX=");
-    print_hex(eax);
-    terminal_writestring(" EBX=");
-    print_hex(ebx);
-    terminal_writestring(" ECX=");
-    print_hex(ecx);
-    terminal_writestring(" EDX=");
-    print_hex(edx);
-    terminal_writestring("\nESI=");
-    print_hex(esi);
-    terminal_writestring(" EDI=");
-    print_hex(edi);
-    terminal_writestring(" ESP=");
-    print_hex(esp);
-    terminal_writestring(" EBP=");
-    print_hex(ebp);
-    terminal_writestring("\nCS=");
-    print_hex(cs);
-    terminal_writestring(" DS=");
-    print_hex(ds);
-    terminal_writestring(" ES=");
-    print_hex(es);
-    terminal_writestring(" FS=");
-    print_hex(fs);
-    terminal_writestring(" GS=");
-    print_hex(gs);
-    terminal_writestring(" SS=");
-    print_hex(ss);
-    terminal_writestring("\n");
+    uint32_t within;
+    bcache_buf_t *buf = fs_block_buffer(block, &within, 1);
+    if (!buf)
+        return NULL;
+    if (write)
+        bcache_mark_dirty(buf);
+    return (fs_dir_bucket_t *)(buf->data + within);
 }
 
-static void kernel_panic(const char *msg)
+// Новая пустая корзина (блоки обнуляются при выделении), 0 — нет места
+static uint32_t fs_dir_new_bucket(uint32_t hint)
 {
-    terminal_writestring("\nKERNEL PANIC: ");
-    terminal_writestring(msg);
-    terminal_writestring("\nSystem halted.\n");
-    dump_registers();
-    asm volatile("cli");
-    while (1)
-        asm volatile("hlt");
+    uint32_t got;
+    uint32_t block = fs_alloc_run(1, hint, &got);
+    return got ? block : 0;
 }
 
-void handle_exception(void)
+// Удвоение таблицы корзин: вторая половина — копия первой. Блоки
+// выделяются с запасом на ещё одно удвоение, чтобы таблица оставалась
+// в немногих экстентах
+static int fs_dir_double(fs_inode_t *dir)
 {
-    log_reg_dump("CPU exception occurred");
-    kernel_panic("Unhandled CPU exception");
-}
+    uint32_t size = dir->size;
+    if (fs_inode_block_count(dir) * FS_BLOCK_SIZE < size * 2 && fs_inode_reserve(dir, size * 4) < 0)
+        return -1;
 
-// ===== ПРОСТОЙ ФИЗИЧЕСКИЙ АЛЛОКАТОР (BITMAP) =====
-#define MAX_PHYS_PAGES (HEAP_SIZE / PAGE_SIZE)
-static uint8_t phys_bitmap[MAX_PHYS_PAGES];
-static uint32_t phys_alloc_count = 0;
-static uint32_t phys_free_count = 0;
+    static uint32_t slots[FS_BLOCK_SIZE / 4];
+    for (uint32_t offset = 0; offset < size; offset += sizeof(slots))
+    {
+        uint32_t chunk = size - offset < sizeof(slots) ? size - offset : sizeof(slots);
+        fs_inode_read(dir, offset, slots, chunk);
+        if (fs_inode_write(dir, size + offset, slots, chunk) < 0)
+            return -1;
+    }
+    return 0;
+}
 
-static int phys_alloc_page(uint32_t *out_phys)
+// Разделение полной корзины block с локальной глубиной depth, на которую
+// указывает слот index: записи с установленным битом depth хеша переходят
+// в новую корзину
+static int fs_dir_split(fs_inode_t *dir, uint32_t index, uint32_t block, uint32_t depth)
 {
-    for (uint32_t i = 0; i < MAX_PHYS_PAGES; i++)
+    if (depth == fs_dir_depth(dir))
+    {
+        if (depth >= FS_DIR_MAX_DEPTH || fs_dir_double(dir) < 0)
+            return -1;
+    }
+
+    uint32_t new_block = fs_dir_new_bucket(block + 1);
+    if (new_block == 0)
+        return -1;
+
+    fs_dir_bucket_t *old = fs_dir_bucket(block, 1);
+    fs_dir_bucket_t *new = old ? fs_dir_bucket(new_block, 1) : NULL;
+    if (!new)
+    {
+        if (old)
+            fs_span_put((uint8_t *)old);
+        fs_free_run(new_block, 1);
+        return -1;
+    }
+
+    old->depth = depth + 1;
+    new->depth = depth + 1;
+    for (uint32_t i = 0; i < FS_DIR_BUCKET_ENTRIES; i++)
     {
-        if (!phys_bitmap[i])
+        fs_dir_entry_t *entry = &old->entries[i];
+        if (entry->inode_number != 0 && (fs_dir_hash(entry->name) >> depth) & 1)
         {
-            phys_bitmap[i] = 1;
-            phys_alloc_count++;
-            *out_phys = HEAP_START + i * PAGE_SIZE;
-            return 0;
+            new->entries[new->count++] = *entry;
+            memset(entry, 0, sizeof(fs_dir_entry_t));
+            old->count--;
         }
     }
-    return -1;
+    fs_span_put((uint8_t *)new);
+    fs_span_put((uint8_t *)old);
+
+    // Слоты старой корзины с установленным битом depth — на новую
+    uint32_t slots = dir->size / 4;
+    uint32_t low = index & ((1u << depth) - 1);
+    for (uint32_t i = low | (1u << depth); i < slots; i += 2u << depth)
+    {
+        fs_inode_write(dir, i * 4, &new_block, 4);
+    }
+    return 0;
 }
 
-static void phys_free_page(uint32_t phys)
+// Поиск записи name: номер inode или -1. Блок корзины и индекс записи
+// в ней — в *block и *slot
+static int fs_dir_find(fs_inode_t *dir, const char *name, uint32_t *block, uint32_t *slot)
 {
-    if (phys < HEAP_START)
-        return;
-    uint32_t idx = (phys - HEAP_START) / PAGE_SIZE;
-    if (idx < MAX_PHYS_PAGES)
+    if (dir->size == 0)
+        return -1;
+
+    *block = fs_dir_slot(dir, fs_dir_hash(name) & (dir->size / 4 - 1));
+    fs_dir_bucket_t *bucket = fs_dir_bucket(*block, 0);
+    if (!bucket)
+        return -1;
+
+    int found = -1;
+    for (uint32_t i = 0; i < FS_DIR_BUCKET_ENTRIES; i++)
     {
-        phys_bitmap[idx] = 0;
-        phys_free_count++;
+        if (bucket->entries[i].inode_number != 0 && strcmp(bucket->entries[i].name, name) == 0)
+        {
+            found = bucket->entries[i].inode_number;
+            *slot = i;
+            break;
+        }
     }
+    fs_span_put((uint8_t *)bucket);
+    return found;
 }
 
-// ===== DEMAND-PAGING: подкачка страниц ELF при fault =====
-static uint32_t demand_page_count = 0;
+// Ключ записи для позиции обхода: хеш имени с обратным порядком бит, без
+// младшего бита. Записи корзины глубины d — это все ключи с одними и теми
+// же старшими d битами, то есть непрерывный отрезок ключей, и разделение
+// корзины делит её отрезок на два. Поэтому позиция-ключ не сдвигается,
+// когда корзины делятся
+#define FS_DIR_POS_END 0x80000000u // Позиция после последней записи
 
-static int demand_page_load(task_t *task, uint32_t fault_addr)
+// Младшие 31 бит value в обратном порядке (обратное преобразование — она же)
+static inline uint32_t fs_dir_reverse31(uint32_t value)
 {
-    if (!task || !task->elf_loader)
-        return -1;
-    elf_loader_t *ldr = task->elf_loader;
-    for (uint32_t i = 0; i < ldr->num_segments && i < 16; i++)
+    uint32_t result = 0;
+    for (int i = 0; i < 31; i++)
+        result |= ((value >> i) & 1) << (30 - i);
+    return result;
+}
+
+static inline uint32_t fs_dir_key(const char *name)
+{
+    return fs_dir_reverse31(fs_dir_hash(name));
+}
+
+// Обход записей директории в порядке ключей с позиции *pos (ключ первой
+// ещё не отданной записи, 0 — с начала). Корзины посещаются по
+// возрастанию их отрезков ключей, записи корзины — по возрастанию ключа.
+// Возвращает результат fn, прервавшего обход, или 0; *pos остаётся на
+// записи, где обход прерван (или FS_DIR_POS_END), и следующий обход
+// продолжается с неё. Записи с совпадающим ключом на месте прерывания
+// могут быть отданы повторно
+static int fs_dir_iterate_at(fs_inode_t *dir, uint32_t *pos, fs_dir_fn_t fn, void *ctx)
+{
+    uint32_t mask = dir->size / 4 - 1;
+
+    while (dir->size > 0 && *pos < FS_DIR_POS_END)
     {
-        // Translate original vaddr to loaded vaddr using min_vaddr baseline
-        uint32_t seg_start = ldr->load_base + (ldr->segments[i].vaddr - ldr->min_vaddr);
-        uint32_t seg_end = seg_start + ldr->segments[i].memsz;
-        if (fault_addr >= seg_start && fault_addr < seg_end)
+        // Слот таблицы — младшие биты хеша, то есть старшие биты ключа
+        uint32_t slot = fs_dir_reverse31(*pos) & mask;
+        fs_dir_bucket_t *bucket = fs_dir_bucket(fs_dir_slot(dir, slot), 0);
+        if (!bucket)
+            return -1;
+
+        // Записи корзины с ключом не меньше *pos, по возрастанию ключа
+        fs_dir_entry_t entries[FS_DIR_BUCKET_ENTRIES];
+        uint32_t keys[FS_DIR_BUCKET_ENTRIES];
+        uint32_t used = 0;
+        for (uint32_t j = 0; j < FS_DIR_BUCKET_ENTRIES; j++)
         {
-            uint32_t page_base = fault_addr & 0xFFFFF000;
-            uint32_t phys;
-            if (phys_alloc_page(&phys) != 0)
-                return -1;
-            // Инициализируем страницу из файла если попадает в filesz
-            uint32_t within = page_base - seg_start;
-            uint32_t file_off = ldr->segments[i].offset + within;
-            memset((void *)phys, 0, PAGE_SIZE);
-            if (within < ldr->segments[i].filesz)
+            if (bucket->entries[j].inode_number == 0)
+                continue;
+            uint32_t key = fs_dir_key(bucket->entries[j].name);
+            if (key < *pos)
+                continue;
+            uint32_t k = used++;
+            for (; k > 0 && keys[k - 1] > key; k--)
             {
-                uint32_t to_copy = ldr->segments[i].filesz - within;
-                if (to_copy > PAGE_SIZE)
-                    to_copy = PAGE_SIZE;
-                memcpy((void *)phys, ldr->data + file_off, to_copy);
+                keys[k] = keys[k - 1];
+                entries[k] = entries[k - 1];
             }
-            // Отобразим страницу в адресное пространство процесса
-            if (map_memory_for_process(task, page_base, phys, PAGE_SIZE, PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER) < 0)
+            keys[k] = key;
+            entries[k] = bucket->entries[j];
+        }
+        uint32_t span = FS_DIR_POS_END >> bucket->depth; // Длина отрезка корзины
+        fs_span_put((uint8_t *)bucket);
+
+        // Обработчик получает копии: корзина уже не закреплена
+        for (uint32_t j = 0; j < used; j++)
+        {
+            int result = fn(&entries[j], ctx);
+            if (result)
             {
-                phys_free_page(phys);
-                return -1;
+                *pos = keys[j];
+                return result;
             }
-            flush_tlb();
-            demand_page_count++;
-            return 0;
         }
+        *pos = (*pos & ~(span - 1)) + span;
     }
-    return -1;
+    *pos = FS_DIR_POS_END;
+    return 0;
 }
 
-void handle_page_fault(void)
+// Обход всех записей директории
+static int fs_dir_iterate(fs_inode_t *dir, fs_dir_fn_t fn, void *ctx)
 {
-    uint32_t fault_addr = get_page_fault_address();
-    if (current_task && is_user_address((void *)fault_addr, 1))
+    uint32_t pos = 0;
+    return fs_dir_iterate_at(dir, &pos, fn, ctx);
+}
+
+// Освобождение блоков всех корзин директории (таблицу освобождает
+// fs_inode_truncate)
+static void fs_dir_free_buckets(fs_inode_t *dir)
+{
+    uint32_t count = dir->size / 4;
+    for (uint32_t i = 0; i < count; i++)
     {
-        if (demand_page_load(current_task, fault_addr) == 0)
-        {
-            return; // успешно подкачали
-        }
+        uint32_t block = fs_dir_slot(dir, i);
+        fs_dir_bucket_t *bucket = fs_dir_bucket(block, 0);
+        if (!bucket)
+            continue;
+        uint32_t first = i < (1u << bucket->depth);
+        fs_span_put((uint8_t *)bucket);
+        if (first)
+            fs_free_run(block, 1);
     }
-    terminal_writestring("Page fault at address: ");
-    print_hex(fault_addr);
-    terminal_writestring("\n");
-    kernel_panic("Unhandled page fault");
 }
 
-// Старая функция keyboard_handler заменена на новый модуль клавиатуры
-// Теперь используется keyboard_handler из keyboard.c
+// === КЭШ DENTRY ===
 
-void timer_interrupt_handler(void)
+// Хеш FNV-1a по паре (родительская директория, имя)
+static uint32_t fs_name_hash(uint32_t parent, const char *name)
 {
-    timer_ticks++;
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 4; i++)
+    {
+        hash ^= (parent >> (i * 8)) & 0xFF;
+        hash *= 16777619u;
+    }
+    while (*name)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-    // Планировщик задач каждые 10 тиков (100ms при 100Hz)
-    if (timer_ticks % 10 == 0)
+// Поиск записи кэша по ключу, NULL если записи нет
+static fs_dentry_t *fs_dcache_find(uint32_t parent, const char *name)
+{
+    uint32_t mask = filesystem.dcache_size - 1;
+    uint32_t slot = fs_name_hash(parent, name) & mask;
+
+    filesystem.dcache_lookups++;
+    for (uint32_t i = 0; i < filesystem.dcache_size; i++)
     {
-        scheduler_ticks++;
-        if (current_task && current_task->time_slice > 0)
+        fs_dentry_t *dentry = &filesystem.dcache[slot];
+        filesystem.dcache_probes++;
+
+        if (dentry->state == FS_DENTRY_EMPTY)
+            return NULL;
+        if (dentry->parent == parent && strcmp(dentry->name, name) == 0)
+            return dentry;
+        slot = (slot + 1) & mask;
+    }
+
+    return NULL;
+}
+
+// Вставка без проверки существующей записи, возвращает 0 если места нет
+static int fs_dcache_insert(uint32_t parent, const char *name, int inode_num)
+{
+    uint32_t mask = filesystem.dcache_size - 1;
+    uint32_t slot = fs_name_hash(parent, name) & mask;
+
+    for (uint32_t i = 0; i < filesystem.dcache_size; i++)
+    {
+        fs_dentry_t *dentry = &filesystem.dcache[slot];
+        if (dentry->state == FS_DENTRY_EMPTY)
         {
-            current_task->time_slice--;
-            if (current_task->time_slice == 0)
+            dentry->parent = parent;
+            strncpy(dentry->name, name, FS_MAX_FILENAME - 1);
+            dentry->name[FS_MAX_FILENAME - 1] = '\0';
+            if (inode_num >= 0)
             {
-                current_task->time_slice = 10; // Сбрасываем time slice
-                schedule();                    // Переключаем задачу
+                dentry->state = FS_DENTRY_POSITIVE;
+                dentry->inode = inode_num;
+            }
+            else
+            {
+                dentry->state = FS_DENTRY_NEGATIVE;
+                dentry->inode = 0;
+                filesystem.dcache_negatives++;
             }
+            return 1;
         }
+        slot = (slot + 1) & mask;
     }
 
-    // Отправляем EOI
-    outb(PIC1_COMMAND, PIC_EOI);
+    return 0;
 }
 
-// === СИСТЕМНЫЕ ВЫЗОВЫ ===
+// Сброс кэша: отрицательные записи выбрасываются, положительные
+// восстанавливаются из таблицы inodes. Размер кэша следует за таблицей inodes
+// в пределах dcache_limit
+static void fs_dcache_reset(void)
+{
+    uint32_t size = FS_MIN_DCACHE;
+    while (size < filesystem.inode_capacity * 2 && size * 2 <= filesystem.dcache_limit)
+        size <<= 1;
 
-// ===== ВАЛИДАЦИЯ СИСТЕМНЫХ ВЫЗОВОВ =====
-typedef int (*syscall_fn_t)(int, int, int, int, int);
+    filesystem.dcache_size = size;
+    memset(filesystem.dcache, 0, size * sizeof(fs_dentry_t));
+    filesystem.dcache_negatives = 0;
 
-static int sys_exit_impl(int code, int _1, int _2, int _3, int _4)
-{
-    (void)_1;
-    (void)_2;
-    (void)_3;
-    (void)_4;
-    if (!current_task)
-        return -1;
-    current_task->state = TASK_STATE_DEAD;
-    cleanup_process(current_task);
-    schedule();
-    return code;
+    // Таблицу inodes тома на устройстве не читаем целиком: кэш заполнится
+    // поиском по директориям
+    if (filesystem.device)
+        return;
+
+    uint32_t capacity = filesystem.inode_capacity;
+    for (uint32_t i = fs_bitmap_next(filesystem.inode_bitmap, capacity, 1, 1); i < capacity;
+         i = fs_bitmap_next(filesystem.inode_bitmap, capacity, i + 1, 1))
+    {
+        fs_dcache_insert(filesystem.inodes[i].parent_inode, filesystem.inodes[i].filename, i);
+    }
 }
 
-static int sys_write_impl(int fdnum, int buf, int count, int _3, int _4)
+// Перестройка кэша на месте: отрицательные записи (в том числе оставшиеся
+// от удалённых файлов) освобождают слоты, положительные переставляются заново,
+// чтобы цепочки поиска не проходили через освободившиеся места. Обход
+// начинается после пустого слота, поэтому каждая запись встаёт не дальше
+// прежнего места в своей цепочке
+static void fs_dcache_rehash(void)
 {
-    (void)_3;
-    (void)_4;
-    if (count < 0)
-        return -1;
-    if (is_cpl3())
+    uint32_t size = filesystem.dcache_size;
+    uint32_t mask = size - 1;
+    uint32_t start = size;
+
+    for (uint32_t i = 0; i < size; i++)
     {
-        if (!is_user_address((void *)buf, (uint32_t)count))
-            return -1;
+        if (filesystem.dcache[i].state == FS_DENTRY_NEGATIVE)
+            filesystem.dcache[i].state = FS_DENTRY_EMPTY;
+        if (filesystem.dcache[i].state == FS_DENTRY_EMPTY && start == size)
+            start = i;
     }
+    filesystem.dcache_negatives = 0;
+    if (start == size)
+        return;
 
-    if (fdnum == STDOUT_FILENO || fdnum == STDERR_FILENO)
+    for (uint32_t n = 1; n <= size; n++)
     {
-        char buffer[256];
-        uint32_t to_copy = (count > 255) ? 255 : count;
-        int copied = 0;
+        fs_dentry_t *dentry = &filesystem.dcache[(start + n) & mask];
+        if (dentry->state != FS_DENTRY_POSITIVE)
+            continue;
 
-        if (is_cpl3())
-        {
-            copied = copy_from_user_safe(buffer, (void *)buf, to_copy);
-            if (copied < 0)
-                return -1;
-        }
-        else
-        {
-            memcpy(buffer, (void *)buf, to_copy);
-            copied = to_copy;
-        }
+        fs_dentry_t entry = *dentry;
+        dentry->state = FS_DENTRY_EMPTY;
+        fs_dcache_insert(entry.parent, entry.name, entry.inode);
+    }
+}
+
+// Запоминание результата поиска: inode_num >= 0 — положительная запись,
+// -1 — отрицательная (имени в директории нет)
+static void fs_dcache_store(uint32_t parent, const char *name, int inode_num)
+{
+    fs_dentry_t *dentry = fs_dcache_find(parent, name);
+    if (dentry)
+    {
+        if (dentry->state == FS_DENTRY_NEGATIVE && inode_num >= 0)
+            filesystem.dcache_negatives--;
+        else if (dentry->state == FS_DENTRY_POSITIVE && inode_num < 0)
+            filesystem.dcache_negatives++;
+
+        dentry->state = inode_num >= 0 ? FS_DENTRY_POSITIVE : FS_DENTRY_NEGATIVE;
+        dentry->inode = inode_num >= 0 ? inode_num : 0;
 
-        for (int i = 0; i < copied; i++)
-            terminal_putchar(buffer[i]);
-        return copied;
+        // Записи удалённых файлов копятся на месте положительных
+        if (filesystem.dcache_negatives >= filesystem.dcache_size / 4)
+            fs_dcache_rehash();
+        return;
     }
 
-    file_descriptor_t *fd = get_fd(current_task, fdnum);
-    if (!fd || !fd->valid)
-        return -1;
+    // Отрицательные записи занимают не больше четверти кэша
+    if (inode_num < 0 && filesystem.dcache_negatives >= filesystem.dcache_size / 4)
+        fs_dcache_rehash();
 
-    char *kernel_buf = (char *)kmalloc(count + 1);
-    if (!kernel_buf)
-        return -1;
+    // Кэш переполнен: сброс заново заполняет его из таблицы inodes, и ключ
+    // мог уже вернуться в кэш
+    if (!fs_dcache_insert(parent, name, inode_num) && inode_num >= 0)
+    {
+        fs_dcache_reset();
+        if (!fs_dcache_find(parent, name))
+            fs_dcache_insert(parent, name, inode_num);
+    }
+}
 
-    int result = -1;
-    if (is_cpl3())
+// Поиск одного компонента пути в директории: сначала кэш dentry,
+// при промахе — просмотр записей директории
+static int fs_lookup(uint32_t dir, const char *name)
+{
+    if (strcmp(name, ".") == 0)
+        return dir;
+    if (strcmp(name, "..") == 0)
+        return fs_inode(dir)->parent_inode;
+
+    fs_dentry_t *dentry = fs_dcache_find(dir, name);
+    if (dentry)
     {
-        int copied = copy_from_user_safe(kernel_buf, (void *)buf, count);
-        if (copied > 0)
+        if (dentry->state == FS_DENTRY_NEGATIVE)
         {
-            result = fs_write_file(fd->filename, kernel_buf, copied) >= 0 ? copied : -1;
+            filesystem.dcache_negative_hits++;
+            return -1;
         }
-    }
-    else
-    {
-        result = fs_write_file(fd->filename, (char *)buf, count) >= 0 ? count : -1;
+        filesystem.dcache_hits++;
+        return dentry->inode;
     }
 
-    kfree(kernel_buf);
-    return result;
+    fs_inode_t *inode = fs_find_inode_in_dir(dir, name);
+    int inode_num = inode ? (int)(inode - filesystem.inodes) : -1;
+    fs_dcache_store(dir, name, inode_num);
+    return inode_num;
 }
 
-static int sys_getpid_impl(int _0, int _1, int _2, int _3, int _4)
+// === РАЗБОР ПУТЕЙ ===
+
+// Текущая директория: в системном вызове — директория вызвавшей задачи,
+// иначе — директория шелла (current_task меняется планировщиком по таймеру)
+static uint32_t fs_cwd_inode(void)
 {
-    (void)_0;
-    (void)_1;
-    (void)_2;
-    (void)_3;
-    (void)_4;
-    return current_task ? (int)current_task->process.pid : -1;
+    uint32_t cwd = shell_cwd_inode;
+    if (in_syscall && current_task)
+        cwd = current_task->process.cwd_inode;
+
+    if (cwd < filesystem.inode_capacity && fs_inode(cwd)->type == FS_INODE_DIR)
+        return cwd;
+    return FS_ROOT_INODE;
 }
 
-static int sys_read_impl(int fdnum, int buf, int count, int _3, int _4)
+// Выделение очередного компонента пути. Возвращает длину компонента,
+// 0 в конце пути и -1 если компонент слишком длинный
+static int fs_next_component(const char **path, char *component)
 {
-    (void)_3;
-    (void)_4;
-    if (count < 0)
-        return -1;
-    if (is_cpl3() && !is_user_address((void *)buf, (uint32_t)count))
+    const char *p = *path;
+    while (*p == '/')
+        p++;
+
+    int len = 0;
+    while (p[len] && p[len] != '/')
+        len++;
+    if (len >= FS_MAX_FILENAME)
         return -1;
 
-    if (fdnum == STDIN_FILENO)
-    {
-        // Пока не реализовано чтение с клавиатуры
-        return 0;
-    }
+    memcpy(component, p, len);
+    component[len] = '\0';
+    *path = p + len;
+    return len;
+}
 
-    file_descriptor_t *fd = get_fd(current_task, fdnum);
-    if (!fd || !fd->valid)
+// Пошаговое разрешение пути: абсолютного от корня, относительного от
+// текущей директории. Возвращает номер inode или -1.
+// Точки монтирования распознаются в том же проходе: если очередной
+// компонент (не "." и не "..") уходит из точки монтирования вглубь, путь
+// принадлежит смонтированной ФС — в *mount она, в *rest остаток пути с этого
+// компонента, результат -1. Путь, кончающийся на точке монтирования, даёт
+// её inode и *mount с пустым *rest. ".." из точки монтирования ведёт в
+// корневую ФС. mount может быть NULL — тогда пути под точкой монтирования
+// просто не находятся
+int fs_walk(const char *path, vfs_mount_t **mount, const char **rest)
+{
+    if (mount)
+        *mount = NULL;
+    if (!filesystem.initialized || !path)
         return -1;
 
-    char *kernel_buf = (char *)kmalloc(count + 1);
-    if (!kernel_buf)
-        return -1;
+    uint32_t current = (path[0] == '/') ? FS_ROOT_INODE : fs_cwd_inode();
+    char component[FS_MAX_FILENAME];
+    int len;
 
-    int result = fs_read_file(fd->filename, kernel_buf, count);
-    if (result > 0)
+    for (;;)
     {
-        if (is_cpl3())
+        const char *start = path;
+        len = fs_next_component(&path, component);
+        vfs_mount_t *at = vfs_mount_at(current);
+        if (at && (len <= 0 || (strcmp(component, ".") != 0 && strcmp(component, "..") != 0)))
         {
-            int copied = copy_to_user_safe((void *)buf, kernel_buf, result);
-            if (copied < 0)
-                result = -1;
-            else if (copied < result)
-                result = copied; // Частичный успех
-        }
-        else
-        {
-            memcpy((void *)buf, kernel_buf, result);
+            if (len < 0)
+                return -1;
+            if (mount)
+            {
+                while (*start == '/')
+                    start++;
+                *mount = at;
+                *rest = start;
+            }
+            return len == 0 ? (int)current : -1;
         }
+        if (len <= 0)
+            break;
+
+        if (fs_inode(current)->type != FS_INODE_DIR)
+            return -1;
+
+        int next = fs_lookup(current, component);
+        if (next < 0)
+            return -1;
+        current = next;
     }
 
-    kfree(kernel_buf);
-    return result;
+    return len < 0 ? -1 : (int)current;
 }
 
-static int sys_open_impl(int path, int flags, int _2, int _3, int _4)
+int fs_lookup_path(const char *path)
 {
-    (void)_2;
-    (void)_3;
-    (void)_4;
-    if (is_cpl3() && !is_user_address((void *)path, 256))
+    return fs_walk(path, NULL, NULL);
+}
+
+// Разрешение всех компонентов, кроме последнего. Возвращает inode
+// родительской директории, имя последнего компонента — в name
+static int fs_lookup_parent(const char *path, char *name)
+{
+    if (!filesystem.initialized || !path)
         return -1;
 
-    char kernel_path[256];
-    int copied = 0;
+    // Отбрасываем завершающие '/' и ищем начало последнего компонента
+    int end = strlen(path);
+    while (end > 1 && path[end - 1] == '/')
+        end--;
+    int start = end;
+    while (start > 0 && path[start - 1] != '/')
+        start--;
 
-    if (is_cpl3())
-    {
-        copied = copy_from_user_safe(kernel_path, (void *)path, 255);
-        if (copied <= 0)
-            return -1;
-    }
-    else
-    {
-        strncpy(kernel_path, (char *)path, 255);
-        copied = strlen(kernel_path);
-    }
-    kernel_path[copied] = '\0';
+    int name_len = end - start;
+    if (name_len <= 0 || name_len >= FS_MAX_FILENAME)
+        return -1;
+    memcpy(name, path + start, name_len);
+    name[name_len] = '\0';
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        return -1;
 
-    return allocate_fd(current_task, kernel_path, flags);
-}
+    if (start == 0)
+        return fs_cwd_inode();
 
-static int sys_close_impl(int fdnum, int _1, int _2, int _3, int _4)
-{
-    (void)_1;
-    (void)_2;
-    (void)_3;
-    (void)_4;
-    free_fd(current_task, fdnum);
-    return 0;
+    char parent_path[FS_MAX_PATH];
+    if (start >= FS_MAX_PATH)
+        return -1;
+    memcpy(parent_path, path, start);
+    parent_path[start] = '\0';
+
+    int parent = fs_lookup_path(parent_path);
+    if (parent < 0 || fs_inode(parent)->type != FS_INODE_DIR)
+        return -1;
+    return parent;
 }
 
-static int sys_fork_impl(int _0, int _1, int _2, int _3, int _4)
+// Построение абсолютного пути inode подъёмом по parent_inode
+int fs_get_path(uint32_t inode_num, char *buffer, uint32_t size)
 {
-    (void)_0;
-    (void)_1;
-    (void)_2;
-    (void)_3;
-    (void)_4;
-    task_t *child = fork_process(current_task);
-    return child ? (int)child->process.pid : -1;
+    if (!filesystem.initialized || inode_num >= filesystem.inode_capacity || !buffer || size < 2)
+        return -1;
+
+    // Сначала считаем длину пути, затем заполняем буфер с конца
+    uint32_t len = 0;
+    for (uint32_t n = inode_num; n != FS_ROOT_INODE; n = fs_inode(n)->parent_inode)
+    {
+        len += strlen(fs_inode(n)->filename) + 1;
+    }
+
+    if (len == 0)
+    {
+        strcpy(buffer, "/");
+        return 1;
+    }
+    if (len + 1 > size)
+        return -1;
+
+    uint32_t pos = len;
+    buffer[pos] = '\0';
+    for (uint32_t n = inode_num; n != FS_ROOT_INODE; n = fs_inode(n)->parent_inode)
+    {
+        uint32_t name_len = strlen(fs_inode(n)->filename);
+        pos -= name_len;
+        memcpy(buffer + pos, fs_inode(n)->filename, name_len);
+        buffer[--pos] = '/';
+    }
+    return len;
 }
 
-static int sys_exec_impl(int path, int argv, int _2, int _3, int _4)
+// Создание inode в директории, заданной путём
+static int fs_create_node(const char *path, uint8_t type)
 {
-    (void)_2;
-    (void)_3;
-    (void)_4;
-    if (is_cpl3() && !is_user_address((void *)path, 256))
+    char name[FS_MAX_FILENAME];
+    int parent = fs_lookup_parent(path, name);
+    if (parent < 0)
+    {
+        terminal_writestring("No such directory: ");
+        terminal_writestring(path);
+        terminal_writestring("\n");
+        return -1;
+    }
+    if (vfs_mount_at(parent))
+    {
+        terminal_writestring("Read-only filesystem: ");
+        terminal_writestring(path);
+        terminal_writestring("\n");
         return -1;
+    }
 
-    char kernel_path[256];
-    int copied = 0;
+    // Проверяем, не существует ли уже запись с таким именем
+    if (fs_lookup(parent, name) >= 0)
+    {
+        terminal_writestring(type == FS_INODE_DIR ? "Directory already exists: " : "File already exists: ");
+        terminal_writestring(path);
+        terminal_writestring("\n");
+        return -1;
+    }
 
-    if (is_cpl3())
+    int i = fs_alloc_inode();
+    if (i < 0)
     {
-        copied = copy_from_user_safe(kernel_path, (void *)path, 255);
-        if (copied <= 0)
-            return -1;
+        terminal_writestring("No free inodes available\n");
+        return -1; // Нет свободных inodes
     }
-    else
+
+    fs_inode_t *inode = fs_inode(i);
+    memset(inode, 0, sizeof(fs_inode_t));
+    inode->type = type;
+    strncpy(inode->filename, name, FS_MAX_FILENAME - 1);
+    inode->created_time = fs_time_counter++;
+    inode->modified_time = inode->created_time;
+    inode->parent_inode = parent;
+    if (type == FS_INODE_FILE && (filesystem.superblock.flags & FS_SB_F_COMPRESS))
+        inode->flags = FS_INODE_F_COMPRESS;
+
+    if (fs_add_entry_to_dir(parent, i, name, type) < 0)
     {
-        strncpy(kernel_path, (char *)path, 255);
-        copied = strlen(kernel_path);
+        terminal_writestring("Directory full\n");
+        memset(inode, 0, sizeof(fs_inode_t));
+        fs_free_inode(i);
+        return -1;
     }
-    kernel_path[copied] = '\0';
 
-    return exec_process(kernel_path, (char **)argv);
+    fs_dcache_store(parent, name, i);
+    fs_notify_entry(i, IN_CREATE, 0);
+    return i;
 }
 
-static int sys_wait_impl(int pid, int _1, int _2, int _3, int _4)
+// Освобождение inode и удаление его записи из родительской директории
+static void fs_release_node(uint32_t inode_num)
 {
-    (void)_1;
-    (void)_2;
-    (void)_3;
-    (void)_4;
-    return wait_process(pid);
-}
+    fs_inode_t *inode = fs_inode(inode_num);
+    fs_notify_entry(inode_num, IN_DELETE, 0);
+    fs_notify_self(inode_num, IN_DELETE_SELF);
 
-static int sys_yield_impl(int _0, int _1, int _2, int _3, int _4)
-{
-    (void)_0;
-    (void)_1;
-    (void)_2;
-    (void)_3;
-    (void)_4;
-    schedule();
-    return 0;
+    // Освобождаем корзины директории и экстенты
+    if (inode->type == FS_INODE_DIR)
+        fs_dir_free_buckets(inode);
+    fs_inode_truncate(inode, 0);
+
+    // Убираем запись из директории, в кэше остаётся отрицательная запись
+    fs_remove_entry_from_dir(inode->parent_inode, inode->filename);
+    fs_dcache_store(inode->parent_inode, inode->filename, -1);
+
+    // Освобождаем inode
+    memset(inode, 0, sizeof(fs_inode_t));
+    fs_free_inode(inode_num);
 }
 
-static int sys_getppid_impl(int _0, int _1, int _2, int _3, int _4)
+int fs_create_file(const char *filename)
 {
-    (void)_0;
-    (void)_1;
-    (void)_2;
-    (void)_3;
-    (void)_4;
-    return current_task ? (int)current_task->process.ppid : -1;
+    if (!filesystem.initialized || !filename)
+        return -1;
+
+    return fs_create_node(filename, FS_INODE_FILE);
 }
 
-static int sys_getuid_impl(int _0, int _1, int _2, int _3, int _4)
+int fs_file_exists(const char *filename)
 {
-    (void)_0;
-    (void)_1;
-    (void)_2;
-    (void)_3;
-    (void)_4;
-    return current_task ? (int)current_task->process.uid : -1;
+    return fs_find_inode(filename) != NULL;
 }
 
-static int sys_getgid_impl(int _0, int _1, int _2, int _3, int _4)
+fs_inode_t *fs_find_inode(const char *filename)
 {
-    (void)_0;
-    (void)_1;
-    (void)_2;
-    (void)_3;
-    (void)_4;
-    return current_task ? (int)current_task->process.gid : -1;
+    if (!filesystem.initialized || !filename)
+        return NULL;
+
+    int i = fs_lookup_path(filename);
+    if (i < 0 || fs_inode(i)->type != FS_INODE_FILE)
+        return NULL;
+
+    // Доступ по пути видит и данные, ещё лежащие в буферах открытых файлов
+    fs_inode_flush(fs_inode(i));
+    return fs_inode(i);
 }
 
-static const struct
+// Перезапись содержимого файла
+int fs_write_file(const char *filename, const char *data, uint32_t size)
 {
-    int num;
-    syscall_fn_t fn;
-} syscall_table[] = {
-    {SYS_EXIT, sys_exit_impl},
-    {SYS_WRITE, sys_write_impl},
-    {SYS_READ, sys_read_impl},
-    {SYS_OPEN, sys_open_impl},
-    {SYS_CLOSE, sys_close_impl},
-    {SYS_FORK, sys_fork_impl},
-    {SYS_EXEC, sys_exec_impl},
-    {SYS_WAIT, sys_wait_impl},
-    {SYS_GETPID, sys_getpid_impl},
-    {SYS_GETPPID, sys_getppid_impl},
-    {SYS_GETUID, sys_getuid_impl},
-    {SYS_GETGID, sys_getgid_impl},
-    {SYS_YIELD, sys_yield_impl},
-};
+    if (!filesystem.initialized || !filename || !data || size == 0)
+        return -1;
 
-static syscall_fn_t find_syscall(int num)
-{
-    for (unsigned i = 0; i < (sizeof(syscall_table) / sizeof(syscall_table[0])); i++)
-        if (syscall_table[i].num == num)
-            return syscall_table[i].fn;
-    return NULL;
+    fs_inode_t *inode = fs_find_inode(filename);
+    if (!inode)
+    {
+        terminal_writestring("File not found: ");
+        terminal_writestring(filename);
+        terminal_writestring("\n");
+        return -1;
+    }
+
+    if (fs_inode_readonly(inode))
+    {
+        terminal_writestring("Read-only file: ");
+        terminal_writestring(filename);
+        terminal_writestring("\n");
+        return -1;
+    }
+
+    // Отдаём лишние блоки, оставшиеся экстенты переиспользуем. Новое
+    // содержимое до FS_INLINE_MAX байт уходит в inode, блоки освобождаются
+    fs_inode_truncate(inode, size <= FS_INLINE_MAX ? 0 : size);
+    inode->size = 0;
+
+    if (fs_inode_write(inode, 0, data, size) < 0)
+    {
+        fs_inode_truncate(inode, 0);
+        return -1;
+    }
+
+    fs_inode_settle(inode);
+    return 0;
 }
 
-int handle_syscall(int syscall_num, int arg0, int arg1, int arg2, int arg3, int arg4)
+// Дописывание в конец файла
+int fs_append_file(const char *filename, const char *data, uint32_t size)
 {
-    if (!current_task)
+    if (!filesystem.initialized || !filename || !data || size == 0)
         return -1;
-    syscall_fn_t fn = find_syscall(syscall_num);
-    if (!fn)
+
+    fs_inode_t *inode = fs_find_inode(filename);
+    if (!inode)
+    {
+        terminal_writestring("File not found: ");
+        terminal_writestring(filename);
+        terminal_writestring("\n");
         return -1;
-    return fn(arg0, arg1, arg2, arg3, arg4);
-}
+    }
 
-// === КОМАНДЫ ШЕЛЛА ===
+    if (fs_inode_write(inode, inode->size, data, size) < 0)
+        return -1;
 
-void shell_prompt(void)
-{
-    terminal_writestring("myos> ");
+    fs_inode_settle(inode);
+    return 0;
 }
 
-void command_help(void)
+// Включение или выключение сжатия файла. Включённое сжатие применяется
+// сразу, если файл никем не открыт, иначе — когда его закроет последний
+// писатель. Возвращает 1, если данные файла теперь сжаты
+int fs_compress_file(const char *filename, int enable)
 {
-    terminal_writestring("Available commands:\n");
-    terminal_writestring("  help       - Show this help\n");
-    terminal_writestring("  clear      - Clear screen\n");
-    terminal_writestring("  about      - System information\n");
-    terminal_writestring("  memory     - Memory usage + stats\n");
-    terminal_writestring("  memtest    - Test memory allocator\n");
-    terminal_writestring("  keyboard   - Keyboard status\n");
-    terminal_writestring("  tasks      - List tasks\n");
-    terminal_writestring("  schedule   - Trigger scheduler\n");
-    terminal_writestring("  ls         - List files\n");
-    terminal_writestring("  touch <f>  - Create file\n");
-    terminal_writestring("  cat <f>    - Show file content\n");
-    terminal_writestring("  rm <f>     - Delete file\n");
-    terminal_writestring("  echo <t> > <f> - Write text to file\n");
-    terminal_writestring("  testelf    - Test ELF loader\n");
-    terminal_writestring("  run <f>    - Run ELF program from file\n");
-    terminal_writestring("  ps         - List processes\n");
-    terminal_writestring("  kill <pid> - Kill process\n");
-    terminal_writestring("  fork       - Test fork system call\n");
-    terminal_writestring("  pwd        - Print working directory\n");
-    terminal_writestring("  cd <dir>   - Change directory\n");
-    terminal_writestring("  mkdir <dir> - Create directory\n");
-    terminal_writestring("  rmdir <dir> - Remove directory\n");
-    terminal_writestring("  syscalls   - Test system calls\n");
-    terminal_writestring("  reboot     - Restart system\n");
-    terminal_writestring("  poweroff   - Shutdown system\n");
-    terminal_writestring("\nELF Loader Commands:\n");
-    terminal_writestring("  testelf    - Test built-in ELF program\n");
-    terminal_writestring("  run <file> - Load and execute ELF file\n");
-    terminal_writestring("\nProcess Management:\n");
-    terminal_writestring("  ps         - List all processes\n");
-    terminal_writestring("  kill <pid> - Terminate process\n");
-    terminal_writestring("  fork       - Test process forking\n");
-    terminal_writestring("\n");
+    if (!filesystem.initialized || !filename)
+        return -1;
+
+    fs_inode_t *inode = fs_find_inode(filename);
+    if (!inode)
+    {
+        terminal_writestring("File not found: ");
+        terminal_writestring(filename);
+        terminal_writestring("\n");
+        return -1;
+    }
+    if (fs_inode_readonly(inode))
+    {
+        terminal_writestring("Read-only file: ");
+        terminal_writestring(filename);
+        terminal_writestring("\n");
+        return -1;
+    }
+
+    if (enable)
+    {
+        inode->flags |= FS_INODE_F_COMPRESS;
+        fs_inode_settle(inode);
+    }
+    else
+    {
+        inode->flags &= ~FS_INODE_F_COMPRESS;
+        if ((inode->flags & FS_INODE_F_COMPRESSED) && fs_inode_expand(inode) < 0)
+            return -1;
+    }
+    fs_meta_dirty();
+    return (inode->flags & FS_INODE_F_COMPRESSED) != 0;
 }
 
-void command_clear(void)
+// Клон файла: dst получает те же блоки данных, что и src, со ссылками на
+// них, и дальше расходится с ним копированием при записи. Существующий
+// файл dst перезаписывается. Данные initrd (не в блоках) копируются.
+// Только для ФС в памяти: счётчики ссылок не хранятся на диске
+int fs_clone_file(const char *src, const char *dst)
+{
+    if (!filesystem.initialized || !src || !dst)
+        return -1;
+
+    fs_inode_t *from = fs_find_inode(src);
+    if (!from)
+    {
+        terminal_writestring("File not found: ");
+        terminal_writestring(src);
+        terminal_writestring("\n");
+        return -1;
+    }
+    if (!filesystem.block_refs)
+    {
+        terminal_writestring("Reflink is only supported by the in-memory filesystem\n");
+        return -1;
+    }
+    if (fs_comp_pack(from) < 0)
+        return -1;
+    for (uint32_t i = 0; i < from->extent_count && !(from->flags & (FS_INODE_F_MEMORY | FS_INODE_F_INLINE)); i++)
+    {
+        for (uint32_t j = 0; j < from->extents[i].length; j++)
+        {
+            if (filesystem.block_refs[from->extents[i].start + j] >= FS_BLOCK_REFS_MAX)
+            {
+                terminal_writestring("Too many references to shared blocks: ");
+                terminal_writestring(src);
+                terminal_writestring("\n");
+                return -1;
+            }
+        }
+    }
+
+    fs_inode_t *to = fs_find_inode(dst);
+    if (!to)
+    {
+        int created = fs_create_file(dst);
+        if (created < 0)
+            return -1;
+        to = fs_inode(created);
+    }
+    if (to == from)
+        return 0;
+    if (fs_inode_readonly(to))
+    {
+        terminal_writestring("Read-only file: ");
+        terminal_writestring(dst);
+        terminal_writestring("\n");
+        return -1;
+    }
+
+    fs_inode_truncate(to, 0);
+    to->size = 0;
+
+    if (from->flags & FS_INODE_F_MEMORY)
+    {
+        if (from->size > 0 && fs_inode_write(to, 0, (const void *)from->extents[0].start, from->size) < 0)
+        {
+            fs_inode_truncate(to, 0);
+            return -1;
+        }
+        return 0;
+    }
+
+    // Встроенные данные копируются вместе с массивом экстентов
+    memcpy(to->extents, from->extents, sizeof(to->extents));
+    to->extent_count = from->extent_count;
+    for (uint32_t i = 0; i < from->extent_count; i++)
+    {
+        for (uint32_t j = 0; j < from->extents[i].length; j++)
+            filesystem.block_refs[from->extents[i].start + j]++;
+        filesystem.dedup_shared += from->extents[i].length;
+    }
+
+    uint32_t storage = FS_INODE_F_INLINE | FS_INODE_F_COMPRESS | FS_INODE_F_COMPRESSED;
+    to->flags = (to->flags & ~storage) | (from->flags & storage);
+    to->size = from->size;
+    to->modified_time = fs_time_counter++;
+    fs_notify_modify(to);
+    return 0;
+}
+
+// Включение или выключение дедупликации ФС в памяти. Включение сразу
+// проходит по всем записанным файлам, которые никем не открыты; общие
+// блоки остаются общими и после выключения. Возвращает число блоков,
+// ставших общими
+int fs_set_dedup(int enable)
+{
+    if (!filesystem.initialized)
+        return -1;
+    if (!filesystem.block_refs)
+    {
+        terminal_writestring("Deduplication is only supported by the in-memory filesystem\n");
+        return -1;
+    }
+
+    filesystem.dedup = enable;
+    if (!enable)
+        return 0;
+
+    int shared = 0;
+    for (uint32_t i = 0; i < filesystem.inode_capacity; i++)
+    {
+        fs_inode_t *inode = fs_inode(i);
+        if (inode->type == FS_INODE_FILE && !fs_inode_is_open(inode))
+            shared += fs_inode_dedup(inode);
+    }
+    return shared;
+}
+
+// Место под данные в KB: логическое (как если бы общих блоков не было)
+// и физическое (занятые блоки)
+void fs_data_usage(uint32_t *logical_kb, uint32_t *physical_kb)
+{
+    uint32_t used = filesystem.superblock.total_blocks - 1 - filesystem.superblock.free_blocks;
+    *physical_kb = used / (1024 / FS_BLOCK_SIZE);
+    *logical_kb = (used + filesystem.dedup_shared) / (1024 / FS_BLOCK_SIZE);
+}
+
+int fs_read_file(const char *filename, char *buffer, uint32_t max_size)
+{
+    if (!filesystem.initialized || !filename || !buffer)
+        return -1;
+
+    fs_inode_t *inode = fs_find_inode(filename);
+    if (!inode || inode->size == 0)
+        return -1;
+
+    return fs_inode_read(inode, 0, buffer, max_size);
+}
+
+// Чтение части файла начиная с offset, в конце файла возвращает 0
+int fs_read_file_at(const char *filename, uint32_t offset, char *buffer, uint32_t size)
+{
+    if (!filesystem.initialized || !filename || !buffer)
+        return -1;
+
+    fs_inode_t *inode = fs_find_inode(filename);
+    if (!inode)
+        return -1;
+
+    return fs_inode_read(inode, offset, buffer, size);
+}
+
+int fs_delete_file(const char *filename)
+{
+    if (!filesystem.initialized || !filename)
+        return -1;
+
+    fs_inode_t *inode = fs_find_inode(filename);
+    if (inode)
+    {
+        // Открытые файлы держат указатель на inode
+        if (fs_inode_is_open(inode))
+        {
+            terminal_writestring("File is open: ");
+            terminal_writestring(filename);
+            terminal_writestring("\n");
+            return -1;
+        }
+
+        fs_release_node(inode - filesystem.inodes);
+        return 0;
+    }
+
+    terminal_writestring("File not found: ");
+    terminal_writestring(filename);
+    terminal_writestring("\n");
+    return -1;
+}
+
+// Переименование или перенос файла либо директории в другую директорию.
+// Inode и данные остаются на месте, меняются только записи директорий
+int fs_rename(const char *old_path, const char *new_path)
+{
+    if (!filesystem.initialized || !old_path || !new_path)
+        return -1;
+
+    int i = fs_lookup_path(old_path);
+    if (i < 0 || i == FS_ROOT_INODE)
+    {
+        terminal_writestring("File not found: ");
+        terminal_writestring(old_path);
+        terminal_writestring("\n");
+        return -1;
+    }
+
+    char name[FS_MAX_FILENAME];
+    int parent = fs_lookup_parent(new_path, name);
+    if (parent < 0 || fs_inode(parent)->type != FS_INODE_DIR)
+    {
+        terminal_writestring("No such directory: ");
+        terminal_writestring(new_path);
+        terminal_writestring("\n");
+        return -1;
+    }
+    if (vfs_mount_at(parent))
+    {
+        terminal_writestring("Read-only filesystem: ");
+        terminal_writestring(new_path);
+        terminal_writestring("\n");
+        return -1;
+    }
+    if (fs_lookup(parent, name) >= 0)
+    {
+        terminal_writestring("File already exists: ");
+        terminal_writestring(new_path);
+        terminal_writestring("\n");
+        return -1;
+    }
+
+    // Директорию нельзя перенести внутрь неё самой
+    for (uint32_t p = parent; p != FS_ROOT_INODE; p = fs_inode(p)->parent_inode)
+    {
+        if (p == (uint32_t)i)
+        {
+            terminal_writestring("Cannot move a directory into itself\n");
+            return -1;
+        }
+    }
+
+    fs_inode_t *inode = fs_inode(i);
+    if (fs_add_entry_to_dir(parent, i, name, inode->type) < 0)
+    {
+        terminal_writestring("Directory full\n");
+        return -1;
+    }
+    uint32_t cookie = ++fs_watch_cookie;
+    fs_notify_entry(i, IN_MOVED_FROM, cookie);
+    fs_remove_entry_from_dir(inode->parent_inode, inode->filename);
+    fs_dcache_store(inode->parent_inode, inode->filename, -1);
+
+    memset(inode->filename, 0, FS_MAX_FILENAME);
+    strncpy(inode->filename, name, FS_MAX_FILENAME - 1);
+    inode->parent_inode = parent;
+    fs_meta_dirty();
+    fs_dcache_store(parent, name, i);
+    fs_notify_entry(i, IN_MOVED_TO, cookie);
+    fs_notify_self(i, IN_MOVE_SELF);
+    return 0;
+}
+
+// === ОТКРЫТЫЕ ФАЙЛЫ ===
+
+// Открыт ли файл хотя бы одним дескриптором
+static int fs_inode_is_open(fs_inode_t *inode)
+{
+    for (int i = 0; i < FS_MAX_OPEN_FILES; i++)
+    {
+        if (open_files[i].ref_count > 0 && open_files[i].inode == inode)
+            return 1;
+    }
+    return 0;
+}
+
+// Сброс буфера записи открытого файла в блоки. При ошибке данные остаются
+// в буфере: ошибку получит следующая запись или close
+static int fs_file_flush(open_file_t *file)
+{
+    if (file->wbuf_len == 0)
+        return 0;
+
+    if (fs_inode_write(file->inode, file->wbuf_offset, file->wbuf, file->wbuf_len) < 0)
+        return -1;
+    file->wbuf_len = 0;
+    open_files_buffered--;
+    return 0;
+}
+
+// Сброс буферов записи всех открытых файлов inode: перед чтением и доступом
+// по пути данные должны быть в блоках
+static void fs_inode_flush(fs_inode_t *inode)
+{
+    if (open_files_buffered == 0)
+        return;
+
+    for (int i = 0; i < FS_MAX_OPEN_FILES; i++)
+    {
+        if (open_files[i].wbuf_len > 0 && open_files[i].inode == inode)
+            fs_file_flush(&open_files[i]);
+    }
+}
+
+// Свободный слот таблицы открытых файлов с одной ссылкой
+static open_file_t *fs_file_alloc(int flags)
+{
+    for (int slot = 0; slot < FS_MAX_OPEN_FILES; slot++)
+    {
+        open_file_t *file = &open_files[slot];
+        if (file->ref_count == 0)
+        {
+            file->offset = 0;
+            file->flags = flags;
+            file->ref_count = 1;
+            return file;
+        }
+    }
+
+    terminal_writestring("Too many open files\n");
+    return NULL;
+}
+
+static const file_ops_t fs_inode_file_ops;
+static const file_ops_t fs_dir_file_ops;
+// Открытие файла по пути. Путь разрешается один раз, дальше ввод-вывод
+// идёт через операции и позицию открытого файла. Пути под точкой
+// монтирования открывает смонтированная там ФС
+open_file_t *fs_open(const char *path, int flags)
+{
+    if (!filesystem.initialized || !path)
+        return NULL;
+
+    vfs_mount_t *mount;
+    const char *rest;
+    int i = fs_walk(path, &mount, &rest);
+    if (mount)
+        return mount->ops->open(rest, flags);
+
+    if (i < 0 && (flags & O_CREAT))
+        i = fs_create_node(path, FS_INODE_FILE);
+
+    // Директория открывается только на чтение — для getdents
+    if (i >= 0 && fs_inode(i)->type == FS_INODE_DIR && (flags & O_ACCMODE) == O_RDONLY)
+    {
+        open_file_t *file = fs_file_alloc(flags);
+        if (file)
+        {
+            file->ops = &fs_dir_file_ops;
+            file->private_data = fs_inode(i);
+        }
+        return file;
+    }
+    if (i < 0 || fs_inode(i)->type != FS_INODE_FILE)
+        return NULL;
+
+    fs_inode_t *inode = fs_inode(i);
+    if (fs_inode_readonly(inode) && (flags & O_ACCMODE) != O_RDONLY)
+        return NULL;
+
+    open_file_t *file = fs_file_alloc(flags);
+    if (!file)
+        return NULL;
+
+    // O_TRUNC без права записи игнорируется
+    if ((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY)
+    {
+        fs_inode_flush(inode);
+        fs_inode_truncate(inode, 0);
+        inode->size = 0;
+        inode->modified_time = fs_time_counter++;
+        fs_notify_modify(inode);
+    }
+
+    file->ops = &fs_inode_file_ops;
+    file->inode = inode;
+    return file;
+}
+
+// Новая ссылка на открытый файл (fork, dup)
+open_file_t *fs_file_dup(open_file_t *file)
+{
+    if (file)
+        file->ref_count++;
+    return file;
+}
+
+// Закрытие ссылки; последняя сбрасывает буфер записи и освобождает слот.
+// Возвращает -1, если данные файла не удалось записать
+int fs_close(open_file_t *file)
+{
+    if (!file || file->ref_count == 0)
+        return -1;
+
+    int result = 0;
+    if (--file->ref_count == 0)
+    {
+        if (file->ops && file->ops->release)
+            result = file->ops->release(file);
+        memset(file, 0, sizeof(open_file_t));
+    }
+    return result;
+}
+
+// Копирование участка в буфер ядра и из него (ctx — позиция в буфере)
+static int fs_span_to_buffer(void *ctx, uint8_t *data, uint32_t size)
+{
+    uint8_t **buf = (uint8_t **)ctx;
+    memcpy(*buf, data, size);
+    *buf += size;
+    return size;
+}
+
+static int fs_span_from_buffer(void *ctx, uint8_t *data, uint32_t size)
+{
+    uint8_t **buf = (uint8_t **)ctx;
+    memcpy(data, *buf, size);
+    *buf += size;
+    return size;
+}
+
+// Чтение файла корневой ФС: fn получает участки прямо из блоков хранения
+static int fs_inode_read_spans(open_file_t *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx)
+{
+    fs_inode_t *inode = file->inode;
+    fs_inode_flush(inode);
+
+    int advance = offset == FS_AT_POSITION;
+    if (advance)
+        offset = file->offset;
+    if (offset >= inode->size)
+        return 0;
+    if (size > inode->size - offset)
+        size = inode->size - offset;
+
+    uint32_t done = 0;
+    while (done < size)
+    {
+        uint8_t *data;
+        uint32_t chunk = fs_inode_span(inode, offset + done, size - done, &data, 0);
+        if (chunk == 0)
+        {
+            if (done == 0)
+                return -1; // Данные до конца файла не прочитались
+            break;
+        }
+        int handled = fn(ctx, data, chunk);
+        fs_span_put(data);
+        if (handled < 0)
+        {
+            if (done == 0)
+                return -1;
+            break;
+        }
+
+        done += handled;
+        if ((uint32_t)handled < chunk)
+            break; // Потребитель принял не всё
+    }
+
+    if (advance)
+        file->offset = offset + done;
+    return done;
+}
+
+// Запись напрямую в блоки хранения: fn заполняет их участки.
+// Размер файла растёт только на фактически записанные байты. Накопленное
+// в буферах других дескрипторов файла пишется раньше, иначе оно легло бы
+// поверх этой записи
+static int fs_file_write_direct(open_file_t *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx)
+{
+    fs_inode_t *inode = file->inode;
+    fs_inode_flush(inode);
+    if (fs_inode_prepare_write(inode, offset, size) < 0)
+        return -1;
+
+    uint32_t done = 0;
+    while (done < size)
+    {
+        uint8_t *data;
+        uint32_t chunk = fs_inode_span(inode, offset + done, size - done, &data, 1);
+        if (chunk == 0)
+            break;
+        int handled = fs_span_written(data, fn(ctx, data, chunk), chunk);
+        fs_span_put(data);
+        if (handled <= 0)
+            break;
+
+        done += handled;
+        if ((uint32_t)handled < chunk)
+            break;
+    }
+
+    // Блоки, выделенные под непринятую часть записи, возвращаются (у
+    // сжатого файла блоки не выделялись)
+    if (done < size && !(inode->flags & FS_INODE_F_COMPRESSED))
+        fs_inode_truncate(inode, offset + done > inode->size ? offset + done : inode->size);
+    if (done == 0)
+        return -1;
+    fs_inode_commit_write(inode, offset + done);
+    return done;
+}
+
+// Запись в файл корневой ФС. Небольшие последовательные записи копятся в
+// буфере открытого файла и попадают в блоки одной записью — при заполнении
+// буфера, несмежной записи, чтении или закрытии. При O_APPEND позиция — конец
+// файла
+static int fs_inode_write_spans(open_file_t *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx)
+{
+    int advance = offset == FS_AT_POSITION;
+    if (advance)
+    {
+        offset = file->offset;
+        if (file->flags & O_APPEND)
+        {
+            // Конец файла с учётом несброшенных данных: если в буферах
+            // есть чужие данные этого файла, сбрасываем все буферы inode
+            if (open_files_buffered > (file->wbuf_len > 0 ? 1u : 0u))
+                fs_inode_flush(file->inode);
+            offset = file->inode->size;
+            if (file->wbuf_len > 0 && file->wbuf_offset + file->wbuf_len > offset)
+                offset = file->wbuf_offset + file->wbuf_len;
+        }
+    }
+
+    // Несмежная запись или переполнение — сначала сбрасываем накопленное
+    if (file->wbuf_len > 0 &&
+        (offset != file->wbuf_offset + file->wbuf_len || file->wbuf_len + size > FS_WRITE_BUFFER_SIZE))
+    {
+        if (fs_file_flush(file) < 0)
+            return -1;
+    }
+
+    int result;
+    if (size < FS_WRITE_BUFFER_SIZE && (file->wbuf || (file->wbuf = (uint8_t *)kmalloc(FS_WRITE_BUFFER_SIZE))))
+    {
+        if (file->wbuf_len == 0)
+            file->wbuf_offset = offset;
+
+        result = fn(ctx, file->wbuf + file->wbuf_len, size);
+        if (result <= 0)
+            return -1;
+
+        if (file->wbuf_len == 0)
+            open_files_buffered++;
+        file->wbuf_len += result;
+        if (file->wbuf_len == FS_WRITE_BUFFER_SIZE && fs_file_flush(file) < 0)
+            return -1;
+    }
+    else
+    {
+        result = fs_file_write_direct(file, offset, size, fn, ctx);
+    }
+
+    if (result > 0 && advance)
+        file->offset = offset + result;
+    return result;
+}
+
+// Размер с учётом несброшенных буферов записи
+static uint32_t fs_inode_file_size(open_file_t *file)
+{
+    fs_inode_flush(file->inode);
+    return file->inode->size;
+}
+
+// Последний close сбрасывает буфер записи. Когда уходит последняя ссылка
+// на изменённый файл (в любом режиме), он сжимается или делит блоки с
+// другими файлами
+static int fs_inode_release(open_file_t *file)
+{
+    int result = fs_file_flush(file);
+    if (result < 0)
+        open_files_buffered--; // Несохранённый буфер уходит вместе с файлом
+    if (file->wbuf)
+        kfree(file->wbuf);
+    if (file->inode->flags & FS_INODE_F_UNSETTLED)
+        fs_inode_settle(file->inode);
+    return result;
+}
+
+static const file_ops_t fs_inode_file_ops = {
+    .read_spans = fs_inode_read_spans,
+    .write_spans = fs_inode_write_spans,
+    .size = fs_inode_file_size,
+    .release = fs_inode_release,
+};
+
+// Открытая директория: private_data — её inode (открытую директорию нельзя
+// удалить, см. fs_delete_directory), позиция — ключ обхода fs_dir_iterate_at
+static int fs_dir_file_readdir(open_file_t *file, fs_dir_fn_t fn, void *ctx)
+{
+    return fs_dir_iterate_at((fs_inode_t *)file->private_data, &file->offset, fn, ctx);
+}
+
+static const file_ops_t fs_dir_file_ops = {
+    .readdir = fs_dir_file_readdir,
+};
+
+// Чтение без промежуточного буфера: fn получает участки прямо из памяти
+// хранения файла. offset == FS_AT_POSITION — с позиции открытого файла со
+// сдвигом. Возвращает число переданных байт, 0 — конец файла
+int fs_file_read_spans(open_file_t *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx)
+{
+    if (!file || !file->ops || !file->ops->read_spans || !fn || (file->flags & O_ACCMODE) == O_WRONLY)
+        return -1;
+    return file->ops->read_spans(file, offset, size, fn, ctx);
+}
+
+// Запись без промежуточного буфера: fn заполняет участки памяти хранения.
+// offset == FS_AT_POSITION — с позиции открытого файла (или с конца при
+// O_APPEND) со сдвигом
+int fs_file_write_spans(open_file_t *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx)
+{
+    if (!file || !file->ops || !file->ops->write_spans || !fn || (file->flags & O_ACCMODE) == O_RDONLY)
+        return -1;
+    if (size == 0)
+        return 0;
+    return file->ops->write_spans(file, offset, size, fn, ctx);
+}
+
+// Чтение по смещению без изменения позиции
+int fs_file_pread(open_file_t *file, void *buffer, uint32_t size, uint32_t offset)
+{
+    return fs_file_read_spans(file, offset, size, fs_span_to_buffer, &buffer);
+}
+
+// Запись по смещению без изменения позиции
+int fs_file_pwrite(open_file_t *file, const void *data, uint32_t size, uint32_t offset)
+{
+    return fs_file_write_spans(file, offset, size, fs_span_from_buffer, &data);
+}
+
+// Последовательное чтение с текущей позиции
+int fs_file_read(open_file_t *file, void *buffer, uint32_t size)
+{
+    return fs_file_read_spans(file, FS_AT_POSITION, size, fs_span_to_buffer, &buffer);
+}
+
+// Последовательная запись с текущей позиции
+int fs_file_write(open_file_t *file, const void *data, uint32_t size)
+{
+    return fs_file_write_spans(file, FS_AT_POSITION, size, fs_span_from_buffer, &data);
+}
+
+// Смена позиции, возвращает новую позицию. Позиция за концом файла
+// допустима: запись туда дополнит файл нулями
+int fs_file_seek(open_file_t *file, int offset, int whence)
+{
+    if (!file || !file->ops)
+        return -1;
+
+    int base;
+    switch (whence)
+    {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = (int)file->offset;
+        break;
+    case SEEK_END:
+        base = (int)fs_file_size(file);
+        break;
+    default:
+        return -1;
+    }
+
+    if (base + offset < 0)
+        return -1;
+
+    file->offset = base + offset;
+    return (int)file->offset;
+}
+
+// Текущий размер открытого файла (с учётом несброшенных буферов записи)
+uint32_t fs_file_size(open_file_t *file)
+{
+    return file->ops && file->ops->size ? file->ops->size(file) : 0;
+}
+
+// Записи открытой директории с её позиции: fn получает записи, пока не
+// вернёт не 0, и позиция остаётся на записи, где обход прерван. Возвращает
+// результат fn, 0 — записи кончились, -1 — файл не директория
+int fs_file_readdir(open_file_t *file, fs_dir_fn_t fn, void *ctx)
+{
+    if (!file || !file->ops || !file->ops->readdir || !fn)
+        return -1;
+    return file->ops->readdir(file, fn, ctx);
+}
+
+// Сведения о файле или директории корневой ФС
+void fs_stat_inode(uint32_t inode_num, stat_t *st)
+{
+    fs_inode_t *inode = fs_inode(inode_num);
+    if (inode->type == FS_INODE_FILE)
+        fs_inode_flush(inode);
+
+    st->st_ino = inode_num;
+    st->st_type = inode->type; // DT_FILE и DT_DIR совпадают с FS_INODE_*
+    st->st_size = inode->size;
+    st->st_blocks = fs_inode_block_count(inode);
+    st->st_ctime = inode->created_time;
+    st->st_mtime = inode->modified_time;
+}
+
+static int vfs_stat(vfs_mount_t *mount, const char *rest, stat_t *st);
+
+// Сведения о файле по пути, в том числе на смонтированной ФС
+int fs_stat(const char *path, stat_t *st)
+{
+    if (!filesystem.initialized || !path)
+        return -1;
+
+    memset(st, 0, sizeof(stat_t));
+    vfs_mount_t *mount;
+    const char *rest;
+    int i = fs_walk(path, &mount, &rest);
+    if (mount)
+        return vfs_stat(mount, rest, st);
+
+    if (i < 0)
+        return -1;
+    fs_stat_inode(i, st);
+    return 0;
+}
+
+// === НАБЛЮДЕНИЕ ЗА ФАЙЛАМИ ===
+
+// Изменения файлов и директорий корневой ФС попадают в очереди
+// наблюдателей (формат в inotify.h), так что программы узнают о них без
+// опроса и перечитывания. Пока наблюдений нет, уведомление — одна проверка
+// счётчика
+
+// Постановка события в очередь. Повтор последнего события отбрасывается,
+// последний свободный слот занимает IN_Q_OVERFLOW, дальше события теряются
+static void fs_watch_queue(fs_watcher_t *watcher, int32_t wd, uint32_t mask, uint32_t cookie, const char *name)
+{
+    if (watcher->count == FS_WATCH_QUEUE)
+        return;
+    if (watcher->count > 0)
+    {
+        fs_watch_event_t *last = &watcher->events[(watcher->head + watcher->count - 1) % FS_WATCH_QUEUE];
+        if (last->wd == wd && last->mask == mask && last->cookie == cookie && strcmp(last->name, name) == 0)
+            return;
+    }
+    if (watcher->count == FS_WATCH_QUEUE - 1)
+    {
+        wd = -1;
+        mask = IN_Q_OVERFLOW;
+        cookie = 0;
+        name = "";
+    }
+
+    fs_watch_event_t *event = &watcher->events[(watcher->head + watcher->count) % FS_WATCH_QUEUE];
+    event->wd = wd;
+    event->mask = mask;
+    event->cookie = cookie;
+    memset(event->name, 0, FS_MAX_FILENAME);
+    strncpy(event->name, name, FS_MAX_FILENAME - 1);
+    watcher->count++;
+}
+
+// Событие всем наблюдениям за inode_num, подписанным на него
+static void fs_watch_post(uint32_t inode_num, uint32_t mask, uint32_t cookie, const char *name, int is_dir)
+{
+    for (int i = 0; i < FS_MAX_WATCHES; i++)
+    {
+        fs_watch_t *watch = &fs_watches[i];
+        if (watch->watcher && watch->inode == inode_num && (watch->mask & mask))
+            fs_watch_queue(watch->watcher, i + 1, mask | (is_dir ? IN_ISDIR : 0), cookie, name);
+    }
+}
+
+// Снятие наблюдения; наблюдатель получает IN_IGNORED
+static void fs_watch_drop(int slot)
+{
+    fs_watch_queue(fs_watches[slot].watcher, slot + 1, IN_IGNORED, 0, "");
+    fs_watches[slot].watcher = NULL;
+    fs_watch_count--;
+}
+
+// Изменение данных файла: наблюдениям за ним и за его директорией.
+// Временные inode вне таблицы (перепаковка при сжатии) не уведомляют
+static void fs_notify_modify(fs_inode_t *inode)
+{
+    if (fs_watch_count == 0 || inode < filesystem.inodes ||
+        inode >= filesystem.inodes + filesystem.inode_capacity || inode->type != FS_INODE_FILE)
+        return;
+
+    fs_watch_post(inode - filesystem.inodes, IN_MODIFY, 0, "", 0);
+    fs_watch_post(inode->parent_inode, IN_MODIFY, 0, inode->filename, 0);
+}
+
+// Появление или исчезновение записи inode_num в её директории (IN_CREATE,
+// IN_DELETE, IN_MOVED_*): событие наблюдениям за директорией с именем записи
+static void fs_notify_entry(uint32_t inode_num, uint32_t mask, uint32_t cookie)
+{
+    if (fs_watch_count == 0)
+        return;
+    fs_inode_t *inode = fs_inode(inode_num);
+    fs_watch_post(inode->parent_inode, mask, cookie, inode->filename, inode->type == FS_INODE_DIR);
+}
+
+// Событие самого inode (IN_DELETE_SELF, IN_MOVE_SELF). Наблюдения за
+// удалённым inode снимаются: его номер может достаться новому файлу
+static void fs_notify_self(uint32_t inode_num, uint32_t mask)
+{
+    if (fs_watch_count == 0)
+        return;
+    fs_watch_post(inode_num, mask, 0, "", fs_inode(inode_num)->type == FS_INODE_DIR);
+    if (mask != IN_DELETE_SELF)
+        return;
+    for (int i = 0; i < FS_MAX_WATCHES; i++)
+    {
+        if (fs_watches[i].watcher && fs_watches[i].inode == inode_num)
+            fs_watch_drop(i);
+    }
+}
+
+// Чтение событий целыми записями inotify_event_t. 0 — очередь пуста
+// (чтение не ждёт), -1 — следующая запись не помещается в size
+static int fs_watch_read(open_file_t *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx)
+{
+    (void)offset;
+    fs_watcher_t *watcher = (fs_watcher_t *)file->private_data;
+    uint32_t done = 0;
+    while (watcher->count > 0)
+    {
+        fs_watch_event_t *event = &watcher->events[watcher->head];
+        uint32_t name_len = event->name[0] ? (strlen(event->name) + 4) & ~3u : 0;
+        uint32_t reclen = sizeof(inotify_event_t) + name_len;
+        if (done + reclen > size)
+            break;
+
+        uint8_t record[sizeof(inotify_event_t) + FS_MAX_FILENAME + 4];
+        memset(record, 0, reclen);
+        inotify_event_t *rec = (inotify_event_t *)record;
+        rec->wd = event->wd;
+        rec->mask = event->mask;
+        rec->cookie = event->cookie;
+        rec->len = name_len;
+        if (name_len)
+            strcpy(rec->name, event->name);
+        if (fn(ctx, record, reclen) != (int)reclen)
+            return done > 0 ? (int)done : -1;
+
+        done += reclen;
+        watcher->head = (watcher->head + 1) % FS_WATCH_QUEUE;
+        watcher->count--;
+    }
+    return done > 0 || watcher->count == 0 ? (int)done : -1;
+}
+
+// Последний close: наблюдения уходят вместе с очередью
+static int fs_watch_release(open_file_t *file)
+{
+    for (int i = 0; i < FS_MAX_WATCHES; i++)
+    {
+        if (fs_watches[i].watcher == file->private_data)
+        {
+            fs_watches[i].watcher = NULL;
+            fs_watch_count--;
+        }
+    }
+    kfree(file->private_data);
+    return 0;
+}
+
+static const file_ops_t fs_watch_file_ops = {
+    .read_spans = fs_watch_read,
+    .release = fs_watch_release,
+};
+
+// Новый наблюдатель с пустой очередью
+open_file_t *fs_watch_open(void)
+{
+    fs_watcher_t *watcher = (fs_watcher_t *)kmalloc(sizeof(fs_watcher_t));
+    if (!watcher)
+        return NULL;
+    open_file_t *file = fs_file_alloc(O_RDONLY);
+    if (!file)
+    {
+        kfree(watcher);
+        return NULL;
+    }
+
+    memset(watcher, 0, sizeof(fs_watcher_t));
+    file->ops = &fs_watch_file_ops;
+    file->private_data = watcher;
+    return file;
+}
+
+// Наблюдение за файлом или директорией корневой ФС, возвращает wd.
+// Повторное добавление пути тем же наблюдателем заменяет маску
+int fs_watch_add(open_file_t *file, const char *path, uint32_t mask)
+{
+    if (!filesystem.initialized || !file || file->ops != &fs_watch_file_ops || !path || !(mask & IN_ALL_EVENTS))
+        return -1;
+
+    // Смонтированные ФС не уведомляют об изменениях
+    vfs_mount_t *mount;
+    const char *rest;
+    int inode_num = fs_walk(path, &mount, &rest);
+    if (mount || inode_num < 0)
+        return -1;
+
+    int free_slot = -1;
+    for (int i = 0; i < FS_MAX_WATCHES; i++)
+    {
+        fs_watch_t *watch = &fs_watches[i];
+        if (watch->watcher == file->private_data && watch->inode == (uint32_t)inode_num)
+        {
+            watch->mask = mask & IN_ALL_EVENTS;
+            return i + 1;
+        }
+        if (!watch->watcher && free_slot < 0)
+            free_slot = i;
+    }
+    if (free_slot < 0)
+        return -1;
+
+    fs_watches[free_slot].watcher = (fs_watcher_t *)file->private_data;
+    fs_watches[free_slot].inode = inode_num;
+    fs_watches[free_slot].mask = mask & IN_ALL_EVENTS;
+    fs_watch_count++;
+    return free_slot + 1;
+}
+
+// Снятие наблюдения wd, принадлежащего наблюдателю file
+int fs_watch_remove(open_file_t *file, int wd)
+{
+    if (!file || file->ops != &fs_watch_file_ops || wd < 1 || wd > FS_MAX_WATCHES ||
+        fs_watches[wd - 1].watcher != file->private_data)
+        return -1;
+    fs_watch_drop(wd - 1);
+    return 0;
+}
+
+// === ДЕФРАГМЕНТАЦИЯ ===
+
+// Фоновая дефрагментация из задачи idle. Файл из нескольких экстентов
+// переносится в один непрерывный участок, файл из одного экстента — в
+// первый подходящий свободный участок ближе к началу тома. Если такого
+// участка нет, файл сдвигается к началу тома через свободное место перед
+// ним, поэтому свободное место собирается в конце. Перенос идёт порциями:
+// новое место занимается заранее, старые блоки освобождаются после
+// последней порции, если inode за это время не изменился (иначе перенос
+// отменяется и проход продолжается со следующего inode). Новое место
+// занято только в памяти: на том карта блоков и суперблок пишутся без
+// него (fs_write_meta), так что сбой посреди переноса не теряет блоков.
+// Шаг из задачи idle копирует только блоки, уже лежащие в буферном кэше,
+// а для остальных запускает асинхронное чтение. Общие блоки (дедупликация,
+// клоны), встроенные данные и данные initrd не переносятся, корзины
+// директорий остаются на месте
+
+// Блок тома в буферном кэше (1), иначе запускается его чтение (0)
+static int fs_block_prefetch(uint32_t block)
+{
+    uint32_t sector = filesystem.superblock.data_start + block;
+    return bcache_prefetch(filesystem.device, sector / BCACHE_BLOCK_SECTORS);
+}
+
+// Копирование count блоков данных from -> to (участки не перекрываются).
+// Без wait копируются только блоки, которые не нужно ждать с устройства:
+// на первом же неготовом блоке запускается чтение оставшихся, и
+// копирование останавливается. Возвращает число скопированных блоков
+static int fs_copy_blocks(uint32_t from, uint32_t to, uint32_t count, int wait)
+{
+    if (!filesystem.device)
+    {
+        memcpy(filesystem.data_blocks + to * FS_BLOCK_SIZE, filesystem.data_blocks + from * FS_BLOCK_SIZE,
+               count * FS_BLOCK_SIZE);
+        return count;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!wait && !(fs_block_prefetch(from + i) & fs_block_prefetch(to + i)))
+        {
+            for (uint32_t j = i + 1; j < count; j++)
+            {
+                fs_block_prefetch(from + j);
+                fs_block_prefetch(to + j);
+            }
+            return i;
+        }
+
+        uint32_t src_within, dst_within;
+        bcache_buf_t *src = fs_block_buffer(from + i, &src_within, 1);
+        if (!src)
+            return -1;
+        bcache_buf_t *dst = fs_block_buffer(to + i, &dst_within, 1);
+        if (!dst)
+        {
+            bcache_put(src);
+            return -1;
+        }
+        memcpy(dst->data + dst_within, src->data + src_within, FS_BLOCK_SIZE);
+        bcache_mark_dirty(dst);
+        bcache_put(dst);
+        bcache_put(src);
+    }
+    return count;
+}
+
+// Первый свободный участок не короче length, начинающийся до limit (0 — нет)
+static uint32_t fs_defrag_find_run(uint32_t length, uint32_t limit)
+{
+    uint32_t *bitmap = filesystem.block_bitmap;
+    uint32_t total = filesystem.superblock.total_blocks;
+    for (uint32_t i = 1; i < limit;)
+    {
+        uint32_t start = fs_bitmap_next(bitmap, limit, i, 0);
+        if (start >= limit)
+            break;
+        uint32_t end = fs_bitmap_next(bitmap, total, start, 1);
+        if (end - start >= length)
+            return start;
+        i = end;
+    }
+    return 0;
+}
+
+// Есть ли у inode общие блоки
+static int fs_inode_has_shared(fs_inode_t *inode)
+{
+    uint8_t *refs = filesystem.block_refs;
+    for (uint32_t i = 0; refs && i < inode->extent_count; i++)
+    {
+        for (uint32_t j = 0; j < inode->extents[i].length; j++)
+        {
+            if (refs[inode->extents[i].start + j] > 0)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+// Начало свободного участка, который заканчивается перед блоком end (end — нет)
+static uint32_t fs_free_run_before(uint32_t end)
+{
+    uint32_t *bitmap = filesystem.block_bitmap;
+    for (uint32_t i = fs_bitmap_next(bitmap, end, 1, 0); i < end;)
+    {
+        uint32_t used = fs_bitmap_next(bitmap, end, i, 1);
+        if (used == end)
+            return i;
+        i = fs_bitmap_next(bitmap, end, used, 0);
+    }
+    return end;
+}
+
+// Начало переноса участка файла inode_num, если для него есть место лучше
+// текущего. Свободное место за экстентом сначала заполняется началом
+// следующего экстента, если тот лежит дальше по тому. Иначе файл целиком
+// переносится в первый вмещающий его свободный участок (файл из одного
+// экстента — только ближе к началу тома), а если такого нет, начало
+// единственного экстента переносится в свободное место перед ним — дальше
+// сдвиг продолжается заполнением освободившегося места за экстентом
+static int fs_defrag_start(uint32_t inode_num)
+{
+    fs_inode_t *inode = fs_inode(inode_num);
+    if ((inode->type != FS_INODE_FILE && inode->type != FS_INODE_DIR) || inode->extent_count == 0 ||
+        (inode->flags & (FS_INODE_F_MEMORY | FS_INODE_F_INLINE)) || fs_inode_has_shared(inode))
+        return 0;
+
+    uint32_t blocks = fs_inode_block_count(inode);
+    uint32_t first = 0;
+    uint32_t length = blocks;
+    uint32_t target = 0;
+    uint32_t index = 0; // Порядковый номер первого блока следующего экстента
+    for (uint32_t i = 0; i + 1 < inode->extent_count && target == 0; i++)
+    {
+        uint32_t end = inode->extents[i].start + inode->extents[i].length;
+        fs_extent_t next = inode->extents[i + 1];
+        index += inode->extents[i].length;
+        uint32_t gap = next.start > end ? fs_bitmap_next(filesystem.block_bitmap, next.start, end, 1) - end : 0;
+        if (gap > 0)
+        {
+            first = index;
+            length = gap < next.length ? gap : next.length;
+            target = end;
+        }
+    }
+
+    if (target == 0 && inode->extent_count > 1)
+    {
+        target = fs_defrag_find_run(blocks, filesystem.superblock.total_blocks);
+    }
+    else if (target == 0)
+    {
+        uint32_t start = inode->extents[0].start;
+        target = fs_defrag_find_run(blocks, start);
+        if (target == 0)
+        {
+            // Свободное место перед экстентом короче файла, иначе участок нашёлся бы выше
+            target = fs_free_run_before(start);
+            length = start - target;
+            if (target == start)
+                target = 0;
+        }
+    }
+    if (target == 0)
+        return 0;
+
+    fs_defrag_t *defrag = &filesystem.defrag;
+    fs_bitmap_fill(filesystem.block_bitmap, target, length, 1);
+    filesystem.superblock.free_blocks -= length;
+
+    defrag->moving = 1;
+    defrag->inode = inode_num;
+    defrag->snapshot = *inode;
+    defrag->first = first;
+    defrag->length = length;
+    defrag->target = target;
+    defrag->copied = 0;
+    return 1;
+}
+
+// Отмена переноса: проход продолжается со следующего inode, иначе
+// повторяющаяся ошибка снова и снова начинала бы тот же перенос
+static void fs_defrag_abort(void)
+{
+    fs_defrag_t *defrag = &filesystem.defrag;
+    fs_free_run(defrag->target, defrag->length);
+    defrag->moving = 0;
+    defrag->aborted++;
+    defrag->cursor = defrag->inode + 1;
+}
+
+// Место текущего переноса в карте блоков и счётчике свободных: hide —
+// убрать перед записью метаданных на том, иначе вернуть
+static void fs_defrag_hide_target(int hide)
+{
+    fs_defrag_t *defrag = &filesystem.defrag;
+    if (!defrag->moving)
+        return;
+    fs_bitmap_fill(filesystem.block_bitmap, defrag->target, defrag->length, !hide);
+    if (hide)
+        filesystem.superblock.free_blocks += defrag->length;
+    else
+        filesystem.superblock.free_blocks -= defrag->length;
+}
+
+// Очередная порция переноса. После последней участок в карте экстентов
+// заменяется новым местом, старые блоки освобождаются
+static void fs_defrag_copy(uint32_t budget, int wait)
+{
+    fs_defrag_t *defrag = &filesystem.defrag;
+    fs_inode_t *inode = fs_inode(defrag->inode);
+    if (memcmp(inode, &defrag->snapshot, sizeof(fs_inode_t)) != 0)
+    {
+        // Файл изменён, переименован или удалён: проход не считается
+        // спокойным, следующий вернётся к нему
+        defrag->pass_moves++;
+        fs_defrag_abort();
+        return;
+    }
+
+    // Блоки [first, last) файла
+    uint32_t first = defrag->first + defrag->copied;
+    uint32_t last = defrag->length - defrag->copied < budget ? defrag->first + defrag->length : first + budget;
+    uint32_t index = 0; // Порядковый номер первого блока экстента в файле
+    uint32_t done = 0;
+    for (uint32_t i = 0; i < inode->extent_count && index < last; i++)
+    {
+        fs_extent_t ext = inode->extents[i];
+        uint32_t from = first > index ? first : index;
+        uint32_t to = last < index + ext.length ? last : index + ext.length;
+        if (from < to)
+        {
+            int copied =
+                fs_copy_blocks(ext.start + (from - index), defrag->target + (from - defrag->first), to - from, wait);
+            if (copied < 0)
+            {
+                fs_defrag_abort();
+                return;
+            }
+            done += copied;
+            if ((uint32_t)copied < to - from)
+                break; // Остальное ещё читается с устройства
+        }
+        index += ext.length;
+    }
+    defrag->blocks_moved += done;
+    defrag->copied += done;
+    if (defrag->copied < defrag->length)
+        return;
+
+    // Клон мог разделить блоки, не меняя inode источника
+    if (fs_inode_has_shared(inode))
+    {
+        fs_defrag_abort();
+        return;
+    }
+
+    // Новая карта: участок на новом месте, соседние экстенты сливаются
+    fs_extent_t extents[FS_MAX_EXTENTS];
+    uint32_t count = 0;
+    uint32_t blocks = fs_inode_block_count(inode);
+    for (index = 0; index < blocks; index++)
+    {
+        uint32_t block = index - defrag->first < defrag->length
+                             ? defrag->target + (index - defrag->first)
+                             : fs_extent_block(inode->extents, inode->extent_count, index);
+        if (count > 0 && extents[count - 1].start + extents[count - 1].length == block)
+        {
+            extents[count - 1].length++;
+        }
+        else if (count < FS_MAX_EXTENTS)
+        {
+            extents[count].start = block;
+            extents[count].length = 1;
+            count++;
+        }
+        else
+        {
+            fs_defrag_abort();
+            return;
+        }
+    }
+
+    for (index = defrag->first; index < defrag->first + defrag->length; index++)
+        fs_free_run(fs_extent_block(inode->extents, inode->extent_count, index), 1);
+    memset(inode->extents, 0, sizeof(inode->extents));
+    memcpy(inode->extents, extents, count * sizeof(fs_extent_t));
+    inode->extent_count = count;
+    fs_meta_dirty();
+
+    defrag->moving = 0;
+    defrag->moves++;
+    defrag->pass_moves++;
+}
+
+// Шаг дефрагментации: поиск следующего файла (до FS_DEFRAG_SCAN inodes) и
+// не больше budget блоков копирования (без wait — только из кэша, см.
+// fs_copy_blocks). Возвращает 0, когда проход по всем inodes ничего не
+// перенёс и ФС с тех пор не менялась
+int fs_defrag_step(uint32_t budget, int wait)
+{
+    if (!filesystem.initialized)
+        return 0;
+
+    fs_defrag_t *defrag = &filesystem.defrag;
+    if (!defrag->moving)
+    {
+        if (defrag->settled && defrag->settled_time == fs_time_counter &&
+            defrag->settled_free == filesystem.superblock.free_blocks)
+            return 0;
+        defrag->settled = 0;
+
+        uint32_t capacity = filesystem.inode_capacity;
+        uint32_t end = defrag->cursor + FS_DEFRAG_SCAN < capacity ? defrag->cursor + FS_DEFRAG_SCAN : capacity;
+        uint32_t i = defrag->cursor;
+        while ((i = fs_bitmap_next(filesystem.inode_bitmap, end, i, 1)) < end && !fs_defrag_start(i))
+            i++;
+        defrag->cursor = i; // После переноса файл просматривается снова
+
+        if (defrag->cursor >= capacity)
+        {
+            // Конец прохода
+            defrag->passes++;
+            if (defrag->pass_moves == 0 && !defrag->moving)
+            {
+                defrag->settled = 1;
+                defrag->settled_time = fs_time_counter;
+                defrag->settled_free = filesystem.superblock.free_blocks;
+            }
+            defrag->pass_moves = 0;
+            defrag->cursor = 0;
+        }
+        if (!defrag->moving)
+            return 1;
+    }
+
+    fs_defrag_copy(budget, wait);
+    return 1;
+}
+
+// Шаг из задачи idle: не чаще раза в FS_DEFRAG_INTERVAL тиков, с
+// запрещёнными прерываниями (шелл и системные вызовы работают с ФС в
+// обработчиках прерываний и не прерываются посреди операции) и только
+// когда нет запросов к устройствам в полёте. Ввод-вывод шага не ждёт:
+// копируются блоки из кэша, остальные читаются к следующему шагу
+void fs_defrag_idle(void)
+{
+    if (!filesystem.initialized || !filesystem.defrag.enabled ||
+        timer_ticks - filesystem.defrag.last_tick < FS_DEFRAG_INTERVAL)
+        return;
+
+    uint32_t flags = irq_save();
+    if (blk_idle())
+    {
+        filesystem.defrag.last_tick = timer_ticks;
+        fs_defrag_step(FS_DEFRAG_STEP_BLOCKS, 0);
+    }
+    irq_restore(flags);
+}
+
+// Раскладка тома: файлов и директорий с блоками, из них в нескольких
+// экстентах, число свободных участков и длина самого длинного
+void fs_layout_stats(uint32_t *files, uint32_t *fragmented, uint32_t *free_runs, uint32_t *largest_free)
+{
+    *files = *fragmented = *free_runs = *largest_free = 0;
+    if (!filesystem.initialized)
+        return;
+
+    uint32_t capacity = filesystem.inode_capacity;
+    for (uint32_t i = fs_bitmap_next(filesystem.inode_bitmap, capacity, 0, 1); i < capacity;
+         i = fs_bitmap_next(filesystem.inode_bitmap, capacity, i + 1, 1))
+    {
+        fs_inode_t *inode = fs_inode(i);
+        if (inode->extent_count == 0 || (inode->flags & (FS_INODE_F_MEMORY | FS_INODE_F_INLINE)))
+            continue;
+        (*files)++;
+        if (inode->extent_count > 1)
+            (*fragmented)++;
+    }
+
+    uint32_t *bitmap = filesystem.block_bitmap;
+    uint32_t total = filesystem.superblock.total_blocks;
+    for (uint32_t start = fs_bitmap_next(bitmap, total, 1, 0); start < total;)
+    {
+        uint32_t end = fs_bitmap_next(bitmap, total, start, 1);
+        (*free_runs)++;
+        if (end - start > *largest_free)
+            *largest_free = end - start;
+        start = fs_bitmap_next(bitmap, total, end, 0);
+    }
+}
+
+// === СИНХРОНИЗАЦИЯ С УСТРОЙСТВОМ ===
+
+// Запись на устройство секторов образа из [start, end), отмеченных в map.
+// Соседние секторы уходят одним запросом. Возвращает число записанных секторов
+static int fs_write_sectors(uint32_t *map, uint32_t start, uint32_t end)
+{
+    int written = 0;
+    for (uint32_t sector = fs_bitmap_next(map, end, start, 1); sector < end;
+         sector = fs_bitmap_next(map, end, sector, 1))
+    {
+        uint32_t count = fs_bitmap_next(map, end, sector, 0) - sector;
+        if (count > FS_IO_MAX_SECTORS)
+            count = FS_IO_MAX_SECTORS;
+
+        if (blk_rw(filesystem.device, sector, filesystem.image + sector * FS_BLOCK_SIZE, count, 1) < 0)
+            return -1;
+
+        written += count;
+        sector += count;
+    }
+    return written;
+}
+
+// Запись загруженных секторов метаданных вместе с копией суперблока.
+// Место незавершённого переноса дефрагментации на том не попадает
+static int fs_write_meta(void)
+{
+    fs_defrag_hide_target(1);
+    filesystem.superblock.time_counter = fs_time_counter;
+    memcpy(filesystem.image, &filesystem.superblock, sizeof(fs_superblock_t));
+    int meta = fs_write_sectors(filesystem.sector_loaded, 0, filesystem.image_sectors);
+    fs_defrag_hide_target(0);
+    if (meta < 0)
+        return -1;
+
+    filesystem.meta_dirty = 0;
+    filesystem.sectors_written += meta;
+    return meta;
+}
+
+// Сохранение тома на устройстве: буферы открытых файлов, изменённые блоки
+// данных из буферного кэша, затем метаданные. Данные пишутся раньше
+// метаданных, чтобы inodes на диске не ссылались на незаписанные блоки.
+// Возвращает число записанных секторов, -1 — ошибка ввода-вывода
+int fs_sync(void)
+{
+    if (!filesystem.initialized || !filesystem.device)
+        return 0;
+
+    for (int i = 0; i < FS_MAX_OPEN_FILES; i++)
+    {
+        if (open_files[i].ref_count > 0 && open_files[i].wbuf_len > 0)
+            fs_file_flush(&open_files[i]);
+    }
+    for (int i = 0; i < FS_ZCACHE_SLOTS; i++)
+    {
+        if (filesystem.zcache[i].dirty)
+            fs_comp_pack(filesystem.zcache[i].inode);
+    }
+
+    int data = bcache_flush(filesystem.device);
+    if (data < 0)
+        return -1;
+    data *= BCACHE_BLOCK_SECTORS;
+    filesystem.sectors_written += data;
+
+    int meta = fs_write_meta();
+    if (meta < 0)
+        return -1;
+    return data + meta;
+}
+
+// Отложенная запись метаданных из задачи idle, когда они пробыли
+// изменёнными BCACHE_DIRTY_AGE тиков. Метаданные могут ссылаться на блоки,
+// изменённые позже, поэтому записывается весь том в обычном порядке, вместе
+// с буферами записи открытых файлов. Обработчик таймера этого не делает:
+// сброс буфера файла выделяет блоки
+void fs_idle_writeback(void)
+{
+    if (!filesystem.initialized || !filesystem.device || !filesystem.meta_dirty)
+        return;
+    if (timer_ticks - filesystem.meta_dirty_since < BCACHE_DIRTY_AGE)
+        return;
+
+    uint32_t flags = irq_save();
+    if (blk_idle())
+        fs_sync();
+    irq_restore(flags);
+}
+
+// Строка списка ls для записи директории
+static int fs_list_entry(fs_dir_entry_t *entry, void *ctx)
+{
+    fs_inode_t *inode = fs_inode(entry->inode_number);
+
+    // Имя файла (директории помечаются '/')
+    terminal_writestring(inode->filename);
+    int name_len = strlen(inode->filename);
+    if (inode->type == FS_INODE_DIR)
+    {
+        terminal_putchar('/');
+        name_len++;
+    }
+
+    // Выравнивание
+    for (int j = name_len; j < 18; j++)
+    {
+        terminal_putchar(' ');
+    }
+
+    // Размер
+    print_number(inode->size);
+    terminal_writestring(" bytes   ");
+
+    // Число экстентов, у маленьких файлов — данные в inode
+    if (inode->flags & FS_INODE_F_INLINE)
+    {
+        terminal_writestring("inline  ");
+    }
+    else
+    {
+        print_number(inode->extent_count);
+        terminal_writestring(inode->flags & FS_INODE_F_COMPRESSED ? "z      " : "       ");
+    }
+
+    // Время
+    print_number(inode->modified_time);
+    terminal_putchar('\n');
+
+    (*(int *)ctx)++;
+    return 0;
+}
+
+// Список содержимого текущей директории
+void fs_list_files(void)
+{
+    if (!filesystem.initialized)
+    {
+        terminal_writestring("ERROR: File system not initialized!\n");
+        return;
+    }
+
+    vfs_mount_t *mount = vfs_mount_at(fs_cwd_inode());
+    if (mount)
+    {
+        char path[FS_MAX_PATH];
+        fs_get_path(fs_cwd_inode(), path, sizeof(path));
+        vfs_list(mount, "", path);
+        return;
+    }
+
+    fs_inode_t *dir = fs_inode(fs_cwd_inode());
+
+    terminal_writestring("Files in filesystem:\n");
+    terminal_writestring("Name               Size      Extents Time\n");
+    terminal_writestring("------------------------------------------\n");
+
+    int file_count = 0;
+    fs_dir_iterate(dir, fs_list_entry, &file_count);
+
+    if (file_count == 0)
+    {
+        terminal_writestring("No files found.\n");
+    }
+    else
+    {
+        terminal_writestring("\nTotal files: ");
+        print_number(file_count);
+        terminal_putchar('\n');
+    }
+
+    terminal_writestring("Free inodes: ");
+    print_number(filesystem.superblock.free_inodes);
+    terminal_writestring(", Free blocks: ");
+    print_number(filesystem.superblock.free_blocks);
+    terminal_writestring("\n");
+
+    uint32_t logical_kb, physical_kb;
+    fs_data_usage(&logical_kb, &physical_kb);
+    terminal_writestring("Data: ");
+    print_number(logical_kb);
+    terminal_writestring(" KB logical, ");
+    print_number(physical_kb);
+    terminal_writestring(" KB physical");
+    if (filesystem.dedup_shared > 0)
+    {
+        terminal_writestring(" (");
+        print_number(filesystem.dedup_shared);
+        terminal_writestring(" shared blocks)");
+    }
+    terminal_writestring("\n");
+
+    // Состояние кэша dentry: в среднем должно быть близко к 1 пробе на поиск
+    terminal_writestring("Dentry cache: ");
+    print_number(filesystem.dcache_lookups);
+    terminal_writestring(" lookups, ");
+    print_number(filesystem.dcache_hits);
+    terminal_writestring(" hits, ");
+    print_number(filesystem.dcache_negative_hits);
+    terminal_writestring(" negative hits, ");
+    print_number(filesystem.dcache_probes);
+    terminal_writestring(" probes");
+    if (filesystem.dcache_lookups > 0)
+    {
+        uint32_t avg = filesystem.dcache_probes * 100 / filesystem.dcache_lookups;
+        terminal_writestring(" (");
+        print_number(avg / 100);
+        terminal_putchar('.');
+        if (avg % 100 < 10)
+            terminal_putchar('0');
+        print_number(avg % 100);
+        terminal_writestring(" per lookup)");
+    }
+    terminal_writestring("\n");
+
+    // Том на устройстве: сколько метаданных прочитано лениво и ждут ли они
+    // записи (блоки данных учитываются в буферном кэше, команда bcache)
+    if (filesystem.device)
+    {
+        terminal_writestring("Volume " FS_ROOT_DEVICE ": ");
+        print_number(filesystem.sectors_read);
+        terminal_writestring(" of ");
+        print_number(filesystem.image_sectors);
+        terminal_writestring(" metadata sectors loaded");
+        terminal_writestring(filesystem.meta_dirty ? " (dirty), " : ", ");
+        print_number(filesystem.sectors_written);
+        terminal_writestring(" sectors written\n");
+    }
+    terminal_writestring("\n");
+}
+
+// === ФУНКЦИИ ДЛЯ РАБОТЫ С ДИРЕКТОРИЯМИ ===
+
+// Создание директории
+int fs_create_directory(const char *dirname)
+{
+    if (!filesystem.initialized || !dirname)
+        return -1;
+
+    // Таблица и первая корзина выделяются при добавлении первой записи
+    return fs_create_node(dirname, FS_INODE_DIR);
+}
+
+static int fs_dir_any_entry(fs_dir_entry_t *entry, void *ctx)
+{
+    (void)entry;
+    (void)ctx;
+    return 1;
+}
+
+// Проверка, что в директории нет ни одной записи
+static int fs_dir_is_empty(fs_inode_t *dir)
+{
+    return fs_dir_iterate(dir, fs_dir_any_entry, NULL) == 0;
+}
+
+// Удаление директории
+int fs_delete_directory(const char *dirname)
+{
+    if (!filesystem.initialized || !dirname)
+        return -1;
+
+    int i = fs_lookup_path(dirname);
+    if (i >= 0 && fs_inode(i)->type == FS_INODE_DIR)
+    {
+        fs_inode_t *inode = fs_inode(i);
+
+        if (i == FS_ROOT_INODE)
+        {
+            terminal_writestring("Cannot remove root directory\n");
+            return -1;
+        }
+
+        // Проверяем, что директория пуста
+        if (!fs_dir_is_empty(inode))
+        {
+            terminal_writestring("Directory not empty: ");
+            terminal_writestring(dirname);
+            terminal_writestring("\n");
+            return -1;
+        }
+
+        // Директория не должна быть текущей ни для шелла, ни для задач,
+        // точкой монтирования или открытой
+        int busy = (shell_cwd_inode == (uint32_t)i) || vfs_mount_at(i);
+        for (task_t *task = task_list; task && !busy; task = task->next)
+        {
+            busy = (task->process.cwd_inode == (uint32_t)i);
+        }
+        for (int f = 0; f < FS_MAX_OPEN_FILES && !busy; f++)
+        {
+            busy = open_files[f].ref_count > 0 && open_files[f].ops == &fs_dir_file_ops &&
+                   open_files[f].private_data == inode;
+        }
+        if (busy)
+        {
+            terminal_writestring("Directory busy: ");
+            terminal_writestring(dirname);
+            terminal_writestring("\n");
+            return -1;
+        }
+
+        fs_release_node(i);
+        return 0;
+    }
+
+    terminal_writestring("Directory not found: ");
+    terminal_writestring(dirname);
+    terminal_writestring("\n");
+    return -1;
+}
+
+// Строка списка содержимого директории
+static int fs_list_dir_entry(fs_dir_entry_t *entry, void *ctx)
+{
+    if (fs_inode(entry->inode_number)->type == FS_INODE_DIR)
+    {
+        terminal_writestring("[DIR]  ");
+    }
+    else
+    {
+        terminal_writestring("[FILE] ");
+    }
+    terminal_writestring(entry->name);
+    terminal_putchar('\n');
+    (*(int *)ctx)++;
+    return 0;
+}
+
+// Список содержимого директории
+int fs_list_directory(const char *dirname)
+{
+    if (!filesystem.initialized || !dirname)
+        return -1;
+
+    vfs_mount_t *mount;
+    const char *rest;
+    int dir_num = fs_walk(dirname, &mount, &rest);
+    if (mount)
+        return vfs_list(mount, rest, dirname);
+
+    fs_inode_t *dir_inode = dir_num >= 0 ? fs_inode(dir_num) : NULL;
+    if (!dir_inode || dir_inode->type != FS_INODE_DIR)
+    {
+        terminal_writestring("Directory not found: ");
+        terminal_writestring(dirname);
+        terminal_writestring("\n");
+        return -1;
+    }
+
+    terminal_writestring("Contents of ");
+    terminal_writestring(dirname);
+    terminal_writestring(":\n");
+
+    int shown = 0;
+    fs_dir_iterate(dir_inode, fs_list_dir_entry, &shown);
+
+    if (shown == 0)
+    {
+        terminal_writestring("(empty)\n");
+    }
+
+    return 0;
+}
+
+// Поиск inode в директории
+fs_inode_t *fs_find_inode_in_dir(uint32_t parent_inode, const char *name)
+{
+    if (!filesystem.initialized || parent_inode >= filesystem.inode_capacity || !name)
+        return NULL;
+
+    fs_inode_t *parent = fs_inode(parent_inode);
+    if (parent->type != FS_INODE_DIR)
+        return NULL;
+
+    uint32_t block, slot;
+    int inode_num = fs_dir_find(parent, name, &block, &slot);
+    return inode_num > 0 ? fs_inode(inode_num) : NULL;
+}
+
+// Добавление записи в директорию
+int fs_add_entry_to_dir(uint32_t parent_inode, uint32_t child_inode, const char *name, uint8_t type)
+{
+    if (!filesystem.initialized || parent_inode >= filesystem.inode_capacity ||
+        child_inode >= filesystem.inode_capacity || !name)
+        return -1;
+
+    fs_inode_t *parent = fs_inode(parent_inode);
+    if (parent->type != FS_INODE_DIR)
+        return -1;
+
+    fs_dir_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.inode_number = child_inode;
+    strncpy(entry.name, name, FS_MAX_FILENAME - 1);
+    entry.name[FS_MAX_FILENAME - 1] = '\0';
+    entry.type = type;
+
+    // Первая запись: таблица из одного слота и пустая корзина
+    if (parent->size == 0)
+    {
+        uint32_t block = fs_dir_new_bucket(0);
+        if (block == 0)
+            return -1;
+        if (fs_inode_write(parent, 0, &block, 4) < 0)
+        {
+            fs_free_run(block, 1);
+            return -1;
+        }
+    }
+
+    // Полная корзина делится, пока в нужной не найдётся свободное место
+    uint32_t hash = fs_dir_hash(entry.name);
+    for (;;)
+    {
+        uint32_t index = hash & (parent->size / 4 - 1);
+        uint32_t block = fs_dir_slot(parent, index);
+        fs_dir_bucket_t *bucket = fs_dir_bucket(block, 1);
+        if (!bucket)
+            return -1;
+
+        if (bucket->count < FS_DIR_BUCKET_ENTRIES)
+        {
+            uint32_t i = 0;
+            while (bucket->entries[i].inode_number != 0)
+                i++;
+            bucket->entries[i] = entry;
+            bucket->count++;
+            fs_span_put((uint8_t *)bucket);
+
+            parent->modified_time = fs_time_counter++;
+            fs_meta_dirty();
+            return 0;
+        }
+
+        uint32_t depth = bucket->depth;
+        fs_span_put((uint8_t *)bucket);
+        if (fs_dir_split(parent, index, block, depth) < 0)
+            return -1; // Директория полна
+    }
+}
+
+// Удаление записи из директории
+int fs_remove_entry_from_dir(uint32_t parent_inode, const char *name)
+{
+    if (!filesystem.initialized || parent_inode >= filesystem.inode_capacity || !name)
+        return -1;
+
+    fs_inode_t *parent = fs_inode(parent_inode);
+    if (parent->type != FS_INODE_DIR)
+        return -1;
+
+    uint32_t block, slot;
+    if (fs_dir_find(parent, name, &block, &slot) < 0)
+        return -1; // Запись не найдена
+
+    fs_dir_bucket_t *bucket = fs_dir_bucket(block, 1);
+    if (!bucket)
+        return -1;
+    memset(&bucket->entries[slot], 0, sizeof(fs_dir_entry_t));
+    bucket->count--;
+    fs_span_put((uint8_t *)bucket);
+
+    parent->modified_time = fs_time_counter++;
+    fs_meta_dirty();
+    return 0;
+}
+
+// === INITRD ===
+
+// Содержимое модулей загрузчика появляется в ФС без копирования: inode
+// файла ссылается прямо на память модуля (FS_INODE_F_MEMORY). Архивы cpio
+// (newc) и tar (ustar) раскладываются по путям внутри архива, любой другой
+// модуль становится одним файлом в корне с именем из командной строки
+
+// Файл или директория из initrd по пути name (относительно корня).
+// Недостающие директории пути создаются. Возвращает 1 — добавлен файл,
+// 0 — директория, -1 — ошибка
+static int initrd_add(const char *name, int is_dir, const uint8_t *data, uint32_t size)
+{
+    while ((name[0] == '.' && name[1] == '/') || name[0] == '/')
+        name += name[0] == '/' ? 1 : 2;
+
+    int len = strlen(name);
+    while (len > 0 && name[len - 1] == '/')
+        len--;
+    if (len == 0 || (len == 1 && name[0] == '.'))
+        return 0; // Сам корень архива
+    if (len + 2 > FS_MAX_PATH)
+        return -1;
+
+    char path[FS_MAX_PATH];
+    path[0] = '/';
+    memcpy(path + 1, name, len);
+    path[len + 1] = '\0';
+
+    for (int i = 1; i <= len; i++)
+    {
+        if (path[i] != '/')
+            continue;
+        path[i] = '\0';
+        int dir = fs_lookup_path(path);
+        if (dir < 0)
+            dir = fs_create_node(path, FS_INODE_DIR);
+        path[i] = '/';
+        if (dir < 0 || fs_inode(dir)->type != FS_INODE_DIR)
+            return -1;
+    }
+
+    int existing = fs_lookup_path(path);
+    if (is_dir)
+    {
+        if (existing >= 0)
+            return fs_inode(existing)->type == FS_INODE_DIR ? 0 : -1;
+        return fs_create_node(path, FS_INODE_DIR) < 0 ? -1 : 0;
+    }
+
+    int n = fs_create_node(path, FS_INODE_FILE);
+    if (n < 0)
+        return -1;
+
+    fs_inode_t *inode = fs_inode(n);
+    inode->flags = FS_INODE_F_MEMORY;
+    inode->extents[0].start = (uint32_t)data;
+    inode->size = size;
+    return 1;
+}
+
+// Число из поля заголовка: base 16 (cpio) или 8 (tar)
+static uint32_t initrd_number(const char *field, int length, uint32_t base)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < length; i++)
+    {
+        char c = field[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (base == 16 && c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (base == 16 && c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else if (c == ' ' || c == '\0')
+            continue;
+        else
+            break;
+        value = value * base + digit;
+    }
+    return value;
+}
+
+// Архив cpio newc: заголовок 110 байт, имя и данные выровнены на 4 байта
+static int initrd_load_cpio(const uint8_t *image, uint32_t size, uint32_t *files)
+{
+    uint32_t pos = 0;
+    while (pos + 110 <= size && memcmp(image + pos, INITRD_CPIO_MAGIC, 6) == 0)
+    {
+        const char *header = (const char *)image + pos;
+        uint32_t mode = initrd_number(header + 14, 8, 16);
+        uint32_t file_size = initrd_number(header + 54, 8, 16);
+        uint32_t name_size = initrd_number(header + 94, 8, 16);
+        const char *name = header + 110;
+
+        if (name_size == 0 || name_size > size - pos - 110)
+            return -1;
+        uint32_t data = (pos + 110 + name_size + 3) & ~3u;
+        if (data > size || file_size > size - data || name[name_size - 1] != '\0')
+            return -1;
+        if (strcmp(name, "TRAILER!!!") == 0)
+            return 0;
+
+        uint32_t type = mode & 0170000;
+        if (type == 0040000 || type == 0100000)
+        {
+            int added = initrd_add(name, type == 0040000, image + data, file_size);
+            if (added > 0)
+                (*files)++;
+        }
+        pos = (data + file_size + 3) & ~3u;
+    }
+    return 0;
+}
+
+// Архив tar (ustar): заголовки и данные блоками по 512 байт, длинные имена
+// делятся на префикс и имя
+static int initrd_load_tar(const uint8_t *image, uint32_t size, uint32_t *files)
+{
+    uint32_t pos = 0;
+    while (pos + 512 <= size && image[pos] != '\0')
+    {
+        const char *header = (const char *)image + pos;
+        if (memcmp(header + 257, INITRD_TAR_MAGIC, 5) != 0)
+            return -1;
+
+        uint32_t file_size = initrd_number(header + 124, 12, 8);
+        uint32_t data = pos + 512;
+        if (file_size > size - data)
+            return -1;
+
+        // Префикс (155 байт) и имя (100 байт) могут занимать поле целиком
+        char name[FS_MAX_PATH];
+        int len = 0;
+        for (int i = 0; i < 155 && header[345 + i]; i++)
+            name[len++] = header[345 + i];
+        if (len > 0)
+            name[len++] = '/';
+        for (int i = 0; i < 100 && header[i] && len < FS_MAX_PATH - 1; i++)
+            name[len++] = header[i];
+        name[len] = '\0';
+
+        char type = header[156];
+        if (type == '0' || type == '\0' || type == '5')
+        {
+            int added = initrd_add(name, type == '5', image + data, file_size);
+            if (added > 0)
+                (*files)++;
+        }
+        pos = data + ((file_size + 511) & ~511u);
+    }
+    return 0;
+}
+
+// Раскладка модулей загрузчика в ФС. Корень при этом всегда в памяти
+// (init_filesystem не монтирует том с устройства): inodes тома на диске
+// записывались бы на диск, а адреса модулей после перезагрузки теряют смысл
+void init_initrd(void)
+{
+    if (!filesystem.initialized || filesystem.device || boot_module_count == 0)
+        return;
+
+    for (uint32_t i = 0; i < boot_module_count; i++)
+    {
+        boot_module_t *module = &boot_modules[i];
+        const uint8_t *image = (const uint8_t *)P2V(module->start);
+        uint32_t files = 0;
+        const char *format;
+        int result;
+
+        if (module->size >= 110 && memcmp(image, INITRD_CPIO_MAGIC, 6) == 0)
+        {
+            format = "cpio";
+            result = initrd_load_cpio(image, module->size, &files);
+        }
+        else if (module->size >= 512 && memcmp(image + 257, INITRD_TAR_MAGIC, 5) == 0)
+        {
+            format = "tar";
+            result = initrd_load_tar(image, module->size, &files);
+        }
+        else
+        {
+            // Имя файла — последний компонент первого слова командной строки
+            char name[FS_MAX_FILENAME];
+            int start = 0, end = 0;
+            while (module->name[end] && module->name[end] != ' ')
+            {
+                if (module->name[end] == '/')
+                    start = end + 1;
+                end++;
+            }
+            if (end - start > 0 && end - start < FS_MAX_FILENAME)
+            {
+                memcpy(name, module->name + start, end - start);
+                name[end - start] = '\0';
+            }
+            else
+            {
+                strcpy(name, "module0");
+                name[6] += i;
+            }
+
+            format = "file";
+            result = initrd_add(name, 0, image, module->size);
+            if (result > 0)
+                files = 1;
+        }
+
+        terminal_writestring("Initrd: ");
+        terminal_writestring(module->name[0] ? module->name : "(module)");
+        terminal_writestring(" (");
+        terminal_writestring(format);
+        terminal_writestring(", ");
+        print_number(module->size / 1024);
+        terminal_writestring(" KB): ");
+        print_number(files);
+        terminal_writestring(result < 0 ? " files, stopped at a damaged entry\n" : " files\n");
+    }
+}
+
+// === ФУНКЦИИ ДЛЯ УПРАВЛЕНИЯ ПАМЯТЬЮ ПРОЦЕССОВ ===
+
+// Создание Page Directory для процесса
+// Возвращает физическое значение для CR3: адрес PD, а в режиме PAE — адрес PDPT
+uint32_t create_process_page_directory(void)
+{
+    // Каталог (и PDPT в режиме PAE) занимает целые кадры подряд: CR3 и
+    // записи PDPT требуют выравнивания, которого не даёт куча
+    phys_addr_t phys;
+    uint8_t *frames = phys_alloc_direct(PROCESS_DIR_FRAMES, &phys);
+    if (!frames)
+        return 0;
+
+    page_directory_t *new_page_dir = (page_directory_t *)frames;
+
+    // Пользовательские записи (0..3GB) пусты и заполняются по мере необходимости
+    memset(new_page_dir, 0, KERNEL_PDE_START * sizeof(page_directory_entry_t));
+
+#ifdef CONFIG_PAE
+    // PDPT — в кадре за тремя собственными PD. Записи ядра не копируются —
+    // PDPT[3] ссылается на тот же PD, что и у ядра
+    uint64_t *pdpt = (uint64_t *)(frames + PROCESS_PD_SIZE);
+    memset(pdpt, 0, PAGE_SIZE);
+    for (int i = 0; i < PDPT_ENTRIES - 1; i++)
+    {
+        pdpt[i] = (phys + i * PAGE_SIZE) | PAGE_PRESENT;
+    }
+    pdpt[PDPT_ENTRIES - 1] = (uint64_t)V2P(&page_directory->entries[KERNEL_PDE_START]) | PAGE_PRESENT;
+    return (uint32_t)(phys + PROCESS_PD_SIZE);
+#else
+    // Записи ядра (последний 1GB) ссылаются на общие 4MB-страницы прямого
+    // отображения, поэтому копируются только 256 PDE без таблиц страниц
+    memcpy(&new_page_dir->entries[KERNEL_PDE_START], &page_directory->entries[KERNEL_PDE_START],
+           (PAGE_DIR_ENTRIES - KERNEL_PDE_START) * sizeof(page_directory_entry_t));
+    return (uint32_t)phys;
+#endif
+}
+
+// Уничтожение Page Directory процесса вместе с его таблицами страниц и
+// кадрами (стек, страницы ELF)
+void destroy_process_page_directory(uint32_t page_dir)
+{
+    if (!page_dir)
+        return;
+
+    // Освобождаемый каталог не должен оставаться активным
+    uint32_t cr3;
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    if (cr3 == page_dir)
+        switch_to_process_page_directory(kernel_page_root);
+
+    page_directory_t *dir = (page_directory_t *)page_dir_from_root(page_dir);
+
+    // Записи ядра общие; кадры кучи, отображённые процессу, phys_free_frame пропускает
+    for (uint32_t i = USER_PDE_START; i < KERNEL_PDE_START; i++)
+    {
+        if (dir->entries[i] & PAGE_PRESENT)
+        {
+            page_table_t *page_table = (page_table_t *)P2V(dir->entries[i] & PAGE_FRAME_MASK);
+            for (uint32_t j = 0; j < PAGE_ENTRIES; j++)
+            {
+                if (page_table->entries[j] & PAGE_PRESENT)
+                    phys_free_frame(page_table->entries[j] & PAGE_FRAME_MASK);
+            }
+            phys_free_frame(dir->entries[i] & PAGE_FRAME_MASK);
+        }
+    }
+
+    // Сам Page Directory (вместе с PDPT)
+    for (uint32_t i = 0; i < PROCESS_DIR_FRAMES; i++)
+        phys_free_frame(V2P(dir) + i * PAGE_SIZE);
+}
+
+// Переключение на Page Directory процесса
+void switch_to_process_page_directory(uint32_t page_dir)
+{
+    if (!page_dir)
+        return;
+
+    // Загружаем новый Page Directory в CR3
+    asm volatile("mov %0, %%cr3" : : "r"(page_dir) : "memory");
+}
+
+// Отображение памяти для процесса
+int map_memory_for_process(task_t *task, uint32_t virtual_addr, phys_addr_t physical_addr, uint32_t size, int flags)
+{
+    if (!task || !task->process.page_directory)
+        return -1;
+
+    page_directory_t *page_dir = (page_directory_t *)page_dir_from_root(task->process.page_directory);
+
+    // Выравниваем адреса по границе страницы
+    virtual_addr = virtual_addr & 0xFFFFF000;
+    physical_addr = physical_addr & PAGE_FRAME_MASK;
+    size = (size + PAGE_SIZE - 1) & 0xFFFFF000;
+
+    page_table_entry_t pte_flags = PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+#ifdef CONFIG_PAE
+    if ((flags & PAGE_NOEXEC) && nx_enabled)
+        pte_flags |= PAGE_NX;
+#else
+    (void)flags;
+#endif
+
+    for (uint32_t addr = virtual_addr; addr < virtual_addr + size; addr += PAGE_SIZE, physical_addr += PAGE_SIZE)
+    {
+        uint32_t page_dir_index = PDE_INDEX(addr);
+        uint32_t page_table_index = PTE_INDEX(addr);
+
+        // Проверяем, что адрес в пользовательском пространстве
+        if (page_dir_index < USER_PDE_START || page_dir_index >= KERNEL_PDE_START)
+            return -1;
+
+        // Создаем Page Table если нужно (целый кадр: PDE требует выравнивания по 4KB)
+        if (!(page_dir->entries[page_dir_index] & PAGE_PRESENT))
+        {
+            phys_addr_t page_table_phys;
+            page_table_t *page_table = phys_alloc_direct(1, &page_table_phys);
+            if (!page_table)
+                return -1;
+
+            memset(page_table, 0, PAGE_TABLE_SIZE);
+
+            // Устанавливаем запись в Page Directory
+            page_dir->entries[page_dir_index] = page_table_phys | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+        }
+
+        // Получаем адрес Page Table
+        uint32_t page_table_addr = P2V(page_dir->entries[page_dir_index] & PAGE_FRAME_MASK);
+        page_table_t *page_table = (page_table_t *)page_table_addr;
+
+        // Устанавливаем запись в Page Table
+        page_table->entries[page_table_index] = physical_addr | pte_flags;
+    }
+
+    return 0;
+}
+
+// Отмена отображения памяти для процесса
+int unmap_memory_for_process(task_t *task, uint32_t virtual_addr, uint32_t size)
+{
+    if (!task || !task->process.page_directory)
+        return -1;
+
+    page_directory_t *page_dir = (page_directory_t *)page_dir_from_root(task->process.page_directory);
+
+    // Выравниваем адреса по границе страницы
+    virtual_addr = virtual_addr & 0xFFFFF000;
+    size = (size + PAGE_SIZE - 1) & 0xFFFFF000;
+
+    for (uint32_t addr = virtual_addr; addr < virtual_addr + size; addr += PAGE_SIZE)
+    {
+        uint32_t page_dir_index = PDE_INDEX(addr);
+        uint32_t page_table_index = PTE_INDEX(addr);
+
+        // Проверяем, что адрес в пользовательском пространстве
+        if (page_dir_index < USER_PDE_START || page_dir_index >= KERNEL_PDE_START)
+            return -1;
+
+        if (page_dir->entries[page_dir_index] & PAGE_PRESENT)
+        {
+            uint32_t page_table_addr = P2V(page_dir->entries[page_dir_index] & PAGE_FRAME_MASK);
+            page_table_t *page_table = (page_table_t *)page_table_addr;
+
+            // Очищаем запись в Page Table
+            page_table->entries[page_table_index] = 0;
+        }
+    }
+
+    return 0;
+}
+
+// Физический кадр, отображённый по virtual_addr (0 — страница не отображена)
+static phys_addr_t process_page_frame(task_t *task, uint32_t virtual_addr)
+{
+    page_directory_t *page_dir = (page_directory_t *)page_dir_from_root(task->process.page_directory);
+    page_directory_entry_t pde = page_dir->entries[PDE_INDEX(virtual_addr)];
+    if (!(pde & PAGE_PRESENT))
+        return 0;
+
+    page_table_t *page_table = (page_table_t *)P2V(pde & PAGE_FRAME_MASK);
+    page_table_entry_t pte = page_table->entries[PTE_INDEX(virtual_addr)];
+    return (pte & PAGE_PRESENT) ? (pte & PAGE_FRAME_MASK) : 0;
+}
+
+// Копия пользовательских страниц src в собственные кадры dst (fork).
+// Новые кадры берутся из прямого отображения: источник может занимать окно KMAP
+int copy_process_memory(task_t *dst, task_t *src)
+{
+    page_directory_t *src_dir = (page_directory_t *)page_dir_from_root(src->process.page_directory);
+    for (uint32_t i = USER_PDE_START; i < KERNEL_PDE_START; i++)
+    {
+        if (!(src_dir->entries[i] & PAGE_PRESENT))
+            continue;
+
+        page_table_t *src_table = (page_table_t *)P2V(src_dir->entries[i] & PAGE_FRAME_MASK);
+        for (uint32_t j = 0; j < PAGE_ENTRIES; j++)
+        {
+            page_table_entry_t pte = src_table->entries[j];
+            if (!(pte & PAGE_PRESENT))
+                continue;
+
+            phys_addr_t phys;
+            void *frame = phys_alloc_direct(1, &phys);
+            if (!frame)
+                return -1;
+            memcpy(frame, phys_frame_ptr(pte & PAGE_FRAME_MASK), PAGE_SIZE);
+
+            uint32_t virtual_addr = PDE_ADDR(i) | (j << 12);
+            int flags = PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+#ifdef CONFIG_PAE
+            if (pte & PAGE_NX)
+                flags |= PAGE_NOEXEC;
+#endif
+            if (map_memory_for_process(dst, virtual_addr, phys, PAGE_SIZE, flags) < 0)
+            {
+                phys_free_frame(phys);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Стек пользовательского режима: USER_STACK_SIZE под USER_STACK_TOP с битом
+// U/S. Возвращает начальный ESP, 0 — не хватило памяти
+uint32_t map_user_stack(task_t *task)
+{
+    for (uint32_t addr = USER_STACK_TOP - USER_STACK_SIZE; addr < USER_STACK_TOP; addr += PAGE_SIZE)
+    {
+        phys_addr_t phys;
+        if (phys_alloc_frame(&phys) != 0)
+            return 0;
+        memset(phys_frame_ptr(phys), 0, PAGE_SIZE);
+        if (map_memory_for_process(task, addr, phys, PAGE_SIZE, PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER | PAGE_NOEXEC) < 0)
+        {
+            phys_free_frame(phys);
+            return 0;
+        }
+    }
+    return USER_STACK_TOP - 4;
+}
+
+// Все страницы сегментов ELF задачи в её собственных кадрах. Данные
+// копируются сразу: буфер с образом файла освобождается после загрузки
+int map_elf_program(task_t *task)
+{
+    elf_loader_t *ldr = task->elf_loader;
+    for (uint32_t i = 0; i < ldr->num_segments && i < 16; i++)
+    {
+        uint32_t seg_start = ldr->load_base + (ldr->segments[i].vaddr - ldr->min_vaddr);
+        uint32_t seg_end = seg_start + ldr->segments[i].memsz;
+        for (uint32_t page = seg_start & 0xFFFFF000; page < seg_end; page += PAGE_SIZE)
+        {
+            uint32_t addr = page < seg_start ? seg_start : page;
+            if (!process_page_frame(task, page) && demand_page_load(task, addr) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+// ===== GUARD PAGES ДЛЯ СТЕКА =====
+#define GUARD_PAGE_SIZE PAGE_SIZE
+
+// Выделение памяти для процесса с guard pages
+void *allocate_memory_for_process(task_t *task, uint32_t size)
+{
+    if (!task || size == 0)
+        return NULL;
+
+    // Выравниваем размер по границе страницы
+    size = (size + PAGE_SIZE - 1) & 0xFFFFF000;
+
+    // Проверяем лимит памяти (учитываем guard pages)
+    if (task->process.memory_used + size + GUARD_PAGE_SIZE > task->process.memory_limit)
+    {
+        return NULL;
+    }
+
+    // Выделяем физическую память
+    void *physical_mem = kmalloc(size);
+    if (!physical_mem)
+        return NULL;
+
+    // Находим свободный виртуальный адрес в пользовательском пространстве
+    uint32_t virtual_addr = USER_SPACE_BASE + 0x1000; // Начинаем с 0x00401000
+    // В реальной системе здесь был бы более сложный алгоритм поиска свободного адреса
+
+    // Отображаем основную память
+    if (map_memory_for_process(task, virtual_addr, V2P(physical_mem), size, PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER) < 0)
+    {
+        kfree(physical_mem);
+        return NULL;
+    }
+
+    // Добавляем guard page после выделенной области (без маппинга)
+    // Следующая страница после virtual_addr+size остается неотображенной
+    // Это защищает от переполнения буфера
+
+    task->process.memory_used += size + GUARD_PAGE_SIZE;
+    return (void *)virtual_addr;
+}
+
+// Освобождение памяти процесса
+void free_memory_for_process(task_t *task, void *ptr, uint32_t size)
+{
+    if (!task || !ptr)
+        return;
+
+    // Выравниваем размер по границе страницы
+    size = (size + PAGE_SIZE - 1) & 0xFFFFF000;
+
+    // Отменяем отображение
+    unmap_memory_for_process(task, (uint32_t)ptr, size);
+
+    // Освобождаем физическую память
+    // В реальной системе нужно найти физический адрес по виртуальному
+    // Здесь упрощенная реализация
+    kfree(ptr);
+
+    if (task->process.memory_used >= size)
+    {
+        task->process.memory_used -= size;
+    }
+}
+
+// === УПРАВЛЕНИЕ ПРОЦЕССАМИ ===
+
+void init_process_management(void)
+{
+    terminal_writestring("Process management initialized\n");
+}
+
+// Создание нового процесса (fork)
+task_t *fork_process(task_t *parent)
+{
+    if (!parent)
+        return NULL;
+
+    // Создаем новую задачу
+    task_t *child = (task_t *)kmalloc(sizeof(task_t));
+    if (!child)
+        return NULL;
+
+    // Копируем структуру задачи
+    memcpy(child, parent, sizeof(task_t));
+
+    // Устанавливаем новые ID
+    child->id = next_task_id++;
+    child->process.pid = child->id;
+    child->process.ppid = parent->process.pid;
+
+    // Создаем новый стек
+    child->stack = (uint32_t *)kmalloc(TASK_STACK_SIZE);
+    if (!child->stack)
+    {
+        kfree(child);
+        return NULL;
+    }
+
+    // Копируем содержимое стека
+    memcpy(child->stack, parent->stack, TASK_STACK_SIZE);
+
+    // Обновляем указатель на стек в регистрах
+    child->regs.esp = (uint32_t)child->stack + TASK_STACK_SIZE - 4;
+
+    // Собственное адресное пространство с копией пользовательских страниц
+    child->process.page_directory = create_process_page_directory();
+    if (!child->process.page_directory ||
+        (parent->process.page_directory && copy_process_memory(child, parent) < 0))
+    {
+        destroy_process_page_directory(child->process.page_directory);
+        kfree(child->stack);
+        kfree(child);
+        return NULL;
+    }
+
+    // Дескрипторы потомка ссылаются на те же открытые файлы (общая позиция)
+    for (int i = 0; i < 32; i++)
+    {
+        if (child->process.fds[i].valid)
+            fs_file_dup(child->process.fds[i].file);
+    }
+
+    // Сбрасываем состояние
+    child->state = TASK_STATE_READY;
+    child->time_slice = 10;
+
+    // Добавляем в список задач
+    child->next = task_list;
+    task_list = child;
+
+    terminal_writestring("Process forked: PID ");
+    print_number(child->process.pid);
+    terminal_writestring("\n");
+
+    return child;
+}
+
+// Выполнение программы (exec)
+int exec_process(const char *filename, char **argv)
+{
+    (void)argv;
+    if (!current_task || !filename)
+        return -1;
+
+    // Загружаем ELF файл
+    uint8_t *elf_data;
+    uint32_t elf_size;
+
+    if (!load_elf_from_file(filename, &elf_data, &elf_size))
+    {
+        return -1;
+    }
+
+    // Очищаем старый ELF загрузчик
+    if (current_task->elf_loader)
+    {
+        elf_cleanup(current_task->elf_loader);
+        kfree(current_task->elf_loader);
+    }
+
+    // Создаем новый ELF загрузчик
+    current_task->elf_loader = (elf_loader_t *)kmalloc(sizeof(elf_loader_t));
+    if (!current_task->elf_loader)
+    {
+        kfree(elf_data);
+        return -1;
+    }
+
+    // Парсим и загружаем новую программу
+    if (!elf_parse(current_task->elf_loader, elf_data, elf_size))
+    {
+        kfree(current_task->elf_loader);
+        kfree(elf_data);
+        return -1;
+    }
+
+    uint32_t entry_point = elf_load_program(current_task->elf_loader);
+    if (entry_point == 0)
+    {
+        elf_cleanup(current_task->elf_loader);
+        kfree(current_task->elf_loader);
+        kfree(elf_data);
+        return -1;
+    }
+
+    // Новое адресное пространство: страницы программы и стек; старое
+    // освобождается после переключения CR3
+    uint32_t old_directory = current_task->process.page_directory;
+    uint32_t stack_top = 0;
+    current_task->process.page_directory = create_process_page_directory();
+    if (current_task->process.page_directory && map_elf_program(current_task) == 0)
+        stack_top = map_user_stack(current_task);
+    if (stack_top == 0)
+    {
+        destroy_process_page_directory(current_task->process.page_directory);
+        current_task->process.page_directory = old_directory;
+        elf_cleanup(current_task->elf_loader);
+        kfree(current_task->elf_loader);
+        current_task->elf_loader = NULL;
+        kfree(elf_data);
+        return -1;
+    }
+    switch_to_process_page_directory(current_task->process.page_directory);
+    destroy_process_page_directory(old_directory);
+
+    // Обновляем имя задачи; кольца старой программы больше не действуют
+    strcpy(current_task->name, filename);
+    current_task->process.io_ring = NULL;
+
+    // Настраиваем контекст для новой программы
+    create_user_task(entry_point, stack_top, current_task);
+
+    kfree(elf_data);
+    return 0;
+}
+
+// Ожидание завершения процесса
+int wait_process(uint32_t pid)
+{
+    if (!current_task)
+        return -1;
+
+    // Ищем процесс с указанным PID
+    task_t *target = task_list;
+    while (target)
+    {
+        if (target->process.pid == pid)
+        {
+            if (target->state == TASK_STATE_DEAD)
+            {
+                // Процесс уже завершен
+                cleanup_process(target);
+                return pid;
+            }
+            else
+            {
+                // Блокируем текущий процесс до завершения целевого
+                current_task->state = TASK_STATE_BLOCKED;
+                schedule();
+                return pid;
+            }
+        }
+        target = target->next;
+    }
+
+    return -1; // Процесс не найден
+}
+
+// Очистка ресурсов процесса
+void cleanup_process(task_t *task)
+{
+    if (!task)
+        return;
+
+    // Очищаем ELF загрузчик
+    if (task->elf_loader)
+    {
+        elf_cleanup(task->elf_loader);
+        kfree(task->elf_loader);
+        task->elf_loader = NULL;
+    }
+
+    // Очищаем стек
+    if (task->stack)
+    {
+        kfree(task->stack);
+        task->stack = NULL;
+    }
+
+    // Закрываем все файловые дескрипторы
+    for (int i = 0; i < 32; i++)
+    {
+        if (task->process.fds[i].valid)
+        {
+            free_fd(task, i);
+        }
+    }
+
+    // Очищаем Page Directory процесса
+    if (task->process.page_directory)
+    {
+        destroy_process_page_directory(task->process.page_directory);
+        task->process.page_directory = 0;
+    }
+
+    terminal_writestring("Process cleaned up: PID ");
+    print_number(task->process.pid);
+    terminal_writestring("\n");
+}
+
+// Выделение файлового дескриптора
+int allocate_fd(task_t *task, open_file_t *file)
+{
+    if (!task || !file)
+        return -1;
+
+    // Ищем свободный FD
+    for (int i = 3; i < 32; i++)
+    { // Пропускаем stdin, stdout, stderr
+        if (!task->process.fds[i].valid)
+        {
+            task->process.fds[i].fd = i;
+            task->process.fds[i].file = file;
+            task->process.fds[i].valid = 1;
+            return i;
+        }
+    }
+
+    return -1; // Нет свободных FD
+}
+
+// Освобождение файлового дескриптора, -1 — нет дескриптора или данные
+// файла не записались при последнем закрытии
+int free_fd(task_t *task, int fd)
+{
+    if (!task || fd < 0 || fd >= 32 || !task->process.fds[fd].valid)
+        return -1;
+
+    int result = fs_close(task->process.fds[fd].file);
+    memset(&task->process.fds[fd], 0, sizeof(file_descriptor_t));
+    return result;
+}
+
+// Получение файлового дескриптора
+file_descriptor_t *get_fd(task_t *task, int fd)
+{
+    if (!task || fd < 0 || fd >= 32)
+        return NULL;
+    if (!task->process.fds[fd].valid)
+        return NULL;
+    return &task->process.fds[fd];
+}
+
+// === ПЛАНИРОВЩИК ЗАДАЧ ===
+
+void init_scheduler(void)
+{
+    current_task = NULL;
+    task_list = NULL;
+    next_task_id = 1;
+    scheduler_ticks = 0;
+    terminal_writestring("Task scheduler initialized\n");
+}
+
+task_t *create_task(const char *name, void (*entry_point)(void), uint32_t priority)
+{
+    task_t *task = (task_t *)kmalloc(sizeof(task_t));
+    if (!task)
+    {
+        terminal_writestring("ERROR: Failed to allocate memory for task!\n");
+        return NULL;
+    }
+
+    // Выделяем стек для задачи
+    task->stack = (uint32_t *)kmalloc(TASK_STACK_SIZE);
+    if (!task->stack)
+    {
+        kfree(task);
+        terminal_writestring("ERROR: Failed to allocate stack for task!\n");
+        return NULL;
+    }
+
+    // Инициализируем структуру задачи
+    task->id = next_task_id++;
+    strcpy(task->name, name);
+    task->state = TASK_STATE_READY;
+    task->priority = priority;
+    task->stack_size = TASK_STACK_SIZE;
+    task->time_slice = 10; // 10 тиков
+    task->elf_loader = NULL;
+    task->next = NULL;
+
+    // Инициализируем процесс
+    task->process.pid = task->id;
+    task->process.ppid = 0; // Корневой процесс
+    task->process.uid = 0;  // root
+    task->process.gid = 0;  // root
+    task->process.cwd_inode = shell_cwd_inode; // Задачи запускаются из шелла
+    task->process.next_fd = 3; // Начинаем с FD 3
+    task->process.page_directory = create_process_page_directory();
+    task->process.memory_limit = 0x100000; // 1MB лимит
+    task->process.memory_used = 0;
+    task->process.io_ring = NULL;
+
+    // Инициализируем файловые дескрипторы
+    memset(task->process.fds, 0, sizeof(task->process.fds));
+
+    // Стандартные FD
+    task->process.fds[STDIN_FILENO].fd = STDIN_FILENO;
+    task->process.fds[STDIN_FILENO].file = fs_file_dup(&console_file);
+    task->process.fds[STDIN_FILENO].valid = 1;
+
+    task->process.fds[STDOUT_FILENO].fd = STDOUT_FILENO;
+    task->process.fds[STDOUT_FILENO].file = fs_file_dup(&console_file);
+    task->process.fds[STDOUT_FILENO].valid = 1;
+
+    task->process.fds[STDERR_FILENO].fd = STDERR_FILENO;
+    task->process.fds[STDERR_FILENO].file = fs_file_dup(&console_file);
+    task->process.fds[STDERR_FILENO].valid = 1;
+
+    // Инициализируем регистры
+    memset(&task->regs, 0, sizeof(registers_t));
+    task->regs.eip = (uint32_t)entry_point;
+    task->regs.esp = (uint32_t)task->stack + TASK_STACK_SIZE - 4; // Вершина стека
+    task->regs.cs = 0x08;                                         // Селектор кода ядра
+    task->regs.ds = 0x10;                                         // Селектор данных ядра
+    task->regs.es = 0x10;
+    task->regs.fs = 0x10;
+    task->regs.gs = 0x10;
+    task->regs.ss = 0x10;
+    task->regs.eflags = 0x202; // Прерывания включены
+
+    // Добавляем задачу в список
+    if (task_list == NULL)
+    {
+        task_list = task;
+        current_task = task;
+        switch_to_task(task);
+    }
+    else
+    {
+        task_t *last = task_list;
+        while (last->next)
+        {
+            last = last->next;
+        }
+        last->next = task;
+    }
+
+    return task;
+}
+
+void schedule(void)
+{
+    if (!current_task || !current_task->next)
+    {
+        return;
+    }
+
+    // Находим следующую готовую задачу
+    task_t *next_task = current_task->next;
+    while (next_task && next_task->state != TASK_STATE_READY)
+    {
+        next_task = next_task->next;
+        if (!next_task)
+        {
+            next_task = task_list; // Возвращаемся к началу списка
+            break;
+        }
+    }
+
+    if (next_task && next_task != current_task)
+    {
+        current_task = next_task;
+        switch_to_task(current_task);
+    }
+}
+
+void switch_to_task(task_t *task)
+{
+    if (!task)
+        return;
+
+    // Адресное пространство задачи (без своего каталога — каталог ядра)
+    switch_to_process_page_directory(task->process.page_directory ? task->process.page_directory
+                                                                  : kernel_page_root);
+
+    // В реальной ОС здесь было бы переключение контекста
+    // Переключение происходит без вывода сообщений
+}
+
+void task_yield(void)
+{
+    if (current_task)
+    {
+        current_task->time_slice = 0; // Принудительно вызываем переключение
+        schedule();
+    }
+}
+
+// === ДЕМОНСТРАЦИОННЫЕ ЗАДАЧИ ===
+
+void idle_task(void)
+{
+    while (1)
+    {
+        fs_idle_writeback(); // Фоновая работа ФС, пока задачам нечего делать
+        fs_defrag_idle();
+        asm volatile("hlt"); // Ждем прерывания
+    }
+}
+
+void demo_task1(void)
+{
+    for (int i = 0; i < 5; i++)
+    {
+        terminal_writestring("Task 1 running... ");
+        print_number(i);
+        terminal_putchar('\n');
+
+        // Имитация работы
+        for (volatile int j = 0; j < 1000000; j++)
+            ;
+    }
+}
+
+void demo_task2(void)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        terminal_writestring("Task 2 executing... ");
+        print_number(i);
+        terminal_putchar('\n');
+
+        // Имитация работы
+        for (volatile int j = 0; j < 500000; j++)
+            ;
+    }
+}
+
+// === ОБРАБОТЧИКИ ПРЕРЫВАНИЙ ===
+
+void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags)
+{
+    idt[num].base_lo = base & 0xFFFF;
+    idt[num].base_hi = (base >> 16) & 0xFFFF;
+    idt[num].sel = sel;
+    idt[num].always0 = 0;
+    idt[num].flags = flags;
+}
+
+// ===== ЛОГГЕР И ПАНИКА =====
+static void log_reg_dump(const char *msg)
+{
+    terminal_writestring("\n[EXC] ");
+    terminal_writestring(msg);
+    terminal_writestring("\n");
+}
+
+static void dump_registers(void)
+{
+    uint32_t eax, ebx, ecx, edx, esi, edi, esp, ebp;
+    uint16_t cs, ds, es, fs, gs, ss;
+
+    asm volatile("mov %%eax, %0" : "=m"(eax));
+    asm volatile("mov %%ebx, %0" : "=m"(ebx));
+    asm volatile("mov %%ecx, %0" : "=m"(ecx));
+    asm volatile("mov %%edx, %0" : "=m"(edx));
+    asm volatile("mov %%esi, %0" : "=m"(esi));
+    asm volatile("mov %%edi, %0" : "=m"(edi));
+    asm volatile("mov %%esp, %0" : "=m"(esp));
+    asm volatile("mov %%ebp, %0" : "=m"(ebp));
+    asm volatile("mov %%cs, %0" : "=m"(cs));
+    asm volatile("mov %%ds, %0" : "=m"(ds));
+    asm volatile("mov %%es, %0" : "=m"(es));
+    asm volatile("mov %%fs, %0" : "=m"(fs));
+    asm volatile("mov %%gs, %0" : "=m"(gs));
+    asm volatile("mov %%ss, %0" : "=m"(ss));
+
+    terminal_writestring("Registers:\n");
+    terminal_writestring("EAX=");
+    print_hex(eax);
+    terminal_writestring(" EBX=");
+    print_hex(ebx);
+    terminal_writestring(" ECX=");
+    print_hex(ecx);
+    terminal_writestring(" EDX=");
+    print_hex(edx);
+    terminal_writestring("\nESI=");
+    print_hex(esi);
+    terminal_writestring(" EDI=");
+    print_hex(edi);
+    terminal_writestring(" ESP=");
+    print_hex(esp);
+    terminal_writestring(" EBP=");
+    print_hex(ebp);
+    terminal_writestring("\nCS=");
+    print_hex(cs);
+    terminal_writestring(" DS=");
+    print_hex(ds);
+    terminal_writestring(" ES=");
+    print_hex(es);
+    terminal_writestring(" FS=");
+    print_hex(fs);
+    terminal_writestring(" GS=");
+    print_hex(gs);
+    terminal_writestring(" SS=");
+    print_hex(ss);
+    terminal_writestring("\n");
+}
+
+static void kernel_panic(const char *msg)
+{
+    terminal_writestring("\nKERNEL PANIC: ");
+    terminal_writestring(msg);
+    terminal_writestring("\nSystem halted.\n");
+    dump_registers();
+    asm volatile("cli");
+    while (1)
+        asm volatile("hlt");
+}
+
+void handle_exception(void)
+{
+    log_reg_dump("CPU exception occurred");
+    kernel_panic("Unhandled CPU exception");
+}
+
+// ===== АЛЛОКАТОР КАДРОВ ИЗ КАРТЫ ПАМЯТИ MULTIBOOT =====
+// Память выше ELF-области нарезается на регионы и раздаётся по одному кадру.
+// В режиме PAE сюда попадают и кадры выше 4 GB (доступ к ним — через kmap_frame).
+// Освобождённые кадры идут в стек, а когда он полон — в цепочку, где ссылка
+// на следующий кадр хранится в самом кадре
+#define MAX_PHYS_REGIONS 16
+#define PHYS_FREE_STACK_SIZE 1024
+#define PHYS_REGION_FLOOR (ELF_LOAD_BASE + 0x100000) // Ниже — ядро, куча и ELF-область
+
+typedef struct
+{
+    phys_addr_t base; // Первый кадр региона
+    uint32_t frames;  // Количество кадров
+    uint32_t next;    // Следующий ещё не выданный кадр
+} phys_region_t;
+
+static phys_region_t phys_regions[MAX_PHYS_REGIONS];
+static uint32_t phys_region_count = 0;
+static phys_addr_t phys_free_stack[PHYS_FREE_STACK_SIZE]; // Освобождённые кадры регионов
+static uint32_t phys_free_top = 0;
+static phys_addr_t phys_free_chain = 0; // Освобождённые сверх стека (0 — пусто)
+static uint32_t phys_alloc_count = 0;
+static uint32_t phys_free_count = 0;
+static uint32_t phys_region_frames = 0; // Всего кадров в регионах
+static uint32_t phys_high_frames = 0;   // Из них выше 4 GB
+static uint32_t phys_high_alloc = 0;    // Выдано кадров выше 4 GB
+static uint32_t phys_reserved_frames = 0; // Отдано под арену ФС
+
+#ifdef CONFIG_PAE
+// Таблица страниц окна KMAP (одна страница на кадр)
+static page_table_t kmap_table __attribute__((aligned(4096)));
+
+// Временное отображение физического кадра в адресное пространство ядра
+static void *kmap_frame(phys_addr_t phys)
+{
+    kmap_table.entries[PTE_INDEX(KMAP_VADDR)] = (phys & PAGE_FRAME_MASK) | PAGE_PRESENT | PAGE_WRITABLE;
+    asm volatile("invlpg (%0)" : : "r"(KMAP_VADDR) : "memory");
+    return (void *)KMAP_VADDR;
+}
+
+// Включение NX через EFER, если процессор его поддерживает
+static void pae_enable_nx(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000000));
+    if (eax < 0x80000001)
+        return;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000001));
+    if (!(edx & (1 << 20)))
+        return;
+
+    uint32_t lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(0xC0000080));
+    lo |= (1 << 11); // EFER.NXE
+    asm volatile("wrmsr" : : "a"(lo), "d"(hi), "c"(0xC0000080));
+    nx_enabled = 1;
+}
+#endif
+
+static void phys_add_region(uint64_t base, uint64_t len)
+{
+    uint64_t end = base + len;
+    if (base < PHYS_REGION_FLOOR)
+        base = PHYS_REGION_FLOOR;
+#ifndef CONFIG_PAE
+    // Без PAE ядру доступны только кадры внутри прямого отображения
+    if (end > DIRECT_MAP_SIZE)
+        end = DIRECT_MAP_SIZE;
+#endif
+    base = (base + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    if (end <= base || phys_region_count >= MAX_PHYS_REGIONS)
+        return;
+
+    phys_region_t *region = &phys_regions[phys_region_count++];
+    region->base = (phys_addr_t)base;
+    region->frames = (uint32_t)((end - base) >> 12);
+    region->next = 0;
+    phys_region_frames += region->frames;
+    if (base >= 0x100000000ULL)
+        phys_high_frames += region->frames;
+}
+
+// Исключение [start, end) из регионов (память модулей загрузчика).
+// Вызывается до выдачи первых кадров, пока next у всех регионов равен 0
+static void phys_exclude_range(phys_addr_t start, phys_addr_t end)
+{
+    start &= ~(phys_addr_t)(PAGE_SIZE - 1);
+    end = (end + PAGE_SIZE - 1) & ~(phys_addr_t)(PAGE_SIZE - 1);
+
+    for (uint32_t i = 0; i < phys_region_count; i++)
+    {
+        phys_region_t *region = &phys_regions[i];
+        phys_addr_t limit = region->base + ((phys_addr_t)region->frames << 12);
+        if (end <= region->base || start >= limit)
+            continue;
+
+        uint32_t before = start > region->base ? (uint32_t)((start - region->base) >> 12) : 0;
+        uint32_t after = end < limit ? (uint32_t)((limit - end) >> 12) : 0;
+        phys_region_frames -= region->frames - before - after;
+
+        // Хвост после диапазона — отдельный регион, если есть место
+        if (after > 0 && before > 0 && phys_region_count < MAX_PHYS_REGIONS)
+        {
+            phys_region_t *tail = &phys_regions[phys_region_count++];
+            tail->base = end;
+            tail->frames = after;
+            tail->next = 0;
+            after = 0;
+        }
+        else if (after > 0 && before > 0)
+        {
+            phys_region_frames -= after < before ? after : before;
+            if (after > before)
+                before = 0;
+            else
+                after = 0;
+        }
+
+        if (before == 0)
+            region->base = end;
+        region->frames = before + after;
+    }
+}
+
+// Сохранение списка модулей загрузчика. Вызывается до инициализации кучи:
+// модуль, занявший кучу или ELF-область, переносится в свободную память
+// между кучей и ELF-областью (вслед за остальными модулями и структурами
+// Multiboot). Остальные модули остаются на месте — их память исключается
+// из аллокатора кадров, а ФС ссылается на неё напрямую
+void init_boot_modules(uint32_t multiboot_magic, uint32_t multiboot_info)
+{
+    if (multiboot_magic != MULTIBOOT_BOOTLOADER_MAGIC || !multiboot_info)
+        return;
+
+    multiboot_info_t *mbi = (multiboot_info_t *)P2V(multiboot_info);
+    if (!(mbi->flags & MULTIBOOT_INFO_MODS) || mbi->mods_count == 0)
+        return;
+
+    multiboot_module_t *mods = (multiboot_module_t *)P2V(mbi->mods_addr);
+    uint32_t count = mbi->mods_count < BOOT_MODULES_MAX ? mbi->mods_count : BOOT_MODULES_MAX;
+
+    // Перенос идёт выше всего, что лежит ниже ELF-области: модулей,
+    // таблицы модулей и карты памяти (её потом читает init_frame_allocator)
+    uint32_t ranges[][2] = {
+        {multiboot_info, multiboot_info + sizeof(multiboot_info_t)},
+        {mbi->mods_addr, mbi->mods_addr + mbi->mods_count * sizeof(multiboot_module_t)},
+        {mbi->mmap_addr, mbi->mmap_addr + mbi->mmap_length},
+    };
+    uint32_t cursor = HEAP_PHYS_START + HEAP_SIZE;
+    for (uint32_t i = 0; i < 3 + count; i++)
+    {
+        uint32_t start = i < 3 ? ranges[i][0] : mods[i - 3].mod_start;
+        uint32_t end = i < 3 ? ranges[i][1] : mods[i - 3].mod_end;
+        if (start < ELF_LOAD_BASE && end > cursor)
+            cursor = end;
+    }
+    cursor = (cursor + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    // Командные строки копируются до переноса: он может их затереть
+    for (uint32_t i = 0; i < count; i++)
+    {
+        boot_module_t *module = &boot_modules[i];
+        module->start = mods[i].mod_start;
+        module->size = mods[i].mod_end - mods[i].mod_start;
+        module->name[0] = '\0';
+        if (mods[i].cmdline && mods[i].cmdline < DIRECT_MAP_SIZE)
+            strncpy(module->name, (const char *)P2V(mods[i].cmdline), BOOT_MODULE_NAME - 1);
+        module->name[BOOT_MODULE_NAME - 1] = '\0';
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        boot_module_t module = boot_modules[i];
+        uint32_t end = module.start + module.size;
+
+        // Источник либо целиком ниже cursor, либо выше ELF-области,
+        // поэтому области копирования не перекрываются
+        int misplaced = (module.start < HEAP_PHYS_START + HEAP_SIZE && end > HEAP_PHYS_START) ||
+                        (module.start < PHYS_REGION_FLOOR && end > ELF_LOAD_BASE);
+        if (end < module.start || end > DIRECT_MAP_SIZE ||
+            (misplaced && (module.start < ELF_LOAD_BASE && end > ELF_LOAD_BASE)) ||
+            (misplaced && cursor + module.size > ELF_LOAD_BASE))
+        {
+            terminal_writestring("Boot module skipped (no room to keep it): ");
+            terminal_writestring(module.name);
+            terminal_writestring("\n");
+            continue;
+        }
+
+        if (misplaced)
+        {
+            memcpy((void *)P2V(cursor), (void *)P2V(module.start), module.size);
+            module.start = cursor;
+            cursor = (cursor + module.size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        }
+        boot_modules[boot_module_count++] = module;
+    }
+}
+
+// Разбор карты памяти Multiboot
+void init_frame_allocator(uint32_t multiboot_magic, uint32_t multiboot_info)
+{
+    if (multiboot_magic != MULTIBOOT_BOOTLOADER_MAGIC || !multiboot_info)
+        return;
+
+    multiboot_info_t *mbi = (multiboot_info_t *)P2V(multiboot_info);
+    if (!(mbi->flags & MULTIBOOT_INFO_MEM_MAP))
+        return;
+
+    uint32_t addr = P2V(mbi->mmap_addr);
+    while (addr < P2V(mbi->mmap_addr) + mbi->mmap_length)
+    {
+        multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *)addr;
+        if (entry->type == MULTIBOOT_MEMORY_AVAILABLE)
+            phys_add_region(entry->addr, entry->len);
+        addr += entry->size + sizeof(entry->size);
+    }
+
+    // Модули загрузчика остаются в памяти на всё время работы
+    for (uint32_t i = 0; i < boot_module_count; i++)
+        phys_exclude_range(boot_modules[i].start, (phys_addr_t)boot_modules[i].start + boot_modules[i].size);
+
+#ifdef CONFIG_PAE
+    pae_enable_nx();
+    // Окно KMAP разделяется всеми процессами через общий PD ядра
+    page_directory->entries[PDE_INDEX(KMAP_VADDR)] = V2P(&kmap_table) | PAGE_PRESENT | PAGE_WRITABLE;
+    flush_tlb();
+#endif
+}
+
+// Указатель на содержимое кадра для ядра
+static void *phys_frame_ptr(phys_addr_t phys)
+{
+#ifdef CONFIG_PAE
+    if (phys >= DIRECT_MAP_SIZE)
+        return kmap_frame(phys);
+#endif
+    return (void *)P2V(phys);
+}
+
+// Выделение кадра: сначала освобождённые, затем ещё не выданные кадры регионов
+static int phys_alloc_frame(phys_addr_t *out_phys)
+{
+    if (phys_free_top > 0)
+    {
+        *out_phys = phys_free_stack[--phys_free_top];
+    }
+    else if (phys_free_chain)
+    {
+        *out_phys = phys_free_chain;
+        phys_free_chain = *(phys_addr_t *)phys_frame_ptr(phys_free_chain);
+    }
+    else
+    {
+        uint32_t i;
+        for (i = 0; i < phys_region_count; i++)
+        {
+            phys_region_t *region = &phys_regions[i];
+            if (region->next >= region->frames)
+                continue;
+#ifdef CONFIG_PAE
+            // Кадры вне прямого отображения доступны ядру только через окно KMAP
+            if (region->base >= DIRECT_MAP_SIZE && !paging_enabled)
+                continue;
+#endif
+            *out_phys = region->base + ((phys_addr_t)region->next << 12);
+            region->next++;
+            break;
+        }
+        if (i == phys_region_count)
+            return -1;
+    }
+
+    phys_alloc_count++;
+#ifdef CONFIG_PAE
+    if (*out_phys >= 0x100000000ULL)
+        phys_high_alloc++;
+#endif
+    return 0;
+}
+
+// count кадров подряд внутри прямого отображения (каталоги и таблицы
+// страниц процессов: ядро обращается к ним через P2V). Один кадр берётся и
+// из освобождённых, несколько — только из ещё не выданных кадров региона
+static void *phys_alloc_direct(uint32_t count, phys_addr_t *out_phys)
+{
+    if (count == 1 && phys_free_top > 0 && phys_free_stack[phys_free_top - 1] < DIRECT_MAP_SIZE)
+    {
+        phys_alloc_frame(out_phys);
+        return (void *)P2V((uint32_t)*out_phys);
+    }
+
+    for (uint32_t i = 0; i < phys_region_count; i++)
+    {
+        phys_region_t *region = &phys_regions[i];
+        if (region->frames - region->next < count ||
+            region->base + ((phys_addr_t)(region->next + count) << 12) > DIRECT_MAP_SIZE)
+            continue;
+        *out_phys = region->base + ((phys_addr_t)region->next << 12);
+        region->next += count;
+        phys_alloc_count += count;
+        return (void *)P2V((uint32_t)*out_phys);
+    }
+    return NULL;
+}
+
+static void phys_free_frame(phys_addr_t phys)
+{
+    if (phys < PHYS_REGION_FLOOR)
+        return; // Не из регионов (например, память кучи ядра)
+
+    if (phys_free_top < PHYS_FREE_STACK_SIZE)
+    {
+        phys_free_stack[phys_free_top++] = phys;
+    }
+    else
+    {
+        *(phys_addr_t *)phys_frame_ptr(phys) = phys_free_chain;
+        phys_free_chain = phys;
+    }
+
+    phys_free_count++;
+#ifdef CONFIG_PAE
+    if (phys >= 0x100000000ULL)
+        phys_high_alloc--;
+#endif
+}
+
+// Резервирование непрерывного участка прямо отображённой памяти: хвост
+// самого большого подходящего региона, не больше половины его свободных
+// кадров и не больше max_bytes. Кадры изымаются из региона насовсем
+static void *phys_reserve_direct(uint32_t max_bytes, uint32_t *reserved)
+{
+    phys_region_t *best = NULL;
+    uint32_t best_free = 0;
+
+    for (uint32_t i = 0; i < phys_region_count; i++)
+    {
+        phys_region_t *region = &phys_regions[i];
+        if (region->base + ((phys_addr_t)region->frames << 12) > DIRECT_MAP_SIZE)
+            continue;
+        if (region->frames - region->next > best_free)
+        {
+            best = region;
+            best_free = region->frames - region->next;
+        }
+    }
+
+    *reserved = 0;
+    if (!best)
+        return NULL;
+
+    uint32_t frames = best_free / 2;
+    if (frames > (max_bytes >> 12))
+        frames = max_bytes >> 12;
+    if (frames == 0)
+        return NULL;
+
+    best->frames -= frames;
+    phys_region_frames -= frames;
+    phys_reserved_frames += frames;
+    *reserved = frames << 12;
+    return (void *)P2V((uint32_t)(best->base + ((phys_addr_t)best->frames << 12)));
+}
+
+// ===== DEMAND-PAGING: подкачка страниц ELF при fault =====
+static uint32_t demand_page_count = 0;
+
+static int demand_page_load(task_t *task, uint32_t fault_addr)
+{
+    if (!task || !task->elf_loader)
+        return -1;
+    elf_loader_t *ldr = task->elf_loader;
+    for (uint32_t i = 0; i < ldr->num_segments && i < 16; i++)
+    {
+        // Translate original vaddr to loaded vaddr using min_vaddr baseline
+        uint32_t seg_start = ldr->load_base + (ldr->segments[i].vaddr - ldr->min_vaddr);
+        uint32_t seg_end = seg_start + ldr->segments[i].memsz;
+        if (fault_addr >= seg_start && fault_addr < seg_end)
+        {
+            uint32_t page_base = fault_addr & 0xFFFFF000;
+            phys_addr_t phys;
+            if (phys_alloc_frame(&phys) != 0)
+                return -1;
+            // Инициализируем из файла часть страницы, попадающую в filesz
+            // (сегмент может начинаться не с границы страницы)
+            uint8_t *frame = phys_frame_ptr(phys);
+            memset(frame, 0, PAGE_SIZE);
+            uint32_t from = page_base > seg_start ? page_base : seg_start;
+            uint32_t file_end = seg_start + ldr->segments[i].filesz;
+            if (from < file_end)
+            {
+                uint32_t to = file_end < page_base + PAGE_SIZE ? file_end : page_base + PAGE_SIZE;
+                memcpy(frame + (from - page_base), ldr->data + ldr->segments[i].offset + (from - seg_start),
+                       to - from);
+            }
+            // Отобразим страницу в адресное пространство процесса (данные — без права исполнения)
+            int map_flags = PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+            if (!(ldr->segments[i].flags & PF_X))
+                map_flags |= PAGE_NOEXEC;
+            if (map_memory_for_process(task, page_base, phys, PAGE_SIZE, map_flags) < 0)
+            {
+                phys_free_frame(phys);
+                return -1;
+            }
+            flush_tlb();
+            demand_page_count++;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void handle_page_fault(void)
+{
+    uint32_t fault_addr = get_page_fault_address();
+    if (current_task && is_user_address((void *)fault_addr, 1))
+    {
+        if (demand_page_load(current_task, fault_addr) == 0)
+        {
+            return; // успешно подкачали
+        }
+    }
+    terminal_writestring("Page fault at address: ");
+    print_hex(fault_addr);
+    terminal_writestring("\n");
+    kernel_panic("Unhandled page fault");
+}
+
+// Старая функция keyboard_handler заменена на новый модуль клавиатуры
+// Теперь используется keyboard_handler из keyboard.c
+
+void timer_interrupt_handler(void)
+{
+    timer_ticks++;
+    irq_counts[0]++;
+
+    // Фоновая запись состарившихся буферов кэша; метаданные тома пишет
+    // задача idle (fs_idle_writeback)
+    if (timer_ticks % BCACHE_FLUSH_INTERVAL == 0 && blk_idle())
+        bcache_timer();
+
+    // Планировщик задач каждые 10 тиков (100ms при 100Hz)
+    if (timer_ticks % 10 == 0)
+    {
+        scheduler_ticks++;
+        if (current_task && current_task->time_slice > 0)
+        {
+            current_task->time_slice--;
+            if (current_task->time_slice == 0)
+            {
+                current_task->time_slice = 10; // Сбрасываем time slice
+                schedule();                    // Переключаем задачу
+            }
+        }
+    }
+
+    // Отправляем EOI
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+// === АППАРАТНЫЕ ПРЕРЫВАНИЯ IRQ2-IRQ15 ===
+
+extern uint32_t irq_stub_table[16];        // Точки входа из interrupts.asm
+static irq_handler_t irq_handlers[16];     // Обработчики драйверов
+static uint16_t irq_mask = 0xFFFC;         // Маска PIC: разрешены IRQ0 и IRQ1
+static int pic_ready = 0;                  // PIC перепрограммирован ядром
+
+// Запись маски в оба контроллера
+static void pic_write_mask(void)
+{
+    outb(PIC1_DATA, irq_mask & 0xFF);
+    outb(PIC2_DATA, irq_mask >> 8);
+}
+
+// Регистрация обработчика IRQ и снятие маски линии (и каскада IRQ2 для
+// ведомого PIC). До инициализации PIC маска лишь запоминается
+void irq_register(int irq, irq_handler_t handler)
+{
+    if (irq < 2 || irq > 15)
+        return;
+
+    irq_handlers[irq] = handler;
+    irq_mask &= ~(1u << irq);
+    if (irq >= 8)
+        irq_mask &= ~(1u << 2);
+    if (pic_ready)
+        pic_write_mask();
+}
+
+// Вызывается из irqN_stub: драйвер, затем EOI (ведомому — для IRQ8-15)
+void irq_dispatch(int irq)
+{
+    irq_counts[irq]++;
+    if (irq_handlers[irq])
+        irq_handlers[irq](irq);
+
+    if (irq >= 8)
+        outb(PIC2_COMMAND, PIC_EOI);
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+// === PCI ===
+
+static pci_device_t pci_devices[PCI_MAX_DEVICES];
+static uint32_t pci_device_count = 0;
+
+static uint32_t pci_config_address(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+    return 0x80000000 | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+           ((uint32_t)func << 8) | (offset & 0xFC);
+}
+
+static uint32_t pci_read32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+{
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(bus, slot, func, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+static void pci_write16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint16_t value)
+{
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(bus, slot, func, offset));
+    outw(PCI_CONFIG_DATA + (offset & 2), value);
+}
+
+// Разрешение портов ввода-вывода и DMA для устройства
+static void pci_enable_device(pci_device_t *pci)
+{
+    uint16_t command = pci_read32(pci->bus, pci->slot, pci->func, PCI_COMMAND) & 0xFFFF;
+    pci_write16(pci->bus, pci->slot, pci->func, PCI_COMMAND,
+                command | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+}
+
+static void pci_add_function(uint8_t bus, uint8_t slot, uint8_t func, uint32_t id)
+{
+    if (pci_device_count >= PCI_MAX_DEVICES)
+        return;
+
+    pci_device_t *pci = &pci_devices[pci_device_count++];
+    pci->bus = bus;
+    pci->slot = slot;
+    pci->func = func;
+    pci->vendor_id = id & 0xFFFF;
+    pci->device_id = id >> 16;
+
+    uint32_t class_reg = pci_read32(bus, slot, func, 0x08);
+    pci->class_code = class_reg >> 24;
+    pci->subclass = (class_reg >> 16) & 0xFF;
+    pci->irq_line = pci_read32(bus, slot, func, 0x3C) & 0xFF;
+    for (int i = 0; i < 6; i++)
+        pci->bar[i] = pci_read32(bus, slot, func, 0x10 + i * 4);
+}
+
+// Перебор всех шин, слотов и функций конфигурационного пространства
+void pci_enumerate(void)
+{
+    pci_device_count = 0;
+    for (uint32_t bus = 0; bus < 256; bus++)
+    {
+        for (uint8_t slot = 0; slot < 32; slot++)
+        {
+            uint32_t id = pci_read32(bus, slot, 0, 0x00);
+            if ((id & 0xFFFF) == 0xFFFF)
+                continue;
+
+            pci_add_function(bus, slot, 0, id);
+
+            // Бит 7 типа заголовка — многофункциональное устройство
+            if (pci_read32(bus, slot, 0, 0x0C) & 0x00800000)
+            {
+                for (uint8_t func = 1; func < 8; func++)
+                {
+                    id = pci_read32(bus, slot, func, 0x00);
+                    if ((id & 0xFFFF) != 0xFFFF)
+                        pci_add_function(bus, slot, func, id);
+                }
+            }
+        }
+    }
+
+    terminal_writestring("PCI: ");
+    print_number(pci_device_count);
+    terminal_writestring(" devices\n");
+}
+
+pci_device_t *pci_find_device(uint16_t vendor_id, uint16_t device_id)
+{
+    for (uint32_t i = 0; i < pci_device_count; i++)
+    {
+        if (pci_devices[i].vendor_id == vendor_id && pci_devices[i].device_id == device_id)
+            return &pci_devices[i];
+    }
+    return NULL;
+}
+
+// === БЛОЧНЫЕ УСТРОЙСТВА ===
+
+static block_device_t *block_devices[BLK_MAX_DEVICES];
+static uint32_t block_device_count = 0;
+
+int blk_register(block_device_t *dev)
+{
+    if (block_device_count >= BLK_MAX_DEVICES)
+        return -1;
+    block_devices[block_device_count++] = dev;
+    return 0;
+}
+
+block_device_t *blk_find(const char *name)
+{
+    for (uint32_t i = 0; i < block_device_count; i++)
+    {
+        if (strcmp(block_devices[i]->name, name) == 0)
+            return block_devices[i];
+    }
+    return NULL;
+}
+
+// Нет запросов в полёте ни на одном устройстве. Запросы остаются в полёте
+// только у кода, который ждёт их с разрешёнными прерываниями (blkbench);
+// фоновая запись по таймеру в это время не вмешивается
+int blk_idle(void)
+{
+    for (uint32_t i = 0; i < block_device_count; i++)
+    {
+        if (block_devices[i]->in_flight > 0)
+            return 0;
+    }
+    return 1;
+}
+
+// Постановка запроса в очередь устройства без ожидания. -1 — неверный
+// запрос или очередь устройства заполнена (повторить после завершений)
+int blk_submit(blk_request_t *req)
+{
+    block_device_t *dev = req->device;
+    if (!dev || req->segment_count == 0 || req->segment_count > BLK_MAX_SEGMENTS)
+        return -1;
+
+    uint32_t bytes = 0;
+    for (uint32_t i = 0; i < req->segment_count; i++)
+        bytes += req->segments[i].length;
+    if (bytes % BLK_SECTOR_SIZE != 0 || req->sector + bytes / BLK_SECTOR_SIZE > dev->sector_count)
+        return -1;
+
+    // Статистика обновляется до того, как завершение может прийти из прерывания
+    uint32_t flags = irq_save();
+    req->status = BLK_PENDING;
+    if (dev->submit(dev, req) < 0)
+    {
+        irq_restore(flags);
+        return -1;
+    }
+
+    dev->in_flight++;
+    if (dev->in_flight > dev->max_in_flight)
+        dev->max_in_flight = dev->in_flight;
+    if (req->write)
+    {
+        dev->writes++;
+        dev->sectors_written += bytes / BLK_SECTOR_SIZE;
+    }
+    else
+    {
+        dev->reads++;
+        dev->sectors_read += bytes / BLK_SECTOR_SIZE;
+    }
+    irq_restore(flags);
+    return 0;
+}
+
+// Завершение запроса драйвером (из прерывания или poll)
+static void blk_complete(blk_request_t *req, int status)
+{
+    req->device->in_flight--;
+    if (status != BLK_OK)
+        req->device->errors++;
+    req->status = status;
+    if (req->complete)
+        req->complete(req);
+}
+
+// Ожидание завершения запроса. Завершения собираются и опросом, поэтому
+// ожидание работает и до включения прерываний (монтирование при загрузке)
+int blk_wait(blk_request_t *req)
+{
+    while (req->status == BLK_PENDING)
+    {
+        req->device->poll(req->device);
+        asm volatile("pause");
+    }
+    return req->status;
+}
+
+// Синхронное чтение или запись count секторов в непрерывный буфер ядра
+int blk_rw(block_device_t *dev, uint32_t sector, void *buffer, uint32_t count, int write)
+{
+    blk_request_t req;
+    memset(&req, 0, sizeof(req));
+    req.device = dev;
+    req.sector = sector;
+    req.write = write;
+    req.segments[0].buffer = buffer;
+    req.segments[0].length = count * BLK_SECTOR_SIZE;
+    req.segment_count = 1;
+
+    while (blk_submit(&req) < 0)
+    {
+        // Очередь занята асинхронными запросами — ждём завершений
+        if (dev->in_flight == 0)
+            return -1;
+        dev->poll(dev);
+    }
+    return blk_wait(&req) == BLK_OK ? 0 : -1;
+}
+
+// === БУФЕРНЫЙ КЭШ ===
+
+// Блоки устройств кэшируются буферами по BCACHE_BLOCK_SIZE: поиск по хешу
+// (устройство, блок), вытеснение давно не использованных буферов (LRU),
+// отложенная запись изменённых (из таймера, при вытеснении и по sync) и
+// упреждающее чтение при последовательном доступе. Буфер, полученный
+// bcache_get, закреплён до bcache_put и не вытесняется
+static struct
+{
+    bcache_buf_t *buffers;
+    uint32_t count;
+    uint8_t *data;               // Данные буферов подряд, по BCACHE_BLOCK_SIZE
+    bcache_buf_t **hash;         // Цепочки буферов по хешу (устройство, блок)
+    uint32_t hash_mask;
+    bcache_buf_t *lru_head;      // Кандидаты на вытеснение
+    bcache_buf_t *lru_tail;      // Недавно использованные
+    uint32_t used;               // Буферов с блоками устройств
+    uint32_t dirty;              // Изменённых буферов
+    uint32_t hits, misses;
+    uint32_t readahead;          // Блоков прочитано упреждающе
+    uint32_t readahead_hits;     // Из них потом запрошено
+    uint32_t writebacks;         // Записано буферов
+    uint32_t timer_writebacks;   // Из них фоновой записью по таймеру
+    uint32_t evictions;          // Вытеснено буферов
+    uint32_t dirty_evictions;    // Из них пришлось записать перед вытеснением
+    uint32_t errors;             // Ошибок ввода-вывода
+} bcache;
+
+static inline uint32_t bcache_hash(block_device_t *dev, uint32_t block)
+{
+    return (block * 2654435761u ^ (uint32_t)(uintptr_t)dev) & bcache.hash_mask;
+}
+
+static bcache_buf_t *bcache_lookup(block_device_t *dev, uint32_t block)
+{
+    for (bcache_buf_t *buf = bcache.hash[bcache_hash(dev, block)]; buf; buf = buf->hash_next)
+    {
+        if (buf->dev == dev && buf->block == block)
+            return buf;
+    }
+    return NULL;
+}
+
+static void bcache_hash_remove(bcache_buf_t *buf)
+{
+    bcache_buf_t **link = &bcache.hash[bcache_hash(buf->dev, buf->block)];
+    while (*link != buf)
+        link = &(*link)->hash_next;
+    *link = buf->hash_next;
+    buf->hash_next = NULL;
+}
+
+static void bcache_lru_remove(bcache_buf_t *buf)
+{
+    if (buf->lru_prev)
+        buf->lru_prev->lru_next = buf->lru_next;
+    else
+        bcache.lru_head = buf->lru_next;
+    if (buf->lru_next)
+        buf->lru_next->lru_prev = buf->lru_prev;
+    else
+        bcache.lru_tail = buf->lru_prev;
+}
+
+// Перенос буфера в хвост (tail = 1) или голову списка LRU
+static void bcache_lru_move(bcache_buf_t *buf, int tail)
+{
+    bcache_lru_remove(buf);
+    if (tail)
+    {
+        buf->lru_prev = bcache.lru_tail;
+        buf->lru_next = NULL;
+        if (bcache.lru_tail)
+            bcache.lru_tail->lru_next = buf;
+        else
+            bcache.lru_head = buf;
+        bcache.lru_tail = buf;
+    }
+    else
+    {
+        buf->lru_prev = NULL;
+        buf->lru_next = bcache.lru_head;
+        if (bcache.lru_head)
+            bcache.lru_head->lru_prev = buf;
+        else
+            bcache.lru_tail = buf;
+        bcache.lru_head = buf;
+    }
+}
+
+// Привязка буфера к блоку устройства и отвязка (буфер становится свободным)
+static void bcache_assign(bcache_buf_t *buf, block_device_t *dev, uint32_t block)
+{
+    uint32_t slot = bcache_hash(dev, block);
+    buf->dev = dev;
+    buf->block = block;
+    buf->flags = 0;
+    buf->hash_next = bcache.hash[slot];
+    bcache.hash[slot] = buf;
+    bcache.used++;
+}
+
+static void bcache_release(bcache_buf_t *buf)
+{
+    bcache_hash_remove(buf);
+    buf->dev = NULL;
+    buf->flags = 0;
+    bcache.used--;
+}
+
+static void bcache_set_dirty(bcache_buf_t *buf)
+{
+    if (!(buf->flags & BCACHE_DIRTY))
+    {
+        buf->flags |= BCACHE_DIRTY;
+        buf->dirty_since = timer_ticks;
+        bcache.dirty++;
+    }
+}
+
+// Завершение чтения или записи буфера (из прерывания или опроса)
+static void bcache_io_done(blk_request_t *req)
+{
+    bcache_buf_t *buf = (bcache_buf_t *)req->context;
+    if (req->status != BLK_OK)
+    {
+        bcache.errors++;
+        if (req->write)
+            bcache_set_dirty(buf); // Повторим при следующей записи
+        else
+            memset(buf->data, 0, BCACHE_BLOCK_SIZE); // Нечитаемый блок отдаётся нулями
+    }
+    if (!req->write)
+        buf->flags |= BCACHE_VALID;
+    buf->flags &= ~BCACHE_IO;
+}
+
+// Асинхронное чтение или запись буфера. Последний блок устройства может
+// быть короче BCACHE_BLOCK_SIZE. -1 — запрос не принят (очередь полна)
+static int bcache_start_io(bcache_buf_t *buf, int write)
+{
+    uint32_t first = buf->block * BCACHE_BLOCK_SECTORS;
+    uint32_t sectors = buf->dev->sector_count - first;
+    if (sectors > BCACHE_BLOCK_SECTORS)
+        sectors = BCACHE_BLOCK_SECTORS;
+
+    blk_request_t *req = &buf->req;
+    memset(req, 0, sizeof(blk_request_t));
+    req->device = buf->dev;
+    req->sector = first;
+    req->write = write;
+    req->segments[0].buffer = buf->data;
+    req->segments[0].length = sectors * BLK_SECTOR_SIZE;
+    req->segment_count = 1;
+    req->complete = bcache_io_done;
+    req->context = buf;
+
+    // Флаг грязного буфера снимается до записи: изменения во время записи
+    // снова пометят буфер
+    uint8_t old_flags = buf->flags;
+    buf->flags = (buf->flags & ~BCACHE_DIRTY) | BCACHE_IO;
+    if (blk_submit(req) < 0)
+    {
+        buf->flags = old_flags;
+        return -1;
+    }
+
+    if (write)
+    {
+        bcache.dirty--;
+        bcache.writebacks++;
+    }
+    return 0;
+}
+
+// То же, но при заполненной очереди ждём завершения других запросов
+static int bcache_start_io_wait(bcache_buf_t *buf, int write)
+{
+    while (bcache_start_io(buf, write) < 0)
+    {
+        if (buf->dev->in_flight == 0)
+            return -1; // Запрос отвергнут не из-за очереди
+        buf->dev->poll(buf->dev);
+    }
+    return 0;
+}
+
+static void bcache_wait(bcache_buf_t *buf)
+{
+    if (buf->flags & BCACHE_IO)
+        blk_wait(&buf->req);
+}
+
+// Буфер под новый блок: свободный или дольше всех не использованный.
+// Грязный перед повторным использованием записывается (если allow_dirty).
+// NULL — все буферы закреплены, в полёте или (без allow_dirty) грязные
+static bcache_buf_t *bcache_victim(int allow_dirty)
+{
+    for (bcache_buf_t *buf = bcache.lru_head; buf; buf = buf->lru_next)
+    {
+        if (buf->refcount > 0 || (buf->flags & BCACHE_IO))
+            continue;
+
+        if (buf->flags & BCACHE_DIRTY)
+        {
+            if (!allow_dirty || bcache_start_io_wait(buf, 1) < 0)
+                continue;
+            bcache_wait(buf);
+            if (buf->flags & BCACHE_DIRTY)
+                continue; // Ошибка записи: блок остаётся в кэше
+            bcache.dirty_evictions++;
+        }
+
+        if (buf->dev)
+        {
+            bcache_release(buf);
+            bcache.evictions++;
+        }
+        return buf;
+    }
+    return NULL;
+}
+
+// Ожидание любого запроса в полёте. 0 — запросов нет
+static int bcache_wait_any(void)
+{
+    for (uint32_t i = 0; i < bcache.count; i++)
+    {
+        if (bcache.buffers[i].flags & BCACHE_IO)
+        {
+            bcache_wait(&bcache.buffers[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Упреждающее чтение: начиная со второго подряд идущего блока следующие
+// BCACHE_READAHEAD блоков читаются асинхронно, пока в очереди устройства
+// есть место. Под них берутся только чистые буферы
+static void bcache_readahead(block_device_t *dev, uint32_t block)
+{
+    if (block + 1 == dev->ra_next)
+        return; // Повторное обращение к тому же блоку
+    dev->ra_run = block == dev->ra_next ? dev->ra_run + 1 : 1;
+    dev->ra_next = block + 1;
+    if (dev->ra_run < BCACHE_SEQ_THRESHOLD)
+        return;
+
+    uint32_t blocks = (dev->sector_count + BCACHE_BLOCK_SECTORS - 1) / BCACHE_BLOCK_SECTORS;
+    for (uint32_t next = block + 1; next <= block + BCACHE_READAHEAD && next < blocks; next++)
+    {
+        if (bcache_lookup(dev, next))
+            continue;
+        if (dev->in_flight >= dev->queue_depth)
+            break;
+
+        bcache_buf_t *buf = bcache_victim(0);
+        if (!buf)
+            break;
+
+        bcache_assign(buf, dev, next);
+        if (bcache_start_io(buf, 0) < 0)
+        {
+            bcache_release(buf);
+            bcache_lru_move(buf, 0);
+            break;
+        }
+        buf->flags |= BCACHE_READAHEAD_FLAG;
+        bcache_lru_move(buf, 1);
+        bcache.readahead++;
+    }
+}
+
+// Закреплённый буфер блока устройства. fill = 0 — вызывающий перезапишет
+// блок целиком, читать его с устройства не нужно; такой буфер, отпущенный
+// без bcache_mark_dirty, отбрасывается. NULL — нет буферов
+bcache_buf_t *bcache_get(block_device_t *dev, uint32_t block, int fill)
+{
+    uint32_t flags = irq_save();
+
+    bcache_buf_t *buf = bcache_lookup(dev, block);
+    if (buf)
+    {
+        bcache.hits++;
+        if (buf->flags & BCACHE_READAHEAD_FLAG)
+        {
+            buf->flags &= ~BCACHE_READAHEAD_FLAG;
+            bcache.readahead_hits++;
+        }
+    }
+    else
+    {
+        bcache.misses++;
+        while (!(buf = bcache_victim(1)))
+        {
+            // Все буферы закреплены или в полёте: ждём завершения запросов
+            if (!bcache_wait_any())
+            {
+                irq_restore(flags);
+                terminal_writestring("bcache: no free buffers\n");
+                return NULL;
+            }
+        }
+
+        // Без fill содержимое задаст вызывающий: буфер станет
+        // действительным в bcache_mark_dirty
+        bcache_assign(buf, dev, block);
+        if (fill && bcache_start_io_wait(buf, 0) < 0)
+        {
+            memset(buf->data, 0, BCACHE_BLOCK_SIZE);
+            buf->flags |= BCACHE_VALID;
+            bcache.errors++;
+        }
+    }
+
+    buf->refcount++;
+    bcache_lru_move(buf, 1);
+
+    // Упреждающие запросы уходят до ожидания своего блока
+    if (fill)
+        bcache_readahead(dev, block);
+    bcache_wait(buf);
+
+    irq_restore(flags);
+    return buf;
+}
+
+// Буфер по указателю внутрь его данных
+bcache_buf_t *bcache_buf_of(const void *data)
+{
+    return &bcache.buffers[((const uint8_t *)data - bcache.data) / BCACHE_BLOCK_SIZE];
+}
+
+void bcache_put(bcache_buf_t *buf)
+{
+    if (!buf || buf->refcount == 0)
+        return;
+
+    uint32_t flags = irq_save();
+    if (--buf->refcount == 0 && buf->dev && !(buf->flags & (BCACHE_VALID | BCACHE_IO)))
+    {
+        // Буфер под перезапись так и не заполнили: данных блока в нём нет
+        bcache_release(buf);
+        bcache_lru_move(buf, 0);
+    }
+    irq_restore(flags);
+}
+
+// Пометка закреплённого буфера изменённым: на устройство он попадёт
+// фоновой записью, при вытеснении или по bcache_flush. Буфер, полученный
+// без чтения, с этого момента содержит блок
+void bcache_mark_dirty(bcache_buf_t *buf)
+{
+    uint32_t flags = irq_save();
+    buf->flags |= BCACHE_VALID;
+    bcache_set_dirty(buf);
+    irq_restore(flags);
+}
+
+// Блок уже в кэше и прочитан — 1. Иначе, если в очереди устройства есть
+// место и есть чистый буфер, его чтение запускается асинхронно — 0.
+// Не ждёт, поэтому годится для работы с запрещёнными прерываниями
+int bcache_prefetch(block_device_t *dev, uint32_t block)
+{
+    uint32_t flags = irq_save();
+    int ready = 0;
+    bcache_buf_t *buf = bcache_lookup(dev, block);
+    if (buf)
+    {
+        ready = (buf->flags & (BCACHE_VALID | BCACHE_IO)) == BCACHE_VALID;
+    }
+    else if (dev->in_flight < dev->queue_depth && (buf = bcache_victim(0)))
+    {
+        bcache_assign(buf, dev, block);
+        if (bcache_start_io(buf, 0) < 0)
+        {
+            bcache_release(buf);
+            bcache_lru_move(buf, 0);
+        }
+        else
+        {
+            bcache_lru_move(buf, 1);
+        }
+    }
+    irq_restore(flags);
+    return ready;
+}
+
+// Асинхронная запись буферов устройства dev (NULL — всех устройств),
+// грязных не меньше min_age тиков. Возвращает число поставленных запросов
+int bcache_writeback(block_device_t *dev, uint32_t min_age)
+{
+    if (bcache.dirty == 0)
+        return 0;
+
+    uint32_t flags = irq_save();
+    int started = 0;
+    for (uint32_t i = 0; i < bcache.count; i++)
+    {
+        bcache_buf_t *buf = &bcache.buffers[i];
+        if (!(buf->flags & BCACHE_DIRTY) || (buf->flags & BCACHE_IO) || (dev && buf->dev != dev))
+            continue;
+        if (timer_ticks - buf->dirty_since < min_age)
+            continue;
+
+        // Очередь устройства полна: собираем уже завершённые запросы, а если
+        // места так и нет — остальное запишем в следующий раз
+        if (bcache_start_io(buf, 1) < 0)
+        {
+            buf->dev->poll(buf->dev);
+            if (bcache_start_io(buf, 1) < 0)
+                continue;
+        }
+        started++;
+    }
+    irq_restore(flags);
+    return started;
+}
+
+// Запись всех грязных буферов устройства с ожиданием завершения.
+// Возвращает число записанных буферов, -1 — ошибка ввода-вывода
+int bcache_flush(block_device_t *dev)
+{
+    uint32_t flags = irq_save();
+    uint32_t errors = bcache.errors;
+    int written = 0;
+
+    for (uint32_t i = 0; i < bcache.count; i++)
+    {
+        bcache_buf_t *buf = &bcache.buffers[i];
+        if (buf->dev != dev || !(buf->flags & BCACHE_DIRTY))
+            continue;
+
+        bcache_wait(buf);
+        if (bcache_start_io_wait(buf, 1) < 0)
+            bcache.errors++;
+        else
+            written++;
+    }
+
+    for (uint32_t i = 0; i < bcache.count; i++)
+    {
+        if (bcache.buffers[i].dev == dev)
+            bcache_wait(&bcache.buffers[i]);
+    }
+
+    irq_restore(flags);
+    return bcache.errors == errors ? written : -1;
+}
+
+// Фоновая запись по таймеру: буферы, грязные дольше BCACHE_DIRTY_AGE
+void bcache_timer(void)
+{
+    bcache.timer_writebacks += bcache_writeback(NULL, BCACHE_DIRTY_AGE);
+}
+
+void init_bcache(void)
+{
+    // На буфер: данные, заголовок и до двух слотов хеш-таблицы
+    uint32_t per_buffer = BCACHE_BLOCK_SIZE + sizeof(bcache_buf_t) + 2 * sizeof(bcache_buf_t *);
+    uint32_t reserved = 0;
+    uint8_t *memory = (uint8_t *)phys_reserve_direct(BCACHE_MAX_BYTES, &reserved);
+    uint32_t count = memory ? reserved / per_buffer : 0;
+
+    if (count < BCACHE_MIN_BUFFERS)
+    {
+        // Данные буферов должны начинаться с границы страницы: берём кадры
+        phys_addr_t phys;
+        count = BCACHE_MIN_BUFFERS;
+        memory = (uint8_t *)phys_alloc_direct((count * per_buffer + PAGE_SIZE - 1) / PAGE_SIZE, &phys);
+        if (!memory)
+        {
+            terminal_writestring("Error: Failed to allocate buffer cache\n");
+            return;
+        }
+    }
+
+    uint32_t hash_size = 1;
+    while (hash_size * 2 <= count * 2)
+        hash_size <<= 1;
+
+    // Разметка: данные буферов (выровнены по странице), заголовки, хеш-таблица
+    bcache.data = memory;
+    bcache.buffers = (bcache_buf_t *)(memory + count * BCACHE_BLOCK_SIZE);
+    bcache.hash = (bcache_buf_t **)(bcache.buffers + count);
+    bcache.hash_mask = hash_size - 1;
+    bcache.count = count;
+    memset(bcache.buffers, 0, count * sizeof(bcache_buf_t));
+    memset(bcache.hash, 0, hash_size * sizeof(bcache_buf_t *));
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        bcache_buf_t *buf = &bcache.buffers[i];
+        buf->data = bcache.data + i * BCACHE_BLOCK_SIZE;
+        buf->lru_prev = i > 0 ? &bcache.buffers[i - 1] : NULL;
+        buf->lru_next = i + 1 < count ? &bcache.buffers[i + 1] : NULL;
+    }
+    bcache.lru_head = &bcache.buffers[0];
+    bcache.lru_tail = &bcache.buffers[count - 1];
+
+    terminal_writestring("Buffer cache: ");
+    print_number(count * BCACHE_BLOCK_SIZE / 1024);
+    terminal_writestring(" KB in ");
+    print_number(count);
+    terminal_writestring(" buffers\n");
+}
+
+// === RAM-ДИСК ===
+
+// Блочное устройство в памяти для проверки блочного слоя и кэша без
+// virtio. Данные копируются при постановке запроса, а завершения, как у
+// настоящего устройства, собираются опросом
+static struct
+{
+    block_device_t dev;
+    uint8_t *data;
+    blk_request_t *pending[RAMDISK_QUEUE_DEPTH];
+    uint32_t pending_count;
+} ramdisk;
+
+static int ramdisk_submit(block_device_t *dev, blk_request_t *req)
+{
+    (void)dev;
+    if (ramdisk.pending_count >= RAMDISK_QUEUE_DEPTH)
+        return -1;
+
+    uint8_t *disk = ramdisk.data + req->sector * BLK_SECTOR_SIZE;
+    for (uint32_t i = 0; i < req->segment_count; i++)
+    {
+        blk_segment_t *seg = &req->segments[i];
+        if (req->write)
+            memcpy(disk, seg->buffer, seg->length);
+        else
+            memcpy(seg->buffer, disk, seg->length);
+        disk += seg->length;
+    }
+
+    ramdisk.pending[ramdisk.pending_count++] = req;
+    return 0;
+}
+
+static void ramdisk_poll(block_device_t *dev)
+{
+    (void)dev;
+    uint32_t flags = irq_save();
+    while (ramdisk.pending_count > 0)
+        blk_complete(ramdisk.pending[--ramdisk.pending_count], BLK_OK);
+    irq_restore(flags);
+}
+
+void init_ramdisk(void)
+{
+    uint32_t reserved = 0;
+    ramdisk.data = (uint8_t *)phys_reserve_direct(RAMDISK_SIZE, &reserved);
+    if (!ramdisk.data || reserved < RAMDISK_SIZE)
+    {
+        terminal_writestring("RAM disk: not enough memory\n");
+        return;
+    }
+
+    memset(ramdisk.data, 0, RAMDISK_SIZE);
+    strcpy(ramdisk.dev.name, "ram0");
+    ramdisk.dev.sector_count = RAMDISK_SIZE / BLK_SECTOR_SIZE;
+    ramdisk.dev.queue_depth = RAMDISK_QUEUE_DEPTH;
+    ramdisk.dev.submit = ramdisk_submit;
+    ramdisk.dev.poll = ramdisk_poll;
+    blk_register(&ramdisk.dev);
+}
+
+// === VIRTIO-BLK ===
+
+// Кольца virtqueue (legacy-раскладка: дескрипторы, avail, выравнивание
+// до страницы, used)
+typedef struct
+{
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) virtq_desc_t;
+
+typedef struct
+{
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} __attribute__((packed)) virtq_avail_t;
+
+typedef struct
+{
+    uint32_t id;
+    uint32_t len;
+} __attribute__((packed)) virtq_used_elem_t;
+
+typedef struct
+{
+    uint16_t flags;
+    uint16_t idx;
+    virtq_used_elem_t ring[];
+} __attribute__((packed)) virtq_used_t;
+
+// Заголовок запроса virtio-blk
+typedef struct
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed)) virtio_blk_header_t;
+
+typedef struct
+{
+    block_device_t dev;
+    uint16_t io_base;
+    uint16_t queue_size;
+    virtq_desc_t *desc;
+    virtq_avail_t *avail;
+    volatile virtq_used_t *used;
+    uint16_t free_head;            // Список свободных дескрипторов через next
+    uint16_t free_count;
+    uint16_t last_used;            // Следующий необработанный элемент used
+    virtio_blk_header_t *headers;  // По индексу головного дескриптора
+    uint8_t *statuses;             // Байт статуса от устройства
+    blk_request_t **requests;      // Запрос по головному дескриптору
+    uint32_t interrupts;
+} virtio_blk_t;
+
+static virtio_blk_t virtio_blk;
+
+static inline void virtio_barrier(void)
+{
+    asm volatile("" : : : "memory");
+}
+
+static int virtio_blk_submit(block_device_t *dev, blk_request_t *req)
+{
+    virtio_blk_t *vb = (virtio_blk_t *)dev->driver_data;
+    uint32_t flags = irq_save();
+
+    // Заголовок, сегменты данных и байт статуса — одна цепочка дескрипторов
+    if (vb->free_count < req->segment_count + 2)
+    {
+        irq_restore(flags);
+        return -1;
+    }
+
+    uint16_t head = vb->free_head;
+    uint16_t index = head;
+    vb->headers[head].type = req->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    vb->headers[head].reserved = 0;
+    vb->headers[head].sector = req->sector;
+    vb->statuses[head] = 0xFF;
+    vb->requests[head] = req;
+
+    vb->desc[index].addr = V2P(&vb->headers[head]);
+    vb->desc[index].len = sizeof(virtio_blk_header_t);
+    vb->desc[index].flags = VIRTQ_DESC_F_NEXT;
+    index = vb->desc[index].next;
+
+    for (uint32_t i = 0; i < req->segment_count; i++)
+    {
+        vb->desc[index].addr = V2P(req->segments[i].buffer);
+        vb->desc[index].len = req->segments[i].length;
+        vb->desc[index].flags = VIRTQ_DESC_F_NEXT | (req->write ? 0 : VIRTQ_DESC_F_WRITE);
+        index = vb->desc[index].next;
+    }
+
+    vb->desc[index].addr = V2P(&vb->statuses[head]);
+    vb->desc[index].len = 1;
+    vb->desc[index].flags = VIRTQ_DESC_F_WRITE;
+    vb->free_head = vb->desc[index].next;
+    vb->free_count -= req->segment_count + 2;
+
+    vb->avail->ring[vb->avail->idx % vb->queue_size] = head;
+    virtio_barrier();
+    vb->avail->idx++;
+    virtio_barrier();
+    outw(vb->io_base + VIRTIO_PCI_QUEUE_NOTIFY, 0);
+
+    irq_restore(flags);
+    return 0;
+}
+
+// Обработка новых элементов кольца used: возврат цепочек в список
+// свободных и завершение запросов. Вызывается с запрещёнными прерываниями
+static void virtio_blk_reap(virtio_blk_t *vb)
+{
+    while (vb->last_used != vb->used->idx)
+    {
+        virtio_barrier();
+        uint16_t head = vb->used->ring[vb->last_used % vb->queue_size].id;
+        blk_request_t *req = vb->requests[head];
+        int status = vb->statuses[head] == 0 ? BLK_OK : BLK_ERROR;
+
+        uint16_t tail = head;
+        uint16_t count = 1;
+        while (vb->desc[tail].flags & VIRTQ_DESC_F_NEXT)
+        {
+            tail = vb->desc[tail].next;
+            count++;
+        }
+        vb->desc[tail].next = vb->free_head;
+        vb->free_head = head;
+        vb->free_count += count;
+        vb->requests[head] = NULL;
+        vb->last_used++;
+
+        if (req)
+            blk_complete(req, status);
+    }
+}
+
+static void virtio_blk_irq(int irq)
+{
+    (void)irq;
+    // Чтение ISR подтверждает прерывание
+    if (inb(virtio_blk.io_base + VIRTIO_PCI_ISR) & 1)
+        virtio_blk.interrupts++;
+    virtio_blk_reap(&virtio_blk);
+}
+
+static void virtio_blk_poll(block_device_t *dev)
+{
+    uint32_t flags = irq_save();
+    virtio_blk_reap((virtio_blk_t *)dev->driver_data);
+    irq_restore(flags);
+}
+
+// Поиск устройства на шине PCI, согласование и настройка очереди 0
+void init_virtio_blk(void)
+{
+    pci_device_t *pci = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID);
+    if (!pci || !(pci->bar[0] & 1))
+    {
+        terminal_writestring("virtio-blk: no device\n");
+        return;
+    }
+
+    virtio_blk_t *vb = &virtio_blk;
+    memset(vb, 0, sizeof(virtio_blk_t));
+    vb->io_base = pci->bar[0] & 0xFFFC;
+    pci_enable_device(pci);
+
+    uint16_t io = vb->io_base;
+    outb(io + VIRTIO_PCI_STATUS, 0); // Сброс
+    outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    outl(io + VIRTIO_PCI_GUEST_FEATURES, 0); // Дополнительные возможности не нужны
+
+    outw(io + VIRTIO_PCI_QUEUE_SEL, 0);
+    vb->queue_size = inw(io + VIRTIO_PCI_QUEUE_NUM);
+    uint32_t n = vb->queue_size;
+    uint32_t avail_end = n * sizeof(virtq_desc_t) + 6 + 2 * n;
+    uint32_t used_offset = (avail_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint32_t ring_bytes = used_offset + ((6 + 8 * n + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+
+    // Кольца — физически непрерывные выровненные по странице кадры
+    uint32_t reserved;
+    uint8_t *ring = (uint8_t *)phys_reserve_direct(ring_bytes, &reserved);
+    vb->headers = (virtio_blk_header_t *)kmalloc(n * sizeof(virtio_blk_header_t));
+    vb->statuses = (uint8_t *)kmalloc(n);
+    vb->requests = (blk_request_t **)kmalloc(n * sizeof(blk_request_t *));
+    if (n == 0 || !ring || reserved < ring_bytes || !vb->headers || !vb->statuses || !vb->requests)
+    {
+        terminal_writestring("virtio-blk: failed to set up queue\n");
+        outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+        return;
+    }
+
+    memset(ring, 0, ring_bytes);
+    memset(vb->requests, 0, n * sizeof(blk_request_t *));
+    vb->desc = (virtq_desc_t *)ring;
+    vb->avail = (virtq_avail_t *)(ring + n * sizeof(virtq_desc_t));
+    vb->used = (volatile virtq_used_t *)(ring + used_offset);
+    for (uint32_t i = 0; i < n; i++)
+        vb->desc[i].next = (i + 1) % n;
+    vb->free_head = 0;
+    vb->free_count = n;
+    outl(io + VIRTIO_PCI_QUEUE_PFN, V2P(ring) >> 12);
+
+    // Ёмкость — 64 бита, используем младшие 32 (до 2TB)
+    vb->dev.sector_count = inl(io + VIRTIO_PCI_CONFIG);
+    strcpy(vb->dev.name, "vda");
+    vb->dev.queue_depth = n / 3; // Минимальная цепочка — 3 дескриптора
+    vb->dev.submit = virtio_blk_submit;
+    vb->dev.poll = virtio_blk_poll;
+    vb->dev.driver_data = vb;
+
+    if (pci->irq_line < 16)
+        irq_register(pci->irq_line, virtio_blk_irq);
+    outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    blk_register(&vb->dev);
+
+    terminal_writestring("virtio-blk: vda, ");
+    print_number(vb->dev.sector_count / 2048);
+    terminal_writestring(" MB, queue ");
+    print_number(n);
+    terminal_writestring(", IRQ ");
+    print_number(pci->irq_line);
+    terminal_writestring("\n");
+}
+
+// === СИСТЕМНЫЕ ВЫЗОВЫ ===
+
+// ===== ВАЛИДАЦИЯ СИСТЕМНЫХ ВЫЗОВОВ =====
+typedef int (*syscall_fn_t)(int, int, int, int, int);
+
+static int sys_exit_impl(int code, int _1, int _2, int _3, int _4)
+{
+    (void)_1;
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    if (!current_task)
+        return -1;
+    current_task->state = TASK_STATE_DEAD;
+    cleanup_process(current_task);
+    schedule();
+    return code;
+}
+
+// Копирование участка файла в память процесса (ctx — позиция в буфере).
+// Недоступная страница в начале участка — ошибка, а не конец файла
+static int span_to_user(void *ctx, uint8_t *data, uint32_t size)
+{
+    uint8_t **user = (uint8_t **)ctx;
+    int copied = copy_to_user_safe(*user, data, size);
+    if (copied <= 0)
+        return -1;
+    *user += copied;
+    return copied;
+}
+
+// Заполнение участка файла из памяти процесса
+static int span_from_user(void *ctx, uint8_t *data, uint32_t size)
+{
+    uint8_t **user = (uint8_t **)ctx;
+    int copied = copy_from_user_safe(data, *user, size);
+    if (copied <= 0)
+        return -1;
+    *user += copied;
+    return copied;
+}
+
+// Дописывание участка в другой открытый файл (ctx — open_file_t)
+static int span_to_file(void *ctx, uint8_t *data, uint32_t size)
+{
+    return fs_file_write((open_file_t *)ctx, data, size);
+}
+
+// Ввод-вывод открытого файла без промежуточного буфера ядра: операции файла
+// передают участки своей памяти хранения прямо в память процесса и из неё.
+// Без positional работает от позиции открытого файла и сдвигает её, иначе —
+// по смещению offset
+static int sys_file_io(int fdnum, int buf, int count, int offset, int positional, int write)
+{
+    if (count < 0 || (positional && offset < 0))
+        return -1;
+    if (is_cpl3() && !is_user_address((void *)buf, (uint32_t)count))
+        return -1;
+
+    file_descriptor_t *fd = get_fd(current_task, fdnum);
+    if (!fd || !fd->file)
+        return -1;
+    if (count == 0)
+        return 0;
+
+    uint8_t *user = (uint8_t *)buf;
+    uint32_t at = positional ? (uint32_t)offset : FS_AT_POSITION;
+    if (write)
+        return fs_file_write_spans(fd->file, at, count, is_cpl3() ? span_from_user : fs_span_from_buffer, &user);
+    return fs_file_read_spans(fd->file, at, count, is_cpl3() ? span_to_user : fs_span_to_buffer, &user);
+}
+
+static int sys_write_impl(int fdnum, int buf, int count, int _3, int _4)
+{
+    (void)_3;
+    (void)_4;
+    return sys_file_io(fdnum, buf, count, 0, 0, 1);
+}
+
+static int sys_getpid_impl(int _0, int _1, int _2, int _3, int _4)
+{
+    (void)_0;
+    (void)_1;
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    return current_task ? (int)current_task->process.pid : -1;
+}
+
+static int sys_read_impl(int fdnum, int buf, int count, int _3, int _4)
+{
+    (void)_3;
+    (void)_4;
+    return sys_file_io(fdnum, buf, count, 0, 0, 0);
+}
+
+static int sys_pread_impl(int fdnum, int buf, int count, int offset, int _4)
+{
+    (void)_4;
+    return sys_file_io(fdnum, buf, count, offset, 1, 0);
+}
+
+static int sys_pwrite_impl(int fdnum, int buf, int count, int offset, int _4)
+{
+    (void)_4;
+    return sys_file_io(fdnum, buf, count, offset, 1, 1);
+}
+
+// Передача данных из файла в другой файл или устройство внутри ядра, без
+// копирования через память процесса. offset < 0 — с позиции in_fd со сдвигом
+static int sys_sendfile_impl(int out_fdnum, int in_fdnum, int offset, int count, int _4)
+{
+    (void)_4;
+    if (count < 0)
+        return -1;
+
+    file_descriptor_t *out = get_fd(current_task, out_fdnum);
+    file_descriptor_t *in = get_fd(current_task, in_fdnum);
+    if (!out || !in)
+        return -1;
+
+    open_file_t *in_file = in->file;
+    open_file_t *out_file = out->file;
+    if (out_file->inode && out_file->inode == in_file->inode)
+        return -1; // Участки источника и приёмника перекрывались бы
+    if ((out_file->flags & O_ACCMODE) == O_RDONLY)
+        return -1;
+
+    uint32_t at = offset < 0 ? FS_AT_POSITION : (uint32_t)offset;
+    return fs_file_read_spans(in_file, at, count, span_to_file, out_file);
+}
+
+// Копирование пути из памяти процесса (или ядра) в буфер FS_MAX_PATH
+static int copy_path_from_user(char *kernel_path, int path)
+{
+    if (is_cpl3() && !is_user_address((void *)path, FS_MAX_PATH))
+        return -1;
+
+    int copied;
+    if (is_cpl3())
+    {
+        copied = copy_from_user_safe(kernel_path, (void *)path, FS_MAX_PATH - 1);
+        if (copied <= 0)
+            return -1;
+    }
+    else
+    {
+        strncpy(kernel_path, (char *)path, FS_MAX_PATH - 1);
+        copied = strlen(kernel_path);
+    }
+    kernel_path[copied] = '\0';
+    return 0;
+}
+
+// Копия файла без копирования данных: dst делит блоки src до первой записи
+static int sys_clonefile_impl(int src, int dst, int _2, int _3, int _4)
+{
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    char src_path[FS_MAX_PATH];
+    char dst_path[FS_MAX_PATH];
+    if (copy_path_from_user(src_path, src) < 0 || copy_path_from_user(dst_path, dst) < 0)
+        return -1;
+    return fs_clone_file(src_path, dst_path);
+}
+
+// Копирование записи в память процесса (или ядра)
+static int copy_out(int dst, const void *src, uint32_t size)
+{
+    if (!is_cpl3())
+    {
+        memcpy((void *)dst, src, size);
+        return 0;
+    }
+    return copy_to_user((void *)dst, src, size);
+}
+
+static int sys_stat_impl(int path, int buf, int _2, int _3, int _4)
+{
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    char kernel_path[FS_MAX_PATH];
+    stat_t st;
+    if (is_cpl3() && !is_user_address((void *)buf, sizeof(stat_t)))
+        return -1;
+    if (copy_path_from_user(kernel_path, path) < 0 || fs_stat(kernel_path, &st) < 0)
+        return -1;
+    return copy_out(buf, &st, sizeof(stat_t));
+}
+
+// Заполнение буфера getdents/readdirplus записями директории
+typedef struct
+{
+    int buf;       // Адрес буфера процесса
+    uint32_t size; // Размер буфера
+    uint32_t used; // Заполнено байт
+    int plus;      // Записи dirent_plus_t со сведениями о файле
+    int error;     // Ошибка копирования в память процесса
+} dirent_fill_t;
+
+static int dirent_fill_entry(fs_dir_entry_t *entry, void *ctx)
+{
+    dirent_fill_t *fill = (dirent_fill_t *)ctx;
+    uint32_t name_len = strlen(entry->name) + 1;
+    uint32_t header = fill->plus ? sizeof(dirent_plus_t) : sizeof(dirent_t);
+    uint32_t reclen = (header + name_len + 3) & ~3u;
+    if (fill->used + reclen > fill->size)
+        return 1; // Запись остаётся следующему вызову
+
+    // Запись собирается на стеке и копируется целиком
+    uint8_t record[sizeof(dirent_plus_t) + FS_MAX_FILENAME + 4];
+    memset(record, 0, reclen);
+    if (fill->plus)
+    {
+        dirent_plus_t *d = (dirent_plus_t *)record;
+        if (entry->inode_number != 0)
+            fs_stat_inode(entry->inode_number, &d->d_stat);
+        else
+            d->d_stat.st_type = entry->type; // Запись смонтированной ФС
+        d->d_reclen = reclen;
+        memcpy(d->d_name, entry->name, name_len);
+    }
+    else
+    {
+        dirent_t *d = (dirent_t *)record;
+        d->d_ino = entry->inode_number;
+        d->d_reclen = reclen;
+        d->d_type = entry->type;
+        memcpy(d->d_name, entry->name, name_len);
+    }
+
+    if (copy_out(fill->buf + fill->used, record, reclen) < 0)
+    {
+        fill->error = 1;
+        return 1;
+    }
+    fill->used += reclen;
+    return 0;
+}
+
+// Чтение записей открытой директории с её позиции: столько записей,
+// сколько целиком помещается в буфер. 0 — конец директории
+static int sys_dirents(int fdnum, int buf, int size, int plus)
+{
+    if (size <= 0)
+        return -1;
+    if (is_cpl3() && !is_user_address((void *)buf, (uint32_t)size))
+        return -1;
+    file_descriptor_t *fd = get_fd(current_task, fdnum);
+    if (!fd || !fd->file)
+        return -1;
+
+    dirent_fill_t fill = {buf, (uint32_t)size, 0, plus, 0};
+    int result = fs_file_readdir(fd->file, dirent_fill_entry, &fill);
+    if (result < 0 || fill.error || (result > 0 && fill.used == 0))
+        return -1; // Не директория или буфер меньше следующей записи
+    return fill.used;
+}
+
+static int sys_getdents_impl(int fdnum, int buf, int size, int _3, int _4)
+{
+    (void)_3;
+    (void)_4;
+    return sys_dirents(fdnum, buf, size, 0);
+}
+
+static int sys_readdirplus_impl(int fdnum, int buf, int size, int _3, int _4)
+{
+    (void)_3;
+    (void)_4;
+    return sys_dirents(fdnum, buf, size, 1);
+}
+
+// Наблюдатель за изменениями файлов; события читаются через read
+static int sys_inotify_init_impl(int _0, int _1, int _2, int _3, int _4)
+{
+    (void)_0;
+    (void)_1;
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    open_file_t *file = fs_watch_open();
+    if (!file)
+        return -1;
+
+    int fd = allocate_fd(current_task, file);
+    if (fd < 0)
+        fs_close(file);
+    return fd;
+}
+
+static int sys_inotify_add_watch_impl(int fdnum, int path, int mask, int _3, int _4)
+{
+    (void)_3;
+    (void)_4;
+    char kernel_path[FS_MAX_PATH];
+    file_descriptor_t *fd = get_fd(current_task, fdnum);
+    if (!fd || copy_path_from_user(kernel_path, path) < 0)
+        return -1;
+    return fs_watch_add(fd->file, kernel_path, (uint32_t)mask);
+}
+
+static int sys_inotify_rm_watch_impl(int fdnum, int wd, int _2, int _3, int _4)
+{
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    file_descriptor_t *fd = get_fd(current_task, fdnum);
+    if (!fd)
+        return -1;
+    return fs_watch_remove(fd->file, wd);
+}
+
+static int sys_lseek_impl(int fdnum, int offset, int whence, int _3, int _4)
+{
+    (void)_3;
+    (void)_4;
+    file_descriptor_t *fd = get_fd(current_task, fdnum);
+    if (!fd)
+        return -1;
+    return fs_file_seek(fd->file, offset, whence);
+}
+
+static int sys_open_impl(int path, int flags, int _2, int _3, int _4)
+{
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    if (is_cpl3() && !is_user_address((void *)path, 256))
+        return -1;
+
+    char kernel_path[256];
+    int copied = 0;
+
+    if (is_cpl3())
+    {
+        copied = copy_from_user_safe(kernel_path, (void *)path, 255);
+        if (copied <= 0)
+            return -1;
+    }
+    else
+    {
+        strncpy(kernel_path, (char *)path, 255);
+        copied = strlen(kernel_path);
+    }
+    kernel_path[copied] = '\0';
+
+    open_file_t *file = fs_open(kernel_path, flags);
+    if (!file)
+        return -1;
+
+    int fd = allocate_fd(current_task, file);
+    if (fd < 0)
+        fs_close(file);
+    return fd;
+}
+
+static int sys_close_impl(int fdnum, int _1, int _2, int _3, int _4)
+{
+    (void)_1;
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    return free_fd(current_task, fdnum);
+}
+
+static int sys_fork_impl(int _0, int _1, int _2, int _3, int _4)
+{
+    (void)_0;
+    (void)_1;
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    task_t *child = fork_process(current_task);
+    return child ? (int)child->process.pid : -1;
+}
+
+static int sys_exec_impl(int path, int argv, int _2, int _3, int _4)
+{
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    if (is_cpl3() && !is_user_address((void *)path, 256))
+        return -1;
+
+    char kernel_path[256];
+    int copied = 0;
+
+    if (is_cpl3())
+    {
+        copied = copy_from_user_safe(kernel_path, (void *)path, 255);
+        if (copied <= 0)
+            return -1;
+    }
+    else
+    {
+        strncpy(kernel_path, (char *)path, 255);
+        copied = strlen(kernel_path);
+    }
+    kernel_path[copied] = '\0';
+
+    return exec_process(kernel_path, (char **)argv);
+}
+
+static int sys_wait_impl(int pid, int _1, int _2, int _3, int _4)
+{
+    (void)_1;
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    return wait_process(pid);
+}
+
+static int sys_yield_impl(int _0, int _1, int _2, int _3, int _4)
+{
+    (void)_0;
+    (void)_1;
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    schedule();
+    return 0;
+}
+
+static int sys_getppid_impl(int _0, int _1, int _2, int _3, int _4)
+{
+    (void)_0;
+    (void)_1;
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    return current_task ? (int)current_task->process.ppid : -1;
+}
+
+static int sys_getuid_impl(int _0, int _1, int _2, int _3, int _4)
+{
+    (void)_0;
+    (void)_1;
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    return current_task ? (int)current_task->process.uid : -1;
+}
+
+static int sys_getgid_impl(int _0, int _1, int _2, int _3, int _4)
+{
+    (void)_0;
+    (void)_1;
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    return current_task ? (int)current_task->process.gid : -1;
+}
+
+static int sys_chdir_impl(int path, int _1, int _2, int _3, int _4)
+{
+    (void)_1;
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    if (is_cpl3() && !is_user_address((void *)path, 256))
+        return -1;
+
+    char kernel_path[FS_MAX_PATH];
+    int copied = 0;
+
+    if (is_cpl3())
+    {
+        copied = copy_from_user_safe(kernel_path, (void *)path, FS_MAX_PATH - 1);
+        if (copied <= 0)
+            return -1;
+    }
+    else
+    {
+        strncpy(kernel_path, (char *)path, FS_MAX_PATH - 1);
+        copied = strlen(kernel_path);
+    }
+    kernel_path[copied] = '\0';
+
+    int inode = fs_lookup_path(kernel_path);
+    if (inode < 0 || fs_inode(inode)->type != FS_INODE_DIR)
+        return -1;
+
+    current_task->process.cwd_inode = inode;
+    return 0;
+}
+
+static int sys_getcwd_impl(int buf, int size, int _2, int _3, int _4)
+{
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    if (size <= 0)
+        return -1;
+    if (is_cpl3() && !is_user_address((void *)buf, size))
+        return -1;
+
+    char path[FS_MAX_PATH];
+    int len = fs_get_path(fs_cwd_inode(), path, sizeof(path));
+    if (len < 0 || len + 1 > size)
+        return -1;
+
+    if (is_cpl3())
+    {
+        if (copy_to_user_safe((void *)buf, path, len + 1) != len + 1)
+            return -1;
+    }
+    else
+    {
+        memcpy((void *)buf, path, len + 1);
+    }
+    return len;
+}
+
+// === КОЛЬЦА ВВОДА-ВЫВОДА ===
+
+// Пакетный ввод-вывод (формат в io_ring.h): процесс заполняет очередь
+// отправки в своей памяти, один io_ring_enter выполняет все накопленные
+// операции и выкладывает результаты в очередь завершений. Стоимость
+// прерывания делится на весь пакет
+
+// Регистрация колец процесса, ring == 0 — отмена регистрации
+static int sys_io_ring_setup_impl(int ring_addr, int _1, int _2, int _3, int _4)
+{
+    (void)_1;
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    io_ring_t *ring = (io_ring_t *)ring_addr;
+    if (!ring)
+    {
+        current_task->process.io_ring = NULL;
+        return 0;
+    }
+    if (is_cpl3() && !is_user_address(ring, sizeof(io_ring_t)))
+        return -1;
+
+    ring->sq_head = ring->sq_tail = 0;
+    ring->cq_head = ring->cq_tail = 0;
+    ring->sq_entries = IO_RING_SQ_ENTRIES;
+    ring->cq_entries = IO_RING_CQ_ENTRIES;
+    current_task->process.io_ring = ring;
+    return 0;
+}
+
+// Выполнение одной операции тем же обработчиком, что и у системного вызова
+static int io_ring_execute(const io_sqe_t *sqe)
+{
+    switch (sqe->opcode)
+    {
+    case IO_OP_NOP:
+        return 0;
+    case IO_OP_READ:
+        if (sqe->offset < 0)
+            return sys_read_impl(sqe->fd, sqe->addr, sqe->len, 0, 0);
+        return sys_pread_impl(sqe->fd, sqe->addr, sqe->len, sqe->offset, 0);
+    case IO_OP_WRITE:
+        if (sqe->offset < 0)
+            return sys_write_impl(sqe->fd, sqe->addr, sqe->len, 0, 0);
+        return sys_pwrite_impl(sqe->fd, sqe->addr, sqe->len, sqe->offset, 0);
+    case IO_OP_OPEN:
+        return sys_open_impl(sqe->addr, sqe->len, 0, 0, 0);
+    case IO_OP_CLOSE:
+        return sys_close_impl(sqe->fd, 0, 0, 0, 0);
+    default:
+        return -1;
+    }
+}
+
+// Выполнение до to_submit операций из очереди отправки. Операции
+// синхронны, поэтому каждая сразу получает завершение; при полной очереди
+// завершений оставшиеся ждут следующего вызова. Возвращает число
+// выполненных операций
+static int sys_io_ring_enter_impl(int to_submit, int _1, int _2, int _3, int _4)
+{
+    (void)_1;
+    (void)_2;
+    (void)_3;
+    (void)_4;
+    io_ring_t *ring = current_task->process.io_ring;
+    if (!ring || to_submit < 0)
+        return -1;
+    if (ring->sq_tail - ring->sq_head > IO_RING_SQ_ENTRIES)
+        return -1; // Индексы испорчены программой
+
+    int done = 0;
+    while (done < to_submit && ring->sq_head != ring->sq_tail &&
+           ring->cq_tail - ring->cq_head < IO_RING_CQ_ENTRIES)
+    {
+        // Запись копируется до сдвига головы: после него программа может
+        // заполнить слот заново
+        io_sqe_t sqe = ring->sq[ring->sq_head & (IO_RING_SQ_ENTRIES - 1)];
+        ring->sq_head++;
+
+        io_cqe_t *cqe = &ring->cq[ring->cq_tail & (IO_RING_CQ_ENTRIES - 1)];
+        cqe->user_data = sqe.user_data;
+        cqe->result = io_ring_execute(&sqe);
+        ring->cq_tail++;
+        done++;
+    }
+    return done;
+}
+
+static const struct
+{
+    int num;
+    const char *name; // Для /proc/syscalls
+    syscall_fn_t fn;
+} syscall_table[] = {
+    {SYS_EXIT, "exit", sys_exit_impl},
+    {SYS_WRITE, "write", sys_write_impl},
+    {SYS_READ, "read", sys_read_impl},
+    {SYS_OPEN, "open", sys_open_impl},
+    {SYS_CLOSE, "close", sys_close_impl},
+    {SYS_FORK, "fork", sys_fork_impl},
+    {SYS_EXEC, "exec", sys_exec_impl},
+    {SYS_WAIT, "wait", sys_wait_impl},
+    {SYS_GETPID, "getpid", sys_getpid_impl},
+    {SYS_GETPPID, "getppid", sys_getppid_impl},
+    {SYS_GETUID, "getuid", sys_getuid_impl},
+    {SYS_GETGID, "getgid", sys_getgid_impl},
+    {SYS_YIELD, "yield", sys_yield_impl},
+    {SYS_CHDIR, "chdir", sys_chdir_impl},
+    {SYS_GETCWD, "getcwd", sys_getcwd_impl},
+    {SYS_LSEEK, "lseek", sys_lseek_impl},
+    {SYS_PREAD, "pread", sys_pread_impl},
+    {SYS_PWRITE, "pwrite", sys_pwrite_impl},
+    {SYS_SENDFILE, "sendfile", sys_sendfile_impl},
+    {SYS_IO_RING_SETUP, "io_ring_setup", sys_io_ring_setup_impl},
+    {SYS_IO_RING_ENTER, "io_ring_enter", sys_io_ring_enter_impl},
+    {SYS_CLONEFILE, "clonefile", sys_clonefile_impl},
+    {SYS_STAT, "stat", sys_stat_impl},
+    {SYS_GETDENTS, "getdents", sys_getdents_impl},
+    {SYS_READDIRPLUS, "readdirplus", sys_readdirplus_impl},
+    {SYS_INOTIFY_INIT, "inotify_init", sys_inotify_init_impl},
+    {SYS_INOTIFY_ADD_WATCH, "inotify_add_watch", sys_inotify_add_watch_impl},
+    {SYS_INOTIFY_RM_WATCH, "inotify_rm_watch", sys_inotify_rm_watch_impl},
+};
+
+static syscall_fn_t find_syscall(int num)
+{
+    for (unsigned i = 0; i < (sizeof(syscall_table) / sizeof(syscall_table[0])); i++)
+        if (syscall_table[i].num == num)
+            return syscall_table[i].fn;
+    return NULL;
+}
+
+int handle_syscall(int syscall_num, int arg0, int arg1, int arg2, int arg3, int arg4)
+{
+    if (!current_task)
+        return -1;
+    syscall_fn_t fn = find_syscall(syscall_num);
+    if (!fn)
+        return -1;
+    syscall_counts[syscall_num]++;
+
+    // Пути в системных вызовах разрешаются от директории вызвавшей задачи
+    in_syscall++;
+    int result = fn(arg0, arg1, arg2, arg3, arg4);
+    in_syscall--;
+    return result;
+}
+
+// === VFS ===
+
+// Корневая ФС (том в памяти или на устройстве) разбирает пути сама. Другие
+// ФС монтируются в её директории: путь, дошедший до точки монтирования,
+// дальше разбирает смонтированная ФС через свою таблицу inode_ops_t, а ввод-
+// вывод открытого файла идёт через его таблицу file_ops_t — одним косвенным
+// вызовом, без проверок типа файла в системных вызовах
+
+// Монтирование ops в директорию path (создаётся, если её нет; на томе она
+// сохраняется как обычная)
+int vfs_mount(const char *path, const inode_ops_t *ops)
+{
+    if (!filesystem.initialized || !ops)
+        return -1;
+
+    int dir = fs_lookup_path(path);
+    if (dir < 0)
+        dir = fs_create_directory(path);
+    vfs_mount_t *slot = NULL;
+    for (int i = 0; i < VFS_MAX_MOUNTS && !slot; i++)
+    {
+        if (vfs_mounts[i].inode == 0)
+            slot = &vfs_mounts[i];
+    }
+    if (dir <= 0 || fs_inode(dir)->type != FS_INODE_DIR || vfs_mount_at(dir) || !slot)
+    {
+        terminal_writestring(ops->name);
+        terminal_writestring(": cannot mount at ");
+        terminal_writestring(path);
+        terminal_writestring("\n");
+        return -1;
+    }
+
+    slot->inode = dir;
+    slot->ops = ops;
+    return 0;
+}
+
+// Точка монтирования в директории inode_num (NULL — нет)
+vfs_mount_t *vfs_mount_at(uint32_t inode_num)
+{
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++)
+    {
+        if (vfs_mounts[i].inode != 0 && vfs_mounts[i].inode == inode_num)
+            return &vfs_mounts[i];
+    }
+    return NULL;
+}
+
+// Передача одной записи обработчику обхода директории смонтированной ФС.
+// У таких записей нет inode корневой ФС (inode_number 0)
+int vfs_emit(fs_dir_fn_t fn, void *ctx, const char *name, uint8_t type)
+{
+    fs_dir_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.name, name, FS_MAX_FILENAME - 1);
+    entry.type = type;
+    return fn(&entry, ctx);
+}
+
+static int vfs_count_entry(fs_dir_entry_t *entry, void *ctx)
+{
+    (void)entry;
+    (*(int *)ctx)++;
+    return 0;
+}
+
+static int vfs_list_entry(fs_dir_entry_t *entry, void *ctx)
+{
+    (void)ctx;
+    if (entry->type == FS_INODE_DIR)
+        terminal_writestring("[DIR]  ");
+    else if (entry->type == VFS_TYPE_DEVICE)
+        terminal_writestring("[DEV]  ");
+    else
+        terminal_writestring("[FILE] ");
+    terminal_writestring(entry->name);
+    terminal_putchar('\n');
+    return 0;
+}
+
+// Список директории смонтированной ФС в формате ls (path — для заголовка)
+int vfs_list(vfs_mount_t *mount, const char *rest, const char *path)
+{
+    int count = 0;
+    if (mount->ops->readdir(rest, vfs_count_entry, &count) < 0)
+    {
+        terminal_writestring("Directory not found: ");
+        terminal_writestring(path);
+        terminal_writestring("\n");
+        return -1;
+    }
+
+    terminal_writestring("Contents of ");
+    terminal_writestring(path);
+    terminal_writestring(":\n");
+    mount->ops->readdir(rest, vfs_list_entry, NULL);
+    if (count == 0)
+        terminal_writestring("(empty)\n");
+    return 0;
+}
+
+// Открытая директория смонтированной ФС. У таких ФС нет позиций записей,
+// поэтому позиция файла — номер записи, и обход с неё пропускает предыдущие
+typedef struct
+{
+    const inode_ops_t *ops;
+    char rest[FS_MAX_PATH];
+} vfs_dir_t;
+
+typedef struct
+{
+    fs_dir_fn_t fn;
+    void *ctx;
+    uint32_t skip;  // Записей до позиции файла
+    uint32_t index; // Номер текущей записи
+} vfs_dir_walk_t;
+
+static int vfs_dir_walk_entry(fs_dir_entry_t *entry, void *ctx)
+{
+    vfs_dir_walk_t *walk = (vfs_dir_walk_t *)ctx;
+    if (walk->index < walk->skip)
+    {
+        walk->index++;
+        return 0;
+    }
+    int result = walk->fn(entry, walk->ctx);
+    if (!result)
+        walk->index++;
+    return result;
+}
+
+static int vfs_dir_readdir(open_file_t *file, fs_dir_fn_t fn, void *ctx)
+{
+    vfs_dir_t *dir = (vfs_dir_t *)file->private_data;
+    vfs_dir_walk_t walk = {fn, ctx, file->offset, 0};
+    int result = dir->ops->readdir(dir->rest, vfs_dir_walk_entry, &walk);
+    if (result < 0)
+        return 0; // Директория исчезла (например, завершилась задача в /proc)
+    file->offset = walk.index;
+    return result;
+}
+
+static int vfs_dir_release(open_file_t *file)
+{
+    kfree(file->private_data);
+    return 0;
+}
+
+static const file_ops_t vfs_dir_file_ops = {
+    .release = vfs_dir_release,
+    .readdir = vfs_dir_readdir,
+};
+
+// Открытие директории смонтированной ФС на чтение. Вызывается из open
+// этой ФС, которая уже нашла по rest директорию
+static open_file_t *vfs_open_dir(const inode_ops_t *ops, const char *rest, int flags)
+{
+    if ((flags & O_ACCMODE) != O_RDONLY || strlen(rest) >= FS_MAX_PATH)
+        return NULL;
+
+    vfs_dir_t *dir = (vfs_dir_t *)kmalloc(sizeof(vfs_dir_t));
+    if (!dir)
+        return NULL;
+    open_file_t *file = fs_file_alloc(flags);
+    if (!file)
+    {
+        kfree(dir);
+        return NULL;
+    }
+
+    dir->ops = ops;
+    strcpy(dir->rest, rest);
+    file->ops = &vfs_dir_file_ops;
+    file->private_data = dir;
+    return file;
+}
+
+typedef struct
+{
+    const char *name;
+    int type; // Найденный тип записи, -1 — нет
+} vfs_find_t;
+
+static int vfs_find_entry(fs_dir_entry_t *entry, void *ctx)
+{
+    vfs_find_t *find = (vfs_find_t *)ctx;
+    if (strcmp(entry->name, find->name) != 0)
+        return 0;
+    find->type = entry->type;
+    return 1;
+}
+
+// Сведения об узле смонтированной ФС: тип берётся из записи в
+// родительской директории, номера inode и размера у таких узлов нет
+static int vfs_stat(vfs_mount_t *mount, const char *rest, stat_t *st)
+{
+    char parent[FS_MAX_PATH];
+    uint32_t len = strlen(rest);
+    if (len >= FS_MAX_PATH)
+        return -1;
+    strcpy(parent, rest);
+    while (len > 0 && parent[len - 1] == '/')
+        parent[--len] = '\0';
+
+    // Корень точки монтирования
+    if (len == 0)
+    {
+        st->st_type = DT_DIR;
+        return 0;
+    }
+
+    // Последний компонент — имя, остальное — путь родителя
+    uint32_t start = len;
+    while (start > 0 && parent[start - 1] != '/')
+        start--;
+    char name[FS_MAX_FILENAME];
+    strncpy(name, parent + start, FS_MAX_FILENAME - 1);
+    name[FS_MAX_FILENAME - 1] = '\0';
+    parent[start > 0 ? start - 1 : 0] = '\0';
+
+    vfs_find_t find = {name, -1};
+    if (mount->ops->readdir(parent, vfs_find_entry, &find) < 0 || find.type < 0)
+        return -1;
+
+    st->st_type = find.type;
+    return 0;
+}
+
+// === DEVFS ===
+
+// Файлы устройств в DEV_MOUNT. Позиция открытого файла устройства не
+// используется: чтение и запись идут в поток устройства
+
+#define DEV_CHUNK 256 // Участок, передаваемый обработчику за раз
+
+// Запись участками через буфер на стеке: fn заполняет его, out выводит
+static int dev_write_chars(uint32_t size, fs_span_fn_t fn, void *ctx, void (*out)(char c))
+{
+    uint8_t chunk[DEV_CHUNK];
+    uint32_t done = 0;
+    while (done < size)
+    {
+        uint32_t n = size - done < DEV_CHUNK ? size - done : DEV_CHUNK;
+        int got = fn(ctx, chunk, n);
+        if (got <= 0)
+            break;
+        for (int i = 0; i < got; i++)
+            out((char)chunk[i]);
+        done += got;
+    }
+    return done > 0 ? (int)done : -1;
+}
+
+// Консоль: вывод на экран. Ввод с клавиатуры получает шелл, задачам
+// чтение возвращает конец файла
+static int dev_console_read(open_file_t *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx)
+{
+    (void)file;
+    (void)offset;
+    (void)size;
+    (void)fn;
+    (void)ctx;
+    return 0;
+}
+
+static int dev_console_write(open_file_t *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx)
+{
+    (void)file;
+    (void)offset;
+    return dev_write_chars(size, fn, ctx, terminal_putchar);
+}
+
+const file_ops_t dev_console_ops = {
+    .read_spans = dev_console_read,
+    .write_spans = dev_console_write,
+};
+
+// /dev/null: чтение — конец файла, запись принимает всё
+static int dev_null_write(open_file_t *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx)
+{
+    (void)file;
+    (void)offset;
+    (void)fn;
+    (void)ctx;
+    return size;
+}
+
+static const file_ops_t dev_null_ops = {
+    .read_spans = dev_console_read,
+    .write_spans = dev_null_write,
+};
+
+// /dev/zero: чтение отдаёт нули участками одного нулевого буфера
+static int dev_zero_read(open_file_t *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx)
+{
+    static uint8_t zeros[DEV_CHUNK];
+    (void)file;
+    (void)offset;
+
+    uint32_t done = 0;
+    while (done < size)
+    {
+        uint32_t n = size - done < DEV_CHUNK ? size - done : DEV_CHUNK;
+        int handled = fn(ctx, zeros, n);
+        if (handled < 0)
+            return done > 0 ? (int)done : -1;
+        done += handled;
+        if ((uint32_t)handled < n)
+            break;
+    }
+    return done;
+}
+
+static const file_ops_t dev_zero_ops = {
+    .read_spans = dev_zero_read,
+    .write_spans = dev_null_write,
+};
+
+// /dev/serial: COM1. Чтение не ждёт — возвращает уже принятые байты
+static int dev_serial_read(open_file_t *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx)
+{
+    (void)file;
+    (void)offset;
+    uint8_t chunk[DEV_CHUNK];
+    uint32_t n = 0;
+    while (n < size && n < DEV_CHUNK && (inb(COM1_LSR) & COM1_LSR_DR))
+        chunk[n++] = inb(COM1_PORT);
+    return n > 0 ? fn(ctx, chunk, n) : 0;
+}
+
+static int dev_serial_write(open_file_t *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx)
+{
+    (void)file;
+    (void)offset;
+    return dev_write_chars(size, fn, ctx, serial_putchar);
+}
+
+static const file_ops_t dev_serial_ops = {
+    .read_spans = dev_serial_read,
+    .write_spans = dev_serial_write,
+};
+
+static const struct
+{
+    const char *name;
+    const file_ops_t *ops;
+} dev_nodes[] = {
+    {"console", &dev_console_ops},
+    {"null", &dev_null_ops},
+    {"zero", &dev_zero_ops},
+    {"serial", &dev_serial_ops},
+};
+
+#define DEV_NODES (sizeof(dev_nodes) / sizeof(dev_nodes[0]))
+
+static open_file_t *devfs_open(const char *rest, int flags)
+{
+    if (!*rest || strcmp(rest, ".") == 0)
+        return vfs_open_dir(&devfs_ops, rest, flags);
+
+    for (uint32_t i = 0; i < DEV_NODES; i++)
+    {
+        if (strcmp(dev_nodes[i].name, rest) != 0)
+            continue;
+
+        open_file_t *file = fs_file_alloc(flags);
+        if (file)
+            file->ops = dev_nodes[i].ops;
+        return file;
+    }
+    return NULL;
+}
+
+static int devfs_readdir(const char *rest, fs_dir_fn_t fn, void *ctx)
+{
+    if (*rest && strcmp(rest, ".") != 0)
+        return -1;
+
+    int stop = 0;
+    for (uint32_t i = 0; i < DEV_NODES && !stop; i++)
+        stop = vfs_emit(fn, ctx, dev_nodes[i].name, VFS_TYPE_DEVICE);
+    return stop;
+}
+
+const inode_ops_t devfs_ops = {
+    .name = "devfs",
+    .open = devfs_open,
+    .readdir = devfs_readdir,
+};
+
+// === PROCFS ===
+
+// Виртуальная ФС статистики ядра в PROC_MOUNT. Файлы не хранятся в блоках:
+// содержимое генерируется из живых счётчиков при открытии и заново при
+// каждом чтении с нулевого смещения (pread(fd, buf, n, 0) — дешёвый опрос
+// без повторного open). Пути под точкой монтирования разбирает procfs:
+//   meminfo, interrupts, syscalls, uptime, tasks/<pid>/stat
+
+// Текст файла procfs в буфере PROC_TEXT_SIZE (лишнее отбрасывается)
+typedef struct
+{
+    char *data;
+    uint32_t len;
+} proc_text_t;
+
+typedef struct
+{
+    const char *name;
+    void (*show)(proc_text_t *text, task_t *task); // task — для файлов задачи
+} proc_entry_t;
+
+static void proc_puts(proc_text_t *text, const char *str)
+{
+    while (*str && text->len < PROC_TEXT_SIZE)
+        text->data[text->len++] = *str++;
+}
+
+static void proc_putu(proc_text_t *text, uint32_t value)
+{
+    char digits[12];
+    int len = 0;
+    do
+    {
+        digits[len++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    while (len > 0 && text->len < PROC_TEXT_SIZE)
+        text->data[text->len++] = digits[--len];
+}
+
+// Строка "Name:   value unit" с выравниванием значения
+static void proc_field(proc_text_t *text, const char *name, uint32_t value, const char *unit)
+{
+    proc_puts(text, name);
+    proc_puts(text, ":");
+    for (int col = strlen(name) + 1; col < 16; col++)
+        proc_puts(text, " ");
+    proc_putu(text, value);
+    proc_puts(text, unit);
+    proc_puts(text, "\n");
+}
+
+static void proc_show_meminfo(proc_text_t *text, task_t *task)
+{
+    (void)task;
+    uint32_t total, free, used;
+    get_memory_info(&total, &free, &used);
+
+    proc_field(text, "HeapTotal", total / 1024, " kB");
+    proc_field(text, "HeapFree", free / 1024, " kB");
+    proc_field(text, "HeapUsed", used / 1024, " kB");
+    proc_field(text, "PagesAllocated", phys_alloc_count, "");
+    proc_field(text, "PagesFreed", phys_free_count, "");
+    proc_field(text, "DemandPages", demand_page_count, "");
+    proc_field(text, "RegionFrames", phys_region_frames, "");
+    proc_field(text, "HighFrames", phys_high_frames, "");
+    proc_field(text, "HighFramesUsed", phys_high_alloc, "");
+    proc_field(text, "FsArenaFrames", phys_reserved_frames, "");
+    proc_field(text, "FsBlocks", filesystem.superblock.total_blocks, "");
+    proc_field(text, "FsBlocksFree", filesystem.superblock.free_blocks, "");
+    proc_field(text, "FsInodes", filesystem.superblock.total_inodes, "");
+    proc_field(text, "FsInodesFree", filesystem.superblock.free_inodes, "");
+}
+
+// Линии с обработчиком или хотя бы одним прерыванием
+static void proc_show_interrupts(proc_text_t *text, task_t *task)
+{
+    (void)task;
+    proc_puts(text, "IRQ      count handler\n");
+    for (int irq = 0; irq < 16; irq++)
+    {
+        int active = irq < 2 || irq_handlers[irq];
+        if (!active && irq_counts[irq] == 0)
+            continue;
+
+        if (irq < 10)
+            proc_puts(text, " ");
+        proc_putu(text, irq);
+        proc_puts(text, " ");
+        for (uint32_t v = irq_counts[irq], width = 1; width < 10; width++, v /= 10)
+        {
+            if (v < 10)
+                proc_puts(text, " ");
+        }
+        proc_putu(text, irq_counts[irq]);
+        proc_puts(text, irq == 0 ? " timer\n" : irq == 1 ? " keyboard\n" : active ? " device\n" : " -\n");
+    }
+}
+
+// Номер, имя и число вызовов каждого системного вызова
+static void proc_show_syscalls(proc_text_t *text, task_t *task)
+{
+    (void)task;
+    for (unsigned i = 0; i < sizeof(syscall_table) / sizeof(syscall_table[0]); i++)
+    {
+        proc_putu(text, syscall_table[i].num);
+        proc_puts(text, " ");
+        proc_puts(text, syscall_table[i].name);
+        proc_puts(text, " ");
+        proc_putu(text, syscall_counts[syscall_table[i].num]);
+        proc_puts(text, "\n");
+    }
+}
+
+// Время работы: секунды с сотыми и тики таймера
+static void proc_show_uptime(proc_text_t *text, task_t *task)
+{
+    (void)task;
+    uint32_t ticks = timer_ticks;
+    proc_putu(text, ticks / TIMER_FREQUENCY);
+    proc_puts(text, ".");
+    uint32_t hundredths = ticks % TIMER_FREQUENCY * 100 / TIMER_FREQUENCY;
+    if (hundredths < 10)
+        proc_puts(text, "0");
+    proc_putu(text, hundredths);
+    proc_puts(text, " ");
+    proc_putu(text, ticks);
+    proc_puts(text, "\n");
+}
+
+// Одна строка: pid (имя) состояние ppid uid gid приоритет квант память
+static void proc_show_task_stat(proc_text_t *text, task_t *task)
+{
+    static const char states[] = "RSBZ"; // RUNNING, READY, BLOCKED, DEAD
+    proc_putu(text, task->process.pid);
+    proc_puts(text, " (");
+    proc_puts(text, task->name);
+    proc_puts(text, ") ");
+    char state[2] = {task->state < 4 ? states[task->state] : '?', '\0'};
+    proc_puts(text, state);
+    uint32_t fields[] = {task->process.ppid, task->process.uid,  task->process.gid,
+                         task->priority,     task->time_slice,   task->process.memory_used};
+    for (unsigned i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+    {
+        proc_puts(text, " ");
+        proc_putu(text, fields[i]);
+    }
+    proc_puts(text, "\n");
+}
+
+static const proc_entry_t proc_entries[] = {
+    {"meminfo", proc_show_meminfo},
+    {"interrupts", proc_show_interrupts},
+    {"syscalls", proc_show_syscalls},
+    {"uptime", proc_show_uptime},
+};
+
+static const proc_entry_t proc_task_entries[] = {
+    {"stat", proc_show_task_stat},
+};
+
+#define PROC_ENTRIES (sizeof(proc_entries) / sizeof(proc_entries[0]))
+#define PROC_TASK_ENTRIES (sizeof(proc_task_entries) / sizeof(proc_task_entries[0]))
+
+// Узел procfs: директория (корень, tasks, tasks/<pid>) или файл
+typedef struct
+{
+    const proc_entry_t *entry; // Файл (NULL — директория)
+    int level;                 // Директория: 0 — корень, 1 — tasks, 2 — tasks/<pid>
+    task_t *task;              // Задача для tasks/<pid>
+} proc_node_t;
+
+static task_t *proc_find_task(uint32_t pid)
+{
+    for (task_t *task = task_list; task; task = task->next)
+    {
+        if (task->process.pid == pid)
+            return task;
+    }
+    return NULL;
+}
+
+static const proc_entry_t *proc_find_entry(const proc_entry_t *entries, uint32_t count, const char *name)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (strcmp(entries[i].name, name) == 0)
+            return &entries[i];
+    }
+    return NULL;
+}
+
+// Разбор пути внутри procfs. -1 — такого узла нет
+static int proc_resolve(const char *rest, proc_node_t *node)
+{
+    node->entry = NULL;
+    node->level = 0;
+    node->task = NULL;
+
+    char component[FS_MAX_FILENAME];
+    int len;
+    while ((len = fs_next_component(&rest, component)) > 0)
+    {
+        if (node->entry || strcmp(component, "..") == 0)
+            return -1; // Внутри файла или выше корня procfs
+        if (strcmp(component, ".") == 0)
+            continue;
+
+        if (node->level == 0)
+        {
+            node->entry = proc_find_entry(proc_entries, PROC_ENTRIES, component);
+            if (!node->entry && strcmp(component, "tasks") != 0)
+                return -1;
+            node->level = node->entry ? 0 : 1;
+        }
+        else if (node->level == 1)
+        {
+            uint32_t pid = 0;
+            for (const char *c = component; *c; c++)
+            {
+                if (*c < '0' || *c > '9')
+                    return -1;
+                pid = pid * 10 + (*c - '0');
+            }
+            node->task = proc_find_task(pid);
+            if (!node->task)
+                return -1;
+            node->level = 2;
+        }
+        else
+        {
+            node->entry = proc_find_entry(proc_task_entries, PROC_TASK_ENTRIES, component);
+            if (!node->entry)
+                return -1;
+        }
+    }
+    return len < 0 ? -1 : 0;
+}
+
+// Открытый файл procfs: узел и сгенерированный текст. Память под текст —
+// по его длине, а не PROC_TEXT_SIZE
+typedef struct
+{
+    const proc_entry_t *entry;
+    uint32_t pid;      // Задача файла из tasks/<pid>
+    uint32_t len;      // Длина текста
+    uint32_t capacity; // Место под текст
+    int stale;         // Текст уже читали: чтение с нулевого смещения генерирует заново
+    char text[];
+} proc_file_t;
+
+// Общий буфер генерации: шелл и системные вызовы работают в обработчиках
+// прерываний и друг друга не прерывают
+static char proc_scratch[PROC_TEXT_SIZE];
+
+// Генерация содержимого в proc_scratch, возвращает длину. Файл
+// завершившейся задачи становится пустым
+static uint32_t proc_render(const proc_entry_t *entry, uint32_t pid)
+{
+    proc_text_t text = {proc_scratch, 0};
+    task_t *task = NULL;
+    int per_task = entry >= proc_task_entries && entry < proc_task_entries + PROC_TASK_ENTRIES;
+    if (per_task)
+        task = proc_find_task(pid);
+    if (task || !per_task)
+        entry->show(&text, task);
+    return text.len;
+}
+
+// Новый текст файла; если он не помещается, файл переезжает в блок
+// большего размера. -1 — нет памяти (остаётся прежний текст)
+static int proc_generate(open_file_t *file)
+{
+    proc_file_t *pf = (proc_file_t *)file->private_data;
+    uint32_t len = proc_render(pf->entry, pf->pid);
+    if (len > pf->capacity)
+    {
+        proc_file_t *grown = (proc_file_t *)kmalloc(sizeof(proc_file_t) + len);
+        if (!grown)
+            return -1;
+        *grown = *pf;
+        grown->capacity = len;
+        kfree(pf);
+        file->private_data = pf = grown;
+    }
+
+    memcpy(pf->text, proc_scratch, len);
+    pf->len = len;
+    pf->stale = 0;
+    return 0;
+}
+
+// Чтение участками, как у обычных файлов: один участок — весь остаток текста
+static int proc_read_spans(open_file_t *file, uint32_t offset, uint32_t size, fs_span_fn_t fn, void *ctx)
+{
+    int advance = offset == FS_AT_POSITION;
+    if (advance)
+        offset = file->offset;
+
+    if (offset == 0 && ((proc_file_t *)file->private_data)->stale && proc_generate(file) < 0)
+        return -1;
+    proc_file_t *pf = (proc_file_t *)file->private_data;
+    pf->stale = 1;
+
+    if (offset >= pf->len)
+        return 0;
+    if (size > pf->len - offset)
+        size = pf->len - offset;
+
+    int done = fn(ctx, (uint8_t *)pf->text + offset, size);
+    if (done < 0)
+        return -1;
+    if (advance)
+        file->offset = offset + done;
+    return done;
+}
+
+static uint32_t proc_file_size(open_file_t *file)
+{
+    return ((proc_file_t *)file->private_data)->len;
+}
+
+static int proc_release(open_file_t *file)
+{
+    kfree(file->private_data);
+    return 0;
+}
+
+static const file_ops_t proc_file_ops = {
+    .read_spans = proc_read_spans,
+    .size = proc_file_size,
+    .release = proc_release,
+};
+
+// Открытие файла или директории procfs (только для чтения). Путь
+// разбирается один раз, текст генерируется сразу
+static open_file_t *proc_open(const char *rest, int flags)
+{
+    proc_node_t node;
+    if (proc_resolve(rest, &node) < 0 || (flags & O_ACCMODE) != O_RDONLY)
+        return NULL;
+    if (!node.entry)
+        return vfs_open_dir(&procfs_ops, rest, flags);
+
+    uint32_t pid = node.task ? node.task->process.pid : 0;
+    uint32_t len = proc_render(node.entry, pid);
+    proc_file_t *pf = (proc_file_t *)kmalloc(sizeof(proc_file_t) + len);
+    if (!pf)
+        return NULL;
+    open_file_t *file = fs_file_alloc(flags);
+    if (!file)
+    {
+        kfree(pf);
+        return NULL;
+    }
+
+    pf->entry = node.entry;
+    pf->pid = pid;
+    pf->len = pf->capacity = len;
+    pf->stale = 0;
+    memcpy(pf->text, proc_scratch, len);
+    file->ops = &proc_file_ops;
+    file->private_data = pf;
+    return file;
+}
+
+// Обход директории procfs
+static int proc_readdir(const char *rest, fs_dir_fn_t fn, void *ctx)
+{
+    proc_node_t node;
+    if (proc_resolve(rest, &node) < 0 || node.entry)
+        return -1;
+
+    int stop = 0;
+    if (node.level == 0)
+    {
+        for (uint32_t i = 0; i < PROC_ENTRIES && !stop; i++)
+            stop = vfs_emit(fn, ctx, proc_entries[i].name, FS_INODE_FILE);
+        if (!stop)
+            stop = vfs_emit(fn, ctx, "tasks", FS_INODE_DIR);
+    }
+    else if (node.level == 1)
+    {
+        for (task_t *task = task_list; task && !stop; task = task->next)
+        {
+            char name[12];
+            proc_text_t text = {name, 0};
+            proc_putu(&text, task->process.pid);
+            name[text.len] = '\0';
+            stop = vfs_emit(fn, ctx, name, FS_INODE_DIR);
+        }
+    }
+    else
+    {
+        for (uint32_t i = 0; i < PROC_TASK_ENTRIES && !stop; i++)
+            stop = vfs_emit(fn, ctx, proc_task_entries[i].name, FS_INODE_FILE);
+    }
+    return stop;
+}
+
+const inode_ops_t procfs_ops = {
+    .name = "procfs",
+    .open = proc_open,
+    .readdir = proc_readdir,
+};
+
+// === КОМАНДЫ ШЕЛЛА ===
+
+void shell_prompt(void)
+{
+    terminal_writestring("myos> ");
+}
+
+void command_help(void)
+{
+    terminal_writestring("Available commands:\n");
+    terminal_writestring("  help       - Show this help\n");
+    terminal_writestring("  clear      - Clear screen\n");
+    terminal_writestring("  about      - System information\n");
+    terminal_writestring("  memory     - Memory usage + stats\n");
+    terminal_writestring("  memtest    - Test memory allocator\n");
+    terminal_writestring("  keyboard   - Keyboard status\n");
+    terminal_writestring("  tasks      - List tasks\n");
+    terminal_writestring("  schedule   - Trigger scheduler\n");
+    terminal_writestring("  ls [-l] [dir] - List files (-l: size, blocks, mtime)\n");
+    terminal_writestring("  touch <f>  - Create file\n");
+    terminal_writestring("  cat <f>    - Show file content\n");
+    terminal_writestring("  rm <f>     - Delete file\n");
+    terminal_writestring("  cp [--reflink] <a> <b> - Copy file (--reflink: share blocks)\n");
+    terminal_writestring("  mv <a> <b> - Rename or move file or directory\n");
+    terminal_writestring("  echo <t> > <f> - Write text to file\n");
+    terminal_writestring("  echo <t> >> <f> - Append text to file\n");
+    terminal_writestring("  testelf    - Test ELF loader\n");
+    terminal_writestring("  run <f>    - Run ELF program from file\n");
+    terminal_writestring("  ps         - List processes\n");
+    terminal_writestring("  kill <pid> - Kill process\n");
+    terminal_writestring("  fork       - Test fork system call\n");
+    terminal_writestring("  pwd        - Print working directory\n");
+    terminal_writestring("  cd <dir>   - Change directory\n");
+    terminal_writestring("  mkdir <dir> - Create directory\n");
+    terminal_writestring("  rmdir <dir> - Remove directory\n");
+    terminal_writestring("  syscalls   - Test system calls\n");
+    terminal_writestring("  lspci      - List PCI devices\n");
+    terminal_writestring("  blkbench [MB] - Disk read throughput (virtio-blk)\n");
+    terminal_writestring("  sync       - Write filesystem changes to disk\n");
+    terminal_writestring("  bcache     - Buffer cache statistics\n");
+    terminal_writestring("  compress [on|off|[-d] <file>] - File compression\n");
+    terminal_writestring("  dedup [on|off] - Block deduplication\n");
+    terminal_writestring("  watch [<path>|-d <wd>] - Watch for file changes, show events\n");
+    terminal_writestring("  defrag [on|off|run] - Idle-time defragmentation\n");
+    terminal_writestring("  ringbench [ops] - I/O rings vs plain syscalls\n");
+    terminal_writestring("  fsbench [n] [size] - Filesystem benchmark (report on COM1)\n");
+    terminal_writestring("  reboot     - Restart system\n");
+    terminal_writestring("  poweroff   - Shutdown system\n");
+    terminal_writestring("\nELF Loader Commands:\n");
+    terminal_writestring("  testelf    - Test built-in ELF program\n");
+    terminal_writestring("  run <file> - Load and execute ELF file\n");
+    terminal_writestring("\nProcess Management:\n");
+    terminal_writestring("  ps         - List all processes\n");
+    terminal_writestring("  kill <pid> - Terminate process\n");
+    terminal_writestring("  fork       - Test process forking\n");
+    terminal_writestring("\n");
+}
+
+void command_clear(void)
 {
     terminal_clear();
 }
 
-void command_about(void)
+void command_about(void)
+{
+    terminal_writestring("MyOS v0.7 - Operating System with ELF Loader\n");
+    terminal_writestring("==============================================\n");
+    terminal_writestring("Features:\n");
+    terminal_writestring("  - 32-bit protected mode\n");
+    terminal_writestring("  - Dynamic memory management\n");
+    terminal_writestring("  - Virtual memory with paging\n");
+    terminal_writestring("  - Simple file system\n");
+    terminal_writestring("  - Basic task scheduler\n");
+    terminal_writestring("  - Enhanced keyboard support\n");
+    terminal_writestring("  - VGA cursor support\n");
+    terminal_writestring("  - Interrupt handling\n");
+    terminal_writestring("  - Interactive command shell\n");
+    terminal_writestring("  - ELF executable loader\n");
+    terminal_writestring("  - User mode execution\n");
+    terminal_writestring("  - System calls (INT 0x80)\n");
+    terminal_writestring("\nNew in v0.7:\n");
+    terminal_writestring("  - Full ELF32 loader implementation\n");
+    terminal_writestring("  - User mode task execution\n");
+    terminal_writestring("  - ELF program validation and loading\n");
+    terminal_writestring("  - File-based ELF execution\n");
+    terminal_writestring("\nBuilt with Assembly and C\n");
+    terminal_writestring("For x86 architecture\n\n");
+}
+
+void command_memory(void)
+{
+    uint32_t total, free, used;
+    get_memory_info(&total, &free, &used);
+
+    terminal_writestring("Memory Usage:\n");
+    terminal_writestring("  Total: ");
+    print_number(total);
+    terminal_writestring(" bytes\n");
+    terminal_writestring("  Free:  ");
+    print_number(free);
+    terminal_writestring(" bytes\n");
+    terminal_writestring("  Used:  ");
+    print_number(used);
+    terminal_writestring(" bytes\n");
+
+    // Процент использования
+    uint32_t percent = (used * 100) / total;
+    terminal_writestring("  Usage: ");
+    print_number(percent);
+    terminal_writestring("%\n");
+
+    // Статистика физических страниц
+    terminal_writestring("\nPhysical Pages:\n");
+    terminal_writestring("  Allocated: ");
+    print_number(phys_alloc_count);
+    terminal_writestring("\n");
+    terminal_writestring("  Freed: ");
+    print_number(phys_free_count);
+    terminal_writestring("\n");
+    terminal_writestring("  Demand pages loaded: ");
+    print_number(demand_page_count);
+    terminal_writestring("\n");
+    terminal_writestring("  Region frames: ");
+    print_number(phys_region_frames);
+    terminal_writestring(" (above 4GB: ");
+    print_number(phys_high_frames);
+    terminal_writestring(", in use: ");
+    print_number(phys_high_alloc);
+    terminal_writestring(")\n");
+    terminal_writestring("  Filesystem arena frames: ");
+    print_number(phys_reserved_frames);
+    terminal_writestring("\n");
+    if (filesystem.initialized)
+    {
+        uint32_t logical_kb, physical_kb;
+        fs_data_usage(&logical_kb, &physical_kb);
+        terminal_writestring("  Filesystem data: ");
+        print_number(logical_kb);
+        terminal_writestring(" KB logical, ");
+        print_number(physical_kb);
+        terminal_writestring(" KB physical\n");
+    }
+#ifdef CONFIG_PAE
+    terminal_writestring("  Paging mode: PAE, NX ");
+    terminal_writestring(nx_enabled ? "enabled\n\n" : "unsupported\n\n");
+#else
+    terminal_writestring("  Paging mode: 32-bit\n\n");
+#endif
+}
+
+void command_memtest(void)
+{
+    terminal_writestring("Testing memory allocator...\n");
+
+    // Тест 1: выделение и освобождение
+    void *ptr1 = kmalloc(128);
+    terminal_writestring("Allocated 128 bytes\n");
+
+    void *ptr2 = kmalloc(256);
+    terminal_writestring("Allocated 256 bytes\n");
+
+    void *ptr3 = kmalloc(64);
+    terminal_writestring("Allocated 64 bytes\n");
+
+    kfree(ptr2);
+    terminal_writestring("Block 2 freed\n");
+
+    kfree(ptr1);
+    kfree(ptr3);
+    terminal_writestring("All blocks freed\n");
+
+    terminal_writestring("Memory test completed!\n\n");
+}
+
+void command_keyboard(void)
+{
+    terminal_writestring("Keyboard Status (v0.7):\n");
+
+    uint8_t modifiers = keyboard_get_modifiers();
+    keyboard_state_t *state = keyboard_get_state();
+
+    terminal_writestring("  Modifier Keys:\n");
+    terminal_writestring("    Shift: ");
+    if (IS_SHIFT_PRESSED(modifiers))
+    {
+        terminal_writestring("PRESSED\n");
+    }
+    else
+    {
+        terminal_writestring("Released\n");
+    }
+
+    terminal_writestring("    Ctrl:  ");
+    if (IS_CTRL_PRESSED(modifiers))
+    {
+        terminal_writestring("PRESSED\n");
+    }
+    else
+    {
+        terminal_writestring("Released\n");
+    }
+
+    terminal_writestring("    Alt:   ");
+    if (IS_ALT_PRESSED(modifiers))
+    {
+        terminal_writestring("PRESSED\n");
+    }
+    else
+    {
+        terminal_writestring("Released\n");
+    }
+
+    terminal_writestring("  Caps Lock: ");
+    if (IS_CAPS_ACTIVE(modifiers))
+    {
+        terminal_writestring("ON\n");
+    }
+    else
+    {
+        terminal_writestring("OFF\n");
+    }
+
+    terminal_writestring("  Last Key: ");
+    if (state->last_char)
+    {
+        terminal_putchar(state->last_char);
+        terminal_writestring(" (scancode: ");
+        print_number(state->last_scancode);
+        terminal_writestring(")\n");
+    }
+    else
+    {
+        terminal_writestring("None\n");
+    }
+
+    terminal_writestring("\n  New Features v0.7:\n");
+    terminal_writestring("    - Extended key support (F1-F12, arrows, etc.)\n");
+    terminal_writestring("    - E0-prefixed scancodes\n");
+    terminal_writestring("    - Event-driven architecture\n");
+    terminal_writestring("    - Modular keyboard system\n");
+    terminal_writestring("    - Full 256-key scancode table\n");
+    terminal_writestring("\n  Try all keys including F1-F12!\n\n");
+}
+
+void command_tasks(void)
+{
+    terminal_writestring("Task List:\n");
+    terminal_writestring("ID   Name             State    Priority\n");
+    terminal_writestring("------------------------------------\n");
+
+    if (!task_list)
+    {
+        terminal_writestring("No tasks created yet.\n\n");
+        return;
+    }
+
+    task_t *task = task_list;
+    while (task)
+    {
+        print_number(task->id);
+        terminal_writestring("    ");
+        terminal_writestring(task->name);
+
+        // Выравнивание
+        int name_len = strlen(task->name);
+        for (int i = name_len; i < 16; i++)
+        {
+            terminal_putchar(' ');
+        }
+
+        switch (task->state)
+        {
+        case TASK_STATE_RUNNING:
+            terminal_writestring("RUNNING  ");
+            break;
+        case TASK_STATE_READY:
+            terminal_writestring("READY    ");
+            break;
+        case TASK_STATE_BLOCKED:
+            terminal_writestring("BLOCKED  ");
+            break;
+        case TASK_STATE_DEAD:
+            terminal_writestring("DEAD     ");
+            break;
+        default:
+            terminal_writestring("UNKNOWN  ");
+        }
+
+        print_number(task->priority);
+        terminal_putchar('\n');
+
+        task = task->next;
+    }
+
+    terminal_writestring("\nCurrent task: ");
+    if (current_task)
+    {
+        terminal_writestring(current_task->name);
+    }
+    else
+    {
+        terminal_writestring("None");
+    }
+    terminal_writestring("\n\n");
+}
+
+void command_schedule(void)
 {
-    terminal_writestring("MyOS v0.7 - Operating System with ELF Loader\n");
-    terminal_writestring("==============================================\n");
-    terminal_writestring("Features:\n");
-    terminal_writestring("  - 32-bit protected mode\n");
-    terminal_writestring("  - Dynamic memory management\n");
-    terminal_writestring("  - Virtual memory with paging\n");
-    terminal_writestring("  - Simple file system\n");
-    terminal_writestring("  - Basic task scheduler\n");
-    terminal_writestring("  - Enhanced keyboard support\n");
-    terminal_writestring("  - VGA cursor support\n");
-    terminal_writestring("  - Interrupt handling\n");
-    terminal_writestring("  - Interactive command shell\n");
-    terminal_writestring("  - ELF executable loader\n");
-    terminal_writestring("  - User mode execution\n");
-    terminal_writestring("  - System calls (INT 0x80)\n");
-    terminal_writestring("\nNew in v0.7:\n");
-    terminal_writestring("  - Full ELF32 loader implementation\n");
-    terminal_writestring("  - User mode task execution\n");
-    terminal_writestring("  - ELF program validation and loading\n");
-    terminal_writestring("  - File-based ELF execution\n");
-    terminal_writestring("\nBuilt with Assembly and C\n");
-    terminal_writestring("For x86 architecture\n\n");
+    terminal_writestring("Triggering scheduler...\n");
+    schedule();
+    terminal_writestring("Scheduler executed\n\n");
 }
 
-void command_memory(void)
+// Подробный список: записи вместе со сведениями о файлах читаются через
+// readdirplus — один системный вызов на буфер, а не stat на каждый файл
+static void command_ls_long(const char *path)
 {
-    uint32_t total, free, used;
-    get_memory_info(&total, &free, &used);
+    int fd = syscall2(SYS_OPEN, (int)path, O_RDONLY);
+    if (fd < 0)
+    {
+        terminal_writestring("Directory not found: ");
+        terminal_writestring(path);
+        terminal_writestring("\n");
+        return;
+    }
 
-    terminal_writestring("Memory Usage:\n");
-    terminal_writestring("  Total: ");
-    print_number(total);
-    terminal_writestring(" bytes\n");
-    terminal_writestring("  Free:  ");
-    print_number(free);
-    terminal_writestring(" bytes\n");
-    terminal_writestring("  Used:  ");
-    print_number(used);
-    terminal_writestring(" bytes\n");
+    terminal_writestring("Contents of ");
+    terminal_writestring(path);
+    terminal_writestring(":\n");
 
-    // Процент использования
-    uint32_t percent = (used * 100) / total;
-    terminal_writestring("  Usage: ");
-    print_number(percent);
-    terminal_writestring("%\n");
+    static uint8_t buf[512];
+    int shown = 0;
+    int got;
+    while ((got = syscall3(SYS_READDIRPLUS, fd, (int)buf, sizeof(buf))) > 0)
+    {
+        for (int pos = 0; pos < got; pos += ((dirent_plus_t *)(buf + pos))->d_reclen)
+        {
+            dirent_plus_t *d = (dirent_plus_t *)(buf + pos);
+            if (d->d_stat.st_type == DT_DIR)
+                terminal_writestring("[DIR]  ");
+            else if (d->d_stat.st_type == DT_DEV)
+                terminal_writestring("[DEV]  ");
+            else
+                terminal_writestring("[FILE] ");
+            terminal_writestring(d->d_name);
+            terminal_writestring("  ");
+            print_number(d->d_stat.st_size);
+            terminal_writestring(" bytes, ");
+            print_number(d->d_stat.st_blocks);
+            terminal_writestring(" blocks, mtime ");
+            print_number(d->d_stat.st_mtime);
+            terminal_writestring("\n");
+            shown++;
+        }
+    }
+    syscall1(SYS_CLOSE, fd);
 
-    // Статистика физических страниц
-    terminal_writestring("\nPhysical Pages:\n");
-    terminal_writestring("  Allocated: ");
-    print_number(phys_alloc_count);
-    terminal_writestring("\n");
-    terminal_writestring("  Freed: ");
-    print_number(phys_free_count);
+    if (got < 0)
+        terminal_writestring("Not a directory\n");
+    else if (shown == 0)
+        terminal_writestring("(empty)\n");
+}
+
+void command_ls(const char *path)
+{
+    if (path && strncmp(path, "-l", 2) == 0 && (path[2] == '\0' || path[2] == ' '))
+    {
+        path += 2;
+        while (*path == ' ')
+            path++;
+        command_ls_long(*path ? path : ".");
+        return;
+    }
+    if (path && path[0] != '\0')
+    {
+        fs_list_directory(path);
+        return;
+    }
+    fs_list_files();
+}
+
+void command_touch(const char *filename)
+{
+    if (filename == NULL || filename[0] == '\0')
+    {
+        terminal_writestring("Usage: touch <filename>\n");
+        return;
+    }
+
+    if (fs_create_file(filename) >= 0)
+    {
+        terminal_writestring("File created: ");
+        terminal_writestring(filename);
+        terminal_writestring("\n");
+    }
+}
+
+void command_cat(const char *filename)
+{
+    if (filename == NULL || filename[0] == '\0')
+    {
+        terminal_writestring("Usage: cat <filename>\n");
+        return;
+    }
+
+    open_file_t *file = fs_open(filename, O_RDONLY);
+    if (file && file->ops->readdir)
+    {
+        fs_close(file); // Директория
+        file = NULL;
+    }
+    if (!file)
+    {
+        terminal_writestring("File not found: ");
+        terminal_writestring(filename);
+        terminal_writestring("\n");
+        return;
+    }
+
+    terminal_writestring("Content of ");
+    terminal_writestring(filename);
+    terminal_writestring(":\n");
+
+    // Выводим данные прямо из блоков хранения, без промежуточного буфера
+    uint32_t size = fs_file_size(file);
+    char last = '\n';
+    fs_file_read_spans(file, 0, size, span_to_file, &console_file);
+    if (size > 0)
+        fs_file_pread(file, &last, 1, size - 1);
+    fs_close(file);
+
+    if (last != '\n')
+    {
+        terminal_writestring("\n");
+    }
+}
+
+void command_rm(const char *filename)
+{
+    if (filename == NULL || filename[0] == '\0')
+    {
+        terminal_writestring("Usage: rm <filename>\n");
+        return;
+    }
+
+    if (fs_delete_file(filename) == 0)
+    {
+        terminal_writestring("File deleted: ");
+        terminal_writestring(filename);
+        terminal_writestring("\n");
+    }
+}
+
+// Копирование файла: cp [--reflink] <src> <dst>. С --reflink копия делит
+// блоки источника (clonefile), иначе данные передаются участками блоков
+void command_cp(const char *args)
+{
+    int reflink = strncmp(args, "--reflink ", 10) == 0;
+    if (reflink)
+        args += 10;
+    while (*args == ' ')
+        args++;
+
+    char src[FS_MAX_PATH];
+    int len = 0;
+    while (args[len] && args[len] != ' ' && len < FS_MAX_PATH - 1)
+    {
+        src[len] = args[len];
+        len++;
+    }
+    src[len] = '\0';
+
+    const char *dst = args + len;
+    while (*dst == ' ')
+        dst++;
+
+    if (src[0] == '\0' || dst[0] == '\0')
+    {
+        terminal_writestring("Usage: cp [--reflink] <src> <dst>\n");
+        return;
+    }
+
+    if (reflink)
+    {
+        if (syscall2(SYS_CLONEFILE, (int)src, (int)dst) == 0)
+        {
+            terminal_writestring("Cloned ");
+            terminal_writestring(src);
+            terminal_writestring(" -> ");
+            terminal_writestring(dst);
+            terminal_writestring("\n");
+        }
+        return;
+    }
+
+    int src_inode = fs_lookup_path(src);
+    if (src_inode >= 0 && src_inode == fs_lookup_path(dst))
+    {
+        terminal_writestring("Same file: ");
+        terminal_writestring(dst);
+        terminal_writestring("\n");
+        return;
+    }
+
+    open_file_t *in = fs_open(src, O_RDONLY);
+    if (in && in->ops->readdir)
+    {
+        fs_close(in); // Директория
+        in = NULL;
+    }
+    if (!in)
+    {
+        terminal_writestring("File not found: ");
+        terminal_writestring(src);
+        terminal_writestring("\n");
+        return;
+    }
+    open_file_t *out = fs_open(dst, O_WRONLY | O_CREAT | O_TRUNC);
+    if (!out)
+    {
+        fs_close(in);
+        return;
+    }
+
+    uint32_t size = fs_file_size(in);
+    int copied = fs_file_read_spans(in, 0, size, span_to_file, out);
+    fs_close(out);
+    fs_close(in);
+
+    if (copied != (int)size)
+    {
+        terminal_writestring("Copy failed: ");
+        terminal_writestring(dst);
+        terminal_writestring("\n");
+        return;
+    }
+    terminal_writestring("Copied ");
+    print_number(size);
+    terminal_writestring(" bytes ");
+    terminal_writestring(src);
+    terminal_writestring(" -> ");
+    terminal_writestring(dst);
     terminal_writestring("\n");
-    terminal_writestring("  Demand pages loaded: ");
-    print_number(demand_page_count);
-    terminal_writestring("\n\n");
 }
 
-void command_memtest(void)
+void command_mv(const char *args)
 {
-    terminal_writestring("Testing memory allocator...\n");
+    // Два аргумента: старый и новый путь
+    char old_path[FS_MAX_PATH];
+    int len = 0;
+    while (args[len] && args[len] != ' ' && len < FS_MAX_PATH - 1)
+    {
+        old_path[len] = args[len];
+        len++;
+    }
+    old_path[len] = '\0';
+
+    const char *new_path = args + len;
+    while (*new_path == ' ')
+        new_path++;
+
+    if (old_path[0] == '\0' || new_path[0] == '\0')
+    {
+        terminal_writestring("Usage: mv <old> <new>\n");
+        return;
+    }
+
+    if (fs_rename(old_path, new_path) == 0)
+    {
+        terminal_writestring("Renamed ");
+        terminal_writestring(old_path);
+        terminal_writestring(" -> ");
+        terminal_writestring(new_path);
+        terminal_writestring("\n");
+    }
+}
+
+void command_echo(const char *args)
+{
+    if (args == NULL || args[0] == '\0')
+    {
+        terminal_writestring("Usage: echo <text> > <filename>\n");
+        terminal_writestring("       echo <text> >> <filename>  (append)\n");
+        terminal_writestring("Example: echo Hello World > myfile.txt\n");
+        return;
+    }
 
-    // Тест 1: выделение и освобождение
-    void *ptr1 = kmalloc(128);
-    terminal_writestring("Allocated 128 bytes\n");
+    // Простой парсинг команды echo "text" > filename (или >> для дописывания)
+    const char *text_start = args;
+    const char *redirect_pos = NULL;
+    int append = 0;
 
-    void *ptr2 = kmalloc(256);
-    terminal_writestring("Allocated 256 bytes\n");
+    // Ищем символ '>'
+    for (const char *p = args; *p; p++)
+    {
+        if (*p == '>')
+        {
+            redirect_pos = p;
+            break;
+        }
+    }
 
-    void *ptr3 = kmalloc(64);
-    terminal_writestring("Allocated 64 bytes\n");
+    if (!redirect_pos)
+    {
+        terminal_writestring("Error: Missing '>' redirection\n");
+        terminal_writestring("Usage: echo <text> > <filename>\n");
+        return;
+    }
 
-    kfree(ptr2);
-    terminal_writestring("Block 2 freed\n");
+    // Извлекаем текст (до '>')
+    char text[256];
+    int text_len = redirect_pos - text_start;
+    if (text_len >= 256)
+        text_len = 255;
 
-    kfree(ptr1);
-    kfree(ptr3);
-    terminal_writestring("All blocks freed\n");
+    // Копируем текст, убираем пробелы в конце
+    int i;
+    for (i = 0; i < text_len; i++)
+    {
+        text[i] = text_start[i];
+    }
+    while (i > 0 && text[i - 1] == ' ')
+        i--; // Убираем пробелы в конце
+    text[i] = '\0';
 
-    terminal_writestring("Memory test completed!\n\n");
-}
+    // Извлекаем имя файла (после '>' или '>>')
+    const char *filename_start = redirect_pos + 1;
+    if (*filename_start == '>')
+    {
+        append = 1;
+        filename_start++;
+    }
+    while (*filename_start == ' ')
+        filename_start++; // Пропускаем пробелы
 
-void command_keyboard(void)
-{
-    terminal_writestring("Keyboard Status (v0.7):\n");
+    char filename[FS_MAX_FILENAME];
+    for (i = 0; i < FS_MAX_FILENAME - 1 && filename_start[i] && filename_start[i] != ' '; i++)
+    {
+        filename[i] = filename_start[i];
+    }
+    filename[i] = '\0';
 
-    uint8_t modifiers = keyboard_get_modifiers();
-    keyboard_state_t *state = keyboard_get_state();
+    if (filename[0] == '\0')
+    {
+        terminal_writestring("Error: Missing filename\n");
+        return;
+    }
 
-    terminal_writestring("  Modifier Keys:\n");
-    terminal_writestring("    Shift: ");
-    if (IS_SHIFT_PRESSED(modifiers))
+    // Создаем файл если не существует
+    if (!fs_file_exists(filename))
     {
-        terminal_writestring("PRESSED\n");
+        if (fs_create_file(filename) < 0)
+        {
+            return; // Ошибка уже выведена
+        }
     }
-    else
+
+    // Записываем (или дописываем) данные
+    int result = append ? fs_append_file(filename, text, strlen(text))
+                        : fs_write_file(filename, text, strlen(text));
+    if (result == 0)
     {
-        terminal_writestring("Released\n");
+        terminal_writestring(append ? "Text appended to " : "Text written to ");
+        terminal_writestring(filename);
+        terminal_writestring("\n");
     }
+}
 
-    terminal_writestring("    Ctrl:  ");
-    if (IS_CTRL_PRESSED(modifiers))
+void command_testelf(void)
+{
+    terminal_writestring("Testing ELF loader...\n");
+
+    // Создаем тестовую ELF задачу
+    task_t *elf_task = create_elf_task("test_program", test_elf_program, test_elf_size, 10);
+
+    if (elf_task)
     {
-        terminal_writestring("PRESSED\n");
+        terminal_writestring("ELF test program loaded successfully!\n");
+        terminal_writestring("Task ID: ");
+        print_number(elf_task->id);
+        terminal_writestring("\n");
+        terminal_writestring("This program will exit immediately via sys_exit\n");
     }
     else
     {
-        terminal_writestring("Released\n");
+        terminal_writestring("Failed to load ELF test program\n");
     }
+}
 
-    terminal_writestring("    Alt:   ");
-    if (IS_ALT_PRESSED(modifiers))
+void command_run(const char *filename)
+{
+    if (!filename || strlen(filename) == 0)
     {
-        terminal_writestring("PRESSED\n");
+        terminal_writestring("Usage: run <filename>\n");
+        return;
     }
-    else
+
+    // Имя без '/' ищем сначала в текущей директории, затем в SHELL_PATH;
+    // повторные промахи обслуживаются отрицательными записями кэша dentry
+    char path[FS_MAX_PATH];
+    strncpy(path, filename, FS_MAX_PATH - 1);
+    path[FS_MAX_PATH - 1] = '\0';
+
+    int has_slash = 0;
+    for (const char *p = filename; *p; p++)
     {
-        terminal_writestring("Released\n");
+        if (*p == '/')
+            has_slash = 1;
     }
 
-    terminal_writestring("  Caps Lock: ");
-    if (IS_CAPS_ACTIVE(modifiers))
+    const char *search = SHELL_PATH;
+    while (!has_slash && !fs_file_exists(path) && *search)
     {
-        terminal_writestring("ON\n");
+        int len = 0;
+        while (search[len] && search[len] != ':')
+            len++;
+
+        if (len + 1 + strlen(filename) < FS_MAX_PATH)
+        {
+            memcpy(path, search, len);
+            path[len] = '/';
+            strcpy(path + len + 1, filename);
+        }
+
+        search += len;
+        if (*search == ':')
+            search++;
     }
-    else
+
+    if (!fs_file_exists(path))
     {
-        terminal_writestring("OFF\n");
+        strncpy(path, filename, FS_MAX_PATH - 1);
     }
 
-    terminal_writestring("  Last Key: ");
-    if (state->last_char)
+    terminal_writestring("Loading ELF program: ");
+    terminal_writestring(path);
+    terminal_writestring("\n");
+
+    uint8_t *elf_data;
+    uint32_t elf_size;
+
+    if (load_elf_from_file(path, &elf_data, &elf_size))
     {
-        terminal_putchar(state->last_char);
-        terminal_writestring(" (scancode: ");
-        print_number(state->last_scancode);
-        terminal_writestring(")\n");
+        task_t *elf_task = create_elf_task(filename, elf_data, elf_size, 10);
+
+        if (elf_task)
+        {
+            terminal_writestring("Program loaded successfully!\n");
+            terminal_writestring("Task ID: ");
+            print_number(elf_task->id);
+            terminal_writestring("\n");
+        }
+        else
+        {
+            terminal_writestring("Failed to create task from ELF file\n");
+        }
+
+        kfree(elf_data);
     }
     else
     {
-        terminal_writestring("None\n");
+        terminal_writestring("Failed to load ELF file\n");
     }
+}
 
-    terminal_writestring("\n  New Features v0.7:\n");
-    terminal_writestring("    - Extended key support (F1-F12, arrows, etc.)\n");
-    terminal_writestring("    - E0-prefixed scancodes\n");
-    terminal_writestring("    - Event-driven architecture\n");
-    terminal_writestring("    - Modular keyboard system\n");
-    terminal_writestring("    - Full 256-key scancode table\n");
-    terminal_writestring("\n  Try all keys including F1-F12!\n\n");
+void command_reboot(void)
+{
+    terminal_writestring("Rebooting system...\n");
+    fs_sync();
+    // Простая перезагрузка через клавиатурный контроллер
+    outb(0x64, 0xFE);
+    while (1)
+        asm volatile("hlt");
 }
 
-void command_tasks(void)
+void command_poweroff(void)
 {
-    terminal_writestring("Task List:\n");
-    terminal_writestring("ID   Name             State    Priority\n");
-    terminal_writestring("------------------------------------\n");
+    terminal_writestring("Shutting down system...\n");
+    fs_sync();
+
+    // Попытка ACPI shutdown через порт 0x604 (QEMU)
+    outb(0x604, 0x20);
+    outb(0x605, 0x00);
+
+    // Альтернативный метод для QEMU - порт 0xB004
+    outb(0xB004, 0x20);
+    outb(0xB005, 0x00);
+
+    // Если ничего не помогло, просто останавливаем систему
+    terminal_writestring("System halted. You can close the emulator.\n");
+    asm volatile("cli");
+    while (1)
+        asm volatile("hlt");
+}
+
+void command_ps(void)
+{
+    terminal_writestring("Process List:\n");
+    terminal_writestring("PID   PPID  UID   GID   State     Name\n");
+    terminal_writestring("----------------------------------------\n");
 
     if (!task_list)
     {
-        terminal_writestring("No tasks created yet.\n\n");
+        terminal_writestring("No processes found.\n\n");
         return;
     }
 
     task_t *task = task_list;
     while (task)
     {
-        print_number(task->id);
+        // PID
+        print_number(task->process.pid);
         terminal_writestring("    ");
-        terminal_writestring(task->name);
 
-        // Выравнивание
-        int name_len = strlen(task->name);
-        for (int i = name_len; i < 16; i++)
-        {
-            terminal_putchar(' ');
-        }
+        // PPID
+        print_number(task->process.ppid);
+        terminal_writestring("    ");
+
+        // UID
+        print_number(task->process.uid);
+        terminal_writestring("    ");
+
+        // GID
+        print_number(task->process.gid);
+        terminal_writestring("    ");
 
+        // State
         switch (task->state)
         {
         case TASK_STATE_RUNNING:
@@ -3297,458 +11234,1064 @@ void command_tasks(void)
             terminal_writestring("BLOCKED  ");
             break;
         case TASK_STATE_DEAD:
-            terminal_writestring("DEAD     ");
-            break;
-        default:
-            terminal_writestring("UNKNOWN  ");
-        }
-
-        print_number(task->priority);
-        terminal_putchar('\n');
-
-        task = task->next;
-    }
-
-    terminal_writestring("\nCurrent task: ");
-    if (current_task)
-    {
-        terminal_writestring(current_task->name);
-    }
-    else
-    {
-        terminal_writestring("None");
-    }
-    terminal_writestring("\n\n");
-}
-
-void command_schedule(void)
-{
-    terminal_writestring("Triggering scheduler...\n");
-    schedule();
-    terminal_writestring("Scheduler executed\n\n");
-}
-
-void command_ls(void)
-{
-    fs_list_files();
-}
+            terminal_writestring("DEAD     ");
+            break;
+        default:
+            terminal_writestring("UNKNOWN  ");
+        }
 
-void command_touch(const char *filename)
-{
-    if (filename == NULL || filename[0] == '\0')
-    {
-        terminal_writestring("Usage: touch <filename>\n");
-        return;
-    }
+        // Name
+        terminal_writestring(task->name);
+        terminal_putchar('\n');
 
-    if (fs_create_file(filename) >= 0)
-    {
-        terminal_writestring("File created: ");
-        terminal_writestring(filename);
-        terminal_writestring("\n");
+        task = task->next;
     }
+    terminal_putchar('\n');
 }
 
-void command_cat(const char *filename)
+void command_kill(const char *pid_str)
 {
-    if (filename == NULL || filename[0] == '\0')
+    if (!pid_str || strlen(pid_str) == 0)
     {
-        terminal_writestring("Usage: cat <filename>\n");
+        terminal_writestring("Usage: kill <pid>\n");
         return;
     }
 
-    char buffer[FS_MAX_FILESIZE + 1];
-    int bytes_read = fs_read_file(filename, buffer, FS_MAX_FILESIZE);
+    // Простой парсинг PID
+    uint32_t pid = 0;
+    for (int i = 0; pid_str[i] && pid_str[i] >= '0' && pid_str[i] <= '9'; i++)
+    {
+        pid = pid * 10 + (pid_str[i] - '0');
+    }
 
-    if (bytes_read >= 0)
+    // Ищем процесс
+    task_t *task = task_list;
+    while (task)
     {
-        buffer[bytes_read] = '\0'; // Null-terminate
-        terminal_writestring("Content of ");
-        terminal_writestring(filename);
-        terminal_writestring(":\n");
-        terminal_writestring(buffer);
-        if (bytes_read > 0 && buffer[bytes_read - 1] != '\n')
+        if (task->process.pid == pid)
         {
+            if (task->state == TASK_STATE_DEAD)
+            {
+                terminal_writestring("Process already dead\n");
+                return;
+            }
+
+            // Завершаем процесс
+            task->state = TASK_STATE_DEAD;
+            cleanup_process(task);
+            terminal_writestring("Process killed: PID ");
+            print_number(pid);
             terminal_writestring("\n");
+            return;
         }
+        task = task->next;
     }
+
+    terminal_writestring("Process not found: PID ");
+    print_number(pid);
+    terminal_writestring("\n");
 }
 
-void command_rm(const char *filename)
+void command_fork(void)
 {
-    if (filename == NULL || filename[0] == '\0')
+    if (!current_task)
     {
-        terminal_writestring("Usage: rm <filename>\n");
+        terminal_writestring("No current task to fork\n");
         return;
     }
 
-    if (fs_delete_file(filename) == 0)
+    terminal_writestring("Testing fork system call...\n");
+    task_t *child = fork_process(current_task);
+
+    if (child)
     {
-        terminal_writestring("File deleted: ");
-        terminal_writestring(filename);
+        terminal_writestring("Fork successful! Child PID: ");
+        print_number(child->process.pid);
         terminal_writestring("\n");
     }
+    else
+    {
+        terminal_writestring("Fork failed!\n");
+    }
 }
 
-void command_echo(const char *args)
+void command_pwd(void)
 {
-    if (args == NULL || args[0] == '\0')
+    char path[FS_MAX_PATH];
+    if (fs_get_path(shell_cwd_inode, path, sizeof(path)) < 0)
     {
-        terminal_writestring("Usage: echo <text> > <filename>\n");
-        terminal_writestring("Example: echo Hello World > myfile.txt\n");
+        terminal_writestring("Current directory is unreachable\n");
         return;
     }
 
-    // Простой парсинг команды echo "text" > filename
-    const char *text_start = args;
-    const char *redirect_pos = NULL;
+    terminal_writestring("Current directory: ");
+    terminal_writestring(path);
+    terminal_putchar('\n');
+}
 
-    // Ищем символ '>'
-    for (const char *p = args; *p; p++)
+void command_cd(const char *path)
+{
+    if (!path || strlen(path) == 0)
     {
-        if (*p == '>')
-        {
-            redirect_pos = p;
-            break;
-        }
+        terminal_writestring("Usage: cd <directory>\n");
+        return;
     }
 
-    if (!redirect_pos)
+    // Путь разрешается покомпонентно, текущая директория хранится как inode
+    int inode = fs_lookup_path(path);
+    if (inode < 0 || fs_inode(inode)->type != FS_INODE_DIR)
     {
-        terminal_writestring("Error: Missing '>' redirection\n");
-        terminal_writestring("Usage: echo <text> > <filename>\n");
+        terminal_writestring("No such directory: ");
+        terminal_writestring(path);
+        terminal_putchar('\n');
         return;
     }
 
-    // Извлекаем текст (до '>')
-    char text[256];
-    int text_len = redirect_pos - text_start;
-    if (text_len >= 256)
-        text_len = 255;
+    shell_cwd_inode = inode;
 
-    // Копируем текст, убираем пробелы в конце
-    int i;
-    for (i = 0; i < text_len; i++)
+    char cwd[FS_MAX_PATH];
+    fs_get_path(shell_cwd_inode, cwd, sizeof(cwd));
+    terminal_writestring("Changed directory to: ");
+    terminal_writestring(cwd);
+    terminal_putchar('\n');
+}
+
+void command_mkdir(const char *dirname)
+{
+    if (!dirname || strlen(dirname) == 0)
     {
-        text[i] = text_start[i];
+        terminal_writestring("Usage: mkdir <directory>\n");
+        return;
     }
-    while (i > 0 && text[i - 1] == ' ')
-        i--; // Убираем пробелы в конце
-    text[i] = '\0';
-
-    // Извлекаем имя файла (после '>')
-    const char *filename_start = redirect_pos + 1;
-    while (*filename_start == ' ')
-        filename_start++; // Пропускаем пробелы
 
-    char filename[FS_MAX_FILENAME];
-    for (i = 0; i < FS_MAX_FILENAME - 1 && filename_start[i] && filename_start[i] != ' '; i++)
+    if (fs_create_directory(dirname) >= 0)
     {
-        filename[i] = filename_start[i];
+        terminal_writestring("Directory created: ");
+        terminal_writestring(dirname);
+        terminal_writestring("\n");
     }
-    filename[i] = '\0';
+}
 
-    if (filename[0] == '\0')
+void command_rmdir(const char *dirname)
+{
+    if (!dirname || strlen(dirname) == 0)
     {
-        terminal_writestring("Error: Missing filename\n");
+        terminal_writestring("Usage: rmdir <directory>\n");
         return;
     }
 
-    // Создаем файл если не существует
-    if (!fs_file_exists(filename))
+    if (fs_delete_directory(dirname) == 0)
     {
-        if (fs_create_file(filename) < 0)
-        {
-            return; // Ошибка уже выведена
-        }
+        terminal_writestring("Directory removed: ");
+        terminal_writestring(dirname);
+        terminal_writestring("\n");
     }
+}
 
-    // Записываем данные
-    if (fs_write_file(filename, text, strlen(text)) == 0)
+void command_lspci(void)
+{
+    if (pci_device_count == 0)
     {
-        terminal_writestring("Text written to ");
-        terminal_writestring(filename);
+        terminal_writestring("No PCI devices\n");
+        return;
+    }
+
+    for (uint32_t i = 0; i < pci_device_count; i++)
+    {
+        pci_device_t *pci = &pci_devices[i];
+        print_number(pci->bus);
+        terminal_writestring(":");
+        print_number(pci->slot);
+        terminal_writestring(".");
+        print_number(pci->func);
+        terminal_writestring("  ");
+        print_hex(pci->vendor_id);
+        terminal_writestring(":");
+        print_hex(pci->device_id);
+        terminal_writestring("  class ");
+        print_hex(pci->class_code);
+        terminal_writestring("/");
+        print_hex(pci->subclass);
+        if (pci->irq_line < 16)
+        {
+            terminal_writestring("  IRQ ");
+            print_number(pci->irq_line);
+        }
         terminal_writestring("\n");
     }
 }
 
-void command_testelf(void)
+#define BLKBENCH_REQUEST_KB 32 // Размер запроса бенчмарка
+#define BLKBENCH_MAX_DEPTH 8   // Максимум запросов в полёте
+
+static volatile uint32_t blkbench_completed;
+
+static void blkbench_complete(blk_request_t *req)
 {
-    terminal_writestring("Testing ELF loader...\n");
+    (void)req;
+    blkbench_completed++;
+}
 
-    // Создаем тестовую ELF задачу
-    task_t *elf_task = create_elf_task("test_program", test_elf_program, test_elf_size, 10);
+// Последовательное чтение total_kb с диска при depth запросах в полёте.
+// Возвращает затраченные тики таймера
+static uint32_t blkbench_run(block_device_t *dev, uint8_t *buffer, uint32_t total_kb, uint32_t depth)
+{
+    blk_request_t requests[BLKBENCH_MAX_DEPTH];
+    uint32_t sectors_per_request = BLKBENCH_REQUEST_KB * 1024 / BLK_SECTOR_SIZE;
+    uint32_t total = total_kb / BLKBENCH_REQUEST_KB;
+    uint32_t submitted = 0;
 
-    if (elf_task)
+    // Все запросы читают в один буфер (данные не проверяются), каждый
+    // разбит на страницы, чтобы нагрузить scatter-gather
+    memset(requests, 0, sizeof(requests));
+    for (uint32_t i = 0; i < depth; i++)
     {
-        terminal_writestring("ELF test program loaded successfully!\n");
-        terminal_writestring("Task ID: ");
-        print_number(elf_task->id);
-        terminal_writestring("\n");
-        terminal_writestring("This program will exit immediately via sys_exit\n");
+        requests[i].device = dev;
+        requests[i].status = BLK_OK;
+        requests[i].complete = blkbench_complete;
+        requests[i].segment_count = BLKBENCH_REQUEST_KB * 1024 / PAGE_SIZE;
+        for (uint32_t s = 0; s < requests[i].segment_count; s++)
+        {
+            requests[i].segments[s].buffer = buffer + s * PAGE_SIZE;
+            requests[i].segments[s].length = PAGE_SIZE;
+        }
     }
-    else
+
+    blkbench_completed = 0;
+    uint32_t start = timer_ticks;
+    while (blkbench_completed < total)
     {
-        terminal_writestring("Failed to load ELF test program\n");
+        for (uint32_t i = 0; i < depth && submitted < total; i++)
+        {
+            blk_request_t *req = &requests[i];
+            if (req->status == BLK_PENDING)
+                continue;
+            req->sector = (submitted * sectors_per_request) % (dev->sector_count - sectors_per_request);
+            if (blk_submit(req) == 0)
+                submitted++;
+        }
+
+        // Ждём завершения из прерывания; sti; hlt не теряет прерывание,
+        // пришедшее между проверкой и остановкой
+        asm volatile("cli");
+        if (blkbench_completed < total && submitted - blkbench_completed >= depth)
+            asm volatile("sti; hlt");
+        else
+            asm volatile("sti");
     }
+    return timer_ticks - start;
 }
 
-void command_run(const char *filename)
+void command_blkbench(const char *args)
 {
-    if (!filename || strlen(filename) == 0)
+    block_device_t *dev = blk_find("vda");
+    if (!dev)
     {
-        terminal_writestring("Usage: run <filename>\n");
+        terminal_writestring("No block device (run QEMU with -drive if=virtio)\n");
         return;
     }
 
-    terminal_writestring("Loading ELF program: ");
-    terminal_writestring(filename);
-    terminal_writestring("\n");
+    // Объём чтения в MB, по умолчанию 16
+    uint32_t total_mb = 0;
+    for (int i = 0; args[i] >= '0' && args[i] <= '9'; i++)
+        total_mb = total_mb * 10 + (args[i] - '0');
+    if (total_mb == 0)
+        total_mb = 16;
 
-    uint8_t *elf_data;
-    uint32_t elf_size;
+    uint32_t sectors_per_request = BLKBENCH_REQUEST_KB * 1024 / BLK_SECTOR_SIZE;
+    if (dev->sector_count <= sectors_per_request)
+    {
+        terminal_writestring("Device too small\n");
+        return;
+    }
 
-    if (load_elf_from_file(filename, &elf_data, &elf_size))
+    uint8_t *buffer = (uint8_t *)kmalloc(BLKBENCH_REQUEST_KB * 1024);
+    if (!buffer)
     {
-        task_t *elf_task = create_elf_task(filename, elf_data, elf_size, 10);
+        terminal_writestring("Out of memory\n");
+        return;
+    }
 
-        if (elf_task)
-        {
-            terminal_writestring("Program loaded successfully!\n");
-            terminal_writestring("Task ID: ");
-            print_number(elf_task->id);
-            terminal_writestring("\n");
-        }
-        else
-        {
-            terminal_writestring("Failed to create task from ELF file\n");
-        }
+    // Команды шелла выполняются в обработчике клавиатуры с запрещёнными
+    // прерываниями. На время замера клавиатура маскируется, а прерывания
+    // включаются: таймер отсчитывает время, завершения приходят по IRQ
+    uint16_t saved_mask = irq_mask;
+    irq_mask |= 1u << 1;
+    pic_write_mask();
+    asm volatile("sti");
 
-        kfree(elf_data);
-    }
-    else
-    {
-        terminal_writestring("Failed to load ELF file\n");
+    uint32_t depths[2] = {1, dev->queue_depth < BLKBENCH_MAX_DEPTH ? dev->queue_depth : BLKBENCH_MAX_DEPTH};
+    for (int d = 0; d < 2; d++)
+    {
+        dev->max_in_flight = 0;
+        uint32_t irqs = virtio_blk.interrupts;
+        uint32_t ticks = blkbench_run(dev, buffer, total_mb * 1024, depths[d]);
+        if (ticks == 0)
+            ticks = 1;
+
+        terminal_writestring("depth ");
+        print_number(depths[d]);
+        terminal_writestring(": ");
+        print_number(total_mb);
+        terminal_writestring(" MB in ");
+        print_number(ticks * 1000 / TIMER_FREQUENCY);
+        terminal_writestring(" ms, ");
+        print_number(total_mb * 1024 * TIMER_FREQUENCY / ticks);
+        terminal_writestring(" KB/s, max in flight ");
+        print_number(dev->max_in_flight);
+        terminal_writestring(", interrupts ");
+        print_number(virtio_blk.interrupts - irqs);
+        terminal_writestring("\n");
     }
-}
 
-void command_reboot(void)
-{
-    terminal_writestring("Rebooting system...\n");
-    // Простая перезагрузка через клавиатурный контроллер
-    outb(0x64, 0xFE);
-    while (1)
-        asm volatile("hlt");
+    asm volatile("cli");
+    irq_mask = saved_mask;
+    pic_write_mask();
+    kfree(buffer);
 }
 
-void command_poweroff(void)
+void command_sync(void)
 {
-    terminal_writestring("Shutting down system...\n");
-
-    // Попытка ACPI shutdown через порт 0x604 (QEMU)
-    outb(0x604, 0x20);
-    outb(0x605, 0x00);
+    if (!filesystem.device)
+    {
+        terminal_writestring("Filesystem is in memory, nothing to sync\n");
+        return;
+    }
 
-    // Альтернативный метод для QEMU - порт 0xB004
-    outb(0xB004, 0x20);
-    outb(0xB005, 0x00);
+    int written = fs_sync();
+    if (written < 0)
+    {
+        terminal_writestring("sync: write error on " FS_ROOT_DEVICE "\n");
+        return;
+    }
+    terminal_writestring("Synced ");
+    print_number(written);
+    terminal_writestring(" sectors to " FS_ROOT_DEVICE "\n");
+}
 
-    // Если ничего не помогло, просто останавливаем систему
-    terminal_writestring("System halted. You can close the emulator.\n");
-    asm volatile("cli");
-    while (1)
-        asm volatile("hlt");
+// Вывод доли part/total в процентах с одним знаком после точки
+static void print_ratio(uint32_t part, uint32_t total)
+{
+    // Масштабирование, чтобы part * 1000 помещалось в 32 бита
+    while (total > 4000000)
+    {
+        part >>= 1;
+        total >>= 1;
+    }
+    uint32_t permille = total ? part * 1000 / total : 0;
+    print_number(permille / 10);
+    terminal_putchar('.');
+    print_number(permille % 10);
+    terminal_putchar('%');
 }
 
-void command_ps(void)
+// Сжатие файлов: compress [on|off|<file>|-d <file>]
+void command_compress(const char *args)
 {
-    terminal_writestring("Process List:\n");
-    terminal_writestring("PID   PPID  UID   GID   State     Name\n");
-    terminal_writestring("----------------------------------------\n");
+    if (!filesystem.initialized)
+        return;
 
-    if (!task_list)
+    if (strcmp(args, "on") == 0 || strcmp(args, "off") == 0)
     {
-        terminal_writestring("No processes found.\n\n");
+        if (args[1] == 'n')
+            filesystem.superblock.flags |= FS_SB_F_COMPRESS;
+        else
+            filesystem.superblock.flags &= ~FS_SB_F_COMPRESS;
+        fs_meta_dirty();
+        terminal_writestring(args[1] == 'n' ? "New files will be compressed\n" : "New files will not be compressed\n");
         return;
     }
 
-    task_t *task = task_list;
-    while (task)
+    if (args[0] != '\0')
     {
-        // PID
-        print_number(task->process.pid);
-        terminal_writestring("    ");
+        int enable = strncmp(args, "-d ", 3) != 0;
+        const char *path = enable ? args : args + 3;
+        int result = fs_compress_file(path, enable);
+        if (result < 0)
+            return;
 
-        // PPID
-        print_number(task->process.ppid);
-        terminal_writestring("    ");
+        fs_inode_t *inode = fs_find_inode(path);
+        terminal_writestring(path);
+        terminal_writestring(": ");
+        print_number(inode->size);
+        terminal_writestring(" bytes in ");
+        print_number(fs_inode_block_count(inode));
+        terminal_writestring(result ? " blocks, compressed\n" : " blocks, not compressed\n");
+        return;
+    }
 
-        // UID
-        print_number(task->process.uid);
-        terminal_writestring("    ");
+    // Сводка по всем сжатым файлам тома
+    uint32_t files = 0;
+    uint32_t logical_kb = 0;
+    uint32_t stored_blocks = 0;
+    for (uint32_t i = 0; i < filesystem.inode_capacity; i++)
+    {
+        fs_inode_t *inode = fs_inode(i);
+        if (inode->type == FS_INODE_FILE && (inode->flags & FS_INODE_F_COMPRESSED))
+        {
+            files++;
+            logical_kb += (inode->size + 1023) / 1024;
+            stored_blocks += fs_inode_block_count(inode);
+        }
+    }
 
-        // GID
-        print_number(task->process.gid);
-        terminal_writestring("    ");
+    terminal_writestring("Compression: new files ");
+    terminal_writestring(filesystem.superblock.flags & FS_SB_F_COMPRESS ? "compressed\n" : "not compressed\n");
+    terminal_writestring("  files:       ");
+    print_number(files);
+    terminal_writestring(", ");
+    print_number(logical_kb);
+    terminal_writestring(" KB stored in ");
+    print_number(stored_blocks * FS_BLOCK_SIZE / 1024);
+    terminal_writestring(" KB (");
+    print_ratio(stored_blocks * FS_BLOCK_SIZE / 1024, logical_kb);
+    terminal_writestring(")\n  group cache: ");
+    print_number(FS_ZCACHE_SLOTS);
+    terminal_writestring(" x ");
+    print_number(FS_COMP_GROUP / 1024);
+    terminal_writestring(" KB, ");
+    print_number(filesystem.zcache_hits);
+    terminal_writestring(" hits, ");
+    print_number(filesystem.zcache_misses);
+    terminal_writestring(" groups decompressed\n");
+}
+
+// Дедупликация блоков ФС в памяти: dedup [on|off]
+void command_dedup(const char *args)
+{
+    if (!filesystem.initialized)
+        return;
 
-        // State
-        switch (task->state)
+    if (strcmp(args, "on") == 0 || strcmp(args, "off") == 0)
+    {
+        int shared = fs_set_dedup(args[1] == 'n');
+        if (shared < 0)
+            return;
+        if (args[1] == 'n')
         {
-        case TASK_STATE_RUNNING:
-            terminal_writestring("RUNNING  ");
-            break;
-        case TASK_STATE_READY:
-            terminal_writestring("READY    ");
-            break;
-        case TASK_STATE_BLOCKED:
-            terminal_writestring("BLOCKED  ");
-            break;
-        case TASK_STATE_DEAD:
-            terminal_writestring("DEAD     ");
-            break;
-        default:
-            terminal_writestring("UNKNOWN  ");
+            terminal_writestring("Deduplication enabled, ");
+            print_number(shared);
+            terminal_writestring(" blocks shared\n");
+        }
+        else
+        {
+            terminal_writestring("Deduplication disabled\n");
         }
+        return;
+    }
 
-        // Name
-        terminal_writestring(task->name);
-        terminal_putchar('\n');
+    uint32_t logical_kb, physical_kb;
+    fs_data_usage(&logical_kb, &physical_kb);
+    terminal_writestring("Deduplication: ");
+    terminal_writestring(filesystem.dedup ? "on\n" : "off\n");
+    terminal_writestring("  data:   ");
+    print_number(logical_kb);
+    terminal_writestring(" KB logical, ");
+    print_number(physical_kb);
+    terminal_writestring(" KB physical (");
+    print_ratio(physical_kb, logical_kb);
+    terminal_writestring(")\n  shared: ");
+    print_number(filesystem.dedup_shared);
+    terminal_writestring(" blocks saved, ");
+    print_number(filesystem.dedup_cow);
+    terminal_writestring(" copied on write\n");
+}
+
+// Дефрагментация: defrag [on|off|run]. run доводит её до конца сразу,
+// без ограничения скорости, но не дольше FS_DEFRAG_RUN_PASSES проходов,
+// в каждом из которых переносятся все inodes и все блоки тома
+void command_defrag(const char *args)
+{
+    if (!filesystem.initialized)
+        return;
 
-        task = task->next;
+    fs_defrag_t *defrag = &filesystem.defrag;
+    if (strcmp(args, "on") == 0 || strcmp(args, "off") == 0)
+    {
+        defrag->enabled = args[1] == 'n';
+        terminal_writestring(defrag->enabled ? "Idle defragmentation enabled\n" : "Idle defragmentation disabled\n");
+        return;
     }
-    terminal_putchar('\n');
-}
+    if (strcmp(args, "run") == 0)
+    {
+        uint32_t moves = defrag->moves;
+        uint32_t pass_steps = filesystem.inode_capacity / FS_DEFRAG_SCAN + filesystem.inode_capacity +
+                              filesystem.superblock.total_blocks / FS_DEFRAG_STEP_BLOCKS + 1;
+        uint32_t steps = 0;
+        while (steps < FS_DEFRAG_RUN_PASSES * pass_steps && fs_defrag_step(FS_DEFRAG_STEP_BLOCKS, 1))
+            steps++;
+        terminal_writestring(steps < FS_DEFRAG_RUN_PASSES * pass_steps ? "Defragmented, " : "Stopped after ");
+        print_number(defrag->moves - moves);
+        terminal_writestring(" moves\n");
+    }
+
+    uint32_t files, fragmented, free_runs, largest_free;
+    fs_layout_stats(&files, &fragmented, &free_runs, &largest_free);
+    terminal_writestring("Defragmentation: ");
+    terminal_writestring(defrag->enabled ? "on" : "off");
+    terminal_writestring(defrag->moving ? ", moving a file\n" : defrag->settled ? ", settled\n" : "\n");
+    terminal_writestring("  files:  ");
+    print_number(files);
+    terminal_writestring(" with blocks, ");
+    print_number(fragmented);
+    terminal_writestring(" fragmented\n  free:   ");
+    print_number(free_runs);
+    terminal_writestring(" runs, largest ");
+    print_number(largest_free);
+    terminal_writestring(" blocks\n  moved:  ");
+    print_number(defrag->moves);
+    terminal_writestring(" moves, ");
+    print_number(defrag->blocks_moved);
+    terminal_writestring(" blocks copied, ");
+    print_number(defrag->aborted);
+    terminal_writestring(" aborted, ");
+    print_number(defrag->passes);
+    terminal_writestring(" passes\n");
+}
+
+// Наблюдатель шелла: создаётся при первом watch <path>
+static open_file_t *shell_watcher = NULL;
 
-void command_kill(const char *pid_str)
+static const struct
 {
-    if (!pid_str || strlen(pid_str) == 0)
+    uint32_t mask;
+    const char *name;
+} watch_event_names[] = {
+    {IN_MODIFY, "MODIFY"},
+    {IN_CREATE, "CREATE"},
+    {IN_DELETE, "DELETE"},
+    {IN_DELETE_SELF, "DELETE_SELF"},
+    {IN_MOVED_FROM, "MOVED_FROM"},
+    {IN_MOVED_TO, "MOVED_TO"},
+    {IN_MOVE_SELF, "MOVE_SELF"},
+    {IN_IGNORED, "IGNORED"},
+    {IN_Q_OVERFLOW, "Q_OVERFLOW"},
+};
+
+// Наблюдение за изменениями: watch <path> добавляет наблюдение,
+// watch -d <wd> снимает, watch без аргументов выводит накопленные события
+void command_watch(const char *args)
+{
+    if (strncmp(args, "-d ", 3) == 0)
     {
-        terminal_writestring("Usage: kill <pid>\n");
+        int wd = 0;
+        for (int i = 3; args[i] >= '0' && args[i] <= '9'; i++)
+            wd = wd * 10 + (args[i] - '0');
+        if (fs_watch_remove(shell_watcher, wd) < 0)
+            terminal_writestring("No such watch\n");
         return;
     }
 
-    // Простой парсинг PID
-    uint32_t pid = 0;
-    for (int i = 0; pid_str[i] && pid_str[i] >= '0' && pid_str[i] <= '9'; i++)
+    if (args[0] != '\0')
     {
-        pid = pid * 10 + (pid_str[i] - '0');
+        if (!shell_watcher && !(shell_watcher = fs_watch_open()))
+            return;
+        int wd = fs_watch_add(shell_watcher, args, IN_ALL_EVENTS);
+        if (wd < 0)
+        {
+            terminal_writestring("Cannot watch: ");
+            terminal_writestring(args);
+            terminal_writestring("\n");
+            return;
+        }
+        terminal_writestring("Watching ");
+        terminal_writestring(args);
+        terminal_writestring(", wd ");
+        print_number(wd);
+        terminal_writestring("\n");
+        return;
     }
 
-    // Ищем процесс
-    task_t *task = task_list;
-    while (task)
+    static uint8_t buf[512];
+    int shown = 0;
+    int got;
+    while (shell_watcher && (got = fs_file_read(shell_watcher, buf, sizeof(buf))) > 0)
     {
-        if (task->process.pid == pid)
+        for (int pos = 0; pos < got; pos += sizeof(inotify_event_t) + ((inotify_event_t *)(buf + pos))->len)
         {
-            if (task->state == TASK_STATE_DEAD)
+            inotify_event_t *event = (inotify_event_t *)(buf + pos);
+            terminal_writestring("wd ");
+            print_number(event->wd < 0 ? 0 : event->wd);
+            terminal_writestring(": ");
+            for (uint32_t i = 0; i < sizeof(watch_event_names) / sizeof(watch_event_names[0]); i++)
             {
-                terminal_writestring("Process already dead\n");
-                return;
+                if (event->mask & watch_event_names[i].mask)
+                    terminal_writestring(watch_event_names[i].name);
+            }
+            if (event->mask & IN_ISDIR)
+                terminal_writestring(" (dir)");
+            if (event->len)
+            {
+                terminal_writestring(" ");
+                terminal_writestring(event->name);
+            }
+            if (event->cookie)
+            {
+                terminal_writestring(" cookie ");
+                print_number(event->cookie);
             }
-
-            // Завершаем процесс
-            task->state = TASK_STATE_DEAD;
-            cleanup_process(task);
-            terminal_writestring("Process killed: PID ");
-            print_number(pid);
             terminal_writestring("\n");
-            return;
+            shown++;
         }
-        task = task->next;
     }
-
-    terminal_writestring("Process not found: PID ");
-    print_number(pid);
-    terminal_writestring("\n");
+    if (shown == 0)
+        terminal_writestring("No events\n");
+}
+
+void command_bcache(void)
+{
+    terminal_writestring("Buffer cache: ");
+    print_number(bcache.count);
+    terminal_writestring(" x ");
+    print_number(BCACHE_BLOCK_SIZE / 1024);
+    terminal_writestring(" KB, ");
+    print_number(bcache.used);
+    terminal_writestring(" in use, ");
+    print_number(bcache.dirty);
+    terminal_writestring(" dirty\n");
+
+    terminal_writestring("  lookups:    ");
+    print_number(bcache.hits);
+    terminal_writestring(" hits, ");
+    print_number(bcache.misses);
+    terminal_writestring(" misses, hit ratio ");
+    print_ratio(bcache.hits, bcache.hits + bcache.misses);
+    terminal_writestring("\n  readahead:  ");
+    print_number(bcache.readahead);
+    terminal_writestring(" blocks, ");
+    print_number(bcache.readahead_hits);
+    terminal_writestring(" used\n  writeback:  ");
+    print_number(bcache.writebacks);
+    terminal_writestring(" blocks (");
+    print_number(bcache.timer_writebacks);
+    terminal_writestring(" by timer), ");
+    print_number(bcache.evictions);
+    terminal_writestring(" evictions (");
+    print_number(bcache.dirty_evictions);
+    terminal_writestring(" dirty), ");
+    print_number(bcache.errors);
+    terminal_writestring(" errors\n");
+
+    for (uint32_t i = 0; i < block_device_count; i++)
+    {
+        block_device_t *dev = block_devices[i];
+        terminal_writestring("  ");
+        terminal_writestring(dev->name);
+        terminal_writestring(": ");
+        print_number(dev->reads);
+        terminal_writestring(" reads (");
+        print_number(dev->sectors_read);
+        terminal_writestring(" sectors), ");
+        print_number(dev->writes);
+        terminal_writestring(" writes (");
+        print_number(dev->sectors_written);
+        terminal_writestring(" sectors), ");
+        print_number(dev->errors);
+        terminal_writestring(" errors\n");
+    }
+}
+
+#define RINGBENCH_OPS 4096       // Операций в замере по умолчанию
+#define RINGBENCH_IO_SIZE 64     // Размер одного чтения или записи
+#define RINGBENCH_SLOTS 64       // Операции ходят по первым 4KB файла
+#define RINGBENCH_FILE "/ringbench.tmp"
+
+static io_ring_t ringbench_ring;
+static uint8_t ringbench_buffer[RINGBENCH_IO_SIZE];
+
+// ops операций отдельными системными вызовами; NOP — getpid.
+// Возвращает такты или 0 при ошибке
+static uint32_t ringbench_syscalls(uint8_t opcode, int fd, uint32_t ops)
+{
+    uint32_t start = (uint32_t)read_tsc();
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        int offset = (i % RINGBENCH_SLOTS) * RINGBENCH_IO_SIZE;
+        int result;
+        if (opcode == IO_OP_NOP)
+            result = syscall1(SYS_GETPID, 0);
+        else
+            result = syscall4(opcode == IO_OP_WRITE ? SYS_PWRITE : SYS_PREAD, fd, (int)ringbench_buffer,
+                              RINGBENCH_IO_SIZE, offset);
+        if (result < 0)
+            return 0;
+    }
+    return (uint32_t)read_tsc() - start;
 }
 
-void command_fork(void)
+// Те же ops операций через кольца: пакет на всю очередь отправки и один
+// io_ring_enter на пакет. Возвращает такты или 0 при ошибке
+static uint32_t ringbench_ring_run(uint8_t opcode, int fd, uint32_t ops)
 {
-    if (!current_task)
+    io_ring_t *ring = &ringbench_ring;
+    uint32_t start = (uint32_t)read_tsc();
+
+    for (uint32_t done = 0; done < ops;)
     {
-        terminal_writestring("No current task to fork\n");
-        return;
-    }
+        uint32_t batch = ops - done < IO_RING_SQ_ENTRIES ? ops - done : IO_RING_SQ_ENTRIES;
+        for (uint32_t i = 0; i < batch; i++)
+        {
+            io_sqe_t *sqe = &ring->sq[ring->sq_tail & (IO_RING_SQ_ENTRIES - 1)];
+            sqe->opcode = opcode;
+            sqe->fd = fd;
+            sqe->addr = (uint32_t)ringbench_buffer;
+            sqe->len = RINGBENCH_IO_SIZE;
+            sqe->offset = ((done + i) % RINGBENCH_SLOTS) * RINGBENCH_IO_SIZE;
+            sqe->user_data = done + i;
+            ring->sq_tail++;
+        }
 
-    terminal_writestring("Testing fork system call...\n");
-    task_t *child = fork_process(current_task);
+        if (syscall1(SYS_IO_RING_ENTER, batch) != (int)batch)
+            return 0;
 
-    if (child)
-    {
-        terminal_writestring("Fork successful! Child PID: ");
-        print_number(child->process.pid);
-        terminal_writestring("\n");
-    }
-    else
-    {
-        terminal_writestring("Fork failed!\n");
+        for (; ring->cq_head != ring->cq_tail; ring->cq_head++)
+        {
+            if (ring->cq[ring->cq_head & (IO_RING_CQ_ENTRIES - 1)].result < 0)
+                return 0;
+        }
+        done += batch;
     }
+    return (uint32_t)read_tsc() - start;
 }
 
-void command_pwd(void)
+// Сравнение системных вызовов и колец на NOP, pwrite и pread по 64 байта
+void command_ringbench(const char *args)
 {
-    if (!current_task)
+    uint32_t ops = 0;
+    for (int i = 0; args[i] >= '0' && args[i] <= '9'; i++)
+        ops = ops * 10 + (args[i] - '0');
+    if (ops == 0 || ops > 65536)
+        ops = RINGBENCH_OPS;
+
+    // Файл удаляется после замера, поэтому чужой файл с тем же именем не трогаем
+    if (fs_find_inode(RINGBENCH_FILE))
     {
-        terminal_writestring("No current task\n");
+        terminal_writestring(RINGBENCH_FILE " already exists, remove it first\n");
         return;
     }
-
-    terminal_writestring("Current directory: ");
-    terminal_writestring(current_task->process.working_dir);
-    terminal_putchar('\n');
-}
-
-void command_cd(const char *path)
-{
-    if (!current_task)
+    int fd = syscall2(SYS_OPEN, (int)RINGBENCH_FILE, O_RDWR | O_CREAT);
+    if (fd < 0)
     {
-        terminal_writestring("No current task\n");
+        terminal_writestring("Cannot create " RINGBENCH_FILE "\n");
         return;
     }
-
-    if (!path || strlen(path) == 0)
+    if (syscall1(SYS_IO_RING_SETUP, (int)&ringbench_ring) < 0)
     {
-        terminal_writestring("Usage: cd <directory>\n");
+        terminal_writestring("io_ring_setup failed\n");
+        syscall1(SYS_CLOSE, fd);
+        fs_delete_file(RINGBENCH_FILE);
         return;
     }
 
-    // Простая реализация - просто меняем рабочую директорию
-    strcpy(current_task->process.working_dir, path);
-    terminal_writestring("Changed directory to: ");
-    terminal_writestring(path);
-    terminal_putchar('\n');
+    static const struct
+    {
+        uint8_t opcode;
+        const char *name;
+    } tests[] = {{IO_OP_NOP, "nop   "}, {IO_OP_WRITE, "pwrite"}, {IO_OP_READ, "pread "}};
+
+    print_number(ops);
+    terminal_writestring(" ops per test, ring batches of ");
+    print_number(IO_RING_SQ_ENTRIES);
+    terminal_writestring(", cycles per op:\n");
+    for (uint32_t t = 0; t < sizeof(tests) / sizeof(tests[0]); t++)
+    {
+        uint32_t sys = ringbench_syscalls(tests[t].opcode, fd, ops) / ops;
+        uint32_t ring = ringbench_ring_run(tests[t].opcode, fd, ops) / ops;
+        terminal_writestring("  ");
+        terminal_writestring(tests[t].name);
+        if (sys == 0 || ring == 0)
+        {
+            terminal_writestring(": failed\n");
+            break;
+        }
+
+        uint32_t speedup = sys * 10 / ring;
+        terminal_writestring(": syscall ");
+        print_number(sys);
+        terminal_writestring(", ring ");
+        print_number(ring);
+        terminal_writestring(" (");
+        print_number(speedup / 10);
+        terminal_putchar('.');
+        print_number(speedup % 10);
+        terminal_writestring("x)\n");
+    }
+
+    syscall1(SYS_IO_RING_SETUP, 0);
+    syscall1(SYS_CLOSE, fd);
+    fs_delete_file(RINGBENCH_FILE);
+}
+
+#define FSBENCH_FILES 256       // Файлов по умолчанию
+#define FSBENCH_MAX_FILES 4096
+#define FSBENCH_SIZE 4096        // Размер файла по умолчанию
+#define FSBENCH_MAX_SIZE 65536
+#define FSBENCH_APPEND_SIZE 256  // Дописывается к каждому файлу
+#define FSBENCH_DIR "/fsbench"
+
+enum
+{
+    FSBENCH_CREATE,
+    FSBENCH_WRITE,
+    FSBENCH_STAT,
+    FSBENCH_READ,
+    FSBENCH_APPEND,
+    FSBENCH_RENAME,
+    FSBENCH_DELETE,
+    FSBENCH_PHASES
+};
+
+static const char *fsbench_phase_names[FSBENCH_PHASES] = {"create", "write", "stat",  "read",
+                                                          "append", "rename", "delete"};
+
+static uint32_t fsbench_latency[FSBENCH_MAX_FILES]; // Такты каждой операции фазы
+
+// Путь файла n бенчмарка: FSBENCH_DIR/<prefix><n>
+static void fsbench_path(char *path, char prefix, uint32_t n)
+{
+    strcpy(path, FSBENCH_DIR "/");
+    char *p = path + strlen(path);
+    *p++ = prefix;
+
+    char digits[12];
+    int len = 0;
+    do
+    {
+        digits[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    while (len > 0)
+        *p++ = digits[--len];
+    *p = '\0';
 }
 
-void command_mkdir(const char *dirname)
+// Сортировка Шелла (для перцентилей задержек)
+static void sort_u32(uint32_t *values, uint32_t count)
 {
-    if (!dirname || strlen(dirname) == 0)
+    for (uint32_t gap = count / 2; gap > 0; gap /= 2)
     {
-        terminal_writestring("Usage: mkdir <directory>\n");
-        return;
+        for (uint32_t i = gap; i < count; i++)
+        {
+            uint32_t value = values[i];
+            uint32_t j = i;
+            while (j >= gap && values[j - gap] > value)
+            {
+                values[j] = values[j - gap];
+                j -= gap;
+            }
+            values[j] = value;
+        }
     }
+}
 
-    if (fs_create_directory(dirname) >= 0)
+// Такты TSC в наносекунды
+static uint32_t tsc_to_ns(uint64_t cycles)
+{
+    return (uint32_t)div_u64(cycles * 1000000, tsc_khz);
+}
+
+// Одна операция фазы над файлом n. 0 — успех
+static int fsbench_op(int phase, uint32_t n, uint32_t size, char *buffer)
+{
+    char path[FS_MAX_PATH];
+    char renamed[FS_MAX_PATH];
+    fsbench_path(path, 'f', n);
+    fsbench_path(renamed, 'r', n);
+
+    switch (phase)
     {
-        terminal_writestring("Directory created: ");
-        terminal_writestring(dirname);
-        terminal_writestring("\n");
+    case FSBENCH_CREATE:
+        return fs_create_file(path) >= 0 ? 0 : -1;
+    case FSBENCH_WRITE:
+        return fs_write_file(path, buffer, size);
+    case FSBENCH_STAT:
+    {
+        int i = fs_lookup_path(path);
+        return (i >= 0 && fs_inode(i)->size == size) ? 0 : -1;
     }
+    case FSBENCH_READ:
+        return fs_read_file(path, buffer, size) == (int)size ? 0 : -1;
+    case FSBENCH_APPEND:
+        return fs_append_file(path, buffer, FSBENCH_APPEND_SIZE);
+    case FSBENCH_RENAME:
+        return fs_rename(path, renamed);
+    case FSBENCH_DELETE:
+        return fs_delete_file(renamed);
+    }
+    return -1;
 }
 
-void command_rmdir(const char *dirname)
+// Число, выровненное вправо по ширине width; blank — прочерк вместо числа
+static void fsbench_print_column(uint32_t value, int width, int blank)
 {
-    if (!dirname || strlen(dirname) == 0)
+    char digits[12];
+    int len = 0;
+    do
+    {
+        digits[len++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    if (blank)
+        len = 1;
+    for (int col = len; col < width; col++)
+        terminal_putchar(' ');
+    if (blank)
+        terminal_putchar('-');
+    while (!blank && len > 0)
+        terminal_putchar(digits[--len]);
+}
+
+// Бенчмарк ФС: фазы create, write, stat, read, append, rename, delete над
+// files файлами по size байт. Каждая операция замеряется TSC; на экран —
+// таблица, в COM1 — по строке FSBENCH на фазу для сравнения между сборками
+void command_fsbench(const char *args)
+{
+    uint32_t files = 0, size = 0;
+    const char *p = args;
+    while (*p >= '0' && *p <= '9')
+        files = files * 10 + (*p++ - '0');
+    while (*p == ' ')
+        p++;
+    while (*p >= '0' && *p <= '9')
+        size = size * 10 + (*p++ - '0');
+    if (files == 0 || files > FSBENCH_MAX_FILES)
+        files = FSBENCH_FILES;
+    if (size == 0 || size > FSBENCH_MAX_SIZE)
+        size = FSBENCH_SIZE;
+
+    if (tsc_khz == 0)
+    {
+        terminal_writestring("TSC not calibrated\n");
+        return;
+    }
+
+    char *buffer = (char *)kmalloc(size);
+    if (!buffer)
     {
-        terminal_writestring("Usage: rmdir <directory>\n");
+        terminal_writestring("Out of memory\n");
+        return;
+    }
+    // Директория удаляется после замера, поэтому чужую не трогаем
+    if (fs_lookup_path(FSBENCH_DIR) >= 0 || fs_create_directory(FSBENCH_DIR) < 0)
+    {
+        terminal_writestring("fsbench: cannot create " FSBENCH_DIR
+                             " (if it is left from an earlier run, remove it first)\n");
+        kfree(buffer);
         return;
     }
+    for (uint32_t i = 0; i < size; i++)
+        buffer[i] = 'a' + i % 26;
+
+    terminal_writestring("fsbench: ");
+    print_number(files);
+    terminal_writestring(" files x ");
+    print_number(size);
+    terminal_writestring(" bytes, latency in us\n");
+    terminal_writestring("phase      ops/s     KB/s     p50     p90     p99     max\n");
+    serial_writestring("FSBENCH begin files=");
+    serial_write_number(files);
+    serial_writestring(" size=");
+    serial_write_number(size);
+    serial_writestring(" tsc_khz=");
+    serial_write_number(tsc_khz);
+    serial_writestring(filesystem.device ? " volume=" FS_ROOT_DEVICE "\n" : " volume=memory\n");
+
+    for (int phase = 0; phase < FSBENCH_PHASES; phase++)
+    {
+        uint32_t failed = files;
+        uint64_t start = read_tsc();
+        for (uint32_t n = 0; n < files && failed == files; n++)
+        {
+            uint64_t op_start = read_tsc();
+            if (fsbench_op(phase, n, size, buffer) < 0)
+                failed = n;
+            fsbench_latency[n] = (uint32_t)(read_tsc() - op_start);
+        }
+        uint64_t elapsed = read_tsc() - start;
 
-    if (fs_delete_directory(dirname) == 0)
+        if (failed < files)
+        {
+            terminal_writestring("fsbench: ");
+            terminal_writestring(fsbench_phase_names[phase]);
+            terminal_writestring(" failed on file ");
+            print_number(failed);
+            terminal_writestring("\n");
+            serial_writestring("FSBENCH error phase=");
+            serial_writestring(fsbench_phase_names[phase]);
+            serial_writestring("\n");
+            break;
+        }
+
+        uint32_t bytes = 0;
+        if (phase == FSBENCH_WRITE || phase == FSBENCH_READ)
+            bytes = size;
+        else if (phase == FSBENCH_APPEND)
+            bytes = FSBENCH_APPEND_SIZE;
+
+        uint32_t us = (uint32_t)div_u64(elapsed * 1000, tsc_khz);
+        if (us == 0)
+            us = 1;
+        uint32_t ops_per_s = (uint32_t)div_u64((uint64_t)files * 1000000, us);
+        uint32_t kb_per_s = (uint32_t)div_u64((uint64_t)files * bytes * 1000000 / 1024, us);
+
+        sort_u32(fsbench_latency, files);
+        uint32_t pct[4] = {tsc_to_ns(fsbench_latency[files * 50 / 100]),
+                           tsc_to_ns(fsbench_latency[files * 90 / 100]),
+                           tsc_to_ns(fsbench_latency[files * 99 / 100]), tsc_to_ns(fsbench_latency[files - 1])};
+        static const char *pct_names[4] = {"p50", "p90", "p99", "max"};
+
+        // Строка таблицы
+        terminal_writestring(fsbench_phase_names[phase]);
+        for (int col = strlen(fsbench_phase_names[phase]); col < 7; col++)
+            terminal_putchar(' ');
+        fsbench_print_column(ops_per_s, 9, 0);
+        fsbench_print_column(kb_per_s, 9, bytes == 0);
+        for (int i = 0; i < 4; i++)
+        {
+            // Микросекунды с одним знаком после точки
+            fsbench_print_column(pct[i] / 1000, 6, 0);
+            terminal_putchar('.');
+            terminal_putchar('0' + pct[i] % 1000 / 100);
+        }
+        terminal_putchar('\n');
+
+        // Строка для сравнения между сборками
+        serial_writestring("FSBENCH phase=");
+        serial_writestring(fsbench_phase_names[phase]);
+        serial_writestring(" ops=");
+        serial_write_number(files);
+        serial_writestring(" bytes=");
+        serial_write_number(files * bytes);
+        serial_writestring(" us=");
+        serial_write_number(us);
+        serial_writestring(" ops_s=");
+        serial_write_number(ops_per_s);
+        serial_writestring(" kb_s=");
+        serial_write_number(kb_per_s);
+        for (int i = 0; i < 4; i++)
+        {
+            serial_writestring(" ");
+            serial_writestring(pct_names[i]);
+            serial_writestring("_ns=");
+            serial_write_number(pct[i]);
+        }
+        serial_writestring("\n");
+    }
+
+    // Уборка, в том числе после прерванной фазы
+    for (uint32_t n = 0; n < files; n++)
     {
-        terminal_writestring("Directory removed: ");
-        terminal_writestring(dirname);
-        terminal_writestring("\n");
+        char path[FS_MAX_PATH];
+        fsbench_path(path, 'f', n);
+        if (fs_file_exists(path))
+            fs_delete_file(path);
+        fsbench_path(path, 'r', n);
+        if (fs_file_exists(path))
+            fs_delete_file(path);
     }
+    fs_delete_directory(FSBENCH_DIR);
+    serial_writestring("FSBENCH end\n");
+    kfree(buffer);
 }
 
 void command_syscalls(void)
@@ -3810,6 +12353,28 @@ void command_syscalls(void)
                 terminal_writestring("\"\n");
             }
 
+            // Тест lseek/pread: pread не сдвигает позицию
+            terminal_writestring("lseek(fd, 5, SEEK_SET) = ");
+            print_number(syscall3(SYS_LSEEK, fd, 5, SEEK_SET));
+            terminal_writestring(", pread(fd, buf, 4, 0) = ");
+            print_number(syscall4(SYS_PREAD, fd, (int)read_buf, 4, 0));
+            terminal_writestring(", read(fd, buf, 4) = ");
+            int seek_result = syscall3(SYS_READ, fd, (int)read_buf, 4);
+            print_number(seek_result);
+            terminal_writestring(" \"");
+            for (int i = 0; i < seek_result; i++)
+            {
+                terminal_putchar(read_buf[i]);
+            }
+            terminal_writestring("\"\n");
+
+            // Тест sendfile: данные файла выводятся на консоль внутри ядра
+            terminal_writestring("sendfile(1, fd, 0, 18): \"");
+            int sent = syscall4(SYS_SENDFILE, STDOUT_FILENO, fd, 0, 18);
+            terminal_writestring("\" = ");
+            print_number(sent);
+            terminal_writestring("\n");
+
             // Тест close
             int close_result = syscall1(SYS_CLOSE, fd);
             terminal_writestring("close(fd) = ");
@@ -3817,6 +12382,30 @@ void command_syscalls(void)
             terminal_writestring("\n");
         }
 
+        // Тест clonefile: копия без чтения и записи данных
+        terminal_writestring("clonefile(\"test_copy.txt\", \"test_clone.txt\") = ");
+        print_number(syscall2(SYS_CLONEFILE, (int)"test_copy.txt", (int)"test_clone.txt"));
+        char clone_buf[32];
+        int clone_size = fs_read_file("test_clone.txt", clone_buf, sizeof(clone_buf));
+        terminal_writestring(", read back ");
+        print_number(clone_size > 0 ? clone_size : 0);
+        terminal_writestring(" bytes\n");
+        fs_delete_file("test_clone.txt");
+
+        // Тест stat и getdents
+        stat_t st;
+        terminal_writestring("stat(\"test_copy.txt\") = ");
+        print_number(syscall2(SYS_STAT, (int)"test_copy.txt", (int)&st));
+        terminal_writestring(", size ");
+        print_number(st.st_size);
+        terminal_writestring("\n");
+        int dir_fd = syscall2(SYS_OPEN, (int)"/", O_RDONLY);
+        uint8_t dents[128];
+        terminal_writestring("getdents(\"/\") = ");
+        print_number(syscall3(SYS_GETDENTS, dir_fd, (int)dents, sizeof(dents)));
+        terminal_writestring(" bytes\n");
+        syscall1(SYS_CLOSE, dir_fd);
+
         // Удаляем тестовый файл
         fs_delete_file("test_copy.txt");
     }
@@ -3893,7 +12482,7 @@ void execute_command(const char *command)
     }
     else if (strcmp(cmd, "ls") == 0)
     {
-        command_ls();
+        command_ls(args);
     }
     else if (strcmp(cmd, "touch") == 0)
     {
@@ -3907,6 +12496,30 @@ void execute_command(const char *command)
     {
         command_rm(args);
     }
+    else if (strcmp(cmd, "cp") == 0)
+    {
+        command_cp(args);
+    }
+    else if (strcmp(cmd, "mv") == 0)
+    {
+        command_mv(args);
+    }
+    else if (strcmp(cmd, "compress") == 0)
+    {
+        command_compress(args);
+    }
+    else if (strcmp(cmd, "dedup") == 0)
+    {
+        command_dedup(args);
+    }
+    else if (strcmp(cmd, "watch") == 0)
+    {
+        command_watch(args);
+    }
+    else if (strcmp(cmd, "defrag") == 0)
+    {
+        command_defrag(args);
+    }
     else if (strcmp(cmd, "echo") == 0)
     {
         command_echo(args);
@@ -3959,6 +12572,30 @@ void execute_command(const char *command)
     {
         command_syscalls();
     }
+    else if (strcmp(cmd, "lspci") == 0)
+    {
+        command_lspci();
+    }
+    else if (strcmp(cmd, "blkbench") == 0)
+    {
+        command_blkbench(args);
+    }
+    else if (strcmp(cmd, "sync") == 0)
+    {
+        command_sync();
+    }
+    else if (strcmp(cmd, "bcache") == 0)
+    {
+        command_bcache();
+    }
+    else if (strcmp(cmd, "ringbench") == 0)
+    {
+        command_ringbench(args);
+    }
+    else if (strcmp(cmd, "fsbench") == 0)
+    {
+        command_fsbench(args);
+    }
     else
     {
         terminal_writestring("Unknown command: ");
@@ -3987,10 +12624,36 @@ void init_timer(int frequency)
     terminal_writestring(" Hz\n");
 }
 
+// Калибровка TSC: такты за TSC_CALIBRATE_MS по однократному счёту канала 2
+// PIT (режим 0, выход OUT поднимается по окончании счёта). Не зависит от
+// прерываний таймера
+void init_tsc(void)
+{
+    uint8_t gate = inb(PIT_GATE_PORT);
+    outb(PIT_GATE_PORT, (gate & ~0x02) | 0x01); // GATE включён, динамик выключен
+
+    uint32_t count = PIT_FREQUENCY / 1000 * TSC_CALIBRATE_MS;
+    outb(PIT_COMMAND, 0xB0); // Канал 2, младший и старший байт, режим 0
+    outb(PIT_DATA2, count & 0xFF);
+    outb(PIT_DATA2, (count >> 8) & 0xFF);
+
+    uint64_t start = read_tsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20))
+        ;
+    uint64_t cycles = read_tsc() - start;
+    outb(PIT_GATE_PORT, gate);
+
+    tsc_khz = (uint32_t)div_u64(cycles, TSC_CALIBRATE_MS);
+    terminal_writestring("TSC: ");
+    print_number(tsc_khz / 1000);
+    terminal_writestring(" MHz\n");
+}
+
 // Главная функция
-void kernel_main(void)
+void kernel_main(uint32_t multiboot_magic, uint32_t multiboot_info)
 {
     terminal_clear();
+    init_serial();
 
     // Включаем VGA курсор
     enable_cursor(14, 15); // Обычный курсор
@@ -4033,16 +12696,39 @@ void kernel_main(void)
 
     // Устанавливаем обработчик клавиатуры (IRQ1 = прерывание 33)
     idt_set_gate(33, (uint32_t)irq1_handler, 0x08, 0x8E);
+
+    // IRQ2-IRQ15 (прерывания 34-47) — общий диспетчер для драйверов
+    for (int irq = 2; irq < 16; irq++)
+    {
+        idt_set_gate(32 + irq, irq_stub_table[irq], 0x08, 0x8E);
+    }
     idt_flush();
 
     terminal_writestring("IDT configured with system calls and timer\n");
 
+    // Модули загрузчика — до кучи, которую может занимать модуль
+    init_boot_modules(multiboot_magic, multiboot_info);
+
     // Инициализация управления памятью
     init_memory_management();
+    paging_enabled = 1; // Пейджинг включён в boot.asm (higher-half)
+    asm volatile("mov %%cr3, %0" : "=r"(kernel_page_root));
+    init_frame_allocator(multiboot_magic, multiboot_info);
     terminal_writestring("Memory management initialized\n");
 
+    // Устройства на шине PCI (диск нужен до монтирования ФС)
+    pci_enumerate();
+    init_virtio_blk();
+    init_ramdisk();
+
+    // Буферный кэш резервирует память раньше арены ФС
+    init_bcache();
+
     // Инициализация файловой системы
     init_filesystem();
+    init_initrd();
+    vfs_mount(DEV_MOUNT, &devfs_ops);
+    vfs_mount(PROC_MOUNT, &procfs_ops);
     terminal_writestring("File system ready\n");
 
     // Инициализация планировщика задач
@@ -4063,12 +12749,14 @@ void kernel_main(void)
     outb(PIC2_DATA, 0x02);
     outb(PIC1_DATA, 0x01); // ICW4: Режим 8086
     outb(PIC2_DATA, 0x01);
-    outb(PIC1_DATA, 0xFC); // Маска: разрешаем IRQ0 (таймер) и IRQ1 (клавиатура)
-    outb(PIC2_DATA, 0xFF); // Маска: отключаем все прерывания PIC2
-    terminal_writestring("PIC configured for timer and keyboard\n");
+    // Маска: таймер, клавиатура и линии, занятые драйверами (irq_register)
+    pic_ready = 1;
+    pic_write_mask();
+    terminal_writestring("PIC configured for timer, keyboard and devices\n");
 
-    // Инициализация таймера (100 Hz)
+    // Инициализация таймера (100 Hz) и калибровка TSC
     init_timer(TIMER_FREQUENCY);
+    init_tsc();
 
     // Инициализация модуля клавиатуры
     terminal_writestring("Initializing keyboard module...\n");
@@ -4097,8 +12785,7 @@ void kernel_main(void)
     shell_ready = 1;
     shell_prompt();
 
-    while (1)
-    {
-        asm volatile("hlt");
-    }
+    // Дальше ядро работает как задача idle: шелл и системные вызовы
+    // выполняются в обработчиках прерываний, фоновая работа ФС — здесь
+    idle_task();
 }
\ No newline at end of file
@@ -0,0 +1,388 @@
+// Сборщик образа тома на хосте. Формат тома — src/include/fs_format.h.
+//
+// Использование: mkfs <образ> <размер_МБ> [файл[=/путь/в/томе]]...
+//
+// Файлы хоста копируются в том; без явного пути файл кладётся в корень
+// под своим именем. Недостающие директории пути создаются.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_format.h"
+
+#define SECTOR_SIZE 512
+#define BYTES_PER_INODE 4096 // Один inode на столько байт тома
+
+static uint8_t *image;
+static fs_superblock_t *sb;
+static uint32_t next_block = 1; // Блоки выделяются подряд, блок 0 зарезервирован
+static uint32_t time_counter = 0;
+
+static void die(const char *msg, const char *arg)
+{
+    fprintf(stderr, "mkfs: %s%s\n", msg, arg ? arg : "");
+    exit(1);
+}
+
+static void bitmap_set(uint32_t first_sector, uint32_t bit)
+{
+    uint32_t *bitmap = (uint32_t *)(image + first_sector * SECTOR_SIZE);
+    bitmap[bit / 32] |= 1u << (bit % 32);
+}
+
+static fs_inode_t *inode_at(uint32_t n)
+{
+    return (fs_inode_t *)(image + sb->inode_table_start * SECTOR_SIZE) + n;
+}
+
+static uint8_t *block_at(uint32_t n)
+{
+    return image + (sb->data_start + n) * SECTOR_SIZE;
+}
+
+static uint32_t alloc_inode(void)
+{
+    for (uint32_t i = 1; i < sb->total_inodes; i++)
+    {
+        if (inode_at(i)->type == FS_INODE_FREE)
+        {
+            bitmap_set(sb->inode_bitmap_start, i);
+            sb->free_inodes--;
+            return i;
+        }
+    }
+    die("out of inodes", NULL);
+    return 0;
+}
+
+static uint32_t blocks_of(fs_inode_t *inode)
+{
+    uint32_t have = 0;
+    for (uint32_t i = 0; i < inode->extent_count; i++)
+        have += inode->extents[i].length;
+    return have;
+}
+
+// Выделение блоков под [0, bytes): продолжение последнего экстента или новый экстент
+static void reserve(fs_inode_t *inode, uint32_t bytes)
+{
+    uint32_t need = (bytes + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+    uint32_t have = blocks_of(inode);
+    if (need <= have)
+        return;
+
+    uint32_t count = need - have;
+    if (next_block + count > sb->total_blocks)
+        die("volume is full: ", inode->filename);
+
+    for (uint32_t i = 0; i < count; i++)
+        bitmap_set(sb->block_bitmap_start, next_block + i);
+    sb->free_blocks -= count;
+
+    fs_extent_t *last = inode->extent_count ? &inode->extents[inode->extent_count - 1] : NULL;
+    if (last && last->start + last->length == next_block)
+        last->length += count;
+    else if (inode->extent_count < FS_MAX_EXTENTS)
+    {
+        inode->extents[inode->extent_count].start = next_block;
+        inode->extents[inode->extent_count].length = count;
+        inode->extent_count++;
+    }
+    else
+        die("too many extents: ", inode->filename);
+
+    next_block += count;
+}
+
+// Запись в inode по смещению с выделением блоков
+static void node_write(fs_inode_t *inode, uint32_t offset, const void *data, uint32_t size)
+{
+    reserve(inode, offset + size);
+
+    const uint8_t *src = data;
+    uint32_t ext_offset = 0;
+    for (uint32_t i = 0; i < inode->extent_count && size > 0; i++)
+    {
+        uint32_t ext_bytes = inode->extents[i].length * FS_BLOCK_SIZE;
+        if (offset < ext_offset + ext_bytes)
+        {
+            uint32_t within = offset - ext_offset;
+            uint32_t chunk = ext_bytes - within < size ? ext_bytes - within : size;
+            memcpy(block_at(inode->extents[i].start) + within, src, chunk);
+            src += chunk;
+            offset += chunk;
+            size -= chunk;
+        }
+        ext_offset += ext_bytes;
+    }
+
+    if (offset > inode->size)
+        inode->size = offset;
+}
+
+// Отдельный блок данных (корзина директории)
+static uint32_t alloc_block(void)
+{
+    if (next_block >= sb->total_blocks)
+        die("volume is full", NULL);
+    bitmap_set(sb->block_bitmap_start, next_block);
+    sb->free_blocks--;
+    return next_block++;
+}
+
+// Слот таблицы корзин директории
+static uint32_t *dir_slot(fs_inode_t *dir, uint32_t index)
+{
+    uint32_t offset = index * 4;
+    for (uint32_t i = 0; i < dir->extent_count; i++)
+    {
+        uint32_t ext_bytes = dir->extents[i].length * FS_BLOCK_SIZE;
+        if (offset < ext_bytes)
+            return (uint32_t *)(block_at(dir->extents[i].start) + offset);
+        offset -= ext_bytes;
+    }
+    die("corrupt directory: ", dir->filename);
+    return NULL;
+}
+
+static fs_dir_bucket_t *dir_bucket(fs_inode_t *dir, uint32_t hash)
+{
+    return (fs_dir_bucket_t *)block_at(*dir_slot(dir, hash & (dir->size / 4 - 1)));
+}
+
+static int dir_lookup(uint32_t dir, const char *name)
+{
+    fs_inode_t *inode = inode_at(dir);
+    if (inode->size == 0)
+        return -1;
+
+    fs_dir_bucket_t *bucket = dir_bucket(inode, fs_dir_hash(name));
+    for (uint32_t i = 0; i < FS_DIR_BUCKET_ENTRIES; i++)
+    {
+        fs_dir_entry_t *entry = &bucket->entries[i];
+        if (entry->inode_number != 0 && strcmp(entry->name, name) == 0)
+            return entry->inode_number;
+    }
+    return -1;
+}
+
+// Разделение полной корзины (как в ядре, см. fs_format.h): при
+// необходимости таблица удваивается, записи с битом depth хеша переходят
+// в новую корзину, а слоты с этим битом — на неё
+static void dir_split(fs_inode_t *dir, uint32_t hash)
+{
+    uint32_t index = hash & (dir->size / 4 - 1);
+    uint32_t block = *dir_slot(dir, index);
+    fs_dir_bucket_t *old = (fs_dir_bucket_t *)block_at(block);
+    uint32_t depth = old->depth;
+
+    if ((1u << depth) == dir->size / 4)
+    {
+        if (depth >= FS_DIR_MAX_DEPTH)
+            die("directory full: ", dir->filename);
+
+        // Блоки с запасом на следующее удвоение, как в ядре
+        uint32_t size = dir->size;
+        if (blocks_of(dir) * FS_BLOCK_SIZE < size * 2)
+            reserve(dir, size * 4);
+        uint32_t *table = malloc(size);
+        if (!table)
+            die("out of memory", NULL);
+        for (uint32_t i = 0; i < size / 4; i++)
+            table[i] = *dir_slot(dir, i);
+        node_write(dir, size, table, size);
+        free(table);
+    }
+
+    uint32_t new_block = alloc_block();
+    fs_dir_bucket_t *new = (fs_dir_bucket_t *)block_at(new_block);
+    old->depth = depth + 1;
+    new->depth = depth + 1;
+    for (uint32_t i = 0; i < FS_DIR_BUCKET_ENTRIES; i++)
+    {
+        fs_dir_entry_t *entry = &old->entries[i];
+        if (entry->inode_number != 0 && (fs_dir_hash(entry->name) >> depth) & 1)
+        {
+            new->entries[new->count++] = *entry;
+            memset(entry, 0, sizeof(*entry));
+            old->count--;
+        }
+    }
+
+    uint32_t low = index & ((1u << depth) - 1);
+    for (uint32_t i = low | (1u << depth); i < dir->size / 4; i += 2u << depth)
+        *dir_slot(dir, i) = new_block;
+}
+
+static void dir_insert(fs_inode_t *dir, const fs_dir_entry_t *entry)
+{
+    if (dir->size == 0)
+    {
+        uint32_t block = alloc_block();
+        node_write(dir, 0, &block, 4);
+    }
+
+    uint32_t hash = fs_dir_hash(entry->name);
+    fs_dir_bucket_t *bucket;
+    while ((bucket = dir_bucket(dir, hash))->count == FS_DIR_BUCKET_ENTRIES)
+        dir_split(dir, hash);
+
+    uint32_t i = 0;
+    while (bucket->entries[i].inode_number != 0)
+        i++;
+    bucket->entries[i] = *entry;
+    bucket->count++;
+}
+
+// Создание inode и записи о нём в родительской директории
+static uint32_t make_node(uint32_t parent, const char *name, uint8_t type)
+{
+    if (strlen(name) >= FS_MAX_FILENAME)
+        die("name too long: ", name);
+
+    uint32_t n = alloc_inode();
+    fs_inode_t *inode = inode_at(n);
+    inode->type = type;
+    strcpy(inode->filename, name);
+    inode->created_time = time_counter++;
+    inode->modified_time = inode->created_time;
+    inode->parent_inode = parent;
+
+    fs_dir_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.inode_number = n;
+    strcpy(entry.name, name);
+    entry.type = type;
+    dir_insert(inode_at(parent), &entry);
+    return n;
+}
+
+// Копирование файла хоста в том по пути target (директории создаются)
+static void add_file(const char *host, const char *target)
+{
+    FILE *f = fopen(host, "rb");
+    if (!f)
+        die("cannot open ", host);
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    if (!data || fread(data, 1, size, f) != (size_t)size)
+        die("cannot read ", host);
+    fclose(f);
+
+    char path[256];
+    if (strlen(target) >= sizeof(path))
+        die("path too long: ", target);
+    strcpy(path, target);
+
+    uint32_t dir = FS_ROOT_INODE;
+    char *component = strtok(path, "/");
+    while (component)
+    {
+        char *next = strtok(NULL, "/");
+        int n = dir_lookup(dir, component);
+        if (!next)
+        {
+            if (n >= 0)
+                die("file already exists: ", target);
+            n = make_node(dir, component, FS_INODE_FILE);
+            fs_inode_t *inode = inode_at(n);
+            if (size > 0 && size <= (long)FS_INLINE_MAX)
+            {
+                // Маленький файл целиком в inode
+                memcpy(inode->extents, data, size);
+                inode->flags = FS_INODE_F_INLINE;
+                inode->size = size;
+            }
+            else
+                node_write(inode, 0, data, size);
+        }
+        else if (n < 0)
+            dir = make_node(dir, component, FS_INODE_DIR);
+        else if (inode_at(n)->type != FS_INODE_DIR)
+            die("not a directory in path: ", target);
+        else
+            dir = n;
+        component = next;
+    }
+    free(data);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: mkfs <image> <size_mb> [file[=/path]]...\n");
+        return 1;
+    }
+
+    uint32_t size_mb = atoi(argv[2]);
+    if (size_mb == 0 || size_mb > 1024)
+        die("bad size: ", argv[2]);
+
+    // Разметка: суперблок, карта inodes, карта блоков, таблица inodes, данные
+    uint32_t total = size_mb * (1024 * 1024 / SECTOR_SIZE);
+    uint32_t inodes = total / (BYTES_PER_INODE / SECTOR_SIZE);
+    inodes -= inodes % FS_INODES_PER_SECTOR;
+    uint32_t bits_per_sector = SECTOR_SIZE * 8;
+
+    image = calloc(total, SECTOR_SIZE);
+    if (!image)
+        die("out of memory", NULL);
+
+    sb = (fs_superblock_t *)image;
+    sb->magic = FS_MAGIC;
+    sb->version = FS_VERSION;
+    sb->block_size = FS_BLOCK_SIZE;
+    sb->total_sectors = total;
+    sb->total_inodes = inodes;
+    sb->inode_bitmap_start = 1;
+    sb->block_bitmap_start = sb->inode_bitmap_start + (inodes + bits_per_sector - 1) / bits_per_sector;
+    sb->inode_table_start = sb->block_bitmap_start + (total + bits_per_sector - 1) / bits_per_sector;
+    sb->data_start = sb->inode_table_start + inodes / FS_INODES_PER_SECTOR;
+    sb->data_start = (sb->data_start + FS_DATA_ALIGN - 1) / FS_DATA_ALIGN * FS_DATA_ALIGN;
+    sb->total_blocks = total - sb->data_start;
+    sb->free_inodes = inodes - 1;
+    sb->free_blocks = sb->total_blocks - 1;
+
+    // Блок 0 зарезервирован, inode 0 — корневая директория
+    bitmap_set(sb->block_bitmap_start, 0);
+    bitmap_set(sb->inode_bitmap_start, FS_ROOT_INODE);
+    fs_inode_t *root = inode_at(FS_ROOT_INODE);
+    root->type = FS_INODE_DIR;
+    strcpy(root->filename, "/");
+    root->parent_inode = FS_ROOT_INODE;
+
+    for (int i = 3; i < argc; i++)
+    {
+        char host[256];
+        const char *eq = strchr(argv[i], '=');
+        uint32_t len = eq ? (uint32_t)(eq - argv[i]) : strlen(argv[i]);
+        if (len >= sizeof(host))
+            die("path too long: ", argv[i]);
+        memcpy(host, argv[i], len);
+        host[len] = '\0';
+
+        if (eq)
+        {
+            add_file(host, eq + 1);
+        }
+        else
+        {
+            const char *base = strrchr(host, '/');
+            add_file(host, base ? base + 1 : host);
+        }
+    }
+    sb->time_counter = time_counter;
+
+    FILE *out = fopen(argv[1], "wb");
+    if (!out || fwrite(image, SECTOR_SIZE, total, out) != total || fclose(out) != 0)
+        die("cannot write ", argv[1]);
+
+    printf("mkfs: %s: %u MB, %u inodes, %u data blocks, %u files\n", argv[1], size_mb, inodes,
+           sb->total_blocks, argc - 3);
+    return 0;
+}